@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# startup.sh -- exec-to-exit time of xclaim for typical one-off commands
+#
+# Copyright (c) 2021, Laurence Lundblade. All rights reserved.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# See BSD-3-Clause license in README.md
+#
+# Usage: bench/startup.sh [<xclaim>] [<runs>]
+#
+# Run by "make bench_startup". Compare a normal build with one made
+# with "make STATIC=1". The first line is /bin/true, the floor for
+# starting any process on this machine. The commands that don't sign
+# or verify shouldn't pay for crypto at all.
+
+XCLAIM=${1:-./xclaim}
+RUNS=${2:-1000}
+BENCH=${BENCH:-./startup_bench}
+
+set -e
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Inputs for the commands
+$XCLAIM -claim nonce:0102030405060708 -claim ueid:0198f50a4ff6c05861c8860d13a638ea \
+        -claim iat:1634000000 -out_form cbor -out "$DIR/uccs.cbor"
+openssl ecparam -genkey -name prime256v1 -noout -out "$DIR/ec.pem" 2>/dev/null
+$XCLAIM -in "$DIR/uccs.cbor" -out_form cbor -out_prot sign -out_sign_key "$DIR/ec.pem" -out "$DIR/cwt.cbor"
+
+$BENCH -n "$RUNS" -l "/bin/true" /bin/true
+
+$BENCH -n "$RUNS" -l "-claim to JSON" \
+    $XCLAIM -claim nonce:0102030405060708 -claim iat:1634000000
+
+$BENCH -n "$RUNS" -l "UCCS to JSON" \
+    $XCLAIM -in "$DIR/uccs.cbor"
+
+$BENCH -n "$RUNS" -l "UCCS to UCCS" \
+    $XCLAIM -in "$DIR/uccs.cbor" -out_form cbor
+
+$BENCH -n "$RUNS" -l "verify CWT to JSON" \
+    $XCLAIM -in "$DIR/cwt.cbor" -in_verify_key "$DIR/ec.pem"
+
+$BENCH -n "$RUNS" -l "sign UCCS to CWT" \
+    $XCLAIM -in "$DIR/uccs.cbor" -out_form cbor -out_prot sign -out_sign_key "$DIR/ec.pem"
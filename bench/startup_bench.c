@@ -0,0 +1,155 @@
+/*
+ * startup_bench.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+/* Times a command from exec to exit, for seeing what it costs a
+ * script to run xclaim many times. The command is run the given
+ * number of times with its output thrown away and the minimum,
+ * median and mean are printed in microseconds. Timing a shell loop
+ * instead would mostly measure the shell.
+ *
+ *     startup_bench [-n <runs>] [-l <label>] <command> [<args>...]
+ *
+ * The exit status is 1 if the command ever fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Runs argv once and waits for it. Returns its time in nanoseconds or
+ * 0 if it didn't exit with 0. */
+static uint64_t run_once(char **argv, posix_spawn_file_actions_t *actions)
+{
+    pid_t    pid;
+    int      status;
+    uint64_t start;
+    uint64_t end;
+
+    start = now_ns();
+    if(posix_spawnp(&pid, argv[0], actions, NULL, argv, environ)) {
+        return 0;
+    }
+    if(waitpid(pid, &status, 0) != pid) {
+        return 0;
+    }
+    end = now_ns();
+
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return 0;
+    }
+
+    return end - start;
+}
+
+
+int main(int argc, char **argv)
+{
+    posix_spawn_file_actions_t actions;
+    uint64_t                  *times;
+    uint64_t                   total;
+    const char                *label;
+    long                       runs;
+    long                       i;
+    int                        return_value;
+    int                        opt;
+
+    runs  = 1000;
+    label = NULL;
+
+    while((opt = getopt(argc, argv, "+n:l:")) != -1) {
+        switch(opt) {
+            case 'n':
+                runs = strtol(optarg, NULL, 10);
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: startup_bench [-n <runs>] [-l <label>] <command> [<args>...]\n");
+                return 1;
+        }
+    }
+    if(optind >= argc || runs <= 0) {
+        fprintf(stderr, "usage: startup_bench [-n <runs>] [-l <label>] <command> [<args>...]\n");
+        return 1;
+    }
+    argv += optind;
+
+    times = malloc((size_t)runs * sizeof(uint64_t));
+    if(times == NULL) {
+        return 1;
+    }
+
+    /* The output of the command isn't part of what is measured */
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+    return_value = 0;
+    total        = 0;
+
+    /* One to warm the page cache that isn't counted */
+    run_once(argv, &actions);
+
+    for(i = 0; i < runs; i++) {
+        times[i] = run_once(argv, &actions);
+        if(times[i] == 0) {
+            fprintf(stderr, "\"%s\" failed\n", argv[0]);
+            return_value = 1;
+            goto Done;
+        }
+        total += times[i];
+    }
+
+    qsort(times, (size_t)runs, sizeof(uint64_t), compare_u64);
+
+    printf("%-40s min %7.1f us  median %7.1f us  mean %7.1f us  (%ld runs)\n",
+           label ? label : argv[0],
+           (double)times[0] / 1000.0,
+           (double)times[runs / 2] / 1000.0,
+           (double)total / (double)runs / 1000.0,
+           runs);
+
+Done:
+    posix_spawn_file_actions_destroy(&actions);
+    free(times);
+
+    return return_value;
+}
@@ -83,6 +83,20 @@ static struct q_useful_buf_c convert_to_binary(const char *z)
 }
 
 
+/* For -archive_ueid and -archive_cti. Unlike convert_to_binary() an
+ * odd number of digits is an error. Returns 0 on success. */
+static int convert_hex_key(const char *hex, struct q_useful_buf_c *key)
+{
+    if(*hex == '\0' || strlen(hex) % 2) {
+        return 1;
+    }
+
+    *key = convert_to_binary(hex);
+
+    return q_useful_buf_c_is_null(*key);
+}
+
+
 /* Command line option indexes used with getopt(). */
 enum arg_id_t {
     HELP,
@@ -100,6 +114,42 @@ enum arg_id_t {
     OUT_SIGN_KID,
     OUT_SIGN_SHORT_CIRCUIT,
     IN_VERIFY_KEY,
+    VERIFY_ONLY,
+    VERIFY_TIME,
+    VERIFY_REASON,
+    VERIFY_CACHE,
+    STATS,
+    REPLAY_WINDOW,
+    REPLAY_CAPACITY,
+    REPLAY_FILE,
+    INPUT_DIR,
+    INPUT_GLOB,
+    INPUT_RECURSIVE,
+    OUTPUT_DIR,
+    WORKERS,
+    IO_DEPTH,
+    MAX_DEPTH,
+    MAX_CLAIMS,
+    MAX_SUBMODS,
+    MAX_NESTED_BYTES,
+    FILTER,
+    INPUT_STREAM,
+    IN_VERIFY_CERT,
+    IN_MAC_KEY,
+    OUT_MAC_KEY,
+    IN_DECRYPT_KEY,
+    OUT_ENCRYPT_KEY,
+    INPUT_SHM,
+    PROFILE,
+    PROFILE_FAIL_FAST,
+    SUBMOD,
+    INPUT_ARCHIVE,
+    OUTPUT_ARCHIVE,
+    ARCHIVE_UEID,
+    ARCHIVE_CTI,
+    ARCHIVE_FROM,
+    ARCHIVE_TO,
+    COLUMNS,
 };
 
 
@@ -120,6 +170,42 @@ static const struct option longopts[] = {
     { "out_sign_key", required_argument,     NULL, OUT_SIGN_KID },
     { "out_sign_short_circuit", no_argument, NULL, OUT_SIGN_SHORT_CIRCUIT},
     { "in_verify_key", required_argument,    NULL, IN_VERIFY_KEY},
+    { "verify_only", no_argument,            NULL, VERIFY_ONLY},
+    { "verify_time", no_argument,            NULL, VERIFY_TIME},
+    { "verify_reason", no_argument,          NULL, VERIFY_REASON},
+    { "verify_cache", required_argument,     NULL, VERIFY_CACHE},
+    { "stats",      no_argument,             NULL, STATS},
+    { "replay_window", required_argument,    NULL, REPLAY_WINDOW},
+    { "replay_capacity", required_argument,  NULL, REPLAY_CAPACITY},
+    { "replay_file", required_argument,      NULL, REPLAY_FILE},
+    { "in_dir",     required_argument,       NULL, INPUT_DIR},
+    { "in_glob",    required_argument,       NULL, INPUT_GLOB},
+    { "in_recursive", no_argument,           NULL, INPUT_RECURSIVE},
+    { "out_dir",    required_argument,       NULL, OUTPUT_DIR},
+    { "workers",    required_argument,       NULL, WORKERS},
+    { "io_depth",   required_argument,       NULL, IO_DEPTH},
+    { "max_depth",  required_argument,       NULL, MAX_DEPTH},
+    { "max_claims", required_argument,       NULL, MAX_CLAIMS},
+    { "max_submods", required_argument,      NULL, MAX_SUBMODS},
+    { "max_nested_bytes", required_argument, NULL, MAX_NESTED_BYTES},
+    { "filter",     required_argument,       NULL, FILTER},
+    { "in_stream",  no_argument,             NULL, INPUT_STREAM},
+    { "in_verify_cert", required_argument,   NULL, IN_VERIFY_CERT},
+    { "in_mac_key", required_argument,       NULL, IN_MAC_KEY},
+    { "out_mac_key", required_argument,      NULL, OUT_MAC_KEY},
+    { "in_decrypt_key", required_argument,   NULL, IN_DECRYPT_KEY},
+    { "out_encrypt_key", required_argument,  NULL, OUT_ENCRYPT_KEY},
+    { "in_shm",     required_argument,       NULL, INPUT_SHM},
+    { "profile",    required_argument,       NULL, PROFILE},
+    { "profile_fail_fast", no_argument,      NULL, PROFILE_FAIL_FAST},
+    { "submod",     required_argument,       NULL, SUBMOD},
+    { "in_archive", required_argument,       NULL, INPUT_ARCHIVE},
+    { "out_archive", required_argument,      NULL, OUTPUT_ARCHIVE},
+    { "archive_ueid", required_argument,     NULL, ARCHIVE_UEID},
+    { "archive_cti", required_argument,      NULL, ARCHIVE_CTI},
+    { "archive_from", required_argument,     NULL, ARCHIVE_FROM},
+    { "archive_to", required_argument,       NULL, ARCHIVE_TO},
+    { "columns",    required_argument,       NULL, COLUMNS},
     { NULL,         0,                       NULL, 0 }
 };
 
@@ -134,8 +220,66 @@ void free_arguments(struct ctoken_arguments *arguments)
         free(arguments->claims);
         arguments->claims = NULL;
     }
+    if(arguments->filters) {
+        free(arguments->filters);
+        arguments->filters = NULL;
+    }
+    free((void *)arguments->archive_ueid.ptr);
+    arguments->archive_ueid = NULL_Q_USEFUL_BUF_C;
+    free((void *)arguments->archive_cti.ptr);
+    arguments->archive_cti = NULL_Q_USEFUL_BUF_C;
+}
+
+
+/* Adds an option that can be given many times, like -claim, to the
+ * NULL-terminated list of them. */
+static const char **append_argument(const char **list, const char *argument)
+{
+    const char **end;
+    size_t       count;
+
+    count = 0;
+    if(list) {
+        /* Count up the ones parsed so far */
+        for(end = list; *end; end++);
+        count = end - list;
+    }
+
+    list = realloc(list, (count + 2) * sizeof(char *));
+    list[count]   = argument;
+    list[count+1] = NULL;
+
+    return list;
 }
 
+/* Splits a -submod path like "tee/ta1" into submodule names. The
+ * names point into path. A "/" at the end is allowed. Returns 0 on
+ * success or 1 if the path is empty, has an empty name or is too
+ * deep. */
+static int parse_submod_path(const char *path, struct ctoken_arguments *arguments)
+{
+    const char *slash;
+    size_t      len;
+
+    arguments->submod_path_len = 0;
+
+    while(*path != '\0') {
+        slash = strchr(path, '/');
+        len   = slash ? (size_t)(slash - path) : strlen(path);
+        if(len == 0 || arguments->submod_path_len == XCLAIM_MAX_NESTING) {
+            return 1;
+        }
+        arguments->submod_path[arguments->submod_path_len++] = (struct q_useful_buf_c){path, len};
+        path += len;
+        if(*path == '/') {
+            path++;
+        }
+    }
+
+    return arguments->submod_path_len == 0;
+}
+
+
 /*
  * Public function. See arg_parse.h
  */
@@ -143,15 +287,25 @@ int parse_arguments(int argc, char **argv, struct ctoken_arguments *arguments)
 {
     int          return_value;
     int          selected_opt;
-    const char **claim;
-    size_t       claim_count;
     char        *end_of_int;
+    uint32_t     output_file_count;
+    uint32_t     output_format_count;
+    uint32_t     i;
 
     memset(arguments, 0, sizeof(*arguments));
 
     /* The basic defaults. Others, like default algorithm, are elsewhere. */
-    arguments->output_format     = OUT_FORMAT_JSON;
+    for(i = 0; i < MAX_OUTPUTS; i++) {
+        arguments->output_formats[i] = OUT_FORMAT_JSON;
+    }
+    output_file_count   = 0;
+    output_format_count = 0;
     arguments->output_protection = OUT_PROT_NONE;
+    arguments->verify_cache_size = 1024;
+    arguments->replay_capacity   = 1 << 20;
+    arguments->archive_from      = INT64_MIN;
+    arguments->archive_to        = INT64_MAX;
+    xclaim_limits_default(&arguments->limits);
 
     return_value = 0;
 
@@ -167,24 +321,20 @@ int parse_arguments(int argc, char **argv, struct ctoken_arguments *arguments)
                 break;
 
             case OUTPUT_FILE:
-                arguments->output_file = optarg;
+                if(output_file_count == MAX_OUTPUTS) {
+                    fprintf(stderr, "Too many -out options. The limit is %d\n", MAX_OUTPUTS);
+                    return_value = 1;
+                    goto Done;
+                }
+                arguments->output_files[output_file_count++] = optarg;
                 break;
 
             case CLAIM:
-                if(arguments->claims) {
-                    /* Count up claims parsed so far */
-                    for(claim = arguments->claims; *claim; claim++);
-                    claim_count = claim - arguments->claims;
-
-                    arguments->claims = realloc(arguments->claims,
-                                                (claim_count + 2) * sizeof(char *));
-                    arguments->claims[claim_count] = optarg;
-                    arguments->claims[claim_count+1] = NULL;
-                } else {
-                    arguments->claims = malloc(2 * sizeof(char *));
-                    arguments->claims[0] = optarg;
-                    arguments->claims[1] = NULL;
-                }
+                arguments->claims = append_argument(arguments->claims, optarg);
+                break;
+
+            case FILTER:
+                arguments->filters = append_argument(arguments->filters, optarg);
                 break;
 
             case INPUT_FORMAT:
@@ -200,10 +350,21 @@ int parse_arguments(int argc, char **argv, struct ctoken_arguments *arguments)
                 break;
 
             case OUTPUT_FORMAT:
+                if(output_format_count == MAX_OUTPUTS) {
+                    fprintf(stderr, "Too many -out_form options. The limit is %d\n", MAX_OUTPUTS);
+                    return_value = 1;
+                    goto Done;
+                }
                 if(!strcasecmp(optarg, "cbor")) {
-                    arguments->output_format = OUT_FORMAT_CBOR;
+                    arguments->output_formats[output_format_count++] = OUT_FORMAT_CBOR;
                 } else if(!strcasecmp(optarg, "json")) {
-                    arguments->output_format = OUT_FORMAT_JSON;
+                    arguments->output_formats[output_format_count++] = OUT_FORMAT_JSON;
+                } else if(!strcasecmp(optarg, "columnar")) {
+                    arguments->output_formats[output_format_count++] = OUT_FORMAT_COLUMNAR;
+                } else if(!strcasecmp(optarg, "csv")) {
+                    arguments->output_formats[output_format_count++] = OUT_FORMAT_CSV;
+                } else if(!strcasecmp(optarg, "tsv")) {
+                    arguments->output_formats[output_format_count++] = OUT_FORMAT_TSV;
                 } else {
                     fprintf(stderr, "Invalid output format: \"%s\"\n", optarg);
                     return_value = 1;
@@ -229,6 +390,7 @@ int parse_arguments(int argc, char **argv, struct ctoken_arguments *arguments)
                     return_value = 1;
                     goto Done;
                 }
+                break;
 
             case OUTPUT_PROTECTION:
                 if(!strcasecmp(optarg, "none")) {
@@ -260,6 +422,7 @@ int parse_arguments(int argc, char **argv, struct ctoken_arguments *arguments)
                     return_value = 1;
                     goto Done;
                 }
+                break;
 
             case NO_VERIFY:
                 arguments->no_verify = true;
@@ -295,12 +458,227 @@ int parse_arguments(int argc, char **argv, struct ctoken_arguments *arguments)
                 arguments->in_verify_key_file = optarg;
                 break;
 
+            case IN_VERIFY_CERT:
+                arguments->in_verify_cert_file = optarg;
+                break;
+
+            case IN_MAC_KEY:
+                arguments->in_mac_key_file = optarg;
+                break;
+
+            case OUT_MAC_KEY:
+                arguments->out_mac_key_file = optarg;
+                break;
+
+            case IN_DECRYPT_KEY:
+                arguments->in_decrypt_key_file = optarg;
+                break;
+
+            case OUT_ENCRYPT_KEY:
+                arguments->out_encrypt_key_file = optarg;
+                break;
+
+            case VERIFY_ONLY:
+                arguments->verify_only = true;
+                break;
+
+            case INPUT_STREAM:
+                arguments->input_stream = true;
+                break;
+
+            case VERIFY_TIME:
+                arguments->verify_time = true;
+                break;
+
+            case VERIFY_REASON:
+                arguments->verify_reason = true;
+                break;
+
+            case VERIFY_CACHE:
+                arguments->verify_cache_size = (int32_t)strtol(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0' || arguments->verify_cache_size < 0) {
+                    fprintf(stderr, "Bad verify cache size \"%s\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case STATS:
+                arguments->stats = true;
+                break;
+
+            case REPLAY_WINDOW:
+                arguments->replay_window = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0' || arguments->replay_window == 0) {
+                    fprintf(stderr, "Bad replay window \"%s\". Should be seconds\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case REPLAY_CAPACITY:
+                arguments->replay_capacity = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0' || arguments->replay_capacity == 0) {
+                    fprintf(stderr, "Bad replay capacity \"%s\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case REPLAY_FILE:
+                arguments->replay_file = optarg;
+                break;
+
+            case INPUT_DIR:
+                arguments->input_dir = optarg;
+                break;
+
+            case INPUT_SHM:
+                arguments->input_shm = optarg;
+                break;
+
+            case PROFILE:
+                arguments->profile = optarg;
+                break;
+
+            case PROFILE_FAIL_FAST:
+                arguments->profile_fail_fast = true;
+                break;
+
+            case INPUT_ARCHIVE:
+                arguments->input_archive = optarg;
+                break;
+
+            case OUTPUT_ARCHIVE:
+                arguments->output_archive = optarg;
+                break;
+
+            case ARCHIVE_UEID:
+                if(convert_hex_key(optarg, &arguments->archive_ueid)) {
+                    fprintf(stderr, "bad byte string value \"%s\" for ueid\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case ARCHIVE_CTI:
+                if(convert_hex_key(optarg, &arguments->archive_cti)) {
+                    fprintf(stderr, "bad byte string value \"%s\" for cti\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case ARCHIVE_FROM:
+                if(convert_to_int64(optarg, &arguments->archive_from)) {
+                    fprintf(stderr, "Bad time \"%s\". Should be seconds since 1970\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case ARCHIVE_TO:
+                if(convert_to_int64(optarg, &arguments->archive_to)) {
+                    fprintf(stderr, "Bad time \"%s\". Should be seconds since 1970\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case COLUMNS:
+                arguments->columns = optarg;
+                break;
+
+            case SUBMOD:
+                arguments->submod = optarg;
+                if(parse_submod_path(optarg, arguments)) {
+                    fprintf(stderr, "Bad submodule path \"%s\". Should be like \"tee/ta1\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case INPUT_GLOB:
+                arguments->input_glob = optarg;
+                break;
+
+            case INPUT_RECURSIVE:
+                arguments->input_recursive = true;
+                break;
+
+            case OUTPUT_DIR:
+                arguments->output_dir = optarg;
+                break;
+
+            case WORKERS:
+                arguments->workers = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0') {
+                    fprintf(stderr, "Bad number of workers \"%s\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case MAX_DEPTH:
+                arguments->limits.max_depth = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0' || arguments->limits.max_depth > XCLAIM_MAX_NESTING) {
+                    fprintf(stderr, "Bad max depth \"%s\". Should be 0 to %d\n", optarg, XCLAIM_MAX_NESTING);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case MAX_CLAIMS:
+                arguments->limits.max_claims = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0') {
+                    fprintf(stderr, "Bad max claims \"%s\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case MAX_SUBMODS:
+                arguments->limits.max_submods = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0') {
+                    fprintf(stderr, "Bad max submods \"%s\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case MAX_NESTED_BYTES:
+                arguments->limits.max_nested_bytes = (size_t)strtoull(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0') {
+                    fprintf(stderr, "Bad max nested bytes \"%s\"\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
+            case IO_DEPTH:
+                arguments->io_depth = (uint32_t)strtoul(optarg, &end_of_int, 10);
+                if(*end_of_int != '\0' || arguments->io_depth == 0 || arguments->io_depth > 4096) {
+                    fprintf(stderr, "Bad I/O depth \"%s\". Should be 1 to 4096\n", optarg);
+                    return_value = 1;
+                    goto Done;
+                }
+                break;
+
             default:
                 fprintf(stderr, "Oops. Input parameter parsing went wrong\n");
                 return_value = 1;
         }
     }
 
+    /* The nth -out goes with the nth -out_form. A missing -out is
+     * stdout and a missing -out_form is JSON. */
+    arguments->output_count  = output_file_count > output_format_count ? output_file_count : output_format_count;
+    if(arguments->output_count == 0) {
+        arguments->output_count = 1;
+    }
+    arguments->output_file   = arguments->output_files[0];
+    arguments->output_format = arguments->output_formats[0];
+
   Done:
     if(return_value) {
         free_arguments(arguments);
@@ -642,12 +1020,29 @@ static int generic_claim(const char *claim_value, QCBORItem *qcbor_item)
 
 
 
-static enum xclaim_error_t parg_get_next(void *me_void, struct xclaim *claim)
+/*
+ * Public function. See arg_decode.h
+ */
+int64_t claim_label_from_string(const char *label)
+{
+    int64_t label_number;
+    char   *end;
+
+    label_number = strtoll(label, &end, 10);
+    if(*end != '\0' || end == label) {
+        /* label is a string. Try to look it up. */
+        label_number = json_name_to_cbor_label(label);
+    }
+
+    return label_number;
+}
+
+
+/*
+ * Public function. See arg_decode.h
+ */
+int claim_from_string(int64_t label, const char *value, struct xclaim *claim)
 {
-    const char                  *submod;
-    const char                  *label;
-    const char                  *value;
-    int64_t                      claim_number;
     int64_t                      int64_value;
     enum ctoken_intended_use_t   intended_use;
     struct q_useful_buf_c        binary_value;
@@ -655,22 +1050,10 @@ static enum xclaim_error_t parg_get_next(void *me_void, struct xclaim *claim)
     enum ctoken_debug_level_t    debug_level;
     int                          error;
 
-    struct claim_argument_decoder *me = (struct claim_argument_decoder *)me_void;
-
-    if(*me->iterator == NULL) {
-        return XCLAIM_NO_MORE;
-    }
-
-    parse_claim_argument(*me->iterator, &submod, &label, &value, &claim_number);
-
-    // TODO: implement submods (lots of work)
-    // TODO: better job of unmatched claims
-
-
-    claim->qcbor_item.label.int64 = claim_number;
+    claim->qcbor_item.label.int64 = label;
     claim->qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
 
-    switch(claim_number) {
+    switch(label) {
         case CTOKEN_CWT_LABEL_ISSUER:
         case CTOKEN_CWT_LABEL_SUBJECT:
         case CTOKEN_CWT_LABEL_AUDIENCE:
@@ -746,6 +1129,32 @@ static enum xclaim_error_t parg_get_next(void *me_void, struct xclaim *claim)
             break;
     }
 
+    return 0;
+}
+
+
+static enum xclaim_error_t parg_get_next(void *me_void, struct xclaim *claim)
+{
+    const char *submod;
+    const char *label;
+    const char *value;
+    int64_t     claim_number;
+
+    struct claim_argument_decoder *me = (struct claim_argument_decoder *)me_void;
+
+    if(*me->iterator == NULL) {
+        return XCLAIM_NO_MORE;
+    }
+
+    parse_claim_argument(*me->iterator, &submod, &label, &value, &claim_number);
+
+    // TODO: implement submods (lots of work)
+    // TODO: better job of unmatched claims
+
+    if(claim_from_string(claim_number, value, claim)) {
+        return 1;
+    }
+
     // TODO: what about freeing the memory?
 
     me->iterator++;
@@ -783,5 +1192,7 @@ void xclaim_argument_decode_init(xclaim_decoder *ic, struct claim_argument_decod
     ic->enter_submod = enter_submod;
     ic->exit_submod  = NULL;
     ic->get_nested   = NULL;
+    ic->first_submod = NULL;
+    ic->next_submod  = NULL;
 }
 
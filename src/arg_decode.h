@@ -23,16 +23,67 @@
 
  */
 
+/* The most -out / -out_form pairs. No more than XCLAIM_TEE_MAX. */
+#define MAX_OUTPUTS 8
+
+enum out_format_t {OUT_FORMAT_CBOR, OUT_FORMAT_JSON, OUT_FORMAT_COLUMNAR,
+                   OUT_FORMAT_CSV, OUT_FORMAT_TSV};
+
 struct ctoken_arguments {
     bool help;
 
     const char *input_file;
     const char *output_file;
 
+    /* Decode -in as it is read rather than after reading all of it */
+    bool        input_stream;
+
+    const char *input_dir;
+    const char *input_glob;
+    bool        input_recursive;
+    const char *output_dir;
+    uint32_t    workers;
+    uint32_t    io_depth;
+
+    /* Shared memory rings to take tokens from. See shm_ring.h */
+    const char *input_shm;
+
+    /* Token archive to query or add to and what to query for. See
+     * token_archive.h */
+    const char           *input_archive;
+    const char           *output_archive;
+    struct q_useful_buf_c archive_ueid;
+    struct q_useful_buf_c archive_cti;
+    int64_t               archive_from;
+    int64_t               archive_to;
+
     const char **claims;
 
+    /* The -filter rules. See claim_filter.h */
+    const char **filters;
+
+    /* A built-in profile name or profile file. See eat_profile.h */
+    const char *profile;
+    bool        profile_fail_fast;
+
+    /* -columns for -out_form csv and tsv. See csv_encode.h */
+    const char *columns;
+
+    /* -submod. Only the submodule at this path is output. */
+    const char           *submod;
+    uint32_t              submod_path_len;
+    struct q_useful_buf_c submod_path[XCLAIM_MAX_NESTING];
+
     enum {IN_FORMAT_CBOR, IN_FORMAT_JSON} input_format;
-    enum {OUT_FORMAT_CBOR, OUT_FORMAT_JSON} output_format;
+    enum out_format_t output_format;
+
+    /* -out and -out_form can be given more than once to output
+     * several formats from one decode. The nth -out goes with the nth
+     * -out_form. A NULL file is stdout. The first pair is also in
+     * output_file and output_format. */
+    uint32_t          output_count;
+    const char       *output_files[MAX_OUTPUTS];
+    enum out_format_t output_formats[MAX_OUTPUTS];
 
     enum {IN_PROT_DETECT, IN_PROT_NONE, IN_PROT_SIGN, IN_PROT_MAC,
           IN_PROT_SIGN_ENCRYPT, IN_PROT_MAC_ENCRYPT} input_protection;
@@ -48,9 +99,34 @@ struct ctoken_arguments {
     int32_t     out_sign_algorithm;
     struct q_useful_buf_c out_sign_kid;
 
+    /* Symmetric keys for -out_prot mac and -in_prot mac */
+    const char *out_mac_key_file;
+    const char *in_mac_key_file;
+
+    /* AES keys for -out_prot sign_encrypt or mac_encrypt and for
+     * decrypting a COSE_Encrypt0 */
+    const char *out_encrypt_key_file;
+    const char *in_decrypt_key_file;
+
     const char *in_verify_key_file;
 
+    /* Trusted CA certs for tokens with an x5chain or x5t */
+    const char *in_verify_cert_file;
+
     bool no_verify;
+
+    bool verify_only;
+    bool verify_time;
+    bool verify_reason;
+    int32_t verify_cache_size;
+
+    uint32_t    replay_window;
+    uint32_t    replay_capacity;
+    const char *replay_file;
+
+    bool stats;
+
+    struct xclaim_limits limits;
 };
 
 
@@ -92,6 +168,22 @@ void xclaim_argument_decode_init(xclaim_decoder *ic,
 
 
 
+/* Returns the integer label for a claim name like "ueid" or a
+ number like "256". Returns 0 if the name is not known. */
+int64_t claim_label_from_string(const char *label);
+
+
+/* Fills in claim with the label and with value converted to the
+ type that goes with the label, for example a byte string for
+ ueid. This is how -claim values are converted.
+
+ Returns 0 on success and 1 if value is not valid for the label.
+ Byte string values are malloced and not freed.
+ */
+int claim_from_string(int64_t label, const char *value, struct xclaim *claim);
+
+
+
 void print_arguments_help(void);
 
 
@@ -0,0 +1,251 @@
+/*
+ * cbor_seq.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cbor_seq.h"
+
+
+/* Deepest nesting of arrays, maps and tags cbor_item_length()
+ * handles. This is well beyond what QCBOR handles. */
+#define CBOR_SEQ_MAX_NESTING 64
+
+/* Marks an indefinite-length array, map or string on the stack in
+ * cbor_item_length(). */
+#define REMAINING_INDEFINITE UINT64_MAX
+
+
+/*
+ * Public function. See cbor_seq.h
+ */
+size_t cbor_decode_head(struct q_useful_buf_c input,
+                        uint8_t              *major_type,
+                        uint8_t              *additional_info,
+                        uint64_t             *argument)
+{
+    const uint8_t *bytes = input.ptr;
+    size_t         argument_len;
+    size_t         i;
+
+    if(input.len < 1) {
+        return 0;
+    }
+
+    *major_type      = bytes[0] >> 5;
+    *additional_info = bytes[0] & 0x1f;
+    *argument        = 0;
+
+    if(*additional_info < 24) {
+        *argument = *additional_info;
+        return 1;
+    } else if(*additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE) {
+        if(*major_type == CBOR_MAJOR_TYPE_POSITIVE_INT ||
+           *major_type == CBOR_MAJOR_TYPE_NEGATIVE_INT ||
+           *major_type == CBOR_MAJOR_TYPE_TAG) {
+            return 0;
+        }
+        return 1;
+    } else if(*additional_info > 27) {
+        /* 28, 29 and 30 are reserved */
+        return 0;
+    }
+
+    argument_len = (size_t)1 << (*additional_info - 24);
+    if(input.len < 1 + argument_len) {
+        return 0;
+    }
+
+    for(i = 1; i <= argument_len; i++) {
+        *argument = (*argument << 8) + bytes[i];
+    }
+
+    return 1 + argument_len;
+}
+
+
+/*
+ * Public function. See cbor_seq.h
+ *
+ * This is iterative with a small stack of item counts rather than
+ * recursive so a hostile input can't run the C stack out.
+ */
+size_t cbor_item_length(struct q_useful_buf_c input)
+{
+    uint64_t remaining[CBOR_SEQ_MAX_NESTING];
+    int      depth;
+    size_t   offset;
+    size_t   head_len;
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+
+    depth        = 0;
+    remaining[0] = 1;
+    offset       = 0;
+
+    while(1) {
+        /* Pop all the arrays, maps and tags that are complete */
+        while(depth >= 0 && remaining[depth] == 0) {
+            depth--;
+        }
+        if(depth < 0) {
+            return offset;
+        }
+
+        head_len = cbor_decode_head(q_useful_buf_tail(input, offset),
+                                    &major_type,
+                                    &additional_info,
+                                    &argument);
+        if(head_len == 0) {
+            return 0;
+        }
+        offset += head_len;
+
+        if(major_type == CBOR_MAJOR_TYPE_SIMPLE &&
+           additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE) {
+            /* A break. Only valid to end an indefinite length item. */
+            if(remaining[depth] != REMAINING_INDEFINITE) {
+                return 0;
+            }
+            remaining[depth] = 0;
+            continue;
+        }
+
+        if(remaining[depth] != REMAINING_INDEFINITE) {
+            remaining[depth]--;
+        }
+
+        switch(major_type) {
+            case CBOR_MAJOR_TYPE_BYTE_STRING:
+            case CBOR_MAJOR_TYPE_TEXT_STRING:
+                if(additional_info != CBOR_ADDITIONAL_INFO_INDEFINITE) {
+                    if(argument > input.len - offset) {
+                        return 0;
+                    }
+                    offset += (size_t)argument;
+                    break;
+                }
+                /* Indefinite length strings are a run of chunks
+                 * ending in a break, so they are treated like an
+                 * indefinite length array. */
+                /* Fall through */
+
+            case CBOR_MAJOR_TYPE_ARRAY:
+            case CBOR_MAJOR_TYPE_MAP:
+            case CBOR_MAJOR_TYPE_TAG:
+                if(depth + 1 >= CBOR_SEQ_MAX_NESTING) {
+                    return 0;
+                }
+                depth++;
+                if(additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE) {
+                    remaining[depth] = REMAINING_INDEFINITE;
+                } else if(major_type == CBOR_MAJOR_TYPE_TAG) {
+                    remaining[depth] = 1;
+                } else if(major_type == CBOR_MAJOR_TYPE_MAP) {
+                    if(argument > (REMAINING_INDEFINITE - 1) / 2) {
+                        return 0;
+                    }
+                    remaining[depth] = argument * 2;
+                } else {
+                    if(argument == REMAINING_INDEFINITE) {
+                        return 0;
+                    }
+                    remaining[depth] = argument;
+                }
+                break;
+
+            default:
+                /* Integers, floats and simple values are all in the
+                 * head. */
+                break;
+        }
+    }
+}
+
+
+/*
+ * Public function. See cbor_seq.h
+ */
+size_t cbor_encode_head(uint8_t major_type, uint64_t argument, uint8_t *out)
+{
+    size_t argument_len;
+    size_t i;
+
+    if(argument < 24) {
+        out[0] = (uint8_t)((major_type << 5) | argument);
+        return 1;
+    } else if(argument <= UINT8_MAX) {
+        out[0] = (uint8_t)((major_type << 5) | 24);
+        argument_len = 1;
+    } else if(argument <= UINT16_MAX) {
+        out[0] = (uint8_t)((major_type << 5) | 25);
+        argument_len = 2;
+    } else if(argument <= UINT32_MAX) {
+        out[0] = (uint8_t)((major_type << 5) | 26);
+        argument_len = 4;
+    } else {
+        out[0] = (uint8_t)((major_type << 5) | 27);
+        argument_len = 8;
+    }
+
+    for(i = argument_len; i > 0; i--) {
+        out[i] = (uint8_t)argument;
+        argument >>= 8;
+    }
+
+    return 1 + argument_len;
+}
+
+
+/*
+ * Public function. See cbor_seq.h
+ */
+size_t cbor_get_byte_string(struct q_useful_buf_c input, struct q_useful_buf_c *contents)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    size_t   head_len;
+
+    head_len = cbor_decode_head(input, &major_type, &additional_info, &argument);
+    if(head_len == 0 ||
+       major_type != CBOR_MAJOR_TYPE_BYTE_STRING ||
+       additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE ||
+       argument > input.len - head_len) {
+        return 0;
+    }
+
+    *contents = (struct q_useful_buf_c){(const uint8_t *)input.ptr + head_len, (size_t)argument};
+
+    return head_len + (size_t)argument;
+}
+
+
+/*
+ * Public function. See cbor_seq.h
+ */
+int cbor_seq_next(struct q_useful_buf_c *sequence, struct q_useful_buf_c *item)
+{
+    size_t item_len;
+
+    if(sequence->len == 0) {
+        return 1;
+    }
+
+    item_len = cbor_item_length(*sequence);
+    if(item_len == 0) {
+        return -1;
+    }
+
+    *item     = q_useful_buf_head(*sequence, item_len);
+    *sequence = q_useful_buf_tail(*sequence, item_len);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * cbor_seq.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cbor_seq_h
+#define cbor_seq_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdint.h>
+
+
+/* These are a few small CBOR utilities that work on the raw bytes
+ * without a full decode. They are used to look at the outer layers of
+ * a token and to split a CBOR sequence (RFC 8742) of tokens, for
+ * example a file with many tokens in it, into the individual tokens.
+ */
+
+
+#define CBOR_MAJOR_TYPE_POSITIVE_INT 0
+#define CBOR_MAJOR_TYPE_NEGATIVE_INT 1
+#define CBOR_MAJOR_TYPE_BYTE_STRING  2
+#define CBOR_MAJOR_TYPE_TEXT_STRING  3
+#define CBOR_MAJOR_TYPE_ARRAY        4
+#define CBOR_MAJOR_TYPE_MAP          5
+#define CBOR_MAJOR_TYPE_TAG          6
+#define CBOR_MAJOR_TYPE_SIMPLE       7
+
+/* The additional info value for indefinite lengths and for break. */
+#define CBOR_ADDITIONAL_INFO_INDEFINITE 31
+
+
+/* Decodes just the head of a CBOR data item. Returns the length of
+ * the head or 0 if it is not well-formed or runs off the end of the
+ * input. For indefinite-length items additional_info is
+ * CBOR_ADDITIONAL_INFO_INDEFINITE and argument is 0.
+ */
+size_t cbor_decode_head(struct q_useful_buf_c input,
+                        uint8_t              *major_type,
+                        uint8_t              *additional_info,
+                        uint64_t             *argument);
+
+
+/* Returns the encoded length of the first complete data item in input
+ * including everything nested in it, or 0 if it is not well-formed
+ * or is truncated. Nothing is decoded or allocated so this is fast.
+ */
+size_t cbor_item_length(struct q_useful_buf_c input);
+
+
+/* Encodes a head in preferred (shortest) form. out must have room
+ * for 9 bytes. Returns the length of the head. */
+size_t cbor_encode_head(uint8_t major_type, uint64_t argument, uint8_t *out);
+
+
+/* Gets the contents of a definite-length byte string off the front
+ * of input. Returns the whole length of the byte string or 0 if it
+ * isn't one or runs off the end. */
+size_t cbor_get_byte_string(struct q_useful_buf_c  input,
+                            struct q_useful_buf_c *contents);
+
+
+/* Split the next data item off the front of a CBOR sequence.
+ *
+ * Returns 0 and the item on success, 1 when the sequence is used up
+ * and -1 if the item is not well-formed. sequence is advanced past
+ * the returned item.
+ */
+int cbor_seq_next(struct q_useful_buf_c *sequence, struct q_useful_buf_c *item);
+
+
+#endif /* cbor_seq_h */
@@ -0,0 +1,467 @@
+/*
+ * cert_chain.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cert_chain.h"
+#include "cbor_seq.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+
+/* Marks the end of a hash chain */
+#define NO_ENTRY UINT32_MAX
+
+
+/* The COSE algorithm ID for SHA-256, the only x5t hash handled */
+#define COSE_ALGORITHM_SHA_256 -16
+
+
+static inline uint32_t bucket_of(const struct cert_chain_cache *me, const uint8_t *fingerprint)
+{
+    uint32_t h;
+
+    /* The fingerprint is a SHA-256 so any part of it works as a hash */
+    memcpy(&h, fingerprint, sizeof(h));
+
+    return h & me->bucket_mask;
+}
+
+
+/*
+ * Public function. See cert_chain.h
+ */
+int cert_chain_init(struct cert_chain_cache *me,
+                    const char              *trust_path,
+                    uint32_t                 capacity)
+{
+    uint32_t    bucket_count;
+    uint32_t    i;
+    struct stat path_stat;
+    X509_STORE *store;
+    int         loaded;
+
+    memset(me, 0, sizeof(*me));
+
+    if(capacity == 0 || capacity >= NO_ENTRY / 2) {
+        return 1;
+    }
+
+    if(stat(trust_path, &path_stat)) {
+        fprintf(stderr, "can't find trusted certs \"%s\"\n", trust_path);
+        return 1;
+    }
+
+    store = X509_STORE_new();
+    if(store == NULL) {
+        return 1;
+    }
+    if(S_ISDIR(path_stat.st_mode)) {
+        loaded = X509_STORE_load_locations(store, NULL, trust_path);
+    } else {
+        loaded = X509_STORE_load_locations(store, trust_path, NULL);
+    }
+    if(!loaded) {
+        fprintf(stderr, "can't load trusted certs from \"%s\"\n", trust_path);
+        X509_STORE_free(store);
+        return 1;
+    }
+    me->trust_store = store;
+
+    pthread_mutex_init(&me->lock, NULL);
+
+    /* About two buckets per entry keeps chains short */
+    for(bucket_count = 1; bucket_count < capacity * 2; bucket_count <<= 1);
+
+    me->entries = calloc(capacity, sizeof(struct cert_chain_entry));
+    me->buckets = malloc(bucket_count * sizeof(uint32_t));
+    if(me->entries == NULL || me->buckets == NULL) {
+        cert_chain_free(me);
+        return 1;
+    }
+
+    for(i = 0; i < bucket_count; i++) {
+        me->buckets[i] = NO_ENTRY;
+    }
+
+    me->capacity    = capacity;
+    me->bucket_mask = bucket_count - 1;
+
+    return 0;
+}
+
+
+/* Gets the certs out of an x5chain. It is either one cert in a byte
+ * string or an array of them with the leaf first. */
+static int decode_x5chain(struct q_useful_buf_c  x5chain,
+                          struct q_useful_buf_c  certs[CERT_CHAIN_MAX_CERTS],
+                          size_t                *cert_count)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    uint64_t count;
+    size_t   head_len;
+    size_t   i;
+
+    head_len = cbor_decode_head(x5chain, &major_type, &additional_info, &argument);
+    if(head_len == 0) {
+        return 1;
+    }
+
+    if(major_type == CBOR_MAJOR_TYPE_ARRAY) {
+        if(additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE ||
+           argument == 0 ||
+           argument > CERT_CHAIN_MAX_CERTS) {
+            return 1;
+        }
+        count   = argument;
+        x5chain = q_useful_buf_tail(x5chain, head_len);
+    } else {
+        count = 1;
+    }
+
+    for(i = 0; i < count; i++) {
+        head_len = cbor_decode_head(x5chain, &major_type, &additional_info, &argument);
+        if(head_len == 0 ||
+           major_type != CBOR_MAJOR_TYPE_BYTE_STRING ||
+           additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE ||
+           argument > x5chain.len - head_len) {
+            return 1;
+        }
+        certs[i] = (struct q_useful_buf_c){(const uint8_t *)x5chain.ptr + head_len, (size_t)argument};
+        x5chain  = q_useful_buf_tail(x5chain, head_len + (size_t)argument);
+    }
+
+    *cert_count = count;
+
+    return 0;
+}
+
+
+/* Gets the SHA-256 out of an x5t, [ alg, hash ]. */
+static int decode_x5t(struct q_useful_buf_c x5t, uint8_t fingerprint[CERT_CHAIN_DIGEST_LEN])
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    size_t   head_len;
+
+    head_len = cbor_decode_head(x5t, &major_type, &additional_info, &argument);
+    if(head_len == 0 || major_type != CBOR_MAJOR_TYPE_ARRAY || argument != 2) {
+        return 1;
+    }
+    x5t = q_useful_buf_tail(x5t, head_len);
+
+    head_len = cbor_decode_head(x5t, &major_type, &additional_info, &argument);
+    if(head_len == 0 ||
+       major_type != CBOR_MAJOR_TYPE_NEGATIVE_INT ||
+       argument != (uint64_t)(-1 - COSE_ALGORITHM_SHA_256)) {
+        fprintf(stderr, "only SHA-256 x5t is supported\n");
+        return 1;
+    }
+    x5t = q_useful_buf_tail(x5t, head_len);
+
+    head_len = cbor_decode_head(x5t, &major_type, &additional_info, &argument);
+    if(head_len == 0 ||
+       major_type != CBOR_MAJOR_TYPE_BYTE_STRING ||
+       argument != CERT_CHAIN_DIGEST_LEN ||
+       x5t.len < head_len + CERT_CHAIN_DIGEST_LEN) {
+        return 1;
+    }
+    memcpy(fingerprint, (const uint8_t *)x5t.ptr + head_len, CERT_CHAIN_DIGEST_LEN);
+
+    return 0;
+}
+
+
+/* Looks up a fingerprint. Returns a new reference to the key or NULL.
+ * Must be called with the lock held. */
+static EVP_PKEY *lookup(struct cert_chain_cache *me,
+                        const uint8_t            fingerprint[CERT_CHAIN_DIGEST_LEN],
+                        int64_t                  now)
+{
+    uint32_t                 i;
+    struct cert_chain_entry *entry;
+
+    me->lookups++;
+
+    for(i = me->buckets[bucket_of(me, fingerprint)]; i != NO_ENTRY; i = entry->next) {
+        entry = &(me->entries[i]);
+        if(!memcmp(entry->fingerprint, fingerprint, CERT_CHAIN_DIGEST_LEN)) {
+            if(entry->expires <= now) {
+                return NULL;
+            }
+            entry->referenced = 1;
+            me->hits++;
+            EVP_PKEY_up_ref(entry->key);
+            return entry->key;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Take an entry out of its hash chain so it can be reused. */
+static void unlink_entry(struct cert_chain_cache *me, uint32_t index)
+{
+    uint32_t *link;
+
+    link = &(me->buckets[bucket_of(me, me->entries[index].fingerprint)]);
+    while(*link != index) {
+        link = &(me->entries[*link].next);
+    }
+    *link = me->entries[index].next;
+}
+
+
+/* Adds a validated chain, replacing any expired entry for the same
+ * leaf. The cache takes its own reference to key. Must be called with
+ * the lock held. */
+static void insert(struct cert_chain_cache *me,
+                   const uint8_t            fingerprint[CERT_CHAIN_DIGEST_LEN],
+                   EVP_PKEY                *key,
+                   int64_t                  expires)
+{
+    struct cert_chain_entry *entry;
+    uint32_t                 victim;
+    uint32_t                 bucket;
+
+    for(victim = me->buckets[bucket_of(me, fingerprint)]; victim != NO_ENTRY; victim = entry->next) {
+        entry = &(me->entries[victim]);
+        if(!memcmp(entry->fingerprint, fingerprint, CERT_CHAIN_DIGEST_LEN)) {
+            /* Another thread validated it too or it expired */
+            EVP_PKEY_free(entry->key);
+            EVP_PKEY_up_ref(key);
+            entry->key     = key;
+            entry->expires = expires;
+            return;
+        }
+    }
+
+    /* The CLOCK sweep. Referenced entries get a second chance. This
+     * always ends within two trips around. */
+    while(1) {
+        victim = me->clock_hand;
+        me->clock_hand = (me->clock_hand + 1) % me->capacity;
+
+        entry = &(me->entries[victim]);
+        if(!entry->in_use) {
+            break;
+        }
+        if(!entry->referenced) {
+            unlink_entry(me, victim);
+            EVP_PKEY_free(entry->key);
+            break;
+        }
+        entry->referenced = 0;
+    }
+
+    memcpy(entry->fingerprint, fingerprint, CERT_CHAIN_DIGEST_LEN);
+    EVP_PKEY_up_ref(key);
+    entry->key        = key;
+    entry->expires    = expires;
+    entry->in_use     = 1;
+    entry->referenced = 0;
+
+    bucket = bucket_of(me, fingerprint);
+    entry->next = me->buckets[bucket];
+    me->buckets[bucket] = victim;
+}
+
+
+/* The full X.509 path validation. On success returns the leaf key
+ * and when the validation should expire. */
+static EVP_PKEY *validate_chain(struct cert_chain_cache *me,
+                                struct q_useful_buf_c    certs[],
+                                size_t                   cert_count,
+                                int64_t                  now,
+                                int64_t                 *expires)
+{
+    X509            *x509s[CERT_CHAIN_MAX_CERTS];
+    STACK_OF(X509)  *untrusted;
+    STACK_OF(X509)  *chain;
+    X509_STORE_CTX  *store_ctx;
+    EVP_PKEY        *key;
+    const uint8_t   *der;
+    size_t           i;
+    int              days;
+    int              seconds;
+    int64_t          not_after;
+
+    key       = NULL;
+    untrusted = sk_X509_new_null();
+    store_ctx = X509_STORE_CTX_new();
+    memset(x509s, 0, sizeof(x509s));
+
+    if(untrusted == NULL || store_ctx == NULL) {
+        goto Done;
+    }
+
+    for(i = 0; i < cert_count; i++) {
+        der = certs[i].ptr;
+        x509s[i] = d2i_X509(NULL, &der, (long)certs[i].len);
+        if(x509s[i] == NULL) {
+            fprintf(stderr, "cert %zu in x5chain can't be decoded\n", i);
+            goto Done;
+        }
+        if(i > 0 && !sk_X509_push(untrusted, x509s[i])) {
+            goto Done;
+        }
+    }
+
+    if(!X509_STORE_CTX_init(store_ctx, me->trust_store, x509s[0], untrusted)) {
+        goto Done;
+    }
+    if(X509_verify_cert(store_ctx) != 1) {
+        fprintf(stderr,
+                "x5chain is not trusted: %s\n",
+                X509_verify_cert_error_string(X509_STORE_CTX_get_error(store_ctx)));
+        goto Done;
+    }
+
+    /* Expire with the first cert in the chain to expire */
+    *expires = now + CERT_CHAIN_MAX_AGE;
+    chain = X509_STORE_CTX_get0_chain(store_ctx);
+    for(i = 0; i < (size_t)sk_X509_num(chain); i++) {
+        if(ASN1_TIME_diff(&days, &seconds, NULL, X509_get0_notAfter(sk_X509_value(chain, (int)i)))) {
+            not_after = now + (int64_t)days * 24 * 60 * 60 + seconds;
+            if(not_after < *expires) {
+                *expires = not_after;
+            }
+        }
+    }
+
+    key = X509_get_pubkey(x509s[0]);
+    if(key != NULL && !EVP_PKEY_is_a(key, "EC") && !EVP_PKEY_is_a(key, "ED25519")) {
+        EVP_PKEY_free(key);
+        key = NULL;
+    }
+    if(key == NULL) {
+        fprintf(stderr, "x5chain leaf cert does not have an EC or Ed25519 key\n");
+    }
+
+Done:
+    X509_STORE_CTX_free(store_ctx);
+    sk_X509_free(untrusted);
+    for(i = 0; i < cert_count; i++) {
+        X509_free(x509s[i]);
+    }
+
+    return key;
+}
+
+
+/*
+ * Public function. See cert_chain.h
+ */
+int cert_chain_get_key(struct cert_chain_cache *me,
+                       struct q_useful_buf_c    token,
+                       int64_t                  now,
+                       struct t_cose_key       *key)
+{
+    struct q_useful_buf_c header;
+    struct q_useful_buf_c certs[CERT_CHAIN_MAX_CERTS];
+    size_t                cert_count;
+    uint8_t               fingerprint[CERT_CHAIN_DIGEST_LEN];
+    EVP_PKEY             *leaf_key;
+    int64_t               expires;
+    int                   result;
+
+    cert_count = 0;
+
+    result = cose_envelope_find_header(token, COSE_HEADER_PARAM_X5CHAIN, &header);
+    if(result == 0) {
+        if(decode_x5chain(header, certs, &cert_count)) {
+            fprintf(stderr, "x5chain in token is not valid\n");
+            return 1;
+        }
+        if(!EVP_Digest(certs[0].ptr, certs[0].len, fingerprint, NULL, EVP_sha256(), NULL)) {
+            return 1;
+        }
+    } else if(result == 1) {
+        result = cose_envelope_find_header(token, COSE_HEADER_PARAM_X5T, &header);
+        if(result == 1) {
+            fprintf(stderr, "token has no x5chain or x5t to get the verification key from\n");
+            return 1;
+        }
+        if(result == 0 && decode_x5t(header, fingerprint)) {
+            fprintf(stderr, "x5t in token is not valid\n");
+            return 1;
+        }
+    }
+    if(result < 0) {
+        fprintf(stderr, "input token is not a well-formed COSE_Sign1\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&me->lock);
+    leaf_key = lookup(me, fingerprint, now);
+    pthread_mutex_unlock(&me->lock);
+
+    if(leaf_key == NULL) {
+        if(cert_count == 0) {
+            fprintf(stderr, "x5t is for a cert that has not been validated from an x5chain\n");
+            return 1;
+        }
+
+        leaf_key = validate_chain(me, certs, cert_count, now, &expires);
+        if(leaf_key == NULL) {
+            return 1;
+        }
+
+        pthread_mutex_lock(&me->lock);
+        insert(me, fingerprint, leaf_key, expires);
+        pthread_mutex_unlock(&me->lock);
+    }
+
+    /* Only now is it made into the kind of key t_cose takes */
+    if(set_evp_pkey(leaf_key, key)) {
+        fprintf(stderr, "can't use x5chain leaf cert key\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See cert_chain.h
+ */
+void cert_chain_free(struct cert_chain_cache *me)
+{
+    uint32_t i;
+
+    if(me->trust_store != NULL) {
+        for(i = 0; i < me->capacity; i++) {
+            if(me->entries[i].in_use) {
+                EVP_PKEY_free(me->entries[i].key);
+            }
+        }
+        pthread_mutex_destroy(&me->lock);
+    }
+
+    X509_STORE_free(me->trust_store);
+    free(me->entries);
+    free(me->buckets);
+    me->trust_store = NULL;
+    me->entries     = NULL;
+    me->buckets     = NULL;
+    me->capacity    = 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * cert_chain.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cert_chain_h
+#define cert_chain_h
+
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include <pthread.h>
+#include <stdint.h>
+
+
+/* This gets the verification key for a token from the certificates
+ * in its COSE header, the x5chain or x5t parameters of RFC 9360. The
+ * chain is validated with OpenSSL against a trust store that is
+ * loaded once for -in_verify_cert.
+ *
+ * X.509 path validation costs much more than the signature check, so
+ * validated chains are cached. The key is the SHA-256 of the leaf
+ * cert, which is also the x5t of the leaf, and the cached value is
+ * the leaf public key. Once a signer has been seen, its tokens cost a
+ * SHA-256 of the leaf cert and a lookup with no X.509 parsing at all.
+ * An x5t only works for a leaf that has already been validated from
+ * an x5chain, since the cert isn't in the token.
+ *
+ * An entry expires when the first cert in its chain does or after
+ * CERT_CHAIN_MAX_AGE seconds, whichever is sooner, and the chain is
+ * then validated again. Replacement is by the CLOCK algorithm as for
+ * struct verify_cache.
+ *
+ * cert_chain_get_key() is thread safe so one cache can be shared by
+ * the -in_dir workers. The lock is not held during validation.
+ */
+
+
+#define CERT_CHAIN_DIGEST_LEN 32
+
+/* The most certs in an x5chain */
+#define CERT_CHAIN_MAX_CERTS 8
+
+/* Validated chains to cache */
+#define CERT_CHAIN_CACHE_SIZE 256
+
+/* The longest a validated chain is trusted without checking again */
+#define CERT_CHAIN_MAX_AGE (24 * 60 * 60)
+
+
+struct cert_chain_entry {
+    uint8_t  fingerprint[CERT_CHAIN_DIGEST_LEN];
+    void    *key;      /* EVP_PKEY* for the leaf */
+    int64_t  expires;
+    uint32_t next;     /* Next in hash chain */
+    uint8_t  in_use;
+    uint8_t  referenced;
+};
+
+
+struct cert_chain_cache {
+    void                    *trust_store; /* X509_STORE* */
+
+    struct cert_chain_entry *entries;
+    uint32_t                *buckets;
+    uint32_t                 capacity;
+    uint32_t                 bucket_mask;
+    uint32_t                 clock_hand;
+
+    pthread_mutex_t          lock;
+
+    /* Statistics for -stats */
+    uint64_t                 lookups;
+    uint64_t                 hits;
+};
+
+
+/* Load the trusted CA certs from trust_path, either a PEM file with
+ * one or more certs or a directory prepared with openssl rehash, and
+ * allocate a cache with room for capacity chains.
+ *
+ * Returns 0 on success. On failure a message is printed and 1 is
+ * returned.
+ */
+int cert_chain_init(struct cert_chain_cache *me,
+                    const char              *trust_path,
+                    uint32_t                 capacity);
+
+
+/* Get the verification key for a COSE_Sign1 from its x5chain or x5t
+ * header. now is the current time used for the cache expiry.
+ *
+ * On success 0 is returned and key is an OpenSSL key the caller must
+ * free with free_ec_key(). The token signature has not been checked.
+ * On failure a message is printed and 1 is returned.
+ */
+int cert_chain_get_key(struct cert_chain_cache *me,
+                       struct q_useful_buf_c    token,
+                       int64_t                  now,
+                       struct t_cose_key       *key);
+
+
+void cert_chain_free(struct cert_chain_cache *me);
+
+
+#endif /* cert_chain_h */
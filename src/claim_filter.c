@@ -0,0 +1,805 @@
+/*
+ * claim_filter.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "claim_filter.h"
+#include "arg_decode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+
+#define RULE_BIT(n) (((uint64_t)1) << (n))
+
+#define SHA256_LEN 32
+
+
+/* Fibonacci hashing of the label into the table */
+static inline uint32_t label_slot(int64_t label)
+{
+    return (uint32_t)(((uint64_t)label * 0x9E3779B97F4A7C15ULL) >> 32) &
+           (CLAIM_FILTER_TABLE_SIZE - 1);
+}
+
+
+/* Returns the first rule for the label or -1 if there is none. */
+static int8_t first_rule(const struct claim_filter_rules *rules, int64_t label)
+{
+    uint32_t slot;
+
+    for(slot = label_slot(label);
+        rules->table[slot].first >= 0;
+        slot = (slot + 1) & (CLAIM_FILTER_TABLE_SIZE - 1)) {
+        if(rules->table[slot].label == label) {
+            return rules->table[slot].first;
+        }
+    }
+
+    return -1;
+}
+
+
+/* Adds rule n to the end of the list for its label so the rules for a
+ * label stay in the order given. */
+static void add_to_table(struct claim_filter_rules *rules, int8_t n)
+{
+    uint32_t slot;
+    int8_t   last;
+    int64_t  label;
+
+    label = rules->rules[n].label;
+    rules->rules[n].next = -1;
+
+    for(slot = label_slot(label);
+        rules->table[slot].first >= 0;
+        slot = (slot + 1) & (CLAIM_FILTER_TABLE_SIZE - 1)) {
+        if(rules->table[slot].label == label) {
+            for(last = rules->table[slot].first;
+                rules->rules[last].next >= 0;
+                last = rules->rules[last].next);
+            rules->rules[last].next = n;
+            return;
+        }
+    }
+
+    rules->table[slot].label = label;
+    rules->table[slot].first = n;
+}
+
+
+static int parse_action(const char *action, size_t len, enum claim_filter_action_t *result)
+{
+    static const struct {
+        const char                *name;
+        enum claim_filter_action_t action;
+    } actions[] = {
+        {"drop",   CLAIM_FILTER_DROP},
+        {"keep",   CLAIM_FILTER_KEEP},
+        {"rename", CLAIM_FILTER_RENAME},
+        {"hash",   CLAIM_FILTER_HASH},
+        {"set",    CLAIM_FILTER_SET},
+    };
+    size_t i;
+
+    for(i = 0; i < sizeof(actions)/sizeof(actions[0]); i++) {
+        if(strlen(actions[i].name) == len && !strncmp(action, actions[i].name, len)) {
+            *result = actions[i].action;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/* Splits the scope, e.g. "a/b/", into the submodule names. */
+static int parse_scope(const char *scope, const char *scope_end, struct claim_filter_rule *rule)
+{
+    const char *slash;
+
+    rule->any_level = false;
+    rule->path_len  = 0;
+
+    if(*scope == '/') {
+        scope++;
+    }
+
+    while(scope < scope_end) {
+        slash = memchr(scope, '/', (size_t)(scope_end - scope));
+        if(slash == scope) {
+            return 1;
+        }
+        if(rule->path_len == XCLAIM_MAX_NESTING) {
+            return 1;
+        }
+        rule->path[rule->path_len++] = (struct q_useful_buf_c){scope, (size_t)(slash - scope)};
+        scope = slash + 1;
+    }
+
+    return 0;
+}
+
+
+/* The type the value of a claim must have because it is encoded with
+ * a function for that claim, see encode_xclaim() in ctoken_adapt.c.
+ * QCBOR_TYPE_NONE for labels that are encoded by the value's type. */
+static uint8_t fixed_type_of(int64_t label)
+{
+    switch(label) {
+        case CTOKEN_CWT_LABEL_ISSUER:
+        case CTOKEN_CWT_LABEL_SUBJECT:
+        case CTOKEN_CWT_LABEL_AUDIENCE:
+            return QCBOR_TYPE_TEXT_STRING;
+
+        case CTOKEN_CWT_LABEL_EXPIRATION:
+        case CTOKEN_CWT_LABEL_NOT_BEFORE:
+        case CTOKEN_CWT_LABEL_IAT:
+        case CTOKEN_EAT_LABEL_SECURITY_LEVEL:
+            return QCBOR_TYPE_INT64;
+
+        case CTOKEN_CWT_LABEL_CTI:
+        case CTOKEN_EAT_LABEL_UEID:
+        case CTOKEN_EAT_LABEL_NONCE:
+            return QCBOR_TYPE_BYTE_STRING;
+
+        case CTOKEN_EAT_LABEL_LOCATION:
+            return QCBOR_TYPE_MAP;
+
+        default:
+            return QCBOR_TYPE_NONE;
+    }
+}
+
+
+/* Parses one -filter option. The path and salt point into rule_arg
+ * so it must stay valid. */
+static int parse_rule(const char *rule_arg, struct claim_filter_rule *rule)
+{
+    const char *spec;
+    const char *label_start;
+    const char *label_end;
+    const char *argument;
+    const char *c;
+    char       *label_string;
+
+    memset(rule, 0, sizeof(*rule));
+
+    spec = strchr(rule_arg, ':');
+    if(spec == NULL) {
+        fprintf(stderr, "filter \"%s\" should be <action>:<label>\n", rule_arg);
+        return 1;
+    }
+    if(parse_action(rule_arg, (size_t)(spec - rule_arg), &rule->action)) {
+        fprintf(stderr, "unknown filter action in \"%s\"\n", rule_arg);
+        return 1;
+    }
+    spec++;
+
+    argument  = strchr(spec, '=');
+    label_end = argument ? argument : spec + strlen(spec);
+    if(argument) {
+        argument++;
+    }
+
+    /* The label is after the last '/' of the scope */
+    label_start = spec;
+    for(c = spec; c < label_end; c++) {
+        if(*c == '/') {
+            label_start = c + 1;
+        }
+    }
+
+    rule->any_level = true;
+    if(label_start != spec) {
+        if(parse_scope(spec, label_start, rule)) {
+            fprintf(stderr, "bad submodule scope in filter \"%s\"\n", rule_arg);
+            return 1;
+        }
+    }
+
+    label_string = strndup(label_start, (size_t)(label_end - label_start));
+    rule->label = claim_label_from_string(label_string);
+    free(label_string);
+    if(rule->label == 0) {
+        fprintf(stderr, "unknown claim label in filter \"%s\"\n", rule_arg);
+        return 1;
+    }
+
+    switch(rule->action) {
+        case CLAIM_FILTER_DROP:
+        case CLAIM_FILTER_KEEP:
+            if(argument != NULL) {
+                fprintf(stderr, "filter \"%s\" doesn't take a value\n", rule_arg);
+                return 1;
+            }
+            break;
+
+        case CLAIM_FILTER_RENAME:
+            rule->new_label = argument ? claim_label_from_string(argument) : 0;
+            if(rule->new_label == 0) {
+                fprintf(stderr, "bad new label in filter \"%s\"\n", rule_arg);
+                return 1;
+            }
+            /* Nothing checks the value when the claim is output, so
+             * e.g. a text string renamed to exp would be encoded as an
+             * integer. A location is decoded into its own structure
+             * and can't be output as anything else. */
+            if((fixed_type_of(rule->new_label) != QCBOR_TYPE_NONE ||
+                fixed_type_of(rule->label) == QCBOR_TYPE_MAP) &&
+               fixed_type_of(rule->new_label) != fixed_type_of(rule->label)) {
+                fprintf(stderr, "filter \"%s\" renames to a label whose value is of a different type\n", rule_arg);
+                return 1;
+            }
+            break;
+
+        case CLAIM_FILTER_HASH:
+            rule->salt = argument ? q_useful_buf_from_sz(argument) : NULL_Q_USEFUL_BUF_C;
+            break;
+
+        case CLAIM_FILTER_SET:
+            if(argument == NULL) {
+                fprintf(stderr, "filter \"%s\" needs a value\n", rule_arg);
+                return 1;
+            }
+            if(rule->label == CTOKEN_CWT_LABEL_IAT && !strcmp(argument, "now")) {
+                rule->value_is_now = true;
+                rule->value.qcbor_item.label.int64 = rule->label;
+                rule->value.qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+                rule->value.qcbor_item.uDataType   = QCBOR_TYPE_INT64;
+            } else if(claim_from_string(rule->label, argument, &rule->value)) {
+                return 1;
+            }
+            break;
+    }
+
+    return 0;
+}
+
+
+/* Hashes the salt once so each claim only needs a copy of the
+ * state. */
+static int start_salted_hash(struct claim_filter_rule *rule)
+{
+    rule->salted_md_ctx = EVP_MD_CTX_new();
+    if(rule->salted_md_ctx == NULL) {
+        return 1;
+    }
+
+    return !EVP_DigestInit_ex(rule->salted_md_ctx, EVP_sha256(), NULL) ||
+           !EVP_DigestUpdate(rule->salted_md_ctx, rule->salt.ptr, rule->salt.len);
+}
+
+
+/*
+ * Public function. See claim_filter.h
+ */
+int claim_filter_compile(const char **rule_args, struct claim_filter_rules *rules)
+{
+    uint32_t i;
+
+    memset(rules, 0, sizeof(*rules));
+    for(i = 0; i < CLAIM_FILTER_TABLE_SIZE; i++) {
+        rules->table[i].first = -1;
+    }
+
+    for(; *rule_args != NULL; rule_args++) {
+        if(rules->rule_count == CLAIM_FILTER_MAX_RULES) {
+            fprintf(stderr, "too many filters. The limit is %d\n", CLAIM_FILTER_MAX_RULES);
+            return 1;
+        }
+        i = rules->rule_count;
+        if(parse_rule(*rule_args, &rules->rules[i])) {
+            return 1;
+        }
+        add_to_table(rules, (int8_t)i);
+        rules->rule_count++;
+
+        switch(rules->rules[i].action) {
+            case CLAIM_FILTER_KEEP:
+                rules->keep_mask   |= RULE_BIT(i);
+                rules->redact_mask |= RULE_BIT(i);
+                break;
+
+            case CLAIM_FILTER_SET:
+                rules->set_mask |= RULE_BIT(i);
+                break;
+
+            case CLAIM_FILTER_DROP:
+                rules->redact_mask |= RULE_BIT(i);
+                break;
+
+            case CLAIM_FILTER_HASH:
+                rules->redact_mask |= RULE_BIT(i);
+                if(start_salted_hash(&rules->rules[i])) {
+                    fprintf(stderr, "can't set up SHA-256 for filter \"%s\"\n", *rule_args);
+                    return 1;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return 0;
+}
+
+
+static bool rule_applies(const struct claim_filter_rule *rule,
+                         const struct q_useful_buf_c    *path,
+                         uint32_t                        depth)
+{
+    uint32_t i;
+
+    if(rule->any_level) {
+        return true;
+    }
+    if(rule->path_len != depth) {
+        return false;
+    }
+    for(i = 0; i < depth; i++) {
+        if(q_useful_buf_compare(rule->path[i], path[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* Works out which rules apply at the level just entered. */
+static void start_level(struct claim_filter *me)
+{
+    struct claim_filter_level *level;
+    uint32_t                   i;
+
+    level = &me->levels[me->depth];
+    level->in_scope    = 0;
+    level->set_done    = 0;
+    level->claims_done = false;
+
+    for(i = 0; i < me->rules->rule_count; i++) {
+        if(rule_applies(&me->rules->rules[i], me->path, me->depth)) {
+            level->in_scope |= RULE_BIT(i);
+        }
+    }
+}
+
+
+static enum xclaim_error_t push_level(struct claim_filter *me, struct q_useful_buf_c name)
+{
+    if(me->depth == XCLAIM_MAX_NESTING) {
+        return XCLAIM_ERR_NESTING_TOO_DEEP;
+    }
+    me->path[me->depth] = name;
+    me->depth++;
+    start_level(me);
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static void pop_level(struct claim_filter *me)
+{
+    if(me->depth > 0) {
+        me->depth--;
+    }
+}
+
+
+/* Returns the rule to apply to a claim with the label at this level
+ * or -1 for none. kept is set if there is a keep rule for it. All the
+ * set rules for the label are marked done so the claim isn't added
+ * again at the end. */
+static int8_t
+rule_for_label(struct claim_filter       *me,
+               struct claim_filter_level *level,
+               int64_t                    label,
+               bool                      *kept)
+{
+    const struct claim_filter_rules *rules = me->rules;
+    int8_t                           n;
+    int8_t                           found;
+
+    found = -1;
+    *kept = false;
+
+    for(n = first_rule(rules, label); n >= 0; n = rules->rules[n].next) {
+        if(!(level->in_scope & RULE_BIT(n))) {
+            continue;
+        }
+        if(rules->rules[n].action == CLAIM_FILTER_KEEP) {
+            *kept = true;
+            continue;
+        }
+        if(rules->rules[n].action == CLAIM_FILTER_SET) {
+            level->set_done |= RULE_BIT(n);
+        }
+        if(found < 0) {
+            found = n;
+        }
+    }
+
+    return found;
+}
+
+
+static void set_claim(const struct claim_filter_rule *rule, struct xclaim *claim)
+{
+    *claim = rule->value;
+    if(rule->value_is_now) {
+        claim->qcbor_item.val.int64 = (int64_t)time(NULL);
+    }
+}
+
+
+/* Replaces a byte or text string value with its hash. Returns
+ * XCLAIM_NO_MORE if the claim is some other type and should be
+ * dropped. */
+static enum xclaim_error_t
+hash_claim(struct claim_filter            *me,
+           const struct claim_filter_rule *rule,
+           struct xclaim                  *claim)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    QCBORItem *item = &(claim->qcbor_item);
+    uint8_t    digest[SHA256_LEN];
+    int        ok;
+    size_t     i;
+
+    if(item->uDataType != QCBOR_TYPE_BYTE_STRING &&
+       item->uDataType != QCBOR_TYPE_TEXT_STRING) {
+        return XCLAIM_NO_MORE;
+    }
+
+    if(me->md_ctx == NULL) {
+        me->md_ctx = EVP_MD_CTX_new();
+        if(me->md_ctx == NULL) {
+            return XCLAIM_ERR_FILTER;
+        }
+    }
+
+    ok = EVP_MD_CTX_copy_ex(me->md_ctx, rule->salted_md_ctx) &&
+         EVP_DigestUpdate(me->md_ctx, item->val.string.ptr, item->val.string.len) &&
+         EVP_DigestFinal_ex(me->md_ctx, digest, NULL);
+    if(!ok) {
+        return XCLAIM_ERR_FILTER;
+    }
+
+    if(item->uDataType == QCBOR_TYPE_BYTE_STRING) {
+        memcpy(me->digest_buf, digest, SHA256_LEN);
+        item->val.string = (struct q_useful_buf_c){me->digest_buf, SHA256_LEN};
+    } else {
+        for(i = 0; i < SHA256_LEN; i++) {
+            me->digest_buf[2*i]   = (uint8_t)hex[digest[i] >> 4];
+            me->digest_buf[2*i+1] = (uint8_t)hex[digest[i] & 0x0f];
+        }
+        item->val.string = (struct q_useful_buf_c){me->digest_buf, 2 * SHA256_LEN};
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* Applies the rules to one claim. Returns XCLAIM_SUCCESS if it is to
+ * be output, XCLAIM_NO_MORE if it is dropped, or an error. */
+static enum xclaim_error_t
+apply_rules(struct claim_filter       *me,
+            struct claim_filter_level *level,
+            struct xclaim             *claim)
+{
+    const struct claim_filter_rule *rule;
+    int8_t                          n;
+    bool                            kept;
+
+    n    = -1;
+    kept = false;
+    if(claim->qcbor_item.uLabelType == QCBOR_TYPE_INT64) {
+        n = rule_for_label(me, level, claim->qcbor_item.label.int64, &kept);
+    }
+    rule = n >= 0 ? &(me->rules->rules[n]) : NULL;
+
+    if((level->in_scope & me->rules->keep_mask) && !kept &&
+       !(rule != NULL && rule->action == CLAIM_FILTER_SET)) {
+        return XCLAIM_NO_MORE;
+    }
+
+    if(rule == NULL) {
+        return XCLAIM_SUCCESS;
+    }
+
+    switch(rule->action) {
+        case CLAIM_FILTER_DROP:
+            return XCLAIM_NO_MORE;
+
+        case CLAIM_FILTER_RENAME:
+            claim->qcbor_item.label.int64 = rule->new_label;
+            return XCLAIM_SUCCESS;
+
+        case CLAIM_FILTER_HASH:
+            return hash_claim(me, rule, claim);
+
+        case CLAIM_FILTER_SET:
+            set_claim(rule, claim);
+            return XCLAIM_SUCCESS;
+
+        default:
+            return XCLAIM_SUCCESS;
+    }
+}
+
+
+/* After the last claim from the wrapped decoder, the set rules for
+ * claims that weren't there add them. */
+static enum xclaim_error_t
+add_set_claims(struct claim_filter *me, struct claim_filter_level *level, struct xclaim *claim)
+{
+    const struct claim_filter_rules *rules = me->rules;
+    uint64_t                         pending;
+    uint32_t                         i;
+    bool                             kept;
+
+    for(i = 0; i < rules->rule_count; i++) {
+        pending = level->in_scope & rules->set_mask & ~level->set_done;
+        if(pending == 0) {
+            break;
+        }
+        if(!(pending & RULE_BIT(i))) {
+            continue;
+        }
+        /* Only if it is the rule that would apply to the label */
+        if(rule_for_label(me, level, rules->rules[i].label, &kept) == (int8_t)i) {
+            set_claim(&(rules->rules[i]), claim);
+            return XCLAIM_SUCCESS;
+        }
+    }
+
+    return XCLAIM_NO_MORE;
+}
+
+
+static enum xclaim_error_t filter_next_claim(void *ctx, struct xclaim *claim)
+{
+    struct claim_filter       *me = (struct claim_filter *)ctx;
+    struct claim_filter_level *level;
+    enum xclaim_error_t        xclaim_error;
+
+    level = &(me->levels[me->depth]);
+
+    while(!level->claims_done) {
+        xclaim_error = (me->inner->next_claim)(me->inner->ctx, claim);
+        if(xclaim_error == XCLAIM_NO_MORE) {
+            level->claims_done = true;
+            break;
+        }
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+
+        xclaim_error = apply_rules(me, level, claim);
+        if(xclaim_error != XCLAIM_NO_MORE) {
+            return xclaim_error;
+        }
+    }
+
+    return add_set_claims(me, level, claim);
+}
+
+
+static enum xclaim_error_t
+filter_enter_submod(void *ctx, uint32_t index, struct q_useful_buf_c *name)
+{
+    struct claim_filter *me = (struct claim_filter *)ctx;
+    enum xclaim_error_t  xclaim_error;
+
+    xclaim_error = (me->inner->enter_submod)(me->inner->ctx, index, name);
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        xclaim_error = push_level(me, *name);
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t filter_exit_submod(void *ctx)
+{
+    struct claim_filter *me = (struct claim_filter *)ctx;
+
+    pop_level(me);
+
+    return (me->inner->exit_submod)(me->inner->ctx);
+}
+
+
+/* Returns true if a drop, keep or hash rule applies in the nested
+ * token with the name at this level or below it. Its claims can't be
+ * filtered so it must not be output. */
+static bool nested_is_filtered(const struct claim_filter *me, struct q_useful_buf_c name)
+{
+    const struct claim_filter_rule *rule;
+    uint32_t                        i;
+    uint32_t                        j;
+
+    for(i = 0; i < me->rules->rule_count; i++) {
+        if(!(me->rules->redact_mask & RULE_BIT(i))) {
+            continue;
+        }
+        rule = &(me->rules->rules[i]);
+        if(rule->any_level) {
+            return true;
+        }
+        if(rule->path_len <= me->depth || q_useful_buf_compare(rule->path[me->depth], name)) {
+            continue;
+        }
+        for(j = 0; j < me->depth; j++) {
+            if(q_useful_buf_compare(rule->path[j], me->path[j])) {
+                break;
+            }
+        }
+        if(j == me->depth) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static enum xclaim_error_t
+filter_get_nested(void                  *ctx,
+                  uint32_t               index,
+                  enum ctoken_type_t    *type,
+                  struct q_useful_buf_c *name,
+                  struct q_useful_buf_c *token)
+{
+    struct claim_filter *me = (struct claim_filter *)ctx;
+    enum xclaim_error_t  xclaim_error;
+
+    xclaim_error = (me->inner->get_nested)(me->inner->ctx, index, type, name, token);
+    if(xclaim_error == XCLAIM_SUCCESS && nested_is_filtered(me, *name)) {
+        /* Skipping it would change the index of the ones after */
+        xclaim_error = XCLAIM_ERR_FILTER;
+    }
+
+    return xclaim_error;
+}
+
+
+/* Moves past the nested tokens that must be dropped */
+static enum xclaim_error_t
+skip_filtered_nested(struct claim_filter         *me,
+                     struct xclaim_submod_cursor *cursor,
+                     enum xclaim_error_t          xclaim_error)
+{
+    while(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN && nested_is_filtered(me, cursor->name)) {
+        xclaim_error = (me->inner->next_submod)(me->inner->ctx, cursor);
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t
+filter_first_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct claim_filter *me = (struct claim_filter *)ctx;
+    enum xclaim_error_t  xclaim_error;
+
+    xclaim_error = (me->inner->first_submod)(me->inner->ctx, cursor);
+    xclaim_error = skip_filtered_nested(me, cursor, xclaim_error);
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        xclaim_error = push_level(me, cursor->name);
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t
+filter_next_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct claim_filter *me = (struct claim_filter *)ctx;
+    enum xclaim_error_t  xclaim_error;
+
+    if(cursor->entered) {
+        /* next_submod exits the one it entered last */
+        pop_level(me);
+    }
+
+    xclaim_error = (me->inner->next_submod)(me->inner->ctx, cursor);
+    xclaim_error = skip_filtered_nested(me, cursor, xclaim_error);
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        xclaim_error = push_level(me, cursor->name);
+    }
+
+    return xclaim_error;
+}
+
+
+static void filter_rewind(void *ctx)
+{
+    struct claim_filter *me = (struct claim_filter *)ctx;
+
+    (me->inner->rewind)(me->inner->ctx);
+
+    me->depth = 0;
+    start_level(me);
+}
+
+
+/*
+ * Public function. See claim_filter.h
+ */
+void claim_filter_init(xclaim_decoder                  *decoder,
+                       struct claim_filter             *filter,
+                       xclaim_decoder                  *inner,
+                       const struct claim_filter_rules *rules)
+{
+    filter->inner  = inner;
+    filter->rules  = rules;
+    filter->md_ctx = NULL;
+    filter->depth  = 0;
+    start_level(filter);
+
+    decoder->ctx = filter;
+
+    decoder->rewind       = filter_rewind;
+    decoder->next_claim   = filter_next_claim;
+    decoder->enter_submod = filter_enter_submod;
+    decoder->exit_submod  = inner->exit_submod  ? filter_exit_submod  : NULL;
+    decoder->get_nested   = inner->get_nested   ? filter_get_nested   : NULL;
+    decoder->first_submod = inner->first_submod ? filter_first_submod : NULL;
+    decoder->next_submod  = inner->next_submod  ? filter_next_submod  : NULL;
+}
+
+
+/*
+ * Public function. See claim_filter.h
+ */
+void claim_filter_finish(struct claim_filter *filter)
+{
+    if(filter->md_ctx != NULL) {
+        EVP_MD_CTX_free(filter->md_ctx);
+        filter->md_ctx = NULL;
+    }
+}
+
+
+/*
+ * Public function. See claim_filter.h
+ */
+void claim_filter_free_rules(struct claim_filter_rules *rules)
+{
+    uint32_t                  i;
+    struct claim_filter_rule *rule;
+
+    for(i = 0; i < rules->rule_count; i++) {
+        rule = &rules->rules[i];
+        EVP_MD_CTX_free(rule->salted_md_ctx);
+        rule->salted_md_ctx = NULL;
+
+        /* claim_from_string() mallocs the binary of a byte string */
+        if(rule->action == CLAIM_FILTER_SET &&
+           rule->value.qcbor_item.uDataType == QCBOR_TYPE_BYTE_STRING &&
+           (rule->label == CTOKEN_CWT_LABEL_CTI ||
+            rule->label == CTOKEN_EAT_LABEL_UEID ||
+            rule->label == CTOKEN_EAT_LABEL_NONCE)) {
+            free((void *)rule->value.qcbor_item.val.string.ptr);
+            rule->value.qcbor_item.val.string = NULL_Q_USEFUL_BUF_C;
+        }
+    }
+}
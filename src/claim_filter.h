@@ -0,0 +1,196 @@
+/*
+ * claim_filter.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef claim_filter_h
+#define claim_filter_h
+
+#include "xclaim.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* This is a filter stage for rewriting and redacting claims as they
+ * go from a decoder to an encoder. It is an xclaim_decoder that wraps
+ * another xclaim_decoder, so it works with any input and output and
+ * in the same single pass xclaim_processor() makes. Nothing is
+ * buffered beyond the claim being worked on.
+ *
+ * The rules are the -filter options. Each is
+ *
+ *     <action>:[<scope>]<label>[=<argument>]
+ *
+ * The label is a claim name like "ueid" or an integer label. The
+ * actions are
+ *
+ *     drop     The claim is not output.
+ *     keep     Only claims with a keep or set rule are output at the
+ *              levels the keep rule applies to.
+ *     rename   The claim is output with the label given as the
+ *              argument. The new label can't be one whose value has
+ *              a set type, such as exp or ueid, unless the old one
+ *              has the same type. A location can't be renamed.
+ *     hash     The value is replaced by its SHA-256 hash. The optional
+ *              argument is a salt that is hashed in first. A byte
+ *              string becomes the 32 byte hash. A text string becomes
+ *              the hash in hex. Claims of other types are dropped so
+ *              nothing meant to be redacted gets through.
+ *     set      The value is replaced by the argument, converted as
+ *              for -claim. If the claim is not present it is added.
+ *              "iat=now" sets the current time.
+ *
+ * Without a scope a rule applies at the top level and in all
+ * submodules. A scope of "/" is the top level only. A scope of
+ * "a/b/" is the submodule b in the submodule a. Submodule names in a
+ * scope can't have a "/" or "=" in them.
+ *
+ * When more than one rule is for the same label at the same level,
+ * the first one given that isn't keep is used.
+ *
+ * The claims in a nested token can't be filtered as it is output as
+ * an opaque blob. A nested token is dropped when a drop, keep or hash
+ * rule applies in it or in any submodule below it, so nothing meant
+ * to be redacted gets through. Only a decoder with first_submod and
+ * next_submod can skip it. With one that only has get_nested it is an
+ * error, XCLAIM_ERR_FILTER, instead.
+ *
+ * The rules are compiled once into a struct claim_filter_rules that
+ * is only read after that, so one set of compiled rules can be used
+ * by many threads. The label for each claim is looked up in a small
+ * hash table. The rules for each level are worked out once when the
+ * level is entered rather than for each claim. For hash, the SHA-256
+ * state after the salt is also made when compiling, so hashing a
+ * claim is only a copy of that state plus hashing the value.
+ */
+
+
+/* The most -filter options. The rules that apply at a level are kept
+ * as a bit mask. */
+#define CLAIM_FILTER_MAX_RULES 64
+
+
+enum claim_filter_action_t {
+    CLAIM_FILTER_DROP,
+    CLAIM_FILTER_KEEP,
+    CLAIM_FILTER_RENAME,
+    CLAIM_FILTER_HASH,
+    CLAIM_FILTER_SET
+};
+
+
+struct claim_filter_rule {
+    enum claim_filter_action_t action;
+    int64_t                    label;
+
+    /* If false the rule is only for the submodule in path. A path of
+     * length 0 is the top level. */
+    bool                       any_level;
+    uint32_t                   path_len;
+    struct q_useful_buf_c      path[XCLAIM_MAX_NESTING];
+
+    /* For rename */
+    int64_t                    new_label;
+
+    /* For hash. salted_md_ctx is an EVP_MD_CTX that has hashed the
+     * salt. It is copied, never changed, for each claim hashed. */
+    struct q_useful_buf_c      salt;
+    void                      *salted_md_ctx;
+
+    /* For set */
+    struct xclaim              value;
+    bool                       value_is_now;
+
+    /* Next rule for the same label or -1 */
+    int8_t                     next;
+};
+
+
+/* Twice the maximum number of rules so the table is never more than
+ * half full. Must be a power of two. */
+#define CLAIM_FILTER_TABLE_SIZE (2 * CLAIM_FILTER_MAX_RULES)
+
+struct claim_filter_rules {
+    uint32_t                 rule_count;
+    struct claim_filter_rule rules[CLAIM_FILTER_MAX_RULES];
+
+    /* Open addressing on the label. first is the first rule for the
+     * label or -1 for an empty slot. */
+    struct {
+        int64_t label;
+        int8_t  first;
+    } table[CLAIM_FILTER_TABLE_SIZE];
+
+    uint64_t                 keep_mask;
+    uint64_t                 set_mask;
+
+    /* The drop, keep and hash rules. Nested tokens in their scope are
+     * dropped. */
+    uint64_t                 redact_mask;
+};
+
+
+/* The state for one level of submodule nesting */
+struct claim_filter_level {
+    /* Bit n is set if rule n applies at this level */
+    uint64_t in_scope;
+
+    /* The set rules whose claim has been seen at this level */
+    uint64_t set_done;
+
+    /* The claims from the wrapped decoder have all been returned */
+    bool     claims_done;
+};
+
+
+/* The context for the xclaim_decoder. One of these is needed per
+ * token being processed. */
+struct claim_filter {
+    xclaim_decoder                  *inner;
+    const struct claim_filter_rules *rules;
+
+    uint32_t                         depth;
+    struct q_useful_buf_c            path[XCLAIM_MAX_NESTING];
+    struct claim_filter_level        levels[XCLAIM_MAX_NESTING + 1];
+
+    /* For hash. The context is made when first needed and the rule's
+     * salted state is copied into it for each claim. The hash or its
+     * hex is put in digest_buf which is good until the next claim. */
+    void                            *md_ctx;
+    uint8_t                          digest_buf[64];
+};
+
+
+/* Compiles the -filter options in rule_args, a NULL-terminated list.
+ * Errors are printed. Returns 0 on success or 1 if a rule is not
+ * valid. claim_filter_free_rules() must be called when the rules are
+ * no longer used, even if this fails. */
+int claim_filter_compile(const char                **rule_args,
+                         struct claim_filter_rules  *rules);
+
+
+/* Frees what claim_filter_compile() allocated. */
+void claim_filter_free_rules(struct claim_filter_rules *rules);
+
+
+/* Sets up decoder to return the claims from inner with the rules
+ * applied. inner must stay valid while decoder is used.
+ * claim_filter_finish() must be called when done. */
+void claim_filter_init(xclaim_decoder                  *decoder,
+                       struct claim_filter             *filter,
+                       xclaim_decoder                  *inner,
+                       const struct claim_filter_rules *rules);
+
+
+/* Frees what claim_filter_init() and the hashing allocated. */
+void claim_filter_finish(struct claim_filter *filter);
+
+
+#endif /* claim_filter_h */
@@ -0,0 +1,1040 @@
+/*
+ * columnar_encode.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "columnar_encode.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define COLUMNAR_MAGIC     "XCLMCOL1"
+#define COLUMNAR_MAGIC_LEN 8
+
+/* Largest path that fits in the footer */
+#define COLUMNAR_MAX_PATH  UINT16_MAX
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+
+/* A byte buffer that grows */
+struct columnar_buf {
+    uint8_t *ptr;
+    size_t   len;
+    size_t   capacity;
+};
+
+
+struct columnar_column {
+    int64_t             label;
+    uint8_t             type;
+    uint8_t             field;
+    uint16_t            path_len;
+    char               *path;
+    uint64_t            hash;
+
+    /* The current row group. rows is how many rows have been filled
+     * in, with or without a value. Rows with no value are only filled
+     * in when the next value comes or the row group is written. */
+    uint32_t            rows;
+    uint32_t            value_count;
+    struct columnar_buf validity;
+
+    /* The 8-byte values, the BOOL bitmap, the bytes of BYTES, TEXT and
+     * NESTED or the codes of DICT */
+    struct columnar_buf values;
+
+    /* The offsets of BYTES, TEXT and NESTED or of the DICT strings */
+    struct columnar_buf offsets;
+
+    /* DICT only. The table is the string's index + 1 or 0 for
+     * empty. */
+    struct columnar_buf dict_bytes;
+    uint32_t            dict_count;
+    uint32_t           *dict_table;
+    uint32_t            dict_table_size;
+};
+
+
+struct columnar_cell {
+    uint32_t path_offset;
+    uint32_t path_len;
+    int64_t  label;
+    uint8_t  type;
+    uint8_t  field;
+    union {
+        int64_t               int64;
+        uint64_t              uint64;
+        double                dfnum;
+        bool                  boolean;
+        struct q_useful_buf_c string;
+    } v;
+};
+
+
+static int buf_reserve(struct columnar_buf *me, size_t more)
+{
+    uint8_t *new_ptr;
+    size_t   new_capacity;
+
+    if(me->capacity - me->len >= more) {
+        return 0;
+    }
+    new_capacity = me->capacity ? me->capacity * 2 : 64;
+    while(new_capacity - me->len < more) {
+        new_capacity *= 2;
+    }
+    new_ptr = realloc(me->ptr, new_capacity);
+    if(new_ptr == NULL) {
+        return 1;
+    }
+    me->ptr      = new_ptr;
+    me->capacity = new_capacity;
+
+    return 0;
+}
+
+
+static int buf_append(struct columnar_buf *me, const void *bytes, size_t len)
+{
+    if(buf_reserve(me, len)) {
+        return 1;
+    }
+    if(len) {
+        memcpy(me->ptr + me->len, bytes, len);
+    }
+    me->len += len;
+
+    return 0;
+}
+
+
+static int buf_append_zeros(struct columnar_buf *me, size_t len)
+{
+    if(buf_reserve(me, len)) {
+        return 1;
+    }
+    memset(me->ptr + me->len, 0, len);
+    me->len += len;
+
+    return 0;
+}
+
+
+static int buf_put_u32(struct columnar_buf *me, uint32_t n)
+{
+    uint8_t b[4];
+    int     i;
+
+    for(i = 0; i < 4; i++) {
+        b[i] = (uint8_t)(n >> (8 * i));
+    }
+
+    return buf_append(me, b, sizeof(b));
+}
+
+
+static int buf_put_u64(struct columnar_buf *me, uint64_t n)
+{
+    uint8_t b[8];
+    int     i;
+
+    for(i = 0; i < 8; i++) {
+        b[i] = (uint8_t)(n >> (8 * i));
+    }
+
+    return buf_append(me, b, sizeof(b));
+}
+
+
+static uint32_t buf_get_u32(const struct columnar_buf *me, size_t offset)
+{
+    const uint8_t *b = me->ptr + offset;
+
+    return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+
+static void buf_free(struct columnar_buf *me)
+{
+    free(me->ptr);
+    me->ptr      = NULL;
+    me->len      = 0;
+    me->capacity = 0;
+}
+
+
+/* Adds bit number index to a bitmap. Bits are added in order. */
+static int bitmap_push(struct columnar_buf *me, uint32_t index, bool bit)
+{
+    if(index % 8 == 0) {
+        if(buf_append_zeros(me, 1)) {
+            return 1;
+        }
+    }
+    if(bit) {
+        me->ptr[index / 8] |= (uint8_t)(1 << (index % 8));
+    }
+
+    return 0;
+}
+
+
+static uint64_t hash_bytes(uint64_t h, const void *bytes, size_t len)
+{
+    const uint8_t *b = bytes;
+    size_t         i;
+
+    for(i = 0; i < len; i++) {
+        h ^= b[i];
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+
+static uint64_t
+column_hash(int64_t label, uint8_t type, uint8_t field, const char *path, size_t path_len)
+{
+    uint64_t h;
+
+    h = hash_bytes(FNV_OFFSET, &label, sizeof(label));
+    h = hash_bytes(h, &type, 1);
+    h = hash_bytes(h, &field, 1);
+    h = hash_bytes(h, path, path_len);
+
+    return h;
+}
+
+
+static bool is_var_type(uint8_t type)
+{
+    return type == COLUMNAR_BYTES || type == COLUMNAR_TEXT || type == COLUMNAR_NESTED;
+}
+
+
+/* Returns the index of string in the column's dictionary, adding it
+ * if it is not there. Returns 1 if out of memory. */
+static int dict_lookup(struct columnar_column *me, struct q_useful_buf_c string, uint32_t *code)
+{
+    uint32_t *new_table;
+    uint32_t  new_size;
+    uint32_t  slot;
+    uint32_t  entry;
+    uint32_t  start;
+    uint32_t  end;
+    uint32_t  i;
+
+    if(me->dict_count == 0 && me->offsets.len == 0) {
+        if(buf_put_u32(&me->offsets, 0)) {
+            return 1;
+        }
+    }
+
+    if(me->dict_count * 2 >= me->dict_table_size) {
+        new_size  = me->dict_table_size ? me->dict_table_size * 2 : 64;
+        new_table = calloc(new_size, sizeof(uint32_t));
+        if(new_table == NULL) {
+            return 1;
+        }
+        for(i = 0; i < me->dict_count; i++) {
+            start = buf_get_u32(&me->offsets, i * 4);
+            end   = buf_get_u32(&me->offsets, (i + 1) * 4);
+            slot  = (uint32_t)hash_bytes(FNV_OFFSET, me->dict_bytes.ptr + start, end - start) & (new_size - 1);
+            while(new_table[slot] != 0) {
+                slot = (slot + 1) & (new_size - 1);
+            }
+            new_table[slot] = i + 1;
+        }
+        free(me->dict_table);
+        me->dict_table      = new_table;
+        me->dict_table_size = new_size;
+    }
+
+    slot = (uint32_t)hash_bytes(FNV_OFFSET, string.ptr, string.len) & (me->dict_table_size - 1);
+    while((entry = me->dict_table[slot]) != 0) {
+        start = buf_get_u32(&me->offsets, (entry - 1) * 4);
+        end   = buf_get_u32(&me->offsets, entry * 4);
+        if(end - start == string.len && memcmp(me->dict_bytes.ptr + start, string.ptr, string.len) == 0) {
+            *code = entry - 1;
+            return 0;
+        }
+        slot = (slot + 1) & (me->dict_table_size - 1);
+    }
+
+    if(me->dict_bytes.len + string.len > UINT32_MAX) {
+        return 1;
+    }
+    if(buf_append(&me->dict_bytes, string.ptr, string.len) ||
+       buf_put_u32(&me->offsets, (uint32_t)me->dict_bytes.len)) {
+        return 1;
+    }
+    me->dict_table[slot] = me->dict_count + 1;
+    *code = me->dict_count;
+    me->dict_count++;
+
+    return 0;
+}
+
+
+/* Fills in the next row of the column. cell is NULL for a row with no
+ * value. */
+static int column_push(struct columnar_column *me, const struct columnar_cell *cell)
+{
+    uint64_t bits;
+    uint32_t code;
+
+    if(is_var_type(me->type) && me->rows == 0) {
+        if(buf_put_u32(&me->offsets, 0)) {
+            return 1;
+        }
+    }
+
+    if(bitmap_push(&me->validity, me->rows, cell != NULL)) {
+        return 1;
+    }
+
+    switch(me->type) {
+        case COLUMNAR_INT64:
+        case COLUMNAR_UINT64:
+        case COLUMNAR_DOUBLE:
+            if(cell == NULL) {
+                if(buf_append_zeros(&me->values, 8)) {
+                    return 1;
+                }
+                break;
+            }
+            if(me->type == COLUMNAR_DOUBLE) {
+                memcpy(&bits, &cell->v.dfnum, sizeof(bits));
+            } else {
+                bits = cell->v.uint64;
+            }
+            if(buf_put_u64(&me->values, bits)) {
+                return 1;
+            }
+            break;
+
+        case COLUMNAR_BOOL:
+            if(bitmap_push(&me->values, me->rows, cell != NULL && cell->v.boolean)) {
+                return 1;
+            }
+            break;
+
+        case COLUMNAR_NULL:
+            break;
+
+        case COLUMNAR_BYTES:
+        case COLUMNAR_TEXT:
+        case COLUMNAR_NESTED:
+            if(cell != NULL) {
+                if(me->values.len + cell->v.string.len > UINT32_MAX) {
+                    return 1;
+                }
+                if(buf_append(&me->values, cell->v.string.ptr, cell->v.string.len)) {
+                    return 1;
+                }
+            }
+            if(buf_put_u32(&me->offsets, (uint32_t)me->values.len)) {
+                return 1;
+            }
+            break;
+
+        case COLUMNAR_DICT:
+            code = 0;
+            if(cell != NULL && dict_lookup(me, cell->v.string, &code)) {
+                return 1;
+            }
+            if(buf_put_u32(&me->values, code)) {
+                return 1;
+            }
+            break;
+    }
+
+    if(cell != NULL) {
+        me->value_count++;
+    }
+    me->rows++;
+
+    return 0;
+}
+
+
+/* Fills in rows with no value up to row */
+static int column_pad(struct columnar_column *me, uint32_t row)
+{
+    while(me->rows < row) {
+        if(column_push(me, NULL)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void column_reset(struct columnar_column *me)
+{
+    me->rows           = 0;
+    me->value_count    = 0;
+    me->validity.len   = 0;
+    me->values.len     = 0;
+    me->offsets.len    = 0;
+    me->dict_bytes.len = 0;
+    me->dict_count     = 0;
+    if(me->dict_table != NULL) {
+        memset(me->dict_table, 0, me->dict_table_size * sizeof(uint32_t));
+    }
+}
+
+
+static void column_free(struct columnar_column *me)
+{
+    free(me->path);
+    buf_free(&me->validity);
+    buf_free(&me->values);
+    buf_free(&me->offsets);
+    buf_free(&me->dict_bytes);
+    free(me->dict_table);
+}
+
+
+static int writer_write(struct columnar_writer *me, const void *bytes, size_t len)
+{
+    if(len && fwrite(bytes, 1, len, me->output) != len) {
+        fprintf(stderr, "error writing columnar output\n");
+        return 1;
+    }
+    me->offset += len;
+
+    return 0;
+}
+
+
+/* Returns the column for the cell's label, type, field and path,
+ * adding it if it is not there yet. NULL if out of memory. */
+static struct columnar_column *
+writer_find_column(struct columnar_writer *me, const struct columnar_cell *cell, const char *path)
+{
+    struct columnar_column *column;
+    struct columnar_column *new_columns;
+    uint32_t               *new_table;
+    uint32_t                new_size;
+    uint32_t                new_capacity;
+    uint32_t                slot;
+    uint32_t                entry;
+    uint32_t                i;
+    uint64_t                hash;
+
+    hash = column_hash(cell->label, cell->type, cell->field, path, cell->path_len);
+
+    slot = (uint32_t)hash & (me->table_size - 1);
+    while((entry = me->table[slot]) != 0) {
+        column = &me->columns[entry - 1];
+        if(column->hash     == hash &&
+           column->label    == cell->label &&
+           column->type     == cell->type &&
+           column->field    == cell->field &&
+           column->path_len == cell->path_len &&
+           memcmp(column->path, path, cell->path_len) == 0) {
+            return column;
+        }
+        slot = (slot + 1) & (me->table_size - 1);
+    }
+
+    /* Not found so add it */
+    if(me->column_count == me->column_capacity) {
+        new_capacity = me->column_capacity ? me->column_capacity * 2 : 16;
+        new_columns  = realloc(me->columns, new_capacity * sizeof(struct columnar_column));
+        if(new_columns == NULL) {
+            return NULL;
+        }
+        me->columns         = new_columns;
+        me->column_capacity = new_capacity;
+    }
+
+    column = &me->columns[me->column_count];
+    memset(column, 0, sizeof(*column));
+    column->label    = cell->label;
+    column->type     = cell->type;
+    column->field    = cell->field;
+    column->path_len = (uint16_t)cell->path_len;
+    column->hash     = hash;
+    column->path     = malloc(cell->path_len + 1);
+    if(column->path == NULL) {
+        return NULL;
+    }
+    memcpy(column->path, path, cell->path_len);
+
+    me->table[slot] = me->column_count + 1;
+    me->column_count++;
+
+    if(me->column_count * 2 >= me->table_size) {
+        new_size  = me->table_size * 2;
+        new_table = calloc(new_size, sizeof(uint32_t));
+        if(new_table == NULL) {
+            /* The column is in the table already so this is fine */
+            return column;
+        }
+        for(i = 0; i < me->column_count; i++) {
+            slot = (uint32_t)me->columns[i].hash & (new_size - 1);
+            while(new_table[slot] != 0) {
+                slot = (slot + 1) & (new_size - 1);
+            }
+            new_table[slot] = i + 1;
+        }
+        free(me->table);
+        me->table      = new_table;
+        me->table_size = new_size;
+    }
+
+    return column;
+}
+
+
+/* Writes out the current row group and starts a new one */
+static int writer_flush_row_group(struct columnar_writer *me)
+{
+    struct columnar_buf     head;
+    struct columnar_buf     count;
+    struct columnar_column *column;
+    uint32_t                chunk_count;
+    uint64_t                len;
+    uint32_t                i;
+    int                     return_value;
+
+    memset(&head, 0, sizeof(head));
+    memset(&count, 0, sizeof(count));
+    return_value = 1;
+
+    chunk_count = 0;
+    for(i = 0; i < me->column_count; i++) {
+        if(me->columns[i].value_count) {
+            chunk_count++;
+        }
+    }
+
+    if(buf_put_u32(&head, me->rows) || buf_put_u32(&head, chunk_count)) {
+        goto OutOfMemory;
+    }
+    if(writer_write(me, head.ptr, head.len)) {
+        goto Done;
+    }
+
+    for(i = 0; i < me->column_count; i++) {
+        column = &me->columns[i];
+        if(column->value_count == 0) {
+            continue;
+        }
+        if(column_pad(column, me->rows)) {
+            goto OutOfMemory;
+        }
+
+        /* The buffers that don't apply to the type are empty, so
+         * this is the layout for every type */
+        len = column->validity.len + column->offsets.len +
+              column->dict_bytes.len + column->values.len;
+
+        count.len = 0;
+        if(column->type == COLUMNAR_DICT) {
+            if(buf_put_u32(&count, column->dict_count)) {
+                goto OutOfMemory;
+            }
+            len += count.len;
+        }
+
+        head.len = 0;
+        if(buf_put_u32(&head, i) || buf_put_u64(&head, len)) {
+            goto OutOfMemory;
+        }
+
+        if(writer_write(me, head.ptr, head.len) ||
+           writer_write(me, column->validity.ptr, column->validity.len) ||
+           writer_write(me, count.ptr, count.len) ||
+           writer_write(me, column->offsets.ptr, column->offsets.len) ||
+           writer_write(me, column->dict_bytes.ptr, column->dict_bytes.len) ||
+           writer_write(me, column->values.ptr, column->values.len)) {
+            goto Done;
+        }
+    }
+
+    for(i = 0; i < me->column_count; i++) {
+        column_reset(&me->columns[i]);
+    }
+    me->rows = 0;
+
+    return_value = 0;
+    goto Done;
+
+OutOfMemory:
+    fprintf(stderr, "out of memory for columnar output\n");
+
+Done:
+    buf_free(&head);
+    buf_free(&count);
+    if(return_value) {
+        me->failed = true;
+    }
+    return return_value;
+}
+
+
+/*
+ * Public function. See columnar_encode.h
+ */
+int columnar_writer_init(struct columnar_writer *me, FILE *output, uint32_t row_group_rows)
+{
+    memset(me, 0, sizeof(*me));
+
+    me->output         = output;
+    me->row_group_rows = row_group_rows ? row_group_rows : COLUMNAR_ROW_GROUP_ROWS;
+
+    pthread_mutex_init(&me->lock, NULL);
+
+    me->table_size = 64;
+    me->table      = calloc(me->table_size, sizeof(uint32_t));
+    if(me->table == NULL) {
+        fprintf(stderr, "out of memory for columnar output\n");
+        me->failed = true;
+        return 1;
+    }
+
+    if(writer_write(me, COLUMNAR_MAGIC, COLUMNAR_MAGIC_LEN)) {
+        me->failed = true;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See columnar_encode.h
+ */
+int columnar_writer_finish(struct columnar_writer *me)
+{
+    struct columnar_buf     footer;
+    struct columnar_column *column;
+    uint64_t                footer_offset;
+    uint32_t                i;
+    int                     return_value;
+
+    memset(&footer, 0, sizeof(footer));
+    return_value = 1;
+
+    if(me->failed) {
+        goto Done;
+    }
+
+    if(me->rows) {
+        if(writer_flush_row_group(me)) {
+            goto Done;
+        }
+    }
+
+    footer_offset = me->offset;
+
+    if(buf_put_u32(&footer, me->column_count)) {
+        goto OutOfMemory;
+    }
+    for(i = 0; i < me->column_count; i++) {
+        column = &me->columns[i];
+        if(buf_put_u64(&footer, (uint64_t)column->label) ||
+           buf_append(&footer, &column->type, 1) ||
+           buf_append(&footer, &column->field, 1) ||
+           buf_append(&footer, (uint8_t[]){(uint8_t)column->path_len, (uint8_t)(column->path_len >> 8)}, 2) ||
+           buf_append(&footer, column->path, column->path_len)) {
+            goto OutOfMemory;
+        }
+    }
+    if(buf_put_u64(&footer, me->total_rows) ||
+       buf_put_u64(&footer, footer_offset) ||
+       buf_append(&footer, COLUMNAR_MAGIC, COLUMNAR_MAGIC_LEN)) {
+        goto OutOfMemory;
+    }
+
+    if(writer_write(me, footer.ptr, footer.len)) {
+        goto Done;
+    }
+    if(fflush(me->output) || ferror(me->output)) {
+        fprintf(stderr, "error writing columnar output\n");
+        goto Done;
+    }
+
+    return_value = 0;
+    goto Done;
+
+OutOfMemory:
+    fprintf(stderr, "out of memory for columnar output\n");
+
+Done:
+    buf_free(&footer);
+    return return_value;
+}
+
+
+/*
+ * Public function. See columnar_encode.h
+ */
+void columnar_writer_free(struct columnar_writer *me)
+{
+    uint32_t i;
+
+    for(i = 0; i < me->column_count; i++) {
+        column_free(&me->columns[i]);
+    }
+    free(me->columns);
+    free(me->table);
+    pthread_mutex_destroy(&me->lock);
+
+    me->columns      = NULL;
+    me->table        = NULL;
+    me->column_count = 0;
+}
+
+
+static struct columnar_cell *
+row_new_cell(struct columnar_row *me, int64_t label, uint8_t type, uint8_t field)
+{
+    struct columnar_cell *new_cells;
+    struct columnar_cell *cell;
+    size_t                new_capacity;
+
+    if(me->cell_count == me->cell_capacity) {
+        new_capacity = me->cell_capacity ? me->cell_capacity * 2 : 32;
+        new_cells    = realloc(me->cells, new_capacity * sizeof(struct columnar_cell));
+        if(new_cells == NULL) {
+            me->failed = true;
+            return NULL;
+        }
+        me->cells         = new_cells;
+        me->cell_capacity = new_capacity;
+    }
+
+    cell = &me->cells[me->cell_count];
+    me->cell_count++;
+
+    cell->path_offset = me->path_stack[me->depth].offset;
+    cell->path_len    = me->path_stack[me->depth].len;
+    cell->label       = label;
+    cell->type        = type;
+    cell->field       = field;
+
+    return cell;
+}
+
+
+/* Adds the path of the current submodule with name after it to the
+ * row's paths. */
+static int
+row_add_path(struct columnar_row *me, struct q_useful_buf_c name, uint32_t *offset, uint32_t *len)
+{
+    char    *new_paths;
+    size_t   new_capacity;
+    size_t   needed;
+    uint32_t parent_offset;
+    uint32_t parent_len;
+
+    parent_offset = me->path_stack[me->depth].offset;
+    parent_len    = me->path_stack[me->depth].len;
+
+    needed = parent_len + 1 + name.len;
+    if(needed > COLUMNAR_MAX_PATH) {
+        return 1;
+    }
+
+    if(me->paths_capacity - me->paths_len < needed) {
+        new_capacity = me->paths_capacity ? me->paths_capacity * 2 : 256;
+        while(new_capacity - me->paths_len < needed) {
+            new_capacity *= 2;
+        }
+        new_paths = realloc(me->paths, new_capacity);
+        if(new_paths == NULL) {
+            return 1;
+        }
+        me->paths          = new_paths;
+        me->paths_capacity = new_capacity;
+    }
+
+    *offset = (uint32_t)me->paths_len;
+    memcpy(me->paths + me->paths_len, me->paths + parent_offset, parent_len);
+    me->paths_len += parent_len;
+    if(parent_len) {
+        me->paths[me->paths_len] = '/';
+        me->paths_len++;
+    }
+    memcpy(me->paths + me->paths_len, name.ptr, name.len);
+    me->paths_len += name.len;
+    *len = (uint32_t)(me->paths_len - *offset);
+
+    return 0;
+}
+
+
+static void row_add_location(struct columnar_row *me, const struct ctoken_location_t *location)
+{
+    struct columnar_cell *cell;
+    int                   i;
+
+    for(i = CTOKEN_EAT_LABEL_LATITUDE; i <= NUM_FLOAT_LOCATION_ITEMS; i++) {
+        if(!ctoken_location_is_item_present(location, i)) {
+            continue;
+        }
+        cell = row_new_cell(me, CTOKEN_EAT_LABEL_LOCATION, COLUMNAR_DOUBLE, (uint8_t)i);
+        if(cell == NULL) {
+            return;
+        }
+        cell->v.dfnum = location->items[i - 1];
+    }
+
+    if(ctoken_location_is_item_present(location, CTOKEN_EAT_LABEL_TIME_STAMP)) {
+        cell = row_new_cell(me, CTOKEN_EAT_LABEL_LOCATION, COLUMNAR_UINT64, CTOKEN_EAT_LABEL_TIME_STAMP);
+        if(cell == NULL) {
+            return;
+        }
+        cell->v.uint64 = location->time_stamp;
+    }
+
+    if(ctoken_location_is_item_present(location, CTOKEN_EAT_LABEL_AGE)) {
+        cell = row_new_cell(me, CTOKEN_EAT_LABEL_LOCATION, COLUMNAR_UINT64, CTOKEN_EAT_LABEL_AGE);
+        if(cell == NULL) {
+            return;
+        }
+        cell->v.uint64 = location->age;
+    }
+}
+
+
+/* Nothing is returned on error. It is remembered in the row and
+ * reported by columnar_row_add() so the rest of the token still gets
+ * decoded and checked. */
+static enum xclaim_error_t columnar_output_claim(void *ctx, const struct xclaim *claim)
+{
+    struct columnar_row  *me   = (struct columnar_row *)ctx;
+    const QCBORItem      *item = &(claim->qcbor_item);
+    struct columnar_cell *cell;
+    uint8_t               type;
+
+    if(item->label.int64 == CTOKEN_EAT_LABEL_LOCATION) {
+        row_add_location(me, &(claim->u.location_claim));
+        return XCLAIM_SUCCESS;
+    }
+
+    switch(item->uDataType) {
+        case QCBOR_TYPE_INT64:       type = COLUMNAR_INT64;  break;
+        case QCBOR_TYPE_UINT64:      type = COLUMNAR_UINT64; break;
+        case QCBOR_TYPE_DOUBLE:      type = COLUMNAR_DOUBLE; break;
+        case QCBOR_TYPE_TRUE:
+        case QCBOR_TYPE_FALSE:       type = COLUMNAR_BOOL;   break;
+        case QCBOR_TYPE_NULL:        type = COLUMNAR_NULL;   break;
+        case QCBOR_TYPE_BYTE_STRING: type = COLUMNAR_BYTES;  break;
+
+        case QCBOR_TYPE_TEXT_STRING:
+            if(item->label.int64 == CTOKEN_CWT_LABEL_ISSUER ||
+               item->label.int64 == CTOKEN_CWT_LABEL_AUDIENCE) {
+                type = COLUMNAR_DICT;
+            } else {
+                type = COLUMNAR_TEXT;
+            }
+            break;
+
+        default:
+            /* Not something that goes in a column */
+            return XCLAIM_SUCCESS;
+    }
+
+    cell = row_new_cell(me, item->label.int64, type, 0);
+    if(cell == NULL) {
+        return XCLAIM_SUCCESS;
+    }
+
+    switch(type) {
+        case COLUMNAR_INT64:  cell->v.int64   = item->val.int64;  break;
+        case COLUMNAR_UINT64: cell->v.uint64  = item->val.uint64; break;
+        case COLUMNAR_DOUBLE: cell->v.dfnum   = item->val.dfnum;  break;
+        case COLUMNAR_BOOL:   cell->v.boolean = item->uDataType == QCBOR_TYPE_TRUE; break;
+        case COLUMNAR_NULL:   break;
+        default:              cell->v.string  = item->val.string; break;
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t columnar_submods_section(void *ctx)
+{
+    (void)ctx;
+
+    /* Submodules are only seen in the paths of the columns */
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t columnar_open_submod(void *ctx, const struct q_useful_buf_c submod_name)
+{
+    struct columnar_row *me = (struct columnar_row *)ctx;
+    uint32_t             offset;
+    uint32_t             len;
+
+    if(me->depth >= XCLAIM_MAX_NESTING) {
+        return XCLAIM_ERR_NESTING_TOO_DEEP;
+    }
+    if(row_add_path(me, submod_name, &offset, &len)) {
+        me->failed = true;
+        offset     = 0;
+        len        = 0;
+    }
+
+    me->depth++;
+    me->path_stack[me->depth].offset = offset;
+    me->path_stack[me->depth].len    = len;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t columnar_close_submod(void *ctx)
+{
+    struct columnar_row *me = (struct columnar_row *)ctx;
+
+    if(me->depth > 0) {
+        me->depth--;
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t columnar_output_nested(void                       *ctx,
+                                                  const struct q_useful_buf_c submod_name,
+                                                  struct q_useful_buf_c       nested_token)
+{
+    struct columnar_row  *me = (struct columnar_row *)ctx;
+    struct columnar_cell *cell;
+    uint32_t              offset;
+    uint32_t              len;
+
+    if(row_add_path(me, submod_name, &offset, &len)) {
+        me->failed = true;
+        return XCLAIM_SUCCESS;
+    }
+
+    cell = row_new_cell(me, 0, COLUMNAR_NESTED, 0);
+    if(cell == NULL) {
+        return XCLAIM_SUCCESS;
+    }
+    cell->path_offset = offset;
+    cell->path_len    = len;
+    cell->v.string    = nested_token;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/*
+ * Public function. See columnar_encode.h
+ */
+void xclaim_columnar_encode_init(xclaim_encoder         *encoder,
+                                 struct columnar_row    *row,
+                                 struct columnar_writer *writer)
+{
+    memset(row, 0, sizeof(*row));
+    row->writer = writer;
+
+    encoder->ctx                   = row;
+    encoder->output_claim          = columnar_output_claim;
+    encoder->start_submods_section = columnar_submods_section;
+    encoder->end_submods_section   = columnar_submods_section;
+    encoder->open_submod           = columnar_open_submod;
+    encoder->close_submod          = columnar_close_submod;
+    encoder->output_nested         = columnar_output_nested;
+}
+
+
+/*
+ * Public function. See columnar_encode.h
+ */
+int columnar_row_add(struct columnar_row *row)
+{
+    struct columnar_writer *me = row->writer;
+    struct columnar_column *column;
+    struct columnar_cell   *cell;
+    size_t                  i;
+    int                     return_value;
+
+    if(row->failed) {
+        fprintf(stderr, "submodule path too long or out of memory for columnar output\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&me->lock);
+
+    return_value = 1;
+    if(me->failed) {
+        /* Already printed */
+        goto Done;
+    }
+
+    for(i = 0; i < row->cell_count; i++) {
+        cell = &row->cells[i];
+
+        /* paths is NULL when there are no submodules */
+        column = writer_find_column(me, cell, row->paths ? row->paths + cell->path_offset : "");
+        if(column == NULL) {
+            goto OutOfMemory;
+        }
+        if(column->rows > me->rows) {
+            /* The same label again in this token. The first is kept. */
+            continue;
+        }
+        if(column_pad(column, me->rows) || column_push(column, cell)) {
+            goto OutOfMemory;
+        }
+    }
+
+    me->rows++;
+    me->total_rows++;
+
+    if(me->rows == me->row_group_rows) {
+        if(writer_flush_row_group(me)) {
+            goto Done;
+        }
+    }
+
+    return_value = 0;
+    goto Done;
+
+OutOfMemory:
+    fprintf(stderr, "out of memory for columnar output\n");
+    me->failed = true;
+
+Done:
+    pthread_mutex_unlock(&me->lock);
+    return return_value;
+}
+
+
+/*
+ * Public function. See columnar_encode.h
+ */
+void columnar_row_free(struct columnar_row *row)
+{
+    free(row->cells);
+    free(row->paths);
+
+    row->cells      = NULL;
+    row->paths      = NULL;
+    row->cell_count = 0;
+    row->paths_len  = 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * columnar_encode.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef columnar_encode_h
+#define columnar_encode_h
+
+#include "xclaim.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+
+/* This is an xclaim_encoder that puts the claims of many tokens into
+ * one file laid out by column, for loading into analytics tools
+ * without parsing JSON. Each token is a row. There is a column for
+ * each claim label, type and submodule path seen, so each column has
+ * one type and its values are in one typed array.
+ *
+ * The claims of a token are gathered by a struct columnar_row as it
+ * is decoded and only go into the columns when the whole token has
+ * been decoded, so a token that fails adds nothing. Many threads can
+ * add rows to one struct columnar_writer.
+ *
+ * The rows are written in row groups of row_group_rows. Only one row
+ * group is in memory at a time.
+ *
+ * The file format. All integers are little-endian. Nothing is
+ * aligned or padded.
+ *
+ *     "XCLMCOL1"
+ *     row group, repeated
+ *     footer
+ *     uint64 offset of the footer
+ *     "XCLMCOL1"
+ *
+ * A row group is
+ *
+ *     uint32 number of rows
+ *     uint32 number of column chunks
+ *     column chunk, repeated, only for the columns with a value in
+ *     one of the rows
+ *
+ * A column chunk is
+ *
+ *     uint32 index of the column in the footer
+ *     uint64 length of the rest of the chunk
+ *     validity bitmap, (rows + 7) / 8 bytes. Bit n, counting from the
+ *         least significant bit of the first byte, is 1 if row n has
+ *         a value.
+ *     the values, by the column type
+ *         INT64, UINT64, DOUBLE  8 bytes for each row
+ *         BOOL                   a bitmap like the validity bitmap
+ *         NULL                   nothing
+ *         BYTES, TEXT, NESTED    uint32 offsets for rows + 1, then
+ *                                the bytes. Row n is from offset n
+ *                                to offset n + 1.
+ *         DICT                   uint32 number of strings, uint32
+ *                                offsets for that + 1, the strings
+ *                                as for TEXT, then a uint32 index
+ *                                of a string for each row
+ *
+ *     Rows with no value have 0, an empty string or index 0.
+ *
+ * The footer is
+ *
+ *     uint32 number of columns
+ *     for each column
+ *         int64  label
+ *         uint8  type, enum columnar_type_t
+ *         uint8  field, 0 or a location field, see below
+ *         uint16 length of the path
+ *         path, the submodule names joined with "/". Empty for the
+ *             top level.
+ *     uint64 number of rows in the file
+ *
+ * The iss and aud claims are DICT as there are usually few distinct
+ * values. The location claim is a column per field, with field 1 to
+ * 7 the latitude to the speed as DOUBLE and 8 and 9 the timestamp and
+ * age as UINT64. Claims of other types, such as arrays and maps, are
+ * not put in any column. A nested token in a submodule is a NESTED
+ * column with label 0 and the nested token's submodule name at the
+ * end of the path. When a label is in a token more than once, the
+ * first one is used.
+ */
+
+
+enum columnar_type_t {
+    COLUMNAR_INT64  = 1,
+    COLUMNAR_UINT64 = 2,
+    COLUMNAR_DOUBLE = 3,
+    COLUMNAR_BOOL   = 4,
+    COLUMNAR_NULL   = 5,
+    COLUMNAR_BYTES  = 6,
+    COLUMNAR_TEXT   = 7,
+    COLUMNAR_DICT   = 8,
+    COLUMNAR_NESTED = 9
+};
+
+
+/* Rows per row group when not otherwise given */
+#define COLUMNAR_ROW_GROUP_ROWS 65536
+
+
+struct columnar_column;
+
+
+struct columnar_writer {
+    FILE                   *output;
+    uint32_t                row_group_rows;
+    pthread_mutex_t         lock;
+
+    struct columnar_column *columns;
+    uint32_t                column_count;
+    uint32_t                column_capacity;
+
+    /* Open addressing on the column's label, type and path. An entry
+     * is the column index + 1 or 0 for empty. */
+    uint32_t               *table;
+    uint32_t                table_size;
+
+    /* Rows in the current row group and in the file */
+    uint32_t                rows;
+    uint64_t                total_rows;
+
+    /* Bytes written to output so far */
+    uint64_t                offset;
+
+    /* Out of memory. Nothing more is added. */
+    bool                    failed;
+};
+
+
+struct columnar_cell;
+
+
+/* The claims of one token. One of these is needed per token being
+ * processed. */
+struct columnar_row {
+    struct columnar_writer *writer;
+
+    struct columnar_cell   *cells;
+    size_t                  cell_count;
+    size_t                  cell_capacity;
+
+    /* The paths of the submodules entered so far, one after another.
+     * A cell's path is an offset and length in here. */
+    char                   *paths;
+    size_t                  paths_len;
+    size_t                  paths_capacity;
+
+    uint32_t                depth;
+    struct {
+        uint32_t offset;
+        uint32_t len;
+    }                       path_stack[XCLAIM_MAX_NESTING + 1];
+
+    bool                    failed;
+};
+
+
+/* Sets up a writer to output and writes the start of the file.
+ * Returns 0 on success or 1 on error after printing it. */
+int columnar_writer_init(struct columnar_writer *me, FILE *output, uint32_t row_group_rows);
+
+
+/* Writes the last row group and the footer. Returns 0 on success or 1
+ * on error after printing it. */
+int columnar_writer_finish(struct columnar_writer *me);
+
+
+void columnar_writer_free(struct columnar_writer *me);
+
+
+/* Sets up encoder to gather the claims of a token into row. Strings
+ * and nested tokens are not copied, so the token must still be in
+ * memory when columnar_row_add() is called. */
+void xclaim_columnar_encode_init(xclaim_encoder         *encoder,
+                                 struct columnar_row    *row,
+                                 struct columnar_writer *writer);
+
+
+/* Adds the row gathered by the encoder to the writer once the token
+ * has been processed. Thread safe. Returns 0 on success or 1 on error
+ * after printing it. */
+int columnar_row_add(struct columnar_row *row);
+
+
+/* Frees what the encoder allocated, whether or not the row was
+ * added. */
+void columnar_row_free(struct columnar_row *row);
+
+
+#endif /* columnar_encode_h */
@@ -0,0 +1,288 @@
+/*
+ * cose_eddsa.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_eddsa.h"
+#include "cose_envelope.h"
+#include "cbor_seq.h"
+
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The COSE header label for the algorithm */
+#define COSE_HEADER_PARAM_ALG 1
+
+/* The COSE header label for the key ID */
+#define COSE_HEADER_PARAM_KID 4
+
+/* The start of the Sig_structure, [ "Signature1", ... */
+static const uint8_t sig_structure_start[] = {
+    0x84, 0x6a, 'S', 'i', 'g', 'n', 'a', 't', 'u', 'r', 'e', '1'
+};
+
+/* The protected headers this makes, {1: -8} */
+static const uint8_t eddsa_protected_headers[] = {0xa1, 0x01, 0x27};
+
+/* Biggest CBOR head */
+#define CBOR_HEAD_MAX 9
+
+
+/* Puts the Sig_structure from RFC 8152 section 4.4 in out, which must
+ * be at least sig_structure_size() bytes. Returns its length.
+ *
+ *   [ "Signature1", protected bstr, external_aad bstr, payload bstr ]
+ */
+static size_t make_sig_structure(struct q_useful_buf_c protected_headers,
+                                 struct q_useful_buf_c payload,
+                                 uint8_t              *out)
+{
+    size_t len;
+
+    memcpy(out, sig_structure_start, sizeof(sig_structure_start));
+    len = sizeof(sig_structure_start);
+
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, protected_headers.len, out + len);
+    memcpy(out + len, protected_headers.ptr, protected_headers.len);
+    len += protected_headers.len;
+
+    /* Empty external_aad */
+    out[len++] = 0x40;
+
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, payload.len, out + len);
+    memcpy(out + len, payload.ptr, payload.len);
+    len += payload.len;
+
+    return len;
+}
+
+
+static inline size_t sig_structure_size(struct q_useful_buf_c protected_headers,
+                                        struct q_useful_buf_c payload)
+{
+    return sizeof(sig_structure_start) + 1 +
+           2 * CBOR_HEAD_MAX + protected_headers.len + payload.len;
+}
+
+
+/* Checks the protected headers say EdDSA. */
+static bool alg_is_eddsa(struct q_useful_buf_c protected_headers)
+{
+    struct q_useful_buf_c value;
+    uint8_t               major_type;
+    uint8_t               additional_info;
+    uint64_t              argument;
+
+    if(protected_headers.len == 0 ||
+       cose_envelope_find_in_map(protected_headers, COSE_HEADER_PARAM_ALG, &value)) {
+        return false;
+    }
+
+    return cbor_decode_head(value, &major_type, &additional_info, &argument) != 0 &&
+           major_type == CBOR_MAJOR_TYPE_NEGATIVE_INT &&
+           argument == (uint64_t)(-1 - COSE_ALGORITHM_EDDSA);
+}
+
+
+/*
+ * Public function. See cose_eddsa.h
+ */
+void cose_eddsa_verifier_init(struct cose_eddsa_verifier *me,
+                              struct t_cose_key           key)
+{
+    memset(me, 0, sizeof(*me));
+    me->key = key;
+}
+
+
+/*
+ * Public function. See cose_eddsa.h
+ */
+int cose_eddsa_verify(struct cose_eddsa_verifier *me,
+                      struct q_useful_buf_c       token,
+                      struct q_useful_buf_c      *payload)
+{
+    struct cose_sign1_parts parts;
+    size_t                  needed;
+    size_t                  len;
+    uint8_t                *new_buf;
+
+    if(cose_envelope_split_sign1(token, &parts) ||
+       !alg_is_eddsa(parts.protected_headers) ||
+       parts.signature.len != COSE_EDDSA_SIGNATURE_LEN) {
+        return 1;
+    }
+
+    needed = sig_structure_size(parts.protected_headers, parts.payload);
+    if(needed > me->buf_size) {
+        new_buf = realloc(me->buf, needed);
+        if(new_buf == NULL) {
+            return 1;
+        }
+        me->buf      = new_buf;
+        me->buf_size = needed;
+    }
+    len = make_sig_structure(parts.protected_headers, parts.payload, me->buf);
+
+    if(me->md_ctx == NULL) {
+        me->md_ctx = EVP_MD_CTX_new();
+        if(me->md_ctx == NULL) {
+            return 1;
+        }
+    } else {
+        EVP_MD_CTX_reset(me->md_ctx);
+    }
+
+    if(EVP_DigestVerifyInit(me->md_ctx, NULL, NULL, NULL, me->key.k.key_ptr) != 1 ||
+       EVP_DigestVerify(me->md_ctx, parts.signature.ptr, parts.signature.len, me->buf, len) != 1) {
+        return 1;
+    }
+
+    *payload = parts.payload;
+
+    return 0;
+}
+
+
+/*
+ * Public function. See cose_eddsa.h
+ *
+ * A random linear combination batch check, as in the Ed25519 paper,
+ * needs curve point arithmetic that OpenSSL doesn't make public.
+ */
+size_t cose_eddsa_verify_each(struct cose_eddsa_verifier  *me,
+                              const struct q_useful_buf_c *tokens,
+                              size_t                       count,
+                              bool                        *valid)
+{
+    struct q_useful_buf_c payload;
+    size_t                valid_count;
+    size_t                i;
+
+    valid_count = 0;
+    for(i = 0; i < count; i++) {
+        valid[i] = cose_eddsa_verify(me, tokens[i], &payload) == 0;
+        if(valid[i]) {
+            valid_count++;
+        }
+    }
+
+    return valid_count;
+}
+
+
+/*
+ * Public function. See cose_eddsa.h
+ */
+void cose_eddsa_verifier_free(struct cose_eddsa_verifier *me)
+{
+    EVP_MD_CTX_free(me->md_ctx);
+    free(me->buf);
+    me->md_ctx   = NULL;
+    me->buf      = NULL;
+    me->buf_size = 0;
+}
+
+
+/*
+ * Public function. See cose_eddsa.h
+ */
+int cose_eddsa_verify_one(struct q_useful_buf_c   token,
+                          struct t_cose_key       key,
+                          struct q_useful_buf_c  *payload)
+{
+    struct cose_eddsa_verifier verifier;
+    int                        result;
+
+    cose_eddsa_verifier_init(&verifier, key);
+    result = cose_eddsa_verify(&verifier, token, payload);
+    cose_eddsa_verifier_free(&verifier);
+
+    return result;
+}
+
+
+/*
+ * Public function. See cose_eddsa.h
+ */
+int cose_eddsa_sign(struct q_useful_buf_c  payload,
+                    struct t_cose_key      key,
+                    struct q_useful_buf_c  kid,
+                    struct q_useful_buf    out_buf,
+                    struct q_useful_buf_c *result)
+{
+    struct q_useful_buf_c protected_headers;
+    EVP_MD_CTX           *md_ctx;
+    uint8_t              *sig_structure;
+    uint8_t              *out;
+    size_t                sig_structure_len;
+    size_t                signature_len;
+    size_t                len;
+    int                   return_value;
+
+    if(out_buf.len < payload.len + kid.len + COSE_EDDSA_OVERHEAD) {
+        fprintf(stderr, "output buffer too small for EdDSA COSE_Sign1\n");
+        return 1;
+    }
+
+    protected_headers = (struct q_useful_buf_c){eddsa_protected_headers, sizeof(eddsa_protected_headers)};
+
+    return_value  = 1;
+    md_ctx        = EVP_MD_CTX_new();
+    sig_structure = malloc(sig_structure_size(protected_headers, payload));
+    if(md_ctx == NULL || sig_structure == NULL) {
+        goto Done;
+    }
+    sig_structure_len = make_sig_structure(protected_headers, payload, sig_structure);
+
+    /* [ protected, unprotected, payload, signature ] */
+    out = out_buf.ptr;
+    len = 0;
+    out[len++] = 0x84;
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, protected_headers.len, out + len);
+    memcpy(out + len, protected_headers.ptr, protected_headers.len);
+    len += protected_headers.len;
+
+    if(kid.len > 0) {
+        out[len++] = 0xa1;
+        out[len++] = COSE_HEADER_PARAM_KID;
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, kid.len, out + len);
+        memcpy(out + len, kid.ptr, kid.len);
+        len += kid.len;
+    } else {
+        out[len++] = 0xa0;
+    }
+
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, payload.len, out + len);
+    memcpy(out + len, payload.ptr, payload.len);
+    len += payload.len;
+
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, COSE_EDDSA_SIGNATURE_LEN, out + len);
+    signature_len = COSE_EDDSA_SIGNATURE_LEN;
+    if(EVP_DigestSignInit(md_ctx, NULL, NULL, NULL, key.k.key_ptr) != 1 ||
+       EVP_DigestSign(md_ctx, out + len, &signature_len, sig_structure, sig_structure_len) != 1 ||
+       signature_len != COSE_EDDSA_SIGNATURE_LEN) {
+        fprintf(stderr, "Ed25519 signing failed\n");
+        goto Done;
+    }
+    len += signature_len;
+
+    *result = (struct q_useful_buf_c){out_buf.ptr, len};
+    return_value = 0;
+
+Done:
+    EVP_MD_CTX_free(md_ctx);
+    free(sig_structure);
+
+    return return_value;
+}
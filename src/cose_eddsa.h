@@ -0,0 +1,105 @@
+/*
+ * cose_eddsa.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_eddsa_h
+#define cose_eddsa_h
+
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* COSE_Sign1 signing and verification with Ed25519, COSE algorithm
+ * EdDSA (-8). The version of t_cose used here only does ECDSA, so
+ * this makes and checks the COSE_Sign1 itself with OpenSSL. ctoken is
+ * then used with T_COSE_OPT_DECODE_ONLY for the claims.
+ *
+ * Ed25519 verification is several times faster than ES256 and the
+ * signatures are deterministic, which suits tokens passed between
+ * internal services.
+ *
+ * Ed25519 signs the whole Sig_structure in one go, not a hash of it,
+ * so it can't be checked incrementally as token_stream does for
+ * ECDSA.
+ */
+
+
+#define COSE_ALGORITHM_EDDSA -8
+
+#define COSE_EDDSA_SIGNATURE_LEN 64
+
+/* Room for the array, headers, kid head, byte string heads and the
+ * signature on top of the payload and kid */
+#define COSE_EDDSA_OVERHEAD 100
+
+
+/* Verifies many tokens with the same key. The OpenSSL context and the
+ * buffer the Sig_structure is put in are kept for each token after
+ * the first, so a sequence of tokens costs little more than the
+ * Ed25519 operations themselves. */
+struct cose_eddsa_verifier {
+    struct t_cose_key key;
+    void             *md_ctx;  /* EVP_MD_CTX* */
+    uint8_t          *buf;
+    size_t            buf_size;
+};
+
+
+/* key must be an Ed25519 key, see key_is_ed25519(). It is not copied
+ * and must stay valid until cose_eddsa_verifier_free(). */
+void cose_eddsa_verifier_init(struct cose_eddsa_verifier *me,
+                              struct t_cose_key           key);
+
+
+/* Verifies a COSE_Sign1, tagged or not. On success 0 is returned and
+ * payload is the payload which points into token. Returns 1 if the
+ * token is not a COSE_Sign1 with alg EdDSA or if the signature is not
+ * valid. Nothing is printed. */
+int cose_eddsa_verify(struct cose_eddsa_verifier *me,
+                      struct q_useful_buf_c       token,
+                      struct q_useful_buf_c      *payload);
+
+
+/* Calls cose_eddsa_verify() for each of count tokens in turn and
+ * sets valid[i] for each. This is not Ed25519 batch verification.
+ * Each signature is checked on its own, so the cost is the same as
+ * calling cose_eddsa_verify() count times. Returns the number that
+ * are valid. */
+size_t cose_eddsa_verify_each(struct cose_eddsa_verifier  *me,
+                              const struct q_useful_buf_c *tokens,
+                              size_t                       count,
+                              bool                        *valid);
+
+
+void cose_eddsa_verifier_free(struct cose_eddsa_verifier *me);
+
+
+/* Verifies one token. Same as cose_eddsa_verify() with a verifier
+ * used only once. */
+int cose_eddsa_verify_one(struct q_useful_buf_c   token,
+                          struct t_cose_key       key,
+                          struct q_useful_buf_c  *payload);
+
+
+/* Makes an untagged COSE_Sign1 with payload signed with an Ed25519
+ * key. kid goes in the unprotected headers if not empty. out_buf must
+ * be at least payload.len + kid.len + COSE_EDDSA_OVERHEAD. Returns 0
+ * on success. On failure a message is printed and 1 is returned. */
+int cose_eddsa_sign(struct q_useful_buf_c  payload,
+                    struct t_cose_key      key,
+                    struct q_useful_buf_c  kid,
+                    struct q_useful_buf    out_buf,
+                    struct q_useful_buf_c *result);
+
+
+#endif /* cose_eddsa_h */
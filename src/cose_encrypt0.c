@@ -0,0 +1,323 @@
+/*
+ * cose_encrypt0.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_encrypt0.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
+#include "cbor_seq.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* The COSE header labels */
+#define COSE_HEADER_PARAM_ALG 1
+#define COSE_HEADER_PARAM_IV  5
+
+/* The COSE_Encrypt0 tag number */
+#define COSE_ENCRYPT0_TAG 16
+
+/* The start of the Enc_structure, [ "Encrypt0", ... */
+static const uint8_t enc_structure_start[] = {
+    0x83, 0x68, 'E', 'n', 'c', 'r', 'y', 'p', 't', '0'
+};
+
+/* Biggest CBOR head */
+#define CBOR_HEAD_MAX 9
+
+
+static int32_t key_algorithm(struct t_cose_key key)
+{
+    return ((struct openssl_aes_key *)key.k.key_ptr)->key_len == 16 ? COSE_ALGORITHM_A128GCM
+                                                                     : COSE_ALGORITHM_A256GCM;
+}
+
+
+/* Gets a cipher context with the key from key and the IV set, ready to
+ * encrypt or decrypt. The copy saves running the key schedule. */
+static EVP_CIPHER_CTX *start_cipher(struct t_cose_key key, const uint8_t *iv, int encrypt)
+{
+    EVP_CIPHER_CTX *ctx;
+
+    ctx = EVP_CIPHER_CTX_new();
+    if(ctx == NULL) {
+        return NULL;
+    }
+
+    if(!EVP_CIPHER_CTX_copy(ctx, ((struct openssl_aes_key *)key.k.key_ptr)->cipher_ctx) ||
+       !EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, encrypt)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+
+/* Gives the Enc_structure from RFC 8152 section 5.3 to AES-GCM as the
+ * additional authenticated data. It goes in a piece at a time.
+ *
+ *   [ "Encrypt0", protected bstr, external_aad bstr ]
+ */
+static int add_aad(EVP_CIPHER_CTX *ctx, struct q_useful_buf_c protected_headers)
+{
+    static const uint8_t empty_aad = 0x40;
+
+    uint8_t head[CBOR_HEAD_MAX];
+    size_t  head_len;
+    int     len;
+
+    head_len = cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, protected_headers.len, head);
+
+    return EVP_CipherUpdate(ctx, NULL, &len, enc_structure_start, sizeof(enc_structure_start)) &&
+           EVP_CipherUpdate(ctx, NULL, &len, head, (int)head_len) &&
+           (protected_headers.len == 0 ||
+            EVP_CipherUpdate(ctx, NULL, &len, protected_headers.ptr, (int)protected_headers.len)) &&
+           EVP_CipherUpdate(ctx, NULL, &len, &empty_aad, 1);
+}
+
+
+/*
+ * Public function. See cose_encrypt0.h
+ */
+bool cose_encrypt0_is_encrypt0(struct q_useful_buf_c token)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    size_t   len;
+
+    while(1) {
+        len = cbor_decode_head(token, &major_type, &additional_info, &argument);
+        if(len == 0) {
+            return false;
+        }
+        if(major_type != CBOR_MAJOR_TYPE_TAG) {
+            break;
+        }
+        if(argument == COSE_ENCRYPT0_TAG) {
+            return true;
+        }
+        token = q_useful_buf_tail(token, len);
+    }
+
+    return major_type == CBOR_MAJOR_TYPE_ARRAY && argument == 3;
+}
+
+
+/*
+ * Public function. See cose_encrypt0.h
+ */
+struct q_useful_buf cose_encrypt0_plaintext_buf(struct q_useful_buf out_buf)
+{
+    if(out_buf.len < COSE_ENCRYPT0_OVERHEAD) {
+        return NULL_Q_USEFUL_BUF;
+    }
+
+    return (struct q_useful_buf){(uint8_t *)out_buf.ptr + COSE_ENCRYPT0_PREFIX_MAX,
+                                 out_buf.len - COSE_ENCRYPT0_OVERHEAD};
+}
+
+
+/*
+ * Public function. See cose_encrypt0.h
+ */
+int cose_encrypt0_seal(struct q_useful_buf    out_buf,
+                       size_t                 plaintext_len,
+                       struct t_cose_key      key,
+                       struct q_useful_buf_c  tag_head,
+                       struct q_useful_buf_c *result)
+{
+    uint8_t         prefix[COSE_ENCRYPT0_PREFIX_MAX];
+    uint8_t         protected_headers[3];
+    uint8_t        *iv;
+    uint8_t        *text;
+    size_t          prefix_len;
+    EVP_CIPHER_CTX *ctx;
+    int             len;
+    int             ok;
+
+    if(!key_is_aes(key)) {
+        fprintf(stderr, "COSE_Encrypt0 needs an AES key\n");
+        return 1;
+    }
+    if(plaintext_len > cose_encrypt0_plaintext_buf(out_buf).len ||
+       tag_head.len > 3 ||
+       plaintext_len > INT32_MAX) {
+        fprintf(stderr, "output buffer too small for COSE_Encrypt0\n");
+        return 1;
+    }
+
+    /* {1: alg} */
+    protected_headers[0] = 0xa1;
+    protected_headers[1] = COSE_HEADER_PARAM_ALG;
+    protected_headers[2] = (uint8_t)key_algorithm(key);
+
+    /* The prefix is made in a local buffer because its length depends
+     * on the ciphertext length. It is then put right in front of the
+     * ciphertext. */
+    prefix_len = 0;
+    if(tag_head.len > 0) {
+        memcpy(prefix, tag_head.ptr, tag_head.len);
+        prefix_len += tag_head.len;
+    }
+    prefix[prefix_len++] = 0x83;
+    prefix_len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, sizeof(protected_headers), prefix + prefix_len);
+    memcpy(prefix + prefix_len, protected_headers, sizeof(protected_headers));
+    prefix_len += sizeof(protected_headers);
+
+    /* {5: iv} */
+    prefix[prefix_len++] = 0xa1;
+    prefix[prefix_len++] = COSE_HEADER_PARAM_IV;
+    prefix_len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, COSE_ENCRYPT0_IV_LEN, prefix + prefix_len);
+    iv = prefix + prefix_len;
+    if(RAND_bytes(iv, COSE_ENCRYPT0_IV_LEN) != 1) {
+        fprintf(stderr, "can't get random bytes for COSE_Encrypt0 IV\n");
+        return 1;
+    }
+    prefix_len += COSE_ENCRYPT0_IV_LEN;
+
+    prefix_len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING,
+                                   plaintext_len + COSE_ENCRYPT0_TAG_LEN,
+                                   prefix + prefix_len);
+
+    text = (uint8_t *)out_buf.ptr + COSE_ENCRYPT0_PREFIX_MAX;
+
+    ctx = start_cipher(key, iv, 1);
+    if(ctx == NULL) {
+        fprintf(stderr, "AES-GCM setup failed\n");
+        return 1;
+    }
+    ok = add_aad(ctx, (struct q_useful_buf_c){protected_headers, sizeof(protected_headers)}) &&
+         EVP_EncryptUpdate(ctx, text, &len, text, (int)plaintext_len) &&
+         EVP_EncryptFinal_ex(ctx, text + len, &len) &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, COSE_ENCRYPT0_TAG_LEN, text + plaintext_len);
+    EVP_CIPHER_CTX_free(ctx);
+    if(!ok) {
+        fprintf(stderr, "AES-GCM encryption failed\n");
+        return 1;
+    }
+
+    memcpy(text - prefix_len, prefix, prefix_len);
+
+    *result = (struct q_useful_buf_c){text - prefix_len,
+                                      prefix_len + plaintext_len + COSE_ENCRYPT0_TAG_LEN};
+
+    return 0;
+}
+
+
+/* Gets an unsigned integer header value */
+static bool get_int_header(struct q_useful_buf_c map, int64_t label, uint64_t *value)
+{
+    struct q_useful_buf_c encoded;
+    uint8_t               major_type;
+    uint8_t               additional_info;
+
+    return map.len > 0 &&
+           cose_envelope_find_in_map(map, label, &encoded) == 0 &&
+           cbor_decode_head(encoded, &major_type, &additional_info, value) != 0 &&
+           major_type == CBOR_MAJOR_TYPE_POSITIVE_INT;
+}
+
+
+/*
+ * Public function. See cose_encrypt0.h
+ */
+int cose_encrypt0_decrypt(struct q_useful_buf_c  token,
+                          struct t_cose_key      key,
+                          struct q_useful_buf_c *plaintext)
+{
+    struct q_useful_buf_c protected_headers;
+    struct q_useful_buf_c unprotected_headers;
+    struct q_useful_buf_c iv;
+    struct q_useful_buf_c ciphertext;
+    uint8_t               major_type;
+    uint8_t               additional_info;
+    uint64_t              argument;
+    uint64_t              algorithm;
+    size_t                len;
+    size_t                text_len;
+    uint8_t              *text;
+    EVP_CIPHER_CTX       *ctx;
+    int                   out_len;
+    int                   ok;
+
+    if(!key_is_aes(key)) {
+        return 1;
+    }
+
+    do {
+        len = cbor_decode_head(token, &major_type, &additional_info, &argument);
+        if(len == 0) {
+            return 1;
+        }
+        token = q_useful_buf_tail(token, len);
+    } while(major_type == CBOR_MAJOR_TYPE_TAG);
+
+    if(major_type != CBOR_MAJOR_TYPE_ARRAY || argument != 3) {
+        return 1;
+    }
+
+    len = cbor_get_byte_string(token, &protected_headers);
+    if(len == 0) {
+        return 1;
+    }
+    token = q_useful_buf_tail(token, len);
+
+    len = cbor_item_length(token);
+    if(len == 0) {
+        return 1;
+    }
+    unprotected_headers = (struct q_useful_buf_c){token.ptr, len};
+    token = q_useful_buf_tail(token, len);
+
+    if(cbor_get_byte_string(token, &ciphertext) == 0 || ciphertext.len < COSE_ENCRYPT0_TAG_LEN) {
+        return 1;
+    }
+
+    if(!get_int_header(protected_headers, COSE_HEADER_PARAM_ALG, &algorithm) ||
+       algorithm != (uint64_t)key_algorithm(key)) {
+        return 1;
+    }
+    if(cose_envelope_find_in_map(unprotected_headers, COSE_HEADER_PARAM_IV, &iv) ||
+       cbor_get_byte_string(iv, &iv) == 0 ||
+       iv.len != COSE_ENCRYPT0_IV_LEN) {
+        return 1;
+    }
+
+    /* In place */
+    text     = (uint8_t *)ciphertext.ptr;
+    text_len = ciphertext.len - COSE_ENCRYPT0_TAG_LEN;
+    if(text_len > INT32_MAX) {
+        return 1;
+    }
+
+    ctx = start_cipher(key, iv.ptr, 0);
+    if(ctx == NULL) {
+        return 1;
+    }
+    ok = add_aad(ctx, protected_headers) &&
+         EVP_DecryptUpdate(ctx, text, &out_len, text, (int)text_len) &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, COSE_ENCRYPT0_TAG_LEN, text + text_len) &&
+         EVP_DecryptFinal_ex(ctx, text + out_len, &out_len) > 0;
+    EVP_CIPHER_CTX_free(ctx);
+    if(!ok) {
+        return 1;
+    }
+
+    *plaintext = (struct q_useful_buf_c){text, text_len};
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * cose_encrypt0.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_encrypt0_h
+#define cose_encrypt0_h
+
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include <stdbool.h>
+
+
+/* COSE_Encrypt0 from RFC 8152 section 5.2 with AES-GCM, COSE
+ * algorithms A128GCM (1) and A256GCM (3) chosen by the key size. This
+ * is for sign-then-encrypt and MAC-then-encrypt: the plaintext is a
+ * whole COSE_Sign1 or COSE_Mac0, as for a nested CWT in RFC 8392
+ * section 7.1.
+ *
+ * Nothing is copied. For encryption, the inner token is made right
+ * where the ciphertext goes in the output buffer, see
+ * cose_encrypt0_plaintext_buf(), then it is encrypted in place and
+ * the small COSE_Encrypt0 header is put in front of it. Decryption is
+ * also in place. OpenSSL uses AES-NI and PCLMULQDQ for AES-GCM where
+ * the CPU has them, so the cost over signing is small.
+ *
+ * The IV is 12 random bytes for each token. With random IVs no more
+ * than 2^32 tokens should be encrypted with one key.
+ */
+
+
+#define COSE_ALGORITHM_A128GCM 1
+#define COSE_ALGORITHM_A256GCM 3
+
+#define COSE_ENCRYPT0_IV_LEN   12
+#define COSE_ENCRYPT0_TAG_LEN  16
+
+/* The most the tags, array, headers and byte string head can take up
+ * in front of the ciphertext */
+#define COSE_ENCRYPT0_PREFIX_MAX 40
+
+/* The most COSE_Encrypt0 adds to the plaintext */
+#define COSE_ENCRYPT0_OVERHEAD (COSE_ENCRYPT0_PREFIX_MAX + COSE_ENCRYPT0_TAG_LEN)
+
+
+/* Tells if token is a COSE_Encrypt0, either from the tag or because
+ * it is an array of three. */
+bool cose_encrypt0_is_encrypt0(struct q_useful_buf_c token);
+
+
+/* Returns the part of out_buf the plaintext, the inner token, should
+ * be written to for cose_encrypt0_seal(). */
+struct q_useful_buf cose_encrypt0_plaintext_buf(struct q_useful_buf out_buf);
+
+
+/* Encrypts the plaintext_len bytes at cose_encrypt0_plaintext_buf()
+ * in place and puts tag_head, the COSE_Encrypt0 array and headers in
+ * front. tag_head has the encoded tags wanted, if any. key is from
+ * read_aes_key_from_file(). result points into out_buf, though not
+ * at its start. Returns 0 on success. On failure a message is printed
+ * and 1 is returned. */
+int cose_encrypt0_seal(struct q_useful_buf    out_buf,
+                       size_t                 plaintext_len,
+                       struct t_cose_key      key,
+                       struct q_useful_buf_c  tag_head,
+                       struct q_useful_buf_c *result);
+
+
+/* Decrypts a COSE_Encrypt0, with or without tags, in place. token
+ * MUST be in writable memory; the const is cast away. On success 0 is
+ * returned and plaintext points into token. Returns 1 if the token is
+ * not a COSE_Encrypt0 for the key's algorithm or it doesn't
+ * authenticate. Nothing is printed. */
+int cose_encrypt0_decrypt(struct q_useful_buf_c  token,
+                          struct t_cose_key      key,
+                          struct q_useful_buf_c *plaintext);
+
+
+#endif /* cose_encrypt0_h */
@@ -0,0 +1,511 @@
+/*
+ * cose_envelope.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_envelope.h"
+#include "cose_eddsa.h"
+#include "cose_mac0.h"
+#include "cose_encrypt0.h"
+#include "openssl_keys.h"
+#include "cbor_seq.h"
+
+#include "t_cose/t_cose_sign1_sign.h"
+#include "t_cose/t_cose_sign1_verify.h"
+
+#include <stdio.h> /* For error prints */
+#include <string.h>
+
+
+/* Pre-encoded tag heads that go in front of the COSE or UCCS */
+static const uint8_t cwt_tag_head[]   = {0xd8, 0x3d};       /* 61 */
+static const uint8_t uccs_tag_head[]  = {0xd9, 0x02, 0x59}; /* 601 */
+static const uint8_t sign1_tag_head[] = {0xd2};             /* 18 */
+static const uint8_t mac0_tag_head[]  = {0xd1};             /* 17 */
+static const uint8_t cwt_encrypt0_tag_head[] = {0xd8, 0x3d, 0xd0}; /* 61, 16 */
+
+/* The COSE_Mac0 tag number */
+#define COSE_MAC0_TAG 17
+
+/* Room for the COSE_Sign1 array, the headers, the bstr heads and the
+ * signature itself. Big enough for an RSA 4096 signature. */
+#define SIGN1_OVERHEAD 600
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+int cose_envelope_unwrap(struct q_useful_buf_c  token,
+                         uint32_t               option_flags,
+                         struct t_cose_key      verification_key,
+                         struct q_useful_buf_c *claims_set)
+{
+    struct t_cose_sign1_verify_ctx verify_ctx;
+    struct cose_sign1_parts        parts;
+    enum t_cose_err_t              t_cose_err;
+    uint8_t                        major_type;
+    uint8_t                        additional_info;
+    uint64_t                       argument;
+    size_t                         head_len;
+    int32_t                        t_cose_opt_flags;
+    bool                           is_mac0;
+
+    /* Skip over all the tags, CWT, UCCS and COSE_Sign1. What sort of
+     * token it is is determined from the type of the item after
+     * them, or the key for a COSE_Mac0 without a tag. */
+    is_mac0 = key_is_hmac(verification_key);
+    while(1) {
+        head_len = cbor_decode_head(token, &major_type, &additional_info, &argument);
+        if(head_len == 0) {
+            fprintf(stderr, "input token is not well-formed CBOR\n");
+            return 1;
+        }
+        if(major_type != CBOR_MAJOR_TYPE_TAG) {
+            break;
+        }
+        if(argument == COSE_MAC0_TAG) {
+            is_mac0 = true;
+        }
+        token = q_useful_buf_tail(token, head_len);
+    }
+
+    /* Bytes after the token would be signed or carried into the
+     * output with the claims-set of a UCCS */
+    if(cbor_item_length(token) != token.len) {
+        fprintf(stderr, "input token is not well-formed or has bytes after it\n");
+        return 1;
+    }
+
+    if(major_type == CBOR_MAJOR_TYPE_MAP) {
+        /* A UCCS. The claims-set is the whole thing. */
+        if((option_flags & COSE_ENVELOPE_OPT_REQUIRE_PROTECTED) ||
+           (verification_key.k.key_ptr != NULL && !(option_flags & COSE_ENVELOPE_OPT_NO_VERIFY))) {
+            fprintf(stderr, "input token is a UCCS, but it must be signed or MACed\n");
+            return 1;
+        }
+        *claims_set = token;
+        return 0;
+    }
+
+    if(major_type != CBOR_MAJOR_TYPE_ARRAY) {
+        fprintf(stderr, "input token is neither a UCCS nor a CWT\n");
+        return 1;
+    }
+
+    if(is_mac0) {
+        /* Neither does t_cose do COSE_Mac0 */
+        if(option_flags & COSE_ENVELOPE_OPT_NO_VERIFY) {
+            if(cose_envelope_split_sign1(token, &parts)) {
+                fprintf(stderr, "input token is not a well-formed COSE_Mac0\n");
+                return 1;
+            }
+            *claims_set = parts.payload;
+        } else if(cose_mac0_verify(token, verification_key, claims_set)) {
+            fprintf(stderr, "token validation failed. %s\n",
+                    key_is_hmac(verification_key) ? "MAC not valid" : "no MAC key for COSE_Mac0");
+            return 1;
+        }
+
+    } else if(!(option_flags & COSE_ENVELOPE_OPT_NO_VERIFY) && key_is_ed25519(verification_key)) {
+        /* t_cose doesn't do EdDSA */
+        if(cose_eddsa_verify_one(token, verification_key, claims_set)) {
+            fprintf(stderr, "token validation failed. EdDSA signature not valid\n");
+            return 1;
+        }
+
+    } else {
+        /* A COSE_Sign1. The tag has already been stripped off and
+         * t_cose is OK with that. */
+        t_cose_opt_flags = 0;
+        if(option_flags & COSE_ENVELOPE_OPT_NO_VERIFY) {
+            t_cose_opt_flags |= T_COSE_OPT_DECODE_ONLY;
+        } else if(verification_key.k.key_ptr == NULL) {
+            fprintf(stderr, "no verification key for signed input token\n");
+            return 1;
+        }
+
+        t_cose_sign1_verify_init(&verify_ctx, t_cose_opt_flags);
+        if(verification_key.k.key_ptr != NULL) {
+            t_cose_sign1_set_verification_key(&verify_ctx, verification_key);
+        }
+
+        t_cose_err = t_cose_sign1_verify(&verify_ctx, token, claims_set, NULL);
+        if(t_cose_err != T_COSE_SUCCESS) {
+            fprintf(stderr, "token validation failed. t_cose error %d\n", t_cose_err);
+            return 1;
+        }
+    }
+
+    /* The payload must be one well-formed map and nothing else, as
+     * it is carried into the output as it is */
+    head_len = cbor_decode_head(*claims_set, &major_type, &additional_info, &argument);
+    if(head_len == 0 ||
+       major_type != CBOR_MAJOR_TYPE_MAP ||
+       cbor_item_length(*claims_set) != claims_set->len) {
+        fprintf(stderr, "payload of input token is not a claims-set\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+bool cose_envelope_is_uccs(struct q_useful_buf_c token)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    size_t   head_len;
+
+    while(1) {
+        head_len = cbor_decode_head(token, &major_type, &additional_info, &argument);
+        if(head_len == 0) {
+            return false;
+        }
+        if(major_type != CBOR_MAJOR_TYPE_TAG) {
+            return major_type == CBOR_MAJOR_TYPE_MAP;
+        }
+        token = q_useful_buf_tail(token, head_len);
+    }
+}
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+int cose_envelope_find_in_map(struct q_useful_buf_c  map,
+                              int64_t                label,
+                              struct q_useful_buf_c *value)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    uint64_t entries;
+    size_t   head_len;
+    size_t   label_len;
+    size_t   value_len;
+    bool     match;
+
+    head_len = cbor_decode_head(map, &major_type, &additional_info, &argument);
+    if(head_len == 0 ||
+       major_type != CBOR_MAJOR_TYPE_MAP ||
+       additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE) {
+        return -1;
+    }
+    map = q_useful_buf_tail(map, head_len);
+
+    for(entries = argument; entries > 0; entries--) {
+        label_len = cbor_item_length(map);
+        if(label_len == 0) {
+            return -1;
+        }
+        value_len = cbor_item_length(q_useful_buf_tail(map, label_len));
+        if(value_len == 0) {
+            return -1;
+        }
+
+        cbor_decode_head(map, &major_type, &additional_info, &argument);
+        if(label >= 0) {
+            match = major_type == CBOR_MAJOR_TYPE_POSITIVE_INT && argument == (uint64_t)label;
+        } else {
+            match = major_type == CBOR_MAJOR_TYPE_NEGATIVE_INT && argument == (uint64_t)(-1 - label);
+        }
+        if(match) {
+            *value = (struct q_useful_buf_c){(const uint8_t *)map.ptr + label_len, value_len};
+            return 0;
+        }
+
+        map = q_useful_buf_tail(map, label_len + value_len);
+    }
+
+    return 1;
+}
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+int cose_envelope_split_sign1(struct q_useful_buf_c    token,
+                              struct cose_sign1_parts *parts)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    size_t   len;
+
+    do {
+        len = cbor_decode_head(token, &major_type, &additional_info, &argument);
+        if(len == 0) {
+            return -1;
+        }
+        token = q_useful_buf_tail(token, len);
+    } while(major_type == CBOR_MAJOR_TYPE_TAG);
+
+    if(major_type != CBOR_MAJOR_TYPE_ARRAY || argument != 4) {
+        return -1;
+    }
+
+    len = cbor_get_byte_string(token, &parts->protected_headers);
+    if(len == 0) {
+        return -1;
+    }
+    token = q_useful_buf_tail(token, len);
+
+    /* The unprotected headers aren't covered by the signature or MAC
+     * so check at least that they are a map */
+    len = cbor_item_length(token);
+    if(len == 0 ||
+       cbor_decode_head(token, &major_type, &additional_info, &argument) == 0 ||
+       major_type != CBOR_MAJOR_TYPE_MAP) {
+        return -1;
+    }
+    parts->unprotected_headers = (struct q_useful_buf_c){token.ptr, len};
+    token = q_useful_buf_tail(token, len);
+
+    len = cbor_get_byte_string(token, &parts->payload);
+    if(len == 0) {
+        return -1;
+    }
+    token = q_useful_buf_tail(token, len);
+
+    if(cbor_get_byte_string(token, &parts->signature) == 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+int cose_envelope_find_header(struct q_useful_buf_c  token,
+                              int64_t                label,
+                              struct q_useful_buf_c *value)
+{
+    struct cose_sign1_parts parts;
+    int                     result;
+
+    if(cose_envelope_split_sign1(token, &parts)) {
+        return -1;
+    }
+
+    /* An empty byte string is the same as an empty map */
+    if(parts.protected_headers.len > 0) {
+        result = cose_envelope_find_in_map(parts.protected_headers, label, value);
+        if(result != 1) {
+            return result;
+        }
+    }
+
+    return cose_envelope_find_in_map(parts.unprotected_headers, label, value);
+}
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+size_t cose_envelope_wrap_size(size_t claims_set_len, size_t kid_len)
+{
+    return sizeof(cwt_tag_head) + SIGN1_OVERHEAD + COSE_ENCRYPT0_OVERHEAD + kid_len + claims_set_len;
+}
+
+
+/* Sign-then-encrypt or MAC-then-encrypt. The inner token is made
+ * where the ciphertext goes and encrypted there. */
+static int wrap_encrypted(struct q_useful_buf_c     claims_set,
+                          enum ctoken_protection_t  protection,
+                          enum cose_envelope_tag_t  tagging,
+                          int32_t                   cose_algorithm_id,
+                          uint32_t                  t_cose_opt_flags,
+                          struct t_cose_key         signing_key,
+                          struct q_useful_buf_c     kid,
+                          struct t_cose_key         encryption_key,
+                          struct q_useful_buf       out_buf,
+                          struct q_useful_buf_c    *completed_token)
+{
+    struct q_useful_buf_c    inner_token;
+    struct q_useful_buf_c    tag_head;
+    enum ctoken_protection_t inner_protection;
+    struct t_cose_key        no_key;
+
+    if(!key_is_aes(encryption_key)) {
+        fprintf(stderr, "encrypted output needs an AES key\n");
+        return 1;
+    }
+
+    memset(&no_key, 0, sizeof(no_key));
+
+    if(protection == CTOKEN_PROTECTION_SIGN1_ENCRYPT0) {
+        inner_protection = CTOKEN_PROTECTION_COSE_SIGN1;
+    } else {
+        inner_protection = CTOKEN_PROTECTION_COSE_MAC0;
+    }
+
+    /* The inner token has its COSE tag so it can be told apart after
+     * decryption. The CWT tag goes on the outside. */
+    if(cose_envelope_wrap(claims_set,
+                          inner_protection,
+                          COSE_ENVELOPE_TAG_COSE,
+                          cose_algorithm_id,
+                          t_cose_opt_flags & ~T_COSE_OPT_OMIT_CBOR_TAG,
+                          signing_key,
+                          kid,
+                          no_key,
+                          cose_encrypt0_plaintext_buf(out_buf),
+                          &inner_token)) {
+        return 1;
+    }
+
+    switch(tagging) {
+        case COSE_ENVELOPE_TAG_CWT:
+            tag_head = (struct q_useful_buf_c){cwt_encrypt0_tag_head, sizeof(cwt_encrypt0_tag_head)};
+            break;
+
+        case COSE_ENVELOPE_TAG_COSE:
+            tag_head = (struct q_useful_buf_c){cwt_encrypt0_tag_head + 2, 1};
+            break;
+
+        default:
+            tag_head = NULL_Q_USEFUL_BUF_C;
+            break;
+    }
+
+    return cose_encrypt0_seal(out_buf, inner_token.len, encryption_key, tag_head, completed_token);
+}
+
+
+/*
+ * Public function. See cose_envelope.h
+ */
+int cose_envelope_wrap(struct q_useful_buf_c     claims_set,
+                       enum ctoken_protection_t  protection,
+                       enum cose_envelope_tag_t  tagging,
+                       int32_t                   cose_algorithm_id,
+                       uint32_t                  t_cose_opt_flags,
+                       struct t_cose_key         signing_key,
+                       struct q_useful_buf_c     kid,
+                       struct t_cose_key         encryption_key,
+                       struct q_useful_buf       out_buf,
+                       struct q_useful_buf_c    *completed_token)
+{
+    struct t_cose_sign1_sign_ctx sign_ctx;
+    enum t_cose_err_t            t_cose_err;
+    struct q_useful_buf_c        tag_head;
+    struct q_useful_buf_c        body;
+    struct q_useful_buf          body_buf;
+    struct q_useful_buf_c        cose_tag_head;
+    bool                         use_t_cose;
+
+    tag_head      = NULL_Q_USEFUL_BUF_C;
+    cose_tag_head = NULL_Q_USEFUL_BUF_C;
+
+    switch(protection) {
+        case CTOKEN_PROTECTION_NONE:
+            if(tagging == COSE_ENVELOPE_TAG_CWT) {
+                tag_head = (struct q_useful_buf_c){uccs_tag_head, sizeof(uccs_tag_head)};
+            }
+            break;
+
+        case CTOKEN_PROTECTION_COSE_SIGN1:
+        case CTOKEN_PROTECTION_COSE_MAC0:
+            if(tagging == COSE_ENVELOPE_TAG_CWT) {
+                tag_head = (struct q_useful_buf_c){cwt_tag_head, sizeof(cwt_tag_head)};
+            } else if(tagging == COSE_ENVELOPE_TAG_NONE) {
+                t_cose_opt_flags |= T_COSE_OPT_OMIT_CBOR_TAG;
+            }
+            break;
+
+        case CTOKEN_PROTECTION_SIGN1_ENCRYPT0:
+        case CTOKEN_PROTECTION_MAC0_ENCRYPT0:
+            return wrap_encrypted(claims_set, protection, tagging,
+                                  cose_algorithm_id, t_cose_opt_flags,
+                                  signing_key, kid, encryption_key,
+                                  out_buf, completed_token);
+
+        default:
+            fprintf(stderr, "unsupported output protection for passthrough\n");
+            return 1;
+    }
+
+    if(protection == CTOKEN_PROTECTION_COSE_MAC0) {
+        if(!key_is_hmac(signing_key)) {
+            fprintf(stderr, "COSE_Mac0 output needs a MAC key\n");
+            return 1;
+        }
+        use_t_cose = false;
+    } else if(protection == CTOKEN_PROTECTION_COSE_SIGN1) {
+        if((cose_algorithm_id == COSE_ALGORITHM_EDDSA) != key_is_ed25519(signing_key)) {
+            fprintf(stderr, "EdDSA needs an Ed25519 key and an Ed25519 key needs EdDSA\n");
+            return 1;
+        }
+        use_t_cose = !key_is_ed25519(signing_key);
+    } else {
+        use_t_cose = false;
+    }
+
+    /* t_cose puts on its own COSE tag. It is done here for the
+     * others. */
+    if(protection != CTOKEN_PROTECTION_NONE && !use_t_cose &&
+       !(t_cose_opt_flags & T_COSE_OPT_OMIT_CBOR_TAG)) {
+        if(protection == CTOKEN_PROTECTION_COSE_MAC0) {
+            cose_tag_head = (struct q_useful_buf_c){mac0_tag_head, sizeof(mac0_tag_head)};
+        } else {
+            cose_tag_head = (struct q_useful_buf_c){sign1_tag_head, sizeof(sign1_tag_head)};
+        }
+    }
+
+    if(out_buf.len < tag_head.len + cose_tag_head.len) {
+        return 1;
+    }
+    if(tag_head.len) {
+        memcpy(out_buf.ptr, tag_head.ptr, tag_head.len);
+    }
+    if(cose_tag_head.len) {
+        memcpy((uint8_t *)out_buf.ptr + tag_head.len, cose_tag_head.ptr, cose_tag_head.len);
+    }
+    body_buf.ptr = (uint8_t *)out_buf.ptr + tag_head.len + cose_tag_head.len;
+    body_buf.len = out_buf.len - tag_head.len - cose_tag_head.len;
+
+    if(protection == CTOKEN_PROTECTION_NONE) {
+        body = q_useful_buf_copy(body_buf, claims_set);
+        if(q_useful_buf_c_is_null(body)) {
+            return 1;
+        }
+
+    } else if(protection == CTOKEN_PROTECTION_COSE_MAC0) {
+        if(cose_mac0_create(claims_set, signing_key, kid, body_buf, &body)) {
+            return 1;
+        }
+
+    } else if(!use_t_cose) {
+        if(cose_eddsa_sign(claims_set, signing_key, kid, body_buf, &body)) {
+            return 1;
+        }
+
+    } else {
+        /* This is the only place the cost is: one hash of the
+         * claims-set plus one signature. */
+        t_cose_sign1_sign_init(&sign_ctx, t_cose_opt_flags, cose_algorithm_id);
+        t_cose_sign1_set_signing_key(&sign_ctx, signing_key, kid);
+        t_cose_err = t_cose_sign1_sign(&sign_ctx, claims_set, body_buf, &body);
+        if(t_cose_err != T_COSE_SUCCESS) {
+            fprintf(stderr, "signing failed. t_cose error %d\n", t_cose_err);
+            return 1;
+        }
+    }
+
+    *completed_token = (struct q_useful_buf_c){out_buf.ptr, tag_head.len + cose_tag_head.len + body.len};
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * cose_envelope.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_envelope_h
+#define cose_envelope_h
+
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include "ctoken/ctoken.h"
+#include <stdbool.h>
+
+
+/* This handles the outer layers of a token, the CBOR tags and the
+ * COSE_Sign1, without touching the claims in the payload. It is used
+ * for passthrough where a UCCS or CWT is re-signed, un-signed or
+ * re-tagged. The claims-set is carried over byte-for-byte so the cost
+ * is one hash and one signature no matter how many claims there are
+ * and claims that xclaim doesn't understand are not lost.
+ */
+
+
+/* How the outer layers of the output token are tagged. */
+enum cose_envelope_tag_t {
+    /* CWT tag (61) around the COSE tag or the UCCS tag (601) for an
+     * unsigned token. */
+    COSE_ENVELOPE_TAG_CWT,
+
+    /* Only the COSE tag. Nothing for an unsigned token. */
+    COSE_ENVELOPE_TAG_COSE,
+
+    /* No tags at all. */
+    COSE_ENVELOPE_TAG_NONE
+};
+
+
+/* Option flags for cose_envelope_unwrap() */
+
+/* Decode the COSE_Sign1, but don't check the signature. No key is
+ * needed. */
+#define COSE_ENVELOPE_OPT_NO_VERIFY 0x01
+
+/* The token must be a COSE_Sign1 or COSE_Mac0, even with
+ * COSE_ENVELOPE_OPT_NO_VERIFY. This is for -in_prot sign and mac. */
+#define COSE_ENVELOPE_OPT_REQUIRE_PROTECTED 0x02
+
+
+/* Strip the tags and verify the COSE_Sign1 or COSE_Mac0 of a UCCS or
+ * CWT and return the encoded claims-set. A COSE_Mac0 is recognized by
+ * its tag or by verification_key being a MAC key. The returned claims_set points into
+ * the input token. No claims are decoded, but the token must be one
+ * well-formed data item and the claims-set one well-formed map with
+ * nothing after either.
+ *
+ * A UCCS is an error when there is a verification_key and
+ * COSE_ENVELOPE_OPT_NO_VERIFY is not set. Otherwise a token with the
+ * COSE_Sign1 taken off would pass as verified.
+ *
+ * Returns 0 on success. On failure a message is printed to stderr and
+ * non-zero is returned.
+ */
+int cose_envelope_unwrap(struct q_useful_buf_c  token,
+                         uint32_t               option_flags,
+                         struct t_cose_key      verification_key,
+                         struct q_useful_buf_c *claims_set);
+
+
+/* Returns true if the token is a UCCS, a claims-set with no COSE
+ * around it, after skipping any tags. */
+bool cose_envelope_is_uccs(struct q_useful_buf_c token);
+
+
+/* COSE header labels for certificates from RFC 9360 */
+#define COSE_HEADER_PARAM_X5CHAIN 33
+#define COSE_HEADER_PARAM_X5T     34
+
+
+/* The four parts of a COSE_Sign1. Each points into the token. */
+struct cose_sign1_parts {
+    /* The encoded map inside the byte string. Empty if there are no
+     * protected headers. */
+    struct q_useful_buf_c protected_headers;
+
+    /* The encoded map */
+    struct q_useful_buf_c unprotected_headers;
+
+    /* The contents of the byte strings */
+    struct q_useful_buf_c payload;
+    struct q_useful_buf_c signature;
+};
+
+
+/* Split a COSE_Sign1, with or without tags, into its parts without
+ * verifying anything. A COSE_Mac0 has the same layout and works too
+ * with the MAC in signature. Returns 0 on success and -1 if the token is not
+ * a COSE_Sign1 or is not well-formed. */
+int cose_envelope_split_sign1(struct q_useful_buf_c    token,
+                              struct cose_sign1_parts *parts);
+
+
+/* Find an integer label in an encoded header map. Returns as for
+ * cose_envelope_find_header(). */
+int cose_envelope_find_in_map(struct q_useful_buf_c  map,
+                              int64_t                label,
+                              struct q_useful_buf_c *value);
+
+
+/* Find a header parameter with an integer label in a COSE_Sign1
+ * without verifying anything. The protected headers are searched
+ * first, then the unprotected. value is the encoded value and points
+ * into token.
+ *
+ * Returns 0 if found, 1 if not there and -1 if the token is not a
+ * COSE_Sign1 or is not well-formed.
+ */
+int cose_envelope_find_header(struct q_useful_buf_c  token,
+                              int64_t                label,
+                              struct q_useful_buf_c *value);
+
+
+/* Put an encoded claims-set into a UCCS or COSE_Sign1 and add the
+ * requested tags. The claims_set must be an encoded CBOR map, for
+ * example as returned by cose_envelope_unwrap().
+ *
+ * protection is CTOKEN_PROTECTION_NONE, CTOKEN_PROTECTION_COSE_SIGN1
+ * or CTOKEN_PROTECTION_COSE_MAC0. The remaining parameters are only
+ * used for the latter two and are the same as those for t_cose
+ * signing. COSE_ALGORITHM_EDDSA with an Ed25519 key is also accepted,
+ * see cose_eddsa.h. For COSE_Mac0 signing_key is a MAC key and
+ * cose_algorithm_id is ignored, see cose_mac0.h.
+ *
+ * protection may also be CTOKEN_PROTECTION_SIGN1_ENCRYPT0 or
+ * CTOKEN_PROTECTION_MAC0_ENCRYPT0. The COSE_Sign1 or COSE_Mac0 is then
+ * put in a COSE_Encrypt0 with encryption_key, an AES key, see
+ * cose_encrypt0.h. Otherwise encryption_key is not used.
+ *
+ * out_buf should be at least cose_envelope_wrap_size() bytes.
+ *
+ * Returns 0 on success. On failure a message is printed to stderr and
+ * non-zero is returned.
+ */
+int cose_envelope_wrap(struct q_useful_buf_c     claims_set,
+                       enum ctoken_protection_t  protection,
+                       enum cose_envelope_tag_t  tagging,
+                       int32_t                   cose_algorithm_id,
+                       uint32_t                  t_cose_opt_flags,
+                       struct t_cose_key         signing_key,
+                       struct q_useful_buf_c     kid,
+                       struct t_cose_key         encryption_key,
+                       struct q_useful_buf       out_buf,
+                       struct q_useful_buf_c    *completed_token);
+
+
+/* An upper bound on the size of the output of cose_envelope_wrap()
+ * for a claims-set and kid of the given sizes. */
+size_t cose_envelope_wrap_size(size_t claims_set_len, size_t kid_len);
+
+
+#endif /* cose_envelope_h */
@@ -0,0 +1,203 @@
+/*
+ * cose_mac0.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_mac0.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
+#include "cbor_seq.h"
+
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* The COSE header label for the algorithm */
+#define COSE_HEADER_PARAM_ALG 1
+
+/* The COSE header label for the key ID */
+#define COSE_HEADER_PARAM_KID 4
+
+/* The start of the MAC_structure, [ "MAC0", ... */
+static const uint8_t mac_structure_start[] = {0x84, 0x64, 'M', 'A', 'C', '0'};
+
+/* The protected headers this makes, {1: 5} */
+static const uint8_t hmac256_protected_headers[] = {0xa1, 0x01, 0x05};
+
+/* Biggest CBOR head */
+#define CBOR_HEAD_MAX 9
+
+
+/* HMACs a byte string head and its contents */
+static int hmac_byte_string(EVP_MAC_CTX *ctx, struct q_useful_buf_c bytes)
+{
+    uint8_t head[CBOR_HEAD_MAX];
+    size_t  head_len;
+
+    head_len = cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, bytes.len, head);
+
+    return EVP_MAC_update(ctx, head, head_len) &&
+           EVP_MAC_update(ctx, bytes.ptr, bytes.len);
+}
+
+
+/* Computes the MAC over the MAC_structure from RFC 8152 section 6.3.
+ * It is fed to HMAC a piece at a time so it is never put together in
+ * memory.
+ *
+ *   [ "MAC0", protected bstr, external_aad bstr, payload bstr ]
+ */
+static int compute_mac(struct t_cose_key     key,
+                       struct q_useful_buf_c protected_headers,
+                       struct q_useful_buf_c payload,
+                       uint8_t               mac[COSE_MAC0_TAG_LEN])
+{
+    static const uint8_t empty_aad = 0x40;
+
+    struct openssl_hmac_key *hmac_key;
+    EVP_MAC_CTX             *ctx;
+    size_t                   mac_len;
+    int                      ok;
+
+    hmac_key = key.k.key_ptr;
+
+    /* The copy already has the key processed */
+    ctx = EVP_MAC_CTX_dup(hmac_key->mac_ctx);
+    if(ctx == NULL) {
+        return 1;
+    }
+
+    ok = EVP_MAC_update(ctx, mac_structure_start, sizeof(mac_structure_start)) &&
+         hmac_byte_string(ctx, protected_headers) &&
+         EVP_MAC_update(ctx, &empty_aad, 1) &&
+         hmac_byte_string(ctx, payload) &&
+         EVP_MAC_final(ctx, mac, &mac_len, COSE_MAC0_TAG_LEN) &&
+         mac_len == COSE_MAC0_TAG_LEN;
+
+    EVP_MAC_CTX_free(ctx);
+
+    return ok ? 0 : 1;
+}
+
+
+/* Checks the protected headers say HMAC 256/256. */
+static bool alg_is_hmac256(struct q_useful_buf_c protected_headers)
+{
+    struct q_useful_buf_c value;
+    uint8_t               major_type;
+    uint8_t               additional_info;
+    uint64_t              argument;
+
+    if(protected_headers.len == 0 ||
+       cose_envelope_find_in_map(protected_headers, COSE_HEADER_PARAM_ALG, &value)) {
+        return false;
+    }
+
+    return cbor_decode_head(value, &major_type, &additional_info, &argument) != 0 &&
+           major_type == CBOR_MAJOR_TYPE_POSITIVE_INT &&
+           argument == COSE_ALGORITHM_HMAC256;
+}
+
+
+/*
+ * Public function. See cose_mac0.h
+ */
+int cose_mac0_verify(struct q_useful_buf_c   token,
+                     struct t_cose_key       key,
+                     struct q_useful_buf_c  *payload)
+{
+    struct cose_sign1_parts parts;
+    uint8_t                 mac[COSE_MAC0_TAG_LEN];
+
+    if(!key_is_hmac(key)) {
+        return 1;
+    }
+
+    /* A COSE_Mac0 has the same layout as a COSE_Sign1 */
+    if(cose_envelope_split_sign1(token, &parts) ||
+       !alg_is_hmac256(parts.protected_headers) ||
+       parts.signature.len != COSE_MAC0_TAG_LEN) {
+        return 1;
+    }
+
+    if(compute_mac(key, parts.protected_headers, parts.payload, mac)) {
+        return 1;
+    }
+
+    if(CRYPTO_memcmp(mac, parts.signature.ptr, COSE_MAC0_TAG_LEN) != 0) {
+        return 1;
+    }
+
+    *payload = parts.payload;
+
+    return 0;
+}
+
+
+/*
+ * Public function. See cose_mac0.h
+ */
+int cose_mac0_create(struct q_useful_buf_c  payload,
+                     struct t_cose_key      key,
+                     struct q_useful_buf_c  kid,
+                     struct q_useful_buf    out_buf,
+                     struct q_useful_buf_c *result)
+{
+    struct q_useful_buf_c protected_headers;
+    uint8_t              *out;
+    size_t                len;
+
+    if(!key_is_hmac(key)) {
+        fprintf(stderr, "COSE_Mac0 needs a MAC key\n");
+        return 1;
+    }
+    if(out_buf.len < payload.len + kid.len + COSE_MAC0_OVERHEAD) {
+        fprintf(stderr, "output buffer too small for COSE_Mac0\n");
+        return 1;
+    }
+
+    protected_headers = (struct q_useful_buf_c){hmac256_protected_headers, sizeof(hmac256_protected_headers)};
+
+    /* [ protected, unprotected, payload, tag ] */
+    out = out_buf.ptr;
+    len = 0;
+    out[len++] = 0x84;
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, protected_headers.len, out + len);
+    memcpy(out + len, protected_headers.ptr, protected_headers.len);
+    len += protected_headers.len;
+
+    if(kid.len > 0) {
+        out[len++] = 0xa1;
+        out[len++] = COSE_HEADER_PARAM_KID;
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, kid.len, out + len);
+        memcpy(out + len, kid.ptr, kid.len);
+        len += kid.len;
+    } else {
+        out[len++] = 0xa0;
+    }
+
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, payload.len, out + len);
+    memcpy(out + len, payload.ptr, payload.len);
+    len += payload.len;
+
+    len += cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, COSE_MAC0_TAG_LEN, out + len);
+    if(compute_mac(key, protected_headers, payload, out + len)) {
+        fprintf(stderr, "computing COSE_Mac0 MAC failed\n");
+        return 1;
+    }
+    len += COSE_MAC0_TAG_LEN;
+
+    *result = (struct q_useful_buf_c){out_buf.ptr, len};
+
+    return 0;
+}
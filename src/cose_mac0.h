@@ -0,0 +1,64 @@
+/*
+ * cose_mac0.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_mac0_h
+#define cose_mac0_h
+
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+
+
+/* COSE_Mac0 from RFC 8152 section 6.2 with HMAC-SHA256, COSE
+ * algorithm HMAC 256/256 (5). Neither t_cose nor ctoken do COSE_Mac0,
+ * so the MAC is made and checked here with OpenSSL and ctoken decodes
+ * the payload as a UCCS.
+ *
+ * An HMAC costs a few SHA-256 compression function calls, much less
+ * than an ECDSA signature or verification, which suits high-volume
+ * tokens between services that can share a key.
+ *
+ * The key is a struct t_cose_key from read_hmac_key_from_file(). The
+ * key is processed once when it is read, so each MAC costs only the
+ * hashing of the token.
+ */
+
+
+#define COSE_ALGORITHM_HMAC256 5
+
+#define COSE_MAC0_TAG_LEN 32
+
+/* Room for the array, headers, kid head, byte string heads and the
+ * MAC on top of the payload and kid */
+#define COSE_MAC0_OVERHEAD 70
+
+
+/* Checks a COSE_Mac0, tagged or not. The MAC is compared in constant
+ * time. On success 0 is returned and payload is the payload which
+ * points into token. Returns 1 if the token is not a COSE_Mac0 with
+ * alg HMAC 256/256 or the MAC is not valid. Nothing is printed. */
+int cose_mac0_verify(struct q_useful_buf_c   token,
+                     struct t_cose_key       key,
+                     struct q_useful_buf_c  *payload);
+
+
+/* Makes an untagged COSE_Mac0 for payload. kid goes in the unprotected
+ * headers if not empty. out_buf must be at least payload.len + kid.len
+ * + COSE_MAC0_OVERHEAD. Returns 0 on success. On failure a message is
+ * printed and 1 is returned. */
+int cose_mac0_create(struct q_useful_buf_c  payload,
+                     struct t_cose_key      key,
+                     struct q_useful_buf_c  kid,
+                     struct q_useful_buf    out_buf,
+                     struct q_useful_buf_c *result);
+
+
+#endif /* cose_mac0_h */
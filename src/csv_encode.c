@@ -0,0 +1,516 @@
+/*
+ * csv_encode.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "csv_encode.h"
+#include "arg_decode.h"
+#include "json_number.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* The most a location field can take, all nine numbers and the ";"
+ * between them */
+#define CSV_LOCATION_MAX_LEN (9 * JSON_NUMBER_MAX_LEN)
+
+
+/* Splits one column name like "tee.ta1.nonce" into the submodule path
+ * and the label. The path points into name. Returns 0 on success or 1
+ * on error after printing it. */
+static int parse_column(char *name, struct csv_column *column)
+{
+    char *dot;
+    char *part;
+
+    column->path_len = 0;
+
+    part = name;
+    while((dot = strchr(part, '.')) != NULL) {
+        if(dot == part || column->path_len == XCLAIM_MAX_NESTING) {
+            fprintf(stderr, "bad submodule path in column \"%s\"\n", column->name);
+            return 1;
+        }
+        column->path[column->path_len++] = (struct q_useful_buf_c){part, (size_t)(dot - part)};
+        part = dot + 1;
+    }
+
+    column->label = claim_label_from_string(part);
+    if(column->label == 0) {
+        fprintf(stderr, "unknown claim \"%s\" in column \"%s\"\n", part, column->name);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* Makes sure there are needed bytes free in the buffer, writing out
+ * what is there if not. The buffer is grown for a value bigger than
+ * it. */
+static int writer_reserve(struct csv_writer *me, size_t needed)
+{
+    uint8_t *new_buffer;
+
+    if(me->buffer_size - me->buffer_len >= needed) {
+        return 0;
+    }
+
+    if(me->buffer_len && fwrite(me->buffer, 1, me->buffer_len, me->output) != me->buffer_len) {
+        fprintf(stderr, "error writing CSV output\n");
+        return 1;
+    }
+    me->buffer_len = 0;
+
+    if(needed > me->buffer_size) {
+        new_buffer = realloc(me->buffer, needed);
+        if(new_buffer == NULL) {
+            fprintf(stderr, "out of memory for CSV output\n");
+            return 1;
+        }
+        me->buffer      = new_buffer;
+        me->buffer_size = needed;
+    }
+
+    return 0;
+}
+
+
+/* Copies a field into the buffer, quoted or escaped as needed. There
+ * must be room for twice its length plus two. */
+static void put_text(struct csv_writer *me, const uint8_t *text, size_t len)
+{
+    uint8_t *out = me->buffer + me->buffer_len;
+    size_t   i;
+    bool     quote;
+
+    if(me->form == CSV_FORM_TSV) {
+        for(i = 0; i < len; i++) {
+            switch(text[i]) {
+                case '\\': *out++ = '\\'; *out++ = '\\'; break;
+                case '\t': *out++ = '\\'; *out++ = 't';  break;
+                case '\r': *out++ = '\\'; *out++ = 'r';  break;
+                case '\n': *out++ = '\\'; *out++ = 'n';  break;
+                default:   *out++ = text[i];             break;
+            }
+        }
+        me->buffer_len = (size_t)(out - me->buffer);
+        return;
+    }
+
+    quote = false;
+    for(i = 0; i < len; i++) {
+        if(text[i] == ',' || text[i] == '"' || text[i] == '\r' || text[i] == '\n') {
+            quote = true;
+            break;
+        }
+    }
+
+    if(!quote) {
+        memcpy(out, text, len);
+        me->buffer_len += len;
+        return;
+    }
+
+    *out++ = '"';
+    for(i = 0; i < len; i++) {
+        if(text[i] == '"') {
+            *out++ = '"';
+        }
+        *out++ = text[i];
+    }
+    *out++ = '"';
+    me->buffer_len = (size_t)(out - me->buffer);
+}
+
+
+static void put_hex(struct csv_writer *me, const uint8_t *bytes, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    uint8_t *out = me->buffer + me->buffer_len;
+    size_t   i;
+
+    for(i = 0; i < len; i++) {
+        *out++ = (uint8_t)hex[bytes[i] >> 4];
+        *out++ = (uint8_t)hex[bytes[i] & 0x0f];
+    }
+    me->buffer_len += 2 * len;
+}
+
+
+static void put_location(struct csv_writer *me, const struct ctoken_location_t *location)
+{
+    char  *out   = (char *)me->buffer + me->buffer_len;
+    char  *start = out;
+    int    i;
+
+    for(i = CTOKEN_EAT_LABEL_LATITUDE; i <= NUM_FLOAT_LOCATION_ITEMS; i++) {
+        if(ctoken_location_is_item_present(location, i)) {
+            if(out != start) {
+                *out++ = ';';
+            }
+            out += json_format_double(location->items[i - 1], out);
+        }
+    }
+    if(ctoken_location_is_item_present(location, CTOKEN_EAT_LABEL_TIME_STAMP)) {
+        if(out != start) {
+            *out++ = ';';
+        }
+        out += json_format_uint64(location->time_stamp, out);
+    }
+    if(ctoken_location_is_item_present(location, CTOKEN_EAT_LABEL_AGE)) {
+        if(out != start) {
+            *out++ = ';';
+        }
+        out += json_format_uint64(location->age, out);
+    }
+
+    me->buffer_len += (size_t)(out - start);
+}
+
+
+/* Adds one field to the buffer. Returns 0 on success or 1 on error
+ * after printing it. */
+static int put_value(struct csv_writer *me, const struct xclaim *value)
+{
+    const QCBORItem *item = &(value->qcbor_item);
+    char            *out;
+
+    if(item->label.int64 == CTOKEN_EAT_LABEL_LOCATION) {
+        if(writer_reserve(me, CSV_LOCATION_MAX_LEN)) {
+            return 1;
+        }
+        put_location(me, &(value->u.location_claim));
+        return 0;
+    }
+
+    switch(item->uDataType) {
+        case QCBOR_TYPE_TEXT_STRING:
+            if(writer_reserve(me, 2 * item->val.string.len + 2)) {
+                return 1;
+            }
+            put_text(me, item->val.string.ptr, item->val.string.len);
+            return 0;
+
+        case QCBOR_TYPE_BYTE_STRING:
+            if(writer_reserve(me, 2 * item->val.string.len)) {
+                return 1;
+            }
+            put_hex(me, item->val.string.ptr, item->val.string.len);
+            return 0;
+
+        default:
+            break;
+    }
+
+    if(writer_reserve(me, JSON_NUMBER_MAX_LEN)) {
+        return 1;
+    }
+    out = (char *)me->buffer + me->buffer_len;
+
+    switch(item->uDataType) {
+        case QCBOR_TYPE_INT64:
+            me->buffer_len += json_format_int64(item->val.int64, out);
+            break;
+
+        case QCBOR_TYPE_UINT64:
+            me->buffer_len += json_format_uint64(item->val.uint64, out);
+            break;
+
+        case QCBOR_TYPE_DOUBLE:
+            me->buffer_len += json_format_double(item->val.dfnum, out);
+            break;
+
+        case QCBOR_TYPE_TRUE:
+            memcpy(out, "true", 4);
+            me->buffer_len += 4;
+            break;
+
+        case QCBOR_TYPE_FALSE:
+            memcpy(out, "false", 5);
+            me->buffer_len += 5;
+            break;
+
+        case QCBOR_TYPE_NULL:
+            memcpy(out, "null", 4);
+            me->buffer_len += 4;
+            break;
+
+        default:
+            /* Arrays, maps and such are an empty field */
+            break;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See csv_encode.h
+ */
+int csv_writer_init(struct csv_writer *me, FILE *output, enum csv_form_t form, const char *spec)
+{
+    struct csv_column *column;
+    char              *name;
+    char              *comma;
+
+    memset(me, 0, sizeof(*me));
+    me->output = output;
+    me->form   = form;
+    pthread_mutex_init(&me->lock, NULL);
+
+    me->buffer_size = CSV_BUFFER_SIZE;
+    me->buffer      = malloc(me->buffer_size);
+    me->spec        = strdup(spec);
+    if(me->buffer == NULL || me->spec == NULL) {
+        fprintf(stderr, "out of memory for CSV output\n");
+        return 1;
+    }
+
+    /* The header is the names as given. The spec is then cut up into
+     * the names. */
+    for(name = me->spec; ; name = comma + 1) {
+        comma = strchr(name, ',');
+        if(me->column_count == CSV_MAX_COLUMNS) {
+            fprintf(stderr, "too many columns. The limit is %d\n", CSV_MAX_COLUMNS);
+            return 1;
+        }
+        if(writer_reserve(me, 2 * strlen(name) + 4)) {
+            return 1;
+        }
+        if(me->column_count) {
+            me->buffer[me->buffer_len++] = form == CSV_FORM_TSV ? '\t' : ',';
+        }
+        put_text(me, (const uint8_t *)name, comma ? (size_t)(comma - name) : strlen(name));
+
+        if(comma != NULL) {
+            *comma = '\0';
+        }
+        column = &me->columns[me->column_count];
+        column->name = name;
+        if(parse_column(name, column)) {
+            return 1;
+        }
+        me->depth_masks[column->path_len] |= (uint64_t)1 << me->column_count;
+        me->column_count++;
+
+        if(comma == NULL) {
+            break;
+        }
+    }
+    me->buffer[me->buffer_len++] = '\n';
+
+    return 0;
+}
+
+
+/*
+ * Public function. See csv_encode.h
+ */
+int csv_writer_finish(struct csv_writer *me)
+{
+    if(me->failed) {
+        return 1;
+    }
+
+    if(me->buffer_len && fwrite(me->buffer, 1, me->buffer_len, me->output) != me->buffer_len) {
+        fprintf(stderr, "error writing CSV output\n");
+        return 1;
+    }
+    me->buffer_len = 0;
+
+    if(fflush(me->output) || ferror(me->output)) {
+        fprintf(stderr, "error writing CSV output\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See csv_encode.h
+ */
+void csv_writer_free(struct csv_writer *me)
+{
+    free(me->buffer);
+    free(me->spec);
+    pthread_mutex_destroy(&me->lock);
+
+    me->buffer = NULL;
+    me->spec   = NULL;
+}
+
+
+static enum xclaim_error_t csv_output_claim(void *ctx, const struct xclaim *claim)
+{
+    struct csv_row    *me     = (struct csv_row *)ctx;
+    struct csv_writer *writer = me->writer;
+    uint64_t           mask;
+    uint64_t           bit;
+    int                i;
+
+    /* Only the columns for this level that are not filled yet */
+    mask = me->prefix_masks[me->depth] & writer->depth_masks[me->depth] & ~me->filled;
+
+    while(mask) {
+        i     = __builtin_ctzll(mask);
+        bit   = (uint64_t)1 << i;
+        mask &= ~bit;
+        if(writer->columns[i].label == claim->qcbor_item.label.int64) {
+            me->values[i] = *claim;
+            me->filled   |= bit;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t csv_submods_section(void *ctx)
+{
+    (void)ctx;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* The columns for the new level are worked out once here rather than
+ * for each claim */
+static enum xclaim_error_t csv_open_submod(void *ctx, const struct q_useful_buf_c submod_name)
+{
+    struct csv_row          *me     = (struct csv_row *)ctx;
+    const struct csv_writer *writer = me->writer;
+    uint64_t                 mask;
+    uint64_t                 inner;
+    int                      i;
+
+    if(me->depth >= XCLAIM_MAX_NESTING) {
+        return XCLAIM_ERR_NESTING_TOO_DEEP;
+    }
+
+    mask  = me->prefix_masks[me->depth] & ~writer->depth_masks[me->depth];
+    inner = 0;
+    while(mask) {
+        i     = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        if(writer->columns[i].path_len > me->depth &&
+           q_useful_buf_compare(writer->columns[i].path[me->depth], submod_name) == 0) {
+            inner |= (uint64_t)1 << i;
+        }
+    }
+
+    me->depth++;
+    me->prefix_masks[me->depth] = inner;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t csv_close_submod(void *ctx)
+{
+    struct csv_row *me = (struct csv_row *)ctx;
+
+    if(me->depth > 0) {
+        me->depth--;
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t csv_output_nested(void                       *ctx,
+                                             const struct q_useful_buf_c submod_name,
+                                             struct q_useful_buf_c       nested_token)
+{
+    (void)ctx;
+    (void)submod_name;
+    (void)nested_token;
+
+    /* Nested tokens are not output */
+    return XCLAIM_SUCCESS;
+}
+
+
+/*
+ * Public function. See csv_encode.h
+ */
+void xclaim_csv_encode_init(xclaim_encoder    *encoder,
+                            struct csv_row    *row,
+                            struct csv_writer *writer)
+{
+    /* values is big and only read where filled is set, so it isn't
+     * cleared */
+    row->writer          = writer;
+    row->depth           = 0;
+    row->prefix_masks[0] = ~(uint64_t)0;
+    row->filled          = 0;
+
+    encoder->ctx                   = row;
+    encoder->output_claim          = csv_output_claim;
+    encoder->start_submods_section = csv_submods_section;
+    encoder->end_submods_section   = csv_submods_section;
+    encoder->open_submod           = csv_open_submod;
+    encoder->close_submod          = csv_close_submod;
+    encoder->output_nested         = csv_output_nested;
+}
+
+
+/*
+ * Public function. See csv_encode.h
+ */
+int csv_row_add(struct csv_row *row)
+{
+    struct csv_writer *me = row->writer;
+    uint8_t            separator;
+    uint32_t           i;
+    int                return_value;
+
+    separator = me->form == CSV_FORM_TSV ? '\t' : ',';
+
+    pthread_mutex_lock(&me->lock);
+
+    return_value = 1;
+    if(me->failed) {
+        /* Already printed */
+        goto Done;
+    }
+
+    for(i = 0; i < me->column_count; i++) {
+        if(i) {
+            if(writer_reserve(me, 1)) {
+                goto Failed;
+            }
+            me->buffer[me->buffer_len++] = separator;
+        }
+        if(row->filled & ((uint64_t)1 << i)) {
+            if(put_value(me, &row->values[i])) {
+                goto Failed;
+            }
+        }
+    }
+    if(writer_reserve(me, 1)) {
+        goto Failed;
+    }
+    me->buffer[me->buffer_len++] = '\n';
+
+    return_value = 0;
+    goto Done;
+
+Failed:
+    me->failed = true;
+
+Done:
+    pthread_mutex_unlock(&me->lock);
+    return return_value;
+}
@@ -0,0 +1,155 @@
+/*
+ * csv_encode.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef csv_encode_h
+#define csv_encode_h
+
+#include "xclaim.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+
+/* This is an xclaim_encoder that outputs each token as one line of
+ * CSV or TSV for spreadsheets, awk and the like. The columns are
+ * fixed by a list given when the writer is set up, so every line has
+ * the same columns in the same order whatever order the claims come
+ * in. The first line is the header, the column names.
+ *
+ * The column list is the -columns option. It is column names
+ * separated by commas. A name is a claim name like "ueid" or an
+ * integer label, after the names of the submodules it is in, each
+ * followed by a ".". For example
+ *
+ *     iat,ueid,tee.nonce,tee.ta1.12
+ *
+ * is the top-level iat and ueid, nonce in the submodule tee and claim
+ * 12 in the submodule ta1 in tee. Submodules whose names have a "."
+ * or "," in them can't be given. Claims that aren't in the list are
+ * not output. Nested tokens are not output.
+ *
+ * The values are
+ *
+ *     integers, floats  decimal
+ *     true, false       true and false
+ *     null              null
+ *     byte strings      hex
+ *     text strings      as they are
+ *     location          the fields that are present separated by ";"
+ *                       in the order of the location labels
+ *
+ * A claim not in the token is an empty field as are arrays and maps.
+ * When a label is in a token more than once, the first one is used.
+ *
+ * In CSV a field with a comma, double quote, CR or LF is put in
+ * double quotes and double quotes in it are doubled, as in RFC 4180.
+ * In TSV a backslash, tab, CR or LF in a field is output as \\, \t, \r
+ * or \n. Lines end in LF.
+ *
+ * Only the values for the columns are kept as the token is decoded,
+ * with strings left in the token. The line is made at the end of the
+ * token straight into the writer's output buffer, which is written
+ * out when it is full. Many threads can add lines to one writer.
+ */
+
+
+/* The most columns. The columns for a level are kept as a bit mask. */
+#define CSV_MAX_COLUMNS 64
+
+/* The size of the output buffer */
+#define CSV_BUFFER_SIZE (1024 * 1024)
+
+/* The columns when -columns is not given */
+#define CSV_DEFAULT_COLUMNS "iss,sub,aud,exp,nbf,iat,cti,ueid,nonce"
+
+
+enum csv_form_t {
+    CSV_FORM_CSV,
+    CSV_FORM_TSV
+};
+
+
+struct csv_column {
+    const char           *name;
+    int64_t               label;
+    uint32_t              path_len;
+    struct q_useful_buf_c path[XCLAIM_MAX_NESTING];
+};
+
+
+struct csv_writer {
+    FILE             *output;
+    enum csv_form_t   form;
+    pthread_mutex_t   lock;
+
+    /* The column list is copied into spec. The column names and paths
+     * point into it. */
+    char             *spec;
+    uint32_t          column_count;
+    struct csv_column columns[CSV_MAX_COLUMNS];
+
+    /* The columns for claims directly in a submodule at each depth */
+    uint64_t          depth_masks[XCLAIM_MAX_NESTING + 1];
+
+    uint8_t          *buffer;
+    size_t            buffer_len;
+    size_t            buffer_size;
+
+    /* Writing failed. Nothing more is added. */
+    bool              failed;
+};
+
+
+/* The values of one token. One of these is needed per token being
+ * processed. */
+struct csv_row {
+    struct csv_writer *writer;
+
+    /* The columns for the submodules at each depth and below */
+    uint32_t           depth;
+    uint64_t           prefix_masks[XCLAIM_MAX_NESTING + 1];
+
+    uint64_t           filled;
+    struct xclaim      values[CSV_MAX_COLUMNS];
+};
+
+
+/* Sets up a writer to output with the columns in spec and writes the
+ * header line. Returns 0 on success or 1 on error after printing it.
+ * csv_writer_free() must be called even on error. */
+int csv_writer_init(struct csv_writer *me, FILE *output, enum csv_form_t form, const char *spec);
+
+
+/* Writes out what is in the buffer. Returns 0 on success or 1 on
+ * error after printing it. */
+int csv_writer_finish(struct csv_writer *me);
+
+
+void csv_writer_free(struct csv_writer *me);
+
+
+/* Sets up encoder to gather the values of a token into row. Strings
+ * are not copied, so the token must still be in memory when
+ * csv_row_add() is called. */
+void xclaim_csv_encode_init(xclaim_encoder    *encoder,
+                            struct csv_row    *row,
+                            struct csv_writer *writer);
+
+
+/* Adds the line for the row gathered by the encoder once the token
+ * has been processed. Thread safe. Returns 0 on success or 1 on error
+ * after printing it. */
+int csv_row_add(struct csv_row *row);
+
+
+#endif /* csv_encode_h */
@@ -11,9 +11,14 @@
  */
 
 #include "ctoken_adapt.h"
+#include "cose_eddsa.h"
+#include "cose_mac0.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
 
 #include "ctoken/ctoken_encode.h"
 #include "ctoken/ctoken_decode.h"
+#include "qcbor/qcbor_spiffy_decode.h"
 
 #include <stdio.h> /* For error prints */
 
@@ -115,11 +120,13 @@ encode_xclaim(void *ctx, const struct xclaim *claim)
             break;
 
         default:
-            xclaim_encode_generic(e_ctx, &(claim->qcbor_item));
+            if(xclaim_encode_generic(e_ctx, &(claim->qcbor_item))) {
+                return XCLAIM_ERR_CLAIM_TYPE;
+            }
             break;
     }
 
-    return 0;
+    return XCLAIM_SUCCESS;
 }
 
 
@@ -203,7 +210,6 @@ Done:
 }
 
 
-
 static enum xclaim_error_t
 enter_submod(void *decode_ctx, uint32_t submod_index, struct q_useful_buf_c *submod_name)
 {
@@ -266,6 +272,175 @@ get_nth_nested_token(void                   *decode_ctx,
 }
 
 
+/* The cursor works with QCBOR directly as ctoken only has the
+ * index-based submodule API. The submods section is entered once and
+ * stays entered until the cursor gets to its end. */
+static enum xclaim_error_t
+next_submod(void *decode_ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct ctoken_decode_ctx *dctx = (struct ctoken_decode_ctx *)decode_ctx;
+    QCBORDecodeContext       *qctx = &(dctx->qcbor_decode_context);
+    QCBORItem                 item;
+    QCBORError                qcbor_error;
+
+    if(cursor->entered) {
+        /* Leave the submodule returned last time */
+        QCBORDecode_ExitMap(qctx);
+        cursor->entered = false;
+    }
+
+    qcbor_error = QCBORDecode_PeekNext(qctx, &item);
+    if(qcbor_error == QCBOR_ERR_NO_MORE_ITEMS) {
+        /* End of the submods section */
+        QCBORDecode_GetAndResetError(qctx);
+        QCBORDecode_ExitMap(qctx);
+        return XCLAIM_NO_MORE;
+    }
+    if(qcbor_error != QCBOR_SUCCESS) {
+        return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_NOT_WELL_FORMED;
+    }
+
+    if(item.uLabelType != QCBOR_TYPE_TEXT_STRING) {
+        return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_NAME_NOT_A_TEXT_STRING;
+    }
+
+    if(item.uDataType == QCBOR_TYPE_MAP) {
+        QCBORDecode_EnterMap(qctx, &item);
+        if(QCBORDecode_GetError(qctx) != QCBOR_SUCCESS) {
+            return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_STRUCTURE;
+        }
+        cursor->name    = item.label.string;
+        cursor->entered = true;
+        return XCLAIM_SUCCESS;
+    }
+
+    /* A nested token. It is consumed, not entered. */
+    QCBORDecode_VGetNextConsume(qctx, &item);
+    if(QCBORDecode_GetError(qctx) != QCBOR_SUCCESS) {
+        return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_NOT_WELL_FORMED;
+    }
+    if(item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+        cursor->nested_type = CTOKEN_TYPE_CWT;
+    } else if(item.uDataType == QCBOR_TYPE_TEXT_STRING) {
+        cursor->nested_type = CTOKEN_TYPE_JSON;
+    } else {
+        return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_TYPE;
+    }
+    cursor->name         = item.label.string;
+    cursor->nested_token = item.val.string;
+
+    return XCLAIM_SUBMOD_IS_TOKEN;
+}
+
+
+static enum xclaim_error_t
+first_submod(void *decode_ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct ctoken_decode_ctx *dctx = (struct ctoken_decode_ctx *)decode_ctx;
+    QCBORDecodeContext       *qctx = &(dctx->qcbor_decode_context);
+    QCBORError                qcbor_error;
+
+    cursor->entered = false;
+
+    QCBORDecode_EnterMapFromMapN(qctx, CTOKEN_EAT_LABEL_SUBMODS);
+    qcbor_error = QCBORDecode_GetError(qctx);
+    if(qcbor_error == QCBOR_ERR_LABEL_NOT_FOUND) {
+        /* No submods at this level */
+        QCBORDecode_GetAndResetError(qctx);
+        return XCLAIM_NO_MORE;
+    }
+    if(qcbor_error != QCBOR_SUCCESS) {
+        return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_SECTION;
+    }
+
+    return next_submod(decode_ctx, cursor);
+}
+
+
+/*
+ * Public function. See ctoken_adapt.h
+ */
+enum xclaim_error_t
+xclaim_ctoken_seek_submod(struct ctoken_decode_ctx    *ctx,
+                          const struct q_useful_buf_c *path,
+                          uint32_t                     path_len,
+                          struct xclaim_submod_cursor *found)
+{
+    QCBORDecodeContext *qctx = &(ctx->qcbor_decode_context);
+    QCBORItem           item;
+    QCBORError          qcbor_error;
+    uint32_t            depth;
+
+    found->entered = false;
+
+    for(depth = 0; depth < path_len; depth++) {
+        /* QCBOR finds the submods section by label without decoding
+         * the claims before it */
+        QCBORDecode_EnterMapFromMapN(qctx, CTOKEN_EAT_LABEL_SUBMODS);
+        qcbor_error = QCBORDecode_GetAndResetError(qctx);
+        if(qcbor_error == QCBOR_ERR_LABEL_NOT_FOUND) {
+            return XCLAIM_NO_MORE;
+        }
+        if(qcbor_error != QCBOR_SUCCESS) {
+            return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_SECTION;
+        }
+
+        /* Each submodule not on the path is consumed whole */
+        while(1) {
+            qcbor_error = QCBORDecode_PeekNext(qctx, &item);
+            if(qcbor_error == QCBOR_ERR_NO_MORE_ITEMS) {
+                return XCLAIM_NO_MORE;
+            }
+            if(qcbor_error != QCBOR_SUCCESS) {
+                return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_NOT_WELL_FORMED;
+            }
+            if(item.uLabelType != QCBOR_TYPE_TEXT_STRING) {
+                return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_NAME_NOT_A_TEXT_STRING;
+            }
+            if(!q_useful_buf_compare(item.label.string, path[depth])) {
+                break;
+            }
+            QCBORDecode_VGetNextConsume(qctx, &item);
+            if(QCBORDecode_GetError(qctx) != QCBOR_SUCCESS) {
+                return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_NOT_WELL_FORMED;
+            }
+        }
+
+        found->name = item.label.string;
+
+        if(item.uDataType == QCBOR_TYPE_MAP) {
+            QCBORDecode_EnterMap(qctx, &item);
+            if(QCBORDecode_GetError(qctx) != QCBOR_SUCCESS) {
+                return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_STRUCTURE;
+            }
+            continue;
+        }
+
+        /* A nested token. Its claims are not gone into, so it must be
+         * the end of the path. */
+        if(depth + 1 < path_len) {
+            return XCLAIM_NO_MORE;
+        }
+        QCBORDecode_VGetNextConsume(qctx, &item);
+        if(QCBORDecode_GetError(qctx) != QCBOR_SUCCESS) {
+            return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_CBOR_NOT_WELL_FORMED;
+        }
+        if(item.uDataType == QCBOR_TYPE_BYTE_STRING) {
+            found->nested_type = CTOKEN_TYPE_CWT;
+        } else if(item.uDataType == QCBOR_TYPE_TEXT_STRING) {
+            found->nested_type = CTOKEN_TYPE_JSON;
+        } else {
+            return XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_TYPE;
+        }
+        found->nested_token = item.val.string;
+
+        return XCLAIM_SUBMOD_IS_TOKEN;
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
 static void
 xclaim_ctoken_decode_setup(xclaim_decoder *ic, struct ctoken_decode_ctx *ctx)
 {
@@ -276,6 +451,8 @@ xclaim_ctoken_decode_setup(xclaim_decoder *ic, struct ctoken_decode_ctx *ctx)
     ic->enter_submod = enter_submod;
     ic->exit_submod  = exit_submod;
     ic->get_nested   = get_nth_nested_token;
+    ic->first_submod = first_submod;
+    ic->next_submod  = next_submod;
     /* Can use ctoken method directly, but need a cast to void * */
     ic->rewind       = (void (*)(void *))ctoken_decode_rewind;
 }
@@ -286,11 +463,60 @@ int xclaim_ctoken_decode_init(xclaim_decoder           *xclaim_decoder,
                               struct q_useful_buf_c     input_bytes,
                               struct t_cose_key         verification_key)
 {
-    enum ctoken_err_t error;
+    return xclaim_ctoken_decode_init_with_verifier(xclaim_decoder,
+                                                   ctx,
+                                                   input_bytes,
+                                                   verification_key,
+                                                   NULL);
+}
 
-    ctoken_decode_init(ctx, 0, 0, CTOKEN_PROTECTION_NONE);
 
-    if(verification_key.k.key_ptr != NULL) {
+int xclaim_ctoken_decode_init_with_verifier(xclaim_decoder             *xclaim_decoder,
+                                            struct ctoken_decode_ctx   *ctx,
+                                            struct q_useful_buf_c       input_bytes,
+                                            struct t_cose_key           verification_key,
+                                            struct cose_eddsa_verifier *eddsa)
+{
+    enum ctoken_err_t     error;
+    struct q_useful_buf_c payload;
+    uint32_t              t_cose_opt_flags;
+    int                   eddsa_result;
+
+    t_cose_opt_flags = 0;
+    if(key_is_hmac(verification_key)) {
+        /* Neither ctoken nor t_cose do COSE_Mac0. Check the MAC here
+         * and have ctoken decode the payload as a UCCS. */
+        if(cose_mac0_verify(input_bytes, verification_key, &payload)) {
+            fprintf(stderr, "token validation failed. MAC not valid\n");
+            return -9;
+        }
+        input_bytes = payload;
+        verification_key.k.key_ptr = NULL;
+
+    } else if(key_is_ed25519(verification_key)) {
+        /* t_cose doesn't do EdDSA. Check the signature here and have
+         * ctoken only decode. */
+        if(eddsa != NULL) {
+            eddsa->key   = verification_key;
+            eddsa_result = cose_eddsa_verify(eddsa, input_bytes, &payload);
+        } else {
+            eddsa_result = cose_eddsa_verify_one(input_bytes, verification_key, &payload);
+        }
+        if(eddsa_result) {
+            fprintf(stderr, "token validation failed. EdDSA signature not valid\n");
+            return -9;
+        }
+        t_cose_opt_flags = T_COSE_OPT_DECODE_ONLY;
+
+    } else if(verification_key.k.key_ptr != NULL && cose_envelope_is_uccs(input_bytes)) {
+        /* ctoken would decode it without complaint */
+        fprintf(stderr, "token validation failed. A UCCS has no signature to verify\n");
+        return -9;
+    }
+
+    ctoken_decode_init(ctx, t_cose_opt_flags, 0, CTOKEN_PROTECTION_NONE);
+
+    if(verification_key.k.key_ptr != NULL && t_cose_opt_flags == 0) {
         ctoken_decode_set_verification_key(ctx, verification_key);
     }
 
@@ -306,3 +532,35 @@ int xclaim_ctoken_decode_init(xclaim_decoder           *xclaim_decoder,
     return 0;
 }
 
+
+/*
+ * Public function. See ctoken_adapt.h
+ */
+int xclaim_ctoken_decode_init_verified(xclaim_decoder           *xclaim_decoder,
+                                       struct ctoken_decode_ctx *ctx,
+                                       struct q_useful_buf_c     input_bytes,
+                                       struct t_cose_key         verification_key)
+{
+    enum ctoken_err_t     error;
+    struct q_useful_buf_c claims_set;
+
+    /* The COSE is only taken apart and ctoken decodes the claims-set
+     * as a UCCS, as is done for COSE_Mac0 above */
+    if(cose_envelope_unwrap(input_bytes, COSE_ENVELOPE_OPT_NO_VERIFY, verification_key, &claims_set)) {
+        return 1;
+    }
+
+    ctoken_decode_init(ctx, 0, 0, CTOKEN_PROTECTION_NONE);
+
+    ctoken_decode_validate_token(ctx, claims_set);
+    error = ctoken_decode_get_and_reset_error(ctx);
+    if(error) {
+        fprintf(stderr, "token decoding failed. Ctoken error %d\n", error);
+        return 1;
+    }
+
+    xclaim_ctoken_decode_setup(xclaim_decoder, ctx);
+
+    return 0;
+}
+
@@ -17,14 +17,59 @@
 #include "ctoken/ctoken_encode.h"
 #include "ctoken/ctoken_decode.h"
 #include "t_cose/t_cose_common.h"
+#include "cose_eddsa.h"
 
 
 void xclaim_ctoken_encode_init(xclaim_encoder *out, struct ctoken_encode_ctx *ctx);
 
 
+/* Verifies input_bytes with verification_key and sets up to decode
+ * its claims. With a verification_key a UCCS is rejected as there is
+ * nothing to verify. Returns 0 on success. */
 int xclaim_ctoken_decode_init(xclaim_decoder           *xclaim_decoder,
                               struct ctoken_decode_ctx *ctx,
                               struct q_useful_buf_c     input_bytes,
                               struct t_cose_key         verification_key);
 
+
+/* Same as xclaim_ctoken_decode_init(), but an Ed25519 signature is
+ * checked with eddsa so its OpenSSL context and buffer are kept from
+ * one token to the next. eddsa's key is set to verification_key. */
+int xclaim_ctoken_decode_init_with_verifier(xclaim_decoder             *xclaim_decoder,
+                                            struct ctoken_decode_ctx   *ctx,
+                                            struct q_useful_buf_c       input_bytes,
+                                            struct t_cose_key           verification_key,
+                                            struct cose_eddsa_verifier *eddsa);
+
+
+/* Same as xclaim_ctoken_decode_init(), but the signature or MAC is
+ * not checked. This is for a token already known to be valid, such as
+ * one found in the verification cache. verification_key is only used
+ * to tell a COSE_Mac0 without a tag. */
+int xclaim_ctoken_decode_init_verified(xclaim_decoder           *xclaim_decoder,
+                                       struct ctoken_decode_ctx *ctx,
+                                       struct q_useful_buf_c     input_bytes,
+                                       struct t_cose_key         verification_key);
+
+
+/* Moves a decoder set up by xclaim_ctoken_decode_init() to the
+ * submodule at path so that only it is returned. path[0] is a
+ * submodule at the top level, path[1] one in that and so on. Only the
+ * labels of the items on the way are looked at. Claims and sibling
+ * submodules are skipped over as CBOR without being decoded, so the
+ * cost goes with the depth of the path, not the size of the token.
+ *
+ * Returns XCLAIM_SUCCESS when the submodule has been entered. The
+ * decoder then returns its claims and submodules as if it were the
+ * whole token. Returns XCLAIM_SUBMOD_IS_TOKEN when the last name in
+ * path is a nested token. It is put in found and not decoded. Returns
+ * XCLAIM_NO_MORE if there is no submodule at path. Nested
+ * tokens are not gone into, so that includes a path that goes through
+ * one. */
+enum xclaim_error_t
+xclaim_ctoken_seek_submod(struct ctoken_decode_ctx    *ctx,
+                          const struct q_useful_buf_c *path,
+                          uint32_t                     path_len,
+                          struct xclaim_submod_cursor *found);
+
 #endif /* ctoken_adapt_h */
@@ -0,0 +1,861 @@
+/*
+ * dir_batch.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "dir_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#ifdef XCLAIM_USE_IO_URING
+#include <liburing.h>
+#endif
+
+
+#define DEFAULT_IO_DEPTH 256
+
+/* The reader thread pool is only the fallback so it is not allowed
+ * to get as big as the io_uring queue can. */
+#define MAX_READER_THREADS 64
+
+
+/* A file that has been read and is waiting for a worker */
+struct batch_item {
+    const char           *path;
+    struct q_useful_buf_c contents;
+    int                   read_errno; /* 0 if the read succeeded */
+};
+
+
+/* Bounded queue from the readers to the workers. The readers block
+ * when it is full so memory use is bounded no matter how far ahead of
+ * the workers the reads get. */
+struct ready_queue {
+    pthread_mutex_t    lock;
+    pthread_cond_t     not_empty;
+    pthread_cond_t     not_full;
+    struct batch_item *items;
+    unsigned           capacity;
+    unsigned           head;
+    unsigned           count;
+    bool               reading_done;
+};
+
+
+struct file_list {
+    char  **paths;
+    size_t  count;
+    size_t  capacity;
+    size_t  base_len; /* Length of in_dir plus the / */
+};
+
+
+struct batch {
+    const struct dir_batch_options *options;
+    dir_batch_process_t             process;
+    void                           *context;
+
+    struct file_list                files;
+    atomic_size_t                   next_file;
+
+    struct ready_queue              queue;
+
+    /* For combined output */
+    pthread_mutex_t                 output_lock;
+};
+
+
+struct worker {
+    pthread_t     thread;
+    struct batch *batch;
+    int           status;
+};
+
+
+
+static int file_list_add(struct file_list *list, const char *path)
+{
+    char **grown;
+
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        grown = realloc(list->paths, list->capacity * sizeof(char *));
+        if(grown == NULL) {
+            return 1;
+        }
+        list->paths = grown;
+    }
+
+    list->paths[list->count] = strdup(path);
+    if(list->paths[list->count] == NULL) {
+        return 1;
+    }
+    list->count++;
+
+    return 0;
+}
+
+
+static void file_list_free(struct file_list *list)
+{
+    size_t i;
+
+    for(i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+}
+
+
+/* Adds the files in dir_path that match to the list, descending into
+ * subdirectories if recursive. */
+static int list_dir(struct file_list               *list,
+                    const char                     *dir_path,
+                    const struct dir_batch_options *options)
+{
+    DIR           *dir;
+    struct dirent *entry;
+    struct stat    entry_stat;
+    char          *path;
+    size_t         dir_len;
+    bool           is_dir;
+    bool           is_file;
+    int            return_value;
+
+    dir = opendir(dir_path);
+    if(dir == NULL) {
+        fprintf(stderr, "can't open directory \"%s\" (%s)\n", dir_path, strerror(errno));
+        return 1;
+    }
+
+    return_value = 0;
+    dir_len      = strlen(dir_path);
+
+    while((entry = readdir(dir)) != NULL) {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+
+        path = malloc(dir_len + strlen(entry->d_name) + 2);
+        if(path == NULL) {
+            return_value = 1;
+            break;
+        }
+        sprintf(path, "%s/%s", dir_path, entry->d_name);
+
+        /* d_type saves a stat per file on file systems that fill it in */
+        is_dir  = entry->d_type == DT_DIR;
+        is_file = entry->d_type == DT_REG;
+        if(entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            if(stat(path, &entry_stat) == 0) {
+                is_dir  = S_ISDIR(entry_stat.st_mode);
+                is_file = S_ISREG(entry_stat.st_mode);
+            }
+        }
+
+        if(is_dir) {
+            if(options->recursive) {
+                return_value = list_dir(list, path, options);
+            }
+        } else if(is_file) {
+            if(options->glob == NULL || fnmatch(options->glob, entry->d_name, 0) == 0) {
+                return_value = file_list_add(list, path);
+            }
+        }
+
+        free(path);
+        if(return_value) {
+            break;
+        }
+    }
+
+    closedir(dir);
+
+    return return_value;
+}
+
+
+
+static int ready_queue_init(struct ready_queue *queue, unsigned capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+
+    queue->items = malloc(capacity * sizeof(struct batch_item));
+    if(queue->items == NULL) {
+        return 1;
+    }
+    queue->capacity = capacity;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    return 0;
+}
+
+
+static void ready_queue_free(struct ready_queue *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+}
+
+
+static void ready_queue_push(struct ready_queue *queue, const struct batch_item *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->capacity) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = *item;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+/* Returns false when all files have been read and taken. */
+static bool ready_queue_pop(struct ready_queue *queue, struct batch_item *item)
+{
+    bool have_item;
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0 && !queue->reading_done) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    have_item = queue->count != 0;
+    if(have_item) {
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return have_item;
+}
+
+
+static void ready_queue_finish(struct ready_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->reading_done = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+
+static void push_read_error(struct batch *batch, const char *path, int read_errno)
+{
+    struct batch_item item;
+
+    item.path       = path;
+    item.contents   = NULL_Q_USEFUL_BUF_C;
+    item.read_errno = read_errno;
+
+    ready_queue_push(&batch->queue, &item);
+}
+
+
+/* Opens a file and allocates a buffer for all of it. The buffer is
+ * always at least one byte so an empty file is distinguishable from
+ * an error, as with read_file(). Returns 0 or an errno. */
+static int open_for_read(const char *path, int *fd, struct q_useful_buf *buffer)
+{
+    struct stat file_stat;
+
+    *fd = open(path, O_RDONLY);
+    if(*fd < 0) {
+        return errno;
+    }
+    if(fstat(*fd, &file_stat)) {
+        close(*fd);
+        return errno;
+    }
+
+    buffer->len = (size_t)file_stat.st_size;
+    buffer->ptr = malloc(buffer->len ? buffer->len : 1);
+    if(buffer->ptr == NULL) {
+        close(*fd);
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+
+
+/* The fallback reader. Each of these threads does blocking reads so
+ * the number of reads in flight is the number of threads. */
+static void *reader_thread(void *arg)
+{
+    struct batch       *batch = arg;
+    struct batch_item   item;
+    struct q_useful_buf buffer;
+    size_t              file_index;
+    size_t              done;
+    ssize_t             amount_read;
+    int                 fd;
+
+    while((file_index = atomic_fetch_add(&batch->next_file, 1)) < batch->files.count) {
+        item.path = batch->files.paths[file_index];
+
+        item.read_errno = open_for_read(item.path, &fd, &buffer);
+        if(item.read_errno) {
+            push_read_error(batch, item.path, item.read_errno);
+            continue;
+        }
+
+        for(done = 0; done < buffer.len; done += (size_t)amount_read) {
+            amount_read = read(fd, (uint8_t *)buffer.ptr + done, buffer.len - done);
+            if(amount_read <= 0) {
+                /* 0 is the file shrinking since the fstat */
+                item.read_errno = amount_read < 0 ? errno : 0;
+                break;
+            }
+        }
+        close(fd);
+
+        if(item.read_errno) {
+            free(buffer.ptr);
+            push_read_error(batch, item.path, item.read_errno);
+            continue;
+        }
+
+        item.contents = (struct q_useful_buf_c){buffer.ptr, done};
+        ready_queue_push(&batch->queue, &item);
+    }
+
+    return NULL;
+}
+
+
+static int read_with_threads(struct batch *batch)
+{
+    pthread_t threads[MAX_READER_THREADS];
+    unsigned  thread_count;
+    unsigned  i;
+
+    thread_count = batch->options->io_depth;
+    if(thread_count > MAX_READER_THREADS) {
+        thread_count = MAX_READER_THREADS;
+    }
+
+    for(i = 0; i < thread_count; i++) {
+        if(pthread_create(&threads[i], NULL, reader_thread, batch)) {
+            break;
+        }
+    }
+    if(i == 0) {
+        fprintf(stderr, "can't start reader threads\n");
+        return 1;
+    }
+
+    thread_count = i;
+    for(i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return 0;
+}
+
+
+
+#ifdef XCLAIM_USE_IO_URING
+
+/* One read in flight */
+struct read_slot {
+    const char         *path;
+    int                 fd;
+    struct q_useful_buf buffer;
+    size_t              done;
+    bool                in_flight;
+    bool                cancelled;
+};
+
+
+/* How long to wait for a cancelled read to come back */
+#define CANCEL_WAIT_SECONDS 5
+
+
+static void queue_read(struct io_uring *ring, struct read_slot *slot)
+{
+    struct io_uring_sqe *sqe;
+
+    /* Never NULL as there are never more reads than ring entries */
+    sqe = io_uring_get_sqe(ring);
+    io_uring_prep_read(sqe,
+                       slot->fd,
+                       (uint8_t *)slot->buffer.ptr + slot->done,
+                       (unsigned)(slot->buffer.len - slot->done),
+                       slot->done);
+    io_uring_sqe_set_data(sqe, slot);
+}
+
+
+static void finish_read(struct batch *batch, struct read_slot *slot, int read_errno)
+{
+    struct batch_item item;
+
+    close(slot->fd);
+
+    if(read_errno) {
+        free(slot->buffer.ptr);
+        push_read_error(batch, slot->path, read_errno);
+        return;
+    }
+
+    item.path       = slot->path;
+    item.contents   = (struct q_useful_buf_c){slot->buffer.ptr, slot->done};
+    item.read_errno = 0;
+    ready_queue_push(&batch->queue, &item);
+}
+
+
+/* Finishes a read that io_uring started with blocking reads */
+static void finish_read_sync(struct batch *batch, struct read_slot *slot)
+{
+    ssize_t amount_read;
+
+    while(slot->done < slot->buffer.len) {
+        amount_read = pread(slot->fd,
+                            (uint8_t *)slot->buffer.ptr + slot->done,
+                            slot->buffer.len - slot->done,
+                            (off_t)slot->done);
+        if(amount_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if(amount_read <= 0) {
+            /* 0 is the file shrinking since the fstat */
+            finish_read(batch, slot, amount_read < 0 ? errno : 0);
+            return;
+        }
+        slot->done += (size_t)amount_read;
+    }
+
+    finish_read(batch, slot, 0);
+}
+
+
+/* Cancels the reads in flight after io_uring has failed and waits for
+ * them all to come back so nothing is still reading into a buffer.
+ * Each is then finished with blocking reads. Returns 1 if they didn't
+ * all come back. Their buffers are then never freed as the kernel may
+ * still write to them. */
+static int drain_reads(struct batch     *batch,
+                       struct io_uring  *ring,
+                       struct read_slot *slots,
+                       unsigned          depth,
+                       unsigned          in_flight_count)
+{
+    struct io_uring_sqe     *sqe;
+    struct io_uring_cqe     *cqe;
+    struct read_slot        *slot;
+    struct __kernel_timespec timeout;
+    unsigned                 i;
+    int                      wait_result;
+
+    for(i = 0; i < depth; i++) {
+        if(!slots[i].in_flight) {
+            continue;
+        }
+        slots[i].cancelled = true;
+        /* NULL when the ring is full of reads that never got
+         * submitted. They are submitted with the cancels or never. */
+        sqe = io_uring_get_sqe(ring);
+        if(sqe != NULL) {
+            io_uring_prep_cancel(sqe, &slots[i], 0);
+            io_uring_sqe_set_data(sqe, NULL);
+        }
+    }
+    io_uring_submit(ring);
+
+    while(in_flight_count > 0) {
+        timeout.tv_sec  = CANCEL_WAIT_SECONDS;
+        timeout.tv_nsec = 0;
+        wait_result = io_uring_wait_cqe_timeout(ring, &cqe, &timeout);
+        if(wait_result == -EINTR) {
+            continue;
+        }
+        if(wait_result < 0) {
+            break;
+        }
+
+        slot = io_uring_cqe_get_data(cqe);
+        if(slot != NULL) {
+            /* Cancelled or done. Either way the kernel is done with
+             * the buffer. */
+            if(cqe->res > 0) {
+                slot->done += (size_t)cqe->res;
+            }
+            slot->in_flight = false;
+            in_flight_count--;
+        }
+        io_uring_cqe_seen(ring, cqe);
+    }
+
+    for(i = 0; i < depth; i++) {
+        slot = &slots[i];
+        if(!slot->cancelled) {
+            continue;
+        }
+        if(slot->in_flight) {
+            push_read_error(batch, slot->path, ECANCELED);
+        } else {
+            finish_read_sync(batch, slot);
+        }
+    }
+
+    return in_flight_count > 0 ? 1 : 0;
+}
+
+
+/* All reads are issued from this one thread. Up to io_depth of them
+ * are in flight at once. Returns -1 if io_uring is not available or
+ * fails part way, after which the caller reads the files from
+ * batch->next_file on with threads. Returns 1 if reads were lost. */
+static int read_with_io_uring(struct batch *batch)
+{
+    struct io_uring     ring;
+    struct io_uring_cqe *cqe;
+    struct read_slot    *slots;
+    struct read_slot   **free_slots;
+    struct read_slot    *slot;
+    unsigned             depth;
+    unsigned             free_count;
+    unsigned             i;
+    size_t               file_index;
+    int                  read_errno;
+    int                  submit_result;
+    int                  return_value;
+
+    depth = batch->options->io_depth;
+
+    if(io_uring_queue_init(depth, &ring, 0) < 0) {
+        return -1;
+    }
+
+    slots      = calloc(depth, sizeof(struct read_slot));
+    free_slots = calloc(depth, sizeof(struct read_slot *));
+    if(slots == NULL || free_slots == NULL) {
+        free(slots);
+        free(free_slots);
+        io_uring_queue_exit(&ring);
+        return -1;
+    }
+    for(i = 0; i < depth; i++) {
+        free_slots[i] = &slots[i];
+    }
+    free_count   = depth;
+    file_index   = 0;
+    return_value = 0;
+
+    while(1) {
+        /* Fill all the free slots. Opens are still synchronous, but
+         * they are cheap next to cold reads of the contents. */
+        while(free_count > 0 && file_index < batch->files.count) {
+            slot = free_slots[free_count - 1];
+            slot->path = batch->files.paths[file_index++];
+            slot->done = 0;
+
+            read_errno = open_for_read(slot->path, &slot->fd, &slot->buffer);
+            if(read_errno) {
+                push_read_error(batch, slot->path, read_errno);
+                continue;
+            }
+            if(slot->buffer.len == 0) {
+                finish_read(batch, slot, 0);
+                continue;
+            }
+
+            free_count--;
+            slot->in_flight = true;
+            queue_read(&ring, slot);
+        }
+
+        if(free_count == depth) {
+            /* Nothing in flight and nothing left to read */
+            break;
+        }
+
+        submit_result = io_uring_submit_and_wait(&ring, 1);
+        if(submit_result < 0) {
+            if(submit_result == -EINTR) {
+                continue;
+            }
+            fprintf(stderr, "io_uring failed (%s), reading with threads\n", strerror(-submit_result));
+            if(drain_reads(batch, &ring, slots, depth, depth - free_count)) {
+                fprintf(stderr, "reads still in flight after io_uring failed\n");
+                return_value = 1;
+            } else {
+                atomic_store(&batch->next_file, file_index);
+                return_value = -1;
+            }
+            break;
+        }
+
+        while(io_uring_peek_cqe(&ring, &cqe) == 0) {
+            slot = io_uring_cqe_get_data(cqe);
+
+            if(cqe->res < 0) {
+                slot->in_flight = false;
+                finish_read(batch, slot, -cqe->res);
+                free_slots[free_count++] = slot;
+
+            } else if(cqe->res == 0 || slot->done + (size_t)cqe->res == slot->buffer.len) {
+                /* 0 is the file shrinking since the fstat */
+                slot->done += (size_t)cqe->res;
+                slot->in_flight = false;
+                finish_read(batch, slot, 0);
+                free_slots[free_count++] = slot;
+
+            } else {
+                /* Short read. Go for the rest. */
+                slot->done += (size_t)cqe->res;
+                queue_read(&ring, slot);
+            }
+
+            io_uring_cqe_seen(&ring, cqe);
+        }
+    }
+
+    io_uring_queue_exit(&ring);
+    free(slots);
+    free(free_slots);
+
+    return return_value;
+}
+
+#endif /* XCLAIM_USE_IO_URING */
+
+
+
+/* Makes the output file name and any directories it needs. */
+static char *make_output_path(const struct dir_batch_options *options,
+                              const char                     *relative_path)
+{
+    char       *out_path;
+    char       *slash;
+    const char *suffix;
+    size_t      keep_len;
+    size_t      dir_len;
+
+    /* The input's suffix, if any, is replaced */
+    suffix   = strrchr(relative_path, '.');
+    keep_len = strlen(relative_path);
+    if(suffix != NULL && strchr(suffix, '/') == NULL) {
+        keep_len = (size_t)(suffix - relative_path);
+    }
+
+    dir_len  = strlen(options->out_dir);
+    out_path = malloc(dir_len + keep_len + strlen(options->out_suffix) + 2);
+    if(out_path == NULL) {
+        return NULL;
+    }
+    sprintf(out_path,
+            "%s/%.*s%s",
+            options->out_dir,
+            (int)keep_len,
+            relative_path,
+            options->out_suffix);
+
+    /* For -in_recursive the subdirectories are made as needed */
+    for(slash = strchr(out_path + dir_len + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(out_path, 0777);
+        *slash = '/';
+    }
+
+    return out_path;
+}
+
+
+/* Runs the process callback on one file that has been read. */
+static int process_item(struct batch *batch, const struct batch_item *item)
+{
+    const struct dir_batch_options *options = batch->options;
+    FILE                           *output;
+    char                           *out_path;
+    char                           *memory;
+    size_t                          memory_len;
+    int                             status;
+
+    if(item->read_errno) {
+        fprintf(stderr, "error reading \"%s\" (%s)\n", item->path, strerror(item->read_errno));
+        return 1;
+    }
+    if(item->contents.len == 0) {
+        fprintf(stderr, "input \"%s\" is empty\n", item->path);
+        return 1;
+    }
+
+    memory   = NULL;
+    out_path = NULL;
+
+    if(options->out_dir != NULL) {
+        out_path = make_output_path(options, item->path + batch->files.base_len);
+        output = out_path ? fopen(out_path, "w") : NULL;
+        if(output == NULL) {
+            fprintf(stderr, "error opening output file \"%s\" (%s)\n",
+                    out_path ? out_path : item->path,
+                    strerror(errno));
+            free(out_path);
+            return 1;
+        }
+    } else {
+        /* Output is collected so that output for different files
+         * doesn't get interleaved in the combined output. */
+        output = open_memstream(&memory, &memory_len);
+        if(output == NULL) {
+            return 1;
+        }
+    }
+
+    status = (*batch->process)(batch->context, item->path, item->contents, output);
+
+    fclose(output);
+
+    if(status == 1) {
+        fprintf(stderr, "error processing \"%s\"\n", item->path);
+    } else if(memory != NULL) {
+        pthread_mutex_lock(&batch->output_lock);
+        fwrite(memory, 1, memory_len, options->combined_output);
+        pthread_mutex_unlock(&batch->output_lock);
+    }
+
+    free(memory);
+    free(out_path);
+
+    return status;
+}
+
+
+static void *worker_thread(void *arg)
+{
+    struct worker    *worker = arg;
+    struct batch_item item;
+    int               status;
+
+    while(ready_queue_pop(&worker->batch->queue, &item)) {
+        status = process_item(worker->batch, &item);
+        if(status > worker->status) {
+            worker->status = status;
+        }
+        free((void *)item.contents.ptr);
+    }
+
+    return NULL;
+}
+
+
+
+/*
+ * Public function. See dir_batch.h
+ */
+int dir_batch_run(const struct dir_batch_options *options,
+                  dir_batch_process_t             process,
+                  void                           *context)
+{
+    struct dir_batch_options actual_options;
+    struct batch             batch;
+    struct worker           *workers;
+    unsigned                 worker_count;
+    unsigned                 i;
+    int                      return_value;
+    int                      read_result;
+
+    actual_options = *options;
+    if(actual_options.io_depth == 0) {
+        actual_options.io_depth = DEFAULT_IO_DEPTH;
+    }
+    if(actual_options.workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        actual_options.workers = cpus > 0 ? (unsigned)cpus : 1;
+    }
+
+    memset(&batch, 0, sizeof(batch));
+    batch.options  = &actual_options;
+    batch.process  = process;
+    batch.context  = context;
+    atomic_init(&batch.next_file, 0);
+
+    batch.files.base_len = strlen(actual_options.in_dir) + 1;
+    if(list_dir(&batch.files, actual_options.in_dir, &actual_options)) {
+        file_list_free(&batch.files);
+        return 1;
+    }
+
+    if(actual_options.out_dir != NULL) {
+        if(mkdir(actual_options.out_dir, 0777) && errno != EEXIST) {
+            fprintf(stderr, "can't make output directory \"%s\" (%s)\n",
+                    actual_options.out_dir,
+                    strerror(errno));
+            file_list_free(&batch.files);
+            return 1;
+        }
+    }
+
+    workers = calloc(actual_options.workers, sizeof(struct worker));
+    if(workers == NULL || ready_queue_init(&batch.queue, actual_options.io_depth * 2)) {
+        free(workers);
+        file_list_free(&batch.files);
+        return 1;
+    }
+    pthread_mutex_init(&batch.output_lock, NULL);
+
+    for(worker_count = 0; worker_count < actual_options.workers; worker_count++) {
+        workers[worker_count].batch = &batch;
+        if(pthread_create(&workers[worker_count].thread, NULL, worker_thread, &workers[worker_count])) {
+            break;
+        }
+    }
+
+    return_value = 0;
+    if(worker_count == 0) {
+        fprintf(stderr, "can't start worker threads\n");
+        return_value = 1;
+    } else {
+        read_result = -1;
+#ifdef XCLAIM_USE_IO_URING
+        read_result = read_with_io_uring(&batch);
+#endif
+        if(read_result < 0) {
+            read_result = read_with_threads(&batch);
+        }
+        return_value = read_result;
+    }
+
+    ready_queue_finish(&batch.queue);
+
+    for(i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if(workers[i].status > return_value) {
+            return_value = workers[i].status;
+        }
+    }
+
+    pthread_mutex_destroy(&batch.output_lock);
+    ready_queue_free(&batch.queue);
+    free(workers);
+    file_list_free(&batch.files);
+
+    return return_value;
+}
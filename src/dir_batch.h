@@ -0,0 +1,84 @@
+/*
+ * dir_batch.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef dir_batch_h
+#define dir_batch_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdio.h>
+#include <stdbool.h>
+
+
+/* This is for -in_dir. It processes every file in a directory, for
+ * example an archive of millions of small .cbor tokens, in one run of
+ * xclaim.
+ *
+ * Reading and processing are separate. Many reads are kept in flight
+ * so the storage device is kept busy. With io_uring they are all
+ * issued from one thread. Without it, a pool of reader threads each
+ * does blocking reads. Files that have been read go on a queue that a
+ * pool of worker threads takes from to verify, convert and output.
+ *
+ * io_uring is used when xclaim is built with XCLAIM_USE_IO_URING and
+ * liburing. See the Makefile. If io_uring fails part way, the reads
+ * in flight are cancelled and finished with blocking reads and the
+ * rest of the files are read by the reader threads.
+ */
+
+
+struct dir_batch_options {
+    const char *in_dir;
+
+    /* fnmatch() pattern the file name must match. NULL for all files */
+    const char *glob;
+
+    bool        recursive;
+
+    /* If not NULL, each output goes in a file here with the same
+     * relative path as the input, but with out_suffix in place of its
+     * suffix. If NULL all output goes to combined_output. */
+    const char *out_dir;
+    const char *out_suffix;
+    FILE       *combined_output;
+
+    /* Number of worker threads. 0 for one per CPU */
+    unsigned    workers;
+
+    /* Max number of reads in flight */
+    unsigned    io_depth;
+};
+
+
+/* Processes one file. This is called from the worker threads so it
+ * must be thread safe. path is the path of the input file. output is
+ * where the output goes. Returns 0 on success, otherwise an exit
+ * status. */
+typedef int (*dir_batch_process_t)(void                 *context,
+                                   const char           *path,
+                                   struct q_useful_buf_c input_bytes,
+                                   FILE                 *output);
+
+
+/* Runs process on every file that matches. Failures are reported on
+ * stderr with the file name and processing goes on with the next
+ * file.
+ *
+ * Returns 0 if all files were processed successfully, 1 if the
+ * directory can't be read, otherwise the largest exit status returned
+ * by process.
+ */
+int dir_batch_run(const struct dir_batch_options *options,
+                  dir_batch_process_t             process,
+                  void                           *context);
+
+
+#endif /* dir_batch_h */
@@ -0,0 +1,913 @@
+/*
+ * eat_profile.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "eat_profile.h"
+#include "arg_decode.h"
+#include "useful_file_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define RULE_BIT(n) (((uint64_t)1) << (n))
+
+
+/* The profiles that can be given by name to -profile */
+
+/* A device whose attestation is rooted in hardware. The ueid and
+ * nonce lengths are the ones allowed by EAT. */
+static const char *hardware_rules[] = {
+    "require:/ueid",
+    "type:ueid=bstr",
+    "length:ueid=7-33",
+    "require:/nonce",
+    "type:nonce=bstr",
+    "length:nonce=8-64",
+    "require:/seclevel",
+    "allow:seclevel=secure_restricted,hardware",
+    "allow:dbgstat=disabled_since_boot,disabled_permanent,disabled_full_permanent",
+    NULL
+};
+
+static const struct {
+    const char  *name;
+    const char **rules;
+} builtin_profiles[] = {
+    {"hardware", hardware_rules},
+};
+
+
+/* Fibonacci hashing of the label into the table */
+static inline uint32_t label_slot(int64_t label)
+{
+    return (uint32_t)(((uint64_t)label * 0x9E3779B97F4A7C15ULL) >> 32) &
+           (EAT_PROFILE_TABLE_SIZE - 1);
+}
+
+
+/* Returns the first rule for the label or -1 if there is none. */
+static int8_t first_rule(const struct eat_profile *profile, int64_t label)
+{
+    uint32_t slot;
+
+    for(slot = label_slot(label);
+        profile->table[slot].first >= 0;
+        slot = (slot + 1) & (EAT_PROFILE_TABLE_SIZE - 1)) {
+        if(profile->table[slot].label == label) {
+            return profile->table[slot].first;
+        }
+    }
+
+    return -1;
+}
+
+
+/* Adds rule n to the end of the list for its label */
+static void add_to_table(struct eat_profile *profile, int8_t n)
+{
+    uint32_t slot;
+    int8_t   last;
+    int64_t  label;
+
+    label = profile->rules[n].label;
+    profile->rules[n].next = -1;
+
+    for(slot = label_slot(label);
+        profile->table[slot].first >= 0;
+        slot = (slot + 1) & (EAT_PROFILE_TABLE_SIZE - 1)) {
+        if(profile->table[slot].label == label) {
+            for(last = profile->table[slot].first;
+                profile->rules[last].next >= 0;
+                last = profile->rules[last].next);
+            profile->rules[last].next = n;
+            return;
+        }
+    }
+
+    profile->table[slot].label = label;
+    profile->table[slot].first = n;
+}
+
+
+static int parse_check(const char *check, size_t len, enum eat_profile_check_t *result)
+{
+    static const struct {
+        const char              *name;
+        enum eat_profile_check_t check;
+    } checks[] = {
+        {"require", EAT_PROFILE_REQUIRE},
+        {"type",    EAT_PROFILE_TYPE},
+        {"allow",   EAT_PROFILE_ALLOW},
+        {"length",  EAT_PROFILE_LENGTH},
+        {"submod",  EAT_PROFILE_SUBMOD},
+    };
+    size_t i;
+
+    for(i = 0; i < sizeof(checks)/sizeof(checks[0]); i++) {
+        if(strlen(checks[i].name) == len && !strncmp(check, checks[i].name, len)) {
+            *result = checks[i].check;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/* Splits the scope, e.g. "a/b/", into the submodule names. This is
+ * the same syntax as for -filter. */
+static int parse_scope(const char *scope, const char *scope_end, struct eat_profile_rule *rule)
+{
+    const char *slash;
+
+    rule->any_level = false;
+    rule->path_len  = 0;
+
+    if(*scope == '/') {
+        scope++;
+    }
+
+    while(scope < scope_end) {
+        slash = memchr(scope, '/', (size_t)(scope_end - scope));
+        if(slash == scope) {
+            return 1;
+        }
+        if(rule->path_len == XCLAIM_MAX_NESTING) {
+            return 1;
+        }
+        rule->path[rule->path_len++] = (struct q_useful_buf_c){scope, (size_t)(slash - scope)};
+        scope = slash + 1;
+    }
+
+    return 0;
+}
+
+
+/* The next item in a comma-separated list copied into a new string.
+ * list is moved past it. Returns NULL at the end. */
+static char *next_list_item(const char **list)
+{
+    const char *comma;
+    char       *item;
+
+    if(*list == NULL) {
+        return NULL;
+    }
+
+    comma = strchr(*list, ',');
+    if(comma == NULL) {
+        item  = strdup(*list);
+        *list = NULL;
+    } else {
+        item  = strndup(*list, (size_t)(comma - *list));
+        *list = comma + 1;
+    }
+
+    return item;
+}
+
+
+static int parse_types(const char *argument, uint64_t *types)
+{
+    static const struct {
+        const char *name;
+        uint64_t    types;
+    } type_names[] = {
+        {"int",   RULE_BIT(QCBOR_TYPE_INT64) | RULE_BIT(QCBOR_TYPE_UINT64)},
+        {"bstr",  RULE_BIT(QCBOR_TYPE_BYTE_STRING)},
+        {"tstr",  RULE_BIT(QCBOR_TYPE_TEXT_STRING)},
+        {"bool",  RULE_BIT(QCBOR_TYPE_TRUE) | RULE_BIT(QCBOR_TYPE_FALSE)},
+        {"float", RULE_BIT(QCBOR_TYPE_DOUBLE) | RULE_BIT(QCBOR_TYPE_FLOAT)},
+        {"null",  RULE_BIT(QCBOR_TYPE_NULL)},
+        {"map",   RULE_BIT(QCBOR_TYPE_MAP)},
+        {"array", RULE_BIT(QCBOR_TYPE_ARRAY)},
+    };
+    char  *item;
+    size_t i;
+    int    return_value;
+
+    *types = 0;
+    return_value = 0;
+
+    while(return_value == 0 && (item = next_list_item(&argument)) != NULL) {
+        return_value = 1;
+        for(i = 0; i < sizeof(type_names)/sizeof(type_names[0]); i++) {
+            if(!strcmp(item, type_names[i].name)) {
+                *types |= type_names[i].types;
+                return_value = 0;
+                break;
+            }
+        }
+        free(item);
+    }
+
+    return return_value;
+}
+
+
+static int parse_values(const char *argument, int64_t label, uint64_t *values)
+{
+    struct xclaim claim;
+    char         *item;
+    int           return_value;
+
+    *values = 0;
+    return_value = 0;
+
+    while(return_value == 0 && (item = next_list_item(&argument)) != NULL) {
+        memset(&claim, 0, sizeof(claim));
+        return_value = claim_from_string(label, item, &claim);
+        if(return_value == 0) {
+            if(claim.qcbor_item.uDataType != QCBOR_TYPE_INT64 ||
+               claim.qcbor_item.val.int64 < 0 ||
+               claim.qcbor_item.val.int64 >= 64) {
+                return_value = 1;
+            } else {
+                *values |= RULE_BIT(claim.qcbor_item.val.int64);
+            }
+        }
+        free(item);
+    }
+
+    return return_value;
+}
+
+
+static int parse_length(const char *argument, size_t *min_len, size_t *max_len)
+{
+    char *end;
+
+    if(!isdigit((unsigned char)*argument)) {
+        return 1;
+    }
+    *min_len = (size_t)strtoull(argument, &end, 10);
+    *max_len = *min_len;
+
+    if(*end == '-') {
+        argument = end + 1;
+        if(!isdigit((unsigned char)*argument)) {
+            return 1;
+        }
+        *max_len = (size_t)strtoull(argument, &end, 10);
+    }
+
+    return *end != '\0' || *max_len < *min_len;
+}
+
+
+/* Parses one rule. The path and submodule name point into rule_arg
+ * so it must stay valid. */
+static int parse_rule(const char *rule_arg, struct eat_profile_rule *rule)
+{
+    const char *spec;
+    const char *label_start;
+    const char *label_end;
+    const char *argument;
+    const char *c;
+    char       *label_string;
+
+    memset(rule, 0, sizeof(*rule));
+    rule->text = rule_arg;
+
+    spec = strchr(rule_arg, ':');
+    if(spec == NULL) {
+        fprintf(stderr, "profile rule \"%s\" should be <check>:<label>\n", rule_arg);
+        return 1;
+    }
+    if(parse_check(rule_arg, (size_t)(spec - rule_arg), &rule->check)) {
+        fprintf(stderr, "unknown check in profile rule \"%s\"\n", rule_arg);
+        return 1;
+    }
+    spec++;
+
+    argument  = strchr(spec, '=');
+    label_end = argument ? argument : spec + strlen(spec);
+    if(argument) {
+        argument++;
+    }
+
+    /* The label is after the last '/' of the scope */
+    label_start = spec;
+    for(c = spec; c < label_end; c++) {
+        if(*c == '/') {
+            label_start = c + 1;
+        }
+    }
+
+    rule->any_level = true;
+    if(label_start != spec) {
+        if(parse_scope(spec, label_start, rule)) {
+            fprintf(stderr, "bad submodule scope in profile rule \"%s\"\n", rule_arg);
+            return 1;
+        }
+    }
+
+    if((rule->check == EAT_PROFILE_REQUIRE || rule->check == EAT_PROFILE_SUBMOD) && argument != NULL) {
+        fprintf(stderr, "profile rule \"%s\" doesn't take a value\n", rule_arg);
+        return 1;
+    }
+    if(rule->check != EAT_PROFILE_REQUIRE && rule->check != EAT_PROFILE_SUBMOD && argument == NULL) {
+        fprintf(stderr, "profile rule \"%s\" needs a value\n", rule_arg);
+        return 1;
+    }
+
+    if(rule->check == EAT_PROFILE_SUBMOD) {
+        /* Without a scope it would be needed in every submodule,
+         * including itself */
+        if(rule->any_level || label_start == label_end) {
+            fprintf(stderr, "profile rule \"%s\" needs a scope, e.g. submod:/name\n", rule_arg);
+            return 1;
+        }
+        rule->submod_name = (struct q_useful_buf_c){label_start, (size_t)(label_end - label_start)};
+        return 0;
+    }
+
+    label_string = strndup(label_start, (size_t)(label_end - label_start));
+    rule->label = claim_label_from_string(label_string);
+    free(label_string);
+    if(rule->label == 0) {
+        fprintf(stderr, "unknown claim label in profile rule \"%s\"\n", rule_arg);
+        return 1;
+    }
+
+    switch(rule->check) {
+        case EAT_PROFILE_TYPE:
+            if(parse_types(argument, &rule->types)) {
+                fprintf(stderr, "bad type in profile rule \"%s\"\n", rule_arg);
+                return 1;
+            }
+            break;
+
+        case EAT_PROFILE_ALLOW:
+            if(parse_values(argument, rule->label, &rule->values)) {
+                fprintf(stderr, "bad value in profile rule \"%s\". Values must be small integers\n", rule_arg);
+                return 1;
+            }
+            break;
+
+        case EAT_PROFILE_LENGTH:
+            if(parse_length(argument, &rule->min_len, &rule->max_len)) {
+                fprintf(stderr, "bad length in profile rule \"%s\"\n", rule_arg);
+                return 1;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See eat_profile.h
+ */
+int eat_profile_compile(const char **rule_args, struct eat_profile *profile)
+{
+    uint32_t i;
+
+    memset(profile, 0, sizeof(*profile));
+    for(i = 0; i < EAT_PROFILE_TABLE_SIZE; i++) {
+        profile->table[i].first = -1;
+    }
+
+    for(; *rule_args != NULL; rule_args++) {
+        if(profile->rule_count == EAT_PROFILE_MAX_RULES) {
+            fprintf(stderr, "too many profile rules. The limit is %d\n", EAT_PROFILE_MAX_RULES);
+            return 1;
+        }
+        i = profile->rule_count;
+        if(parse_rule(*rule_args, &profile->rules[i])) {
+            return 1;
+        }
+
+        /* Submodule rules aren't looked up by label */
+        if(profile->rules[i].check == EAT_PROFILE_SUBMOD) {
+            profile->submod_mask |= RULE_BIT(i);
+        } else {
+            add_to_table(profile, (int8_t)i);
+            if(profile->rules[i].check == EAT_PROFILE_REQUIRE) {
+                profile->require_mask |= RULE_BIT(i);
+            }
+        }
+        profile->rule_count++;
+    }
+
+    return 0;
+}
+
+
+/* Reads a profile file into profile->file_text and compiles the
+ * lines in it. */
+static int load_profile_file(const char *file_name, struct eat_profile *profile)
+{
+    struct q_useful_buf_c file_bytes;
+    int                   file_descriptor;
+    char                 *text;
+    char                 *line;
+    char                 *line_end;
+    char                 *c;
+    const char          **lines;
+    size_t                line_count;
+    int                   return_value;
+
+    file_descriptor = open(file_name, O_RDONLY);
+    if(file_descriptor < 0) {
+        fprintf(stderr, "can't open profile \"%s\". It is not a file or a built-in profile\n", file_name);
+        return 1;
+    }
+    file_bytes = read_file(file_descriptor);
+    close(file_descriptor);
+    if(q_useful_buf_c_is_null(file_bytes)) {
+        fprintf(stderr, "error reading profile \"%s\"\n", file_name);
+        return 1;
+    }
+
+    text = strndup(file_bytes.ptr, file_bytes.len);
+    free((void *)file_bytes.ptr);
+    if(text == NULL) {
+        return 1;
+    }
+
+    /* One more than the number of newlines is enough */
+    line_count = 1;
+    for(c = text; *c; c++) {
+        line_count += *c == '\n';
+    }
+    lines = calloc(line_count + 1, sizeof(char *));
+    if(lines == NULL) {
+        free(text);
+        return 1;
+    }
+
+    /* The lines are trimmed in place */
+    line_count = 0;
+    for(line = text; line != NULL; line = line_end) {
+        line_end = strchr(line, '\n');
+        if(line_end != NULL) {
+            *line_end++ = '\0';
+        }
+        while(isspace((unsigned char)*line)) {
+            line++;
+        }
+        for(c = line + strlen(line); c > line && isspace((unsigned char)c[-1]); c--);
+        *c = '\0';
+
+        if(*line != '\0' && *line != '#') {
+            lines[line_count++] = line;
+        }
+    }
+    lines[line_count] = NULL;
+
+    return_value = eat_profile_compile(lines, profile);
+
+    /* After compiling because that clears profile */
+    profile->file_text = text;
+
+    free(lines);
+
+    return return_value;
+}
+
+
+/*
+ * Public function. See eat_profile.h
+ */
+int eat_profile_load(const char *name, struct eat_profile *profile)
+{
+    size_t i;
+
+    profile->file_text = NULL;
+
+    for(i = 0; i < sizeof(builtin_profiles)/sizeof(builtin_profiles[0]); i++) {
+        if(!strcmp(name, builtin_profiles[i].name)) {
+            return eat_profile_compile(builtin_profiles[i].rules, profile);
+        }
+    }
+
+    return load_profile_file(name, profile);
+}
+
+
+/*
+ * Public function. See eat_profile.h
+ */
+void eat_profile_free(struct eat_profile *profile)
+{
+    free(profile->file_text);
+    profile->file_text = NULL;
+}
+
+
+static bool rule_applies(const struct eat_profile_rule *rule,
+                         const struct q_useful_buf_c   *path,
+                         uint32_t                       depth)
+{
+    uint32_t i;
+
+    if(rule->any_level) {
+        return true;
+    }
+    if(rule->path_len != depth) {
+        return false;
+    }
+    for(i = 0; i < depth; i++) {
+        if(q_useful_buf_compare(rule->path[i], path[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* Works out which rules apply at the level just entered. */
+static void start_level(struct eat_profile_validator *me)
+{
+    struct eat_profile_level *level;
+    uint32_t                  i;
+
+    level = &me->levels[me->depth];
+    level->in_scope    = 0;
+    level->seen        = 0;
+    level->claims_done = false;
+
+    for(i = 0; i < me->profile->rule_count; i++) {
+        if(rule_applies(&me->profile->rules[i], me->path, me->depth)) {
+            level->in_scope |= RULE_BIT(i);
+        }
+    }
+}
+
+
+static enum xclaim_error_t push_level(struct eat_profile_validator *me, struct q_useful_buf_c name)
+{
+    if(me->depth == XCLAIM_MAX_NESTING) {
+        return XCLAIM_ERR_NESTING_TOO_DEEP;
+    }
+    me->path[me->depth] = name;
+    me->depth++;
+    start_level(me);
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static void pop_level(struct eat_profile_validator *me)
+{
+    if(me->depth > 0) {
+        me->depth--;
+    }
+}
+
+
+/* Prints a violation of a rule at the current level. Returns
+ * XCLAIM_ERR_PROFILE if processing should stop now. */
+static enum xclaim_error_t
+violation(struct eat_profile_validator  *me,
+          const struct eat_profile_rule *rule,
+          const char                    *reason)
+{
+    uint32_t i;
+
+    me->violations++;
+
+    fprintf(stderr, "profile rule \"%s\" not met (%s) at ", rule->text, reason);
+    if(me->depth == 0) {
+        fprintf(stderr, "the top level");
+    } else {
+        fprintf(stderr, "submodule ");
+        for(i = 0; i < me->depth; i++) {
+            fprintf(stderr, "%s%.*s", i ? "/" : "", (int)me->path[i].len, (const char *)me->path[i].ptr);
+        }
+    }
+    fprintf(stderr, "\n");
+
+    return me->fail_fast ? XCLAIM_ERR_PROFILE : XCLAIM_SUCCESS;
+}
+
+
+/* Returns NULL if the claim meets the rule or why it doesn't. */
+static const char *check_value(const struct eat_profile_rule *rule, const QCBORItem *item)
+{
+    switch(rule->check) {
+        case EAT_PROFILE_TYPE:
+            if(item->uDataType >= 64 || !(rule->types & RULE_BIT(item->uDataType))) {
+                return "wrong type";
+            }
+            break;
+
+        case EAT_PROFILE_ALLOW:
+            if(item->uDataType != QCBOR_TYPE_INT64 ||
+               item->val.int64 < 0 ||
+               item->val.int64 >= 64 ||
+               !(rule->values & RULE_BIT(item->val.int64))) {
+                return "value not allowed";
+            }
+            break;
+
+        case EAT_PROFILE_LENGTH:
+            if(item->uDataType != QCBOR_TYPE_BYTE_STRING &&
+               item->uDataType != QCBOR_TYPE_TEXT_STRING) {
+                return "not a string";
+            }
+            if(item->val.string.len < rule->min_len || item->val.string.len > rule->max_len) {
+                return "wrong length";
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+
+/* Checks one claim against the rules for its label at this level */
+static enum xclaim_error_t
+check_claim(struct eat_profile_validator *me,
+            struct eat_profile_level     *level,
+            const struct xclaim          *claim)
+{
+    const struct eat_profile *profile = me->profile;
+    const char               *reason;
+    enum xclaim_error_t       xclaim_error;
+    int8_t                    n;
+
+    if(claim->qcbor_item.uLabelType != QCBOR_TYPE_INT64) {
+        return XCLAIM_SUCCESS;
+    }
+
+    for(n = first_rule(profile, claim->qcbor_item.label.int64); n >= 0; n = profile->rules[n].next) {
+        if(!(level->in_scope & RULE_BIT(n))) {
+            continue;
+        }
+        level->seen |= RULE_BIT(n);
+        reason = check_value(&profile->rules[n], &claim->qcbor_item);
+        if(reason != NULL) {
+            xclaim_error = violation(me, &profile->rules[n], reason);
+            if(xclaim_error != XCLAIM_SUCCESS) {
+                return xclaim_error;
+            }
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* Reports the rules in mask that apply at this level and weren't met */
+static enum xclaim_error_t
+check_missing(struct eat_profile_validator *me,
+              struct eat_profile_level     *level,
+              uint64_t                      mask,
+              const char                   *reason)
+{
+    enum xclaim_error_t xclaim_error;
+    uint64_t            missing;
+    uint32_t            i;
+
+    missing = level->in_scope & mask & ~level->seen;
+    for(i = 0; missing != 0 && i < me->profile->rule_count; i++) {
+        if(missing & RULE_BIT(i)) {
+            missing &= ~RULE_BIT(i);
+            xclaim_error = violation(me, &me->profile->rules[i], reason);
+            if(xclaim_error != XCLAIM_SUCCESS) {
+                return xclaim_error;
+            }
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* After the last claim at a level */
+static enum xclaim_error_t end_claims(struct eat_profile_validator *me)
+{
+    struct eat_profile_level *level;
+
+    level = &me->levels[me->depth];
+    if(level->claims_done) {
+        return XCLAIM_SUCCESS;
+    }
+    level->claims_done = true;
+
+    return check_missing(me, level, me->profile->require_mask, "missing claim");
+}
+
+
+/* After the last submodule at a level. At the end of the top level
+ * the token has all been seen. */
+static enum xclaim_error_t end_submods(struct eat_profile_validator *me)
+{
+    enum xclaim_error_t xclaim_error;
+
+    xclaim_error = check_missing(me, &me->levels[me->depth], me->profile->submod_mask, "missing submodule");
+    if(xclaim_error != XCLAIM_SUCCESS) {
+        return xclaim_error;
+    }
+
+    if(me->depth == 0 && me->violations > 0) {
+        return XCLAIM_ERR_PROFILE;
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* Marks the submod rules for a submodule found at this level as met */
+static void found_submod(struct eat_profile_validator *me, struct q_useful_buf_c name)
+{
+    struct eat_profile_level *level;
+    uint64_t                  wanted;
+    uint32_t                  i;
+
+    level  = &me->levels[me->depth];
+    wanted = level->in_scope & me->profile->submod_mask & ~level->seen;
+
+    for(i = 0; wanted != 0 && i < me->profile->rule_count; i++) {
+        if((wanted & RULE_BIT(i)) && !q_useful_buf_compare(me->profile->rules[i].submod_name, name)) {
+            level->seen |= RULE_BIT(i);
+        }
+        wanted &= ~RULE_BIT(i);
+    }
+}
+
+
+/* Common to all the ways of moving to the next submodule */
+static enum xclaim_error_t
+after_submod(struct eat_profile_validator *me,
+             enum xclaim_error_t           xclaim_error,
+             struct q_useful_buf_c         name)
+{
+    enum xclaim_error_t end_error;
+
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        found_submod(me, name);
+        return push_level(me, name);
+    }
+
+    if(xclaim_error == XCLAIM_NO_MORE) {
+        end_error = end_submods(me);
+        if(end_error != XCLAIM_SUCCESS) {
+            return end_error;
+        }
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t profile_next_claim(void *ctx, struct xclaim *claim)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+    enum xclaim_error_t           xclaim_error;
+
+    xclaim_error = (me->inner->next_claim)(me->inner->ctx, claim);
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        return check_claim(me, &me->levels[me->depth], claim);
+    }
+    if(xclaim_error == XCLAIM_NO_MORE) {
+        return end_claims(me) != XCLAIM_SUCCESS ? XCLAIM_ERR_PROFILE : XCLAIM_NO_MORE;
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t
+profile_enter_submod(void *ctx, uint32_t index, struct q_useful_buf_c *name)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+    enum xclaim_error_t           xclaim_error;
+
+    xclaim_error = (me->inner->enter_submod)(me->inner->ctx, index, name);
+    if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        /* Found when get_nested gives its name */
+        return xclaim_error;
+    }
+
+    return after_submod(me, xclaim_error, *name);
+}
+
+
+static enum xclaim_error_t profile_exit_submod(void *ctx)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+
+    pop_level(me);
+
+    return (me->inner->exit_submod)(me->inner->ctx);
+}
+
+
+static enum xclaim_error_t
+profile_get_nested(void                  *ctx,
+                   uint32_t               index,
+                   enum ctoken_type_t    *type,
+                   struct q_useful_buf_c *name,
+                   struct q_useful_buf_c *token)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+    enum xclaim_error_t           xclaim_error;
+
+    xclaim_error = (me->inner->get_nested)(me->inner->ctx, index, type, name, token);
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        found_submod(me, *name);
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t
+profile_first_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+    enum xclaim_error_t           xclaim_error;
+
+    xclaim_error = (me->inner->first_submod)(me->inner->ctx, cursor);
+    if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        found_submod(me, cursor->name);
+        return xclaim_error;
+    }
+
+    return after_submod(me, xclaim_error, cursor->name);
+}
+
+
+static enum xclaim_error_t
+profile_next_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+    enum xclaim_error_t           xclaim_error;
+
+    if(cursor->entered) {
+        /* next_submod exits the one it entered last */
+        pop_level(me);
+    }
+
+    xclaim_error = (me->inner->next_submod)(me->inner->ctx, cursor);
+    if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        found_submod(me, cursor->name);
+        return xclaim_error;
+    }
+
+    return after_submod(me, xclaim_error, cursor->name);
+}
+
+
+static void profile_rewind(void *ctx)
+{
+    struct eat_profile_validator *me = (struct eat_profile_validator *)ctx;
+
+    (me->inner->rewind)(me->inner->ctx);
+
+    me->depth      = 0;
+    me->violations = 0;
+    start_level(me);
+}
+
+
+/*
+ * Public function. See eat_profile.h
+ */
+void eat_profile_validator_init(xclaim_decoder               *decoder,
+                                struct eat_profile_validator *validator,
+                                xclaim_decoder               *inner,
+                                const struct eat_profile     *profile,
+                                bool                          fail_fast)
+{
+    validator->inner      = inner;
+    validator->profile    = profile;
+    validator->fail_fast  = fail_fast;
+    validator->depth      = 0;
+    validator->violations = 0;
+    start_level(validator);
+
+    decoder->ctx = validator;
+
+    decoder->rewind       = profile_rewind;
+    decoder->next_claim   = profile_next_claim;
+    decoder->enter_submod = profile_enter_submod;
+    decoder->exit_submod  = inner->exit_submod  ? profile_exit_submod  : NULL;
+    decoder->get_nested   = inner->get_nested   ? profile_get_nested   : NULL;
+    decoder->first_submod = inner->first_submod ? profile_first_submod : NULL;
+    decoder->next_submod  = inner->next_submod  ? profile_next_submod  : NULL;
+}
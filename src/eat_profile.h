@@ -0,0 +1,191 @@
+/*
+ * eat_profile.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef eat_profile_h
+#define eat_profile_h
+
+#include "xclaim.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* This checks tokens against an EAT profile, the rules a deployment
+ * has for which claims must be present and what their values may
+ * be. It is an xclaim_decoder that wraps another xclaim_decoder, the
+ * same as claim_filter, so the checking happens in the single pass
+ * xclaim_processor() makes to decode the token. The claims are passed
+ * through unchanged.
+ *
+ * A profile is a list of rules, one per line in a profile file. Blank
+ * lines and lines starting with # are ignored. Each rule is
+ *
+ *     <check>:[<scope>]<label>[=<argument>]
+ *
+ * with the label and scope as for -filter. The checks are
+ *
+ *     require  The claim must be present.
+ *     type     The claim must be one of the types in the argument, a
+ *              comma-separated list of int, bstr, tstr, bool, float,
+ *              null, map and array.
+ *     allow    The value must be one of those in the argument, a
+ *              comma-separated list. The values are converted as for
+ *              -claim, so "allow:seclevel=hardware" works. Only for
+ *              claims with small integer values like seclevel and
+ *              dbgstat.
+ *     length   A byte or text string must be this many bytes. The
+ *              argument is <n> or <min>-<max>.
+ *     submod   The label is instead the name of a submodule that must
+ *              be present. A scope is needed. "submod:/radio" is for
+ *              one at the top level.
+ *
+ * type, allow and length say nothing about claims that are absent.
+ * Claims in nested tokens in the submodules section are not checked.
+ *
+ * The rules are compiled into a struct eat_profile that is only read
+ * after that, so one can be used by many threads. As with the filter
+ * rules, the label of each claim is looked up in a small hash table
+ * and the rules that apply at a level are worked out once, as a bit
+ * mask, when the level is entered. For a claim with no rules the cost
+ * is one table probe. The allowed values and types for a rule are bit
+ * masks too, so a check is a shift and an AND.
+ *
+ * All the violations in a token are printed and the processing ends
+ * with XCLAIM_ERR_PROFILE when the whole token has been seen. With
+ * fail_fast it ends at the first one.
+ */
+
+
+/* The most rules in a profile. The rules that apply at a level are
+ * kept as a bit mask. */
+#define EAT_PROFILE_MAX_RULES 64
+
+
+enum eat_profile_check_t {
+    EAT_PROFILE_REQUIRE,
+    EAT_PROFILE_TYPE,
+    EAT_PROFILE_ALLOW,
+    EAT_PROFILE_LENGTH,
+    EAT_PROFILE_SUBMOD
+};
+
+
+struct eat_profile_rule {
+    enum eat_profile_check_t check;
+    int64_t                  label;
+
+    /* As for struct claim_filter_rule. For submod, path is the
+     * submodule the named one must be in. */
+    bool                     any_level;
+    uint32_t                 path_len;
+    struct q_useful_buf_c    path[XCLAIM_MAX_NESTING];
+
+    /* For type. Bit n is set if QCBOR type n is allowed. */
+    uint64_t                 types;
+
+    /* For allow. Bit n is set if the value n is allowed. */
+    uint64_t                 values;
+
+    /* For length */
+    size_t                   min_len;
+    size_t                   max_len;
+
+    /* For submod */
+    struct q_useful_buf_c    submod_name;
+
+    /* The rule as given for error messages */
+    const char              *text;
+
+    /* Next rule for the same label or -1 */
+    int8_t                   next;
+};
+
+
+/* Twice the maximum number of rules so the table is never more than
+ * half full. Must be a power of two. */
+#define EAT_PROFILE_TABLE_SIZE (2 * EAT_PROFILE_MAX_RULES)
+
+struct eat_profile {
+    uint32_t                rule_count;
+    struct eat_profile_rule rules[EAT_PROFILE_MAX_RULES];
+
+    /* Open addressing on the label as in struct claim_filter_rules */
+    struct {
+        int64_t label;
+        int8_t  first;
+    } table[EAT_PROFILE_TABLE_SIZE];
+
+    uint64_t                require_mask;
+    uint64_t                submod_mask;
+
+    /* A profile file read in. The rules point into it. */
+    char                   *file_text;
+};
+
+
+/* The state for one level of submodule nesting */
+struct eat_profile_level {
+    /* Bit n is set if rule n applies at this level */
+    uint64_t in_scope;
+
+    /* The require and submod rules that have been met at this level */
+    uint64_t seen;
+
+    /* The required claims have been checked */
+    bool     claims_done;
+};
+
+
+/* The context for the xclaim_decoder. One of these is needed per
+ * token being processed. Nothing in it needs freeing. */
+struct eat_profile_validator {
+    xclaim_decoder           *inner;
+    const struct eat_profile *profile;
+    bool                      fail_fast;
+
+    uint32_t                  depth;
+    struct q_useful_buf_c     path[XCLAIM_MAX_NESTING];
+    struct eat_profile_level  levels[XCLAIM_MAX_NESTING + 1];
+
+    /* The number found in the token so far */
+    uint32_t                  violations;
+};
+
+
+/* Compiles the rules in rule_args, a NULL-terminated list. The rules
+ * point into rule_args so it must stay valid. Errors are printed.
+ * Returns 0 on success or 1 if a rule is not valid. */
+int eat_profile_compile(const char **rule_args, struct eat_profile *profile);
+
+
+/* Loads the profile for -profile. name is one of the profiles built
+ * into xclaim or a profile file. Returns 0 on success or 1 on error
+ * after printing it. eat_profile_free() must be called even on
+ * error. */
+int eat_profile_load(const char *name, struct eat_profile *profile);
+
+
+/* Frees what eat_profile_load() allocated. */
+void eat_profile_free(struct eat_profile *profile);
+
+
+/* Sets up decoder to return the claims from inner, checking them
+ * against profile as they go by. inner must stay valid while decoder
+ * is used. After processing, validator->violations is the number
+ * found. */
+void eat_profile_validator_init(xclaim_decoder               *decoder,
+                                struct eat_profile_validator *validator,
+                                xclaim_decoder               *inner,
+                                const struct eat_profile     *profile,
+                                bool                          fail_fast);
+
+
+#endif /* eat_profile_h */
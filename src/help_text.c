@@ -31,6 +31,52 @@ const char *help_text =
     "   Turn a UCCS into a signed CWT token\n"
     "     xclaim -in uccs.cbor -out_form CBOR -out_prot sign -out_sign_key ec.pem -out tok.cbor\n"
     "\n"
+    "   Check a CWT token is valid and not expired. Only the exit status is output\n"
+    "     xclaim -in tok.cbor -in_verify_key ec.pem -verify_only -verify_time\n"
+    "\n"
+    "   Verify tokens signed by device certs that chain to a CA\n"
+    "     xclaim -in tok.cbor -in_verify_cert device_ca.pem -verify_only\n"
+    "\n"
+    "   Convert a directory of CWT tokens to JSON files in another directory\n"
+    "     xclaim -in_dir tokens -in_glob '*.cbor' -in_recursive -in_verify_key ec.pem -out_dir json\n"
+    "\n"
+    "   Output a token as JSON for logging and as a re-signed CWT in one pass\n"
+    "     xclaim -in tok.cbor -in_verify_key ec.pem -out log.json -out_form json -out new.cbor -out_form cbor -out_prot sign -out_sign_key ec2.pem\n"
+    "\n"
+    "   Output the claims of a large token as it comes in over a pipe\n"
+    "     produce_token | xclaim -in - -in_stream -in_verify_key ec.pem\n"
+    "\n"
+    "   Redact a token for logging, hashing the ueid and dropping the location\n"
+    "     xclaim -in tok.cbor -in_verify_key ec.pem -filter hash:ueid -filter drop:location\n"
+    "\n"
+    "   Reject tokens that don't meet the hardware profile, listing everything wrong with each\n"
+    "     xclaim -in tok.cbor -in_verify_key ec.pem -profile hardware\n"
+    "\n"
+    "   Output only the submodule ta1 in the submodule tee\n"
+    "     xclaim -in tok.cbor -in_verify_key ec.pem -submod tee/ta1\n"
+    "\n"
+    "   Keep tokens in an archive, then verify and output the ones from one device in an hour\n"
+    "     xclaim -in tok.cbor -out_archive tokens.arc\n"
+    "     xclaim -in_archive tokens.arc -archive_ueid 0198f50a4ff6c058 -archive_from 1634000000 -archive_to 1634003599 -in_verify_key ec.pem\n"
+    "\n"
+    "   Re-protect a signed CWT with an HMAC for cheap checking between internal services\n"
+    "     xclaim -in tok.cbor -in_verify_key ec.pem -out_form cbor -out_prot mac -out_mac_key svc.key -out mac.cbor\n"
+    "     xclaim -in mac.cbor -in_mac_key svc.key -verify_only\n"
+    "\n"
+    "   Sign then encrypt with AES-GCM, then decrypt and verify\n"
+    "     xclaim -claim nonce:AAAA -out_form cbor -out_prot sign_encrypt -out_sign_key ec.pem -out_encrypt_key aes.key -out enc.cbor\n"
+    "     xclaim -in enc.cbor -in_decrypt_key aes.key -in_verify_key ec.pem\n"
+    "\n"
+    "   Export a directory of tokens as columns for analytics\n"
+    "     xclaim -in_dir tokens -in_verify_key ec.pem -out_form columnar -out tokens.col\n"
+    "\n"
+    "   Export the tokens in an archive for a spreadsheet\n"
+    "     xclaim -in_archive tokens.arc -in_verify_key ec.pem -out_form csv -columns iat,ueid,tee.nonce\n"
+    "\n"
+    "   When the input is a UCCS or CWT and the output is CBOR the claims are\n"
+    "   passed through as is without decoding them, unless -filter, -profile, -submod or -replay_window is given. Only the signing and tagging\n"
+    "   are changed. Re-signing is one verify and one sign no matter how many claims.\n"
+    "\n"
     "\n"
     "OPTIONS\n"
     "  -claim <ll:vv>               Describes a claim. <ll> is the label. <vv> is the value.\n"
@@ -41,32 +87,180 @@ const char *help_text =
     "                               or registered. It may also be the text name for\n"
     "                               a standard or registered claim. See list below.\n"
     "\n"
+    "  -filter <rule>               Rewrite or redact claims on the way through. May be given\n"
+    "                               many times. <rule> is <action>:<label>[=<arg>] where\n"
+    "                               <action> is one of:\n"
+    "                                 drop          Remove the claim\n"
+    "                                 keep          Remove every claim without a keep rule\n"
+    "                                 rename=<ll>   Change the label to <ll>\n"
+    "                                 hash[=<salt>] Replace the value with its SHA-256 hash\n"
+    "                                 set=<vv>      Replace or add the claim. iat=now is the time\n"
+    "                               A scope before the label limits it to one level, e.g.\n"
+    "                               drop:/ueid for the top level or drop:sm1/ueid for the\n"
+    "                               submodule sm1. Without one it applies at all levels.\n"
+    "                               A claim can only be renamed to a claim like exp or ueid\n"
+    "                               whose value has a set type if it has the same type.\n"
+    "                               A nested token is left out when a drop, keep or hash rule\n"
+    "                               applies in it, as its claims can't be filtered.\n"
+    "                               With -out_form cbor the claims are decoded and re-encoded\n"
+    "\n"
+    "  -profile <name|file>         Check each token against an EAT profile as it is decoded.\n"
+    "                               The exit status is 2 if it doesn't meet it. Every\n"
+    "                               violation is output to stderr. <name> is a built-in\n"
+    "                               profile. The only one is hardware: ueid, nonce and\n"
+    "                               seclevel required with the EAT lengths, seclevel\n"
+    "                               secure_restricted or hardware, dbgstat disabled. Otherwise\n"
+    "                               it is a file with one rule per line, each\n"
+    "                               <check>:[<scope>]<label>[=<arg>] where <check> is one of:\n"
+    "                                 require       The claim must be present\n"
+    "                                 type=<types>  Comma list of int, bstr, tstr, bool,\n"
+    "                                               float, null, map, array\n"
+    "                                 allow=<vals>  Comma list of allowed values, e.g.\n"
+    "                                               allow:dbgstat=disabled,disabled_permanent\n"
+    "                                 length=<n>[-<max>] Byte or text string length\n"
+    "                                 submod        The label is a submodule name that must be\n"
+    "                                               present, e.g. submod:/radio\n"
+    "                               The scope is as for -filter. Lines starting with # are\n"
+    "                               comments. Not with -verify_only or -in_stream\n"
+    "  -profile_fail_fast           Stop at the first profile violation in a token\n"
+    "\n"
+    "  -submod <path>               Output only the submodule at <path>, e.g. tee/ta1 for the\n"
+    "                               submodule ta1 in the submodule tee. It is output as if it\n"
+    "                               were the whole token. The rest of the token is skipped\n"
+    "                               without decoding it, so this is fast for large tokens.\n"
+    "                               If it is a nested token, its bytes are output as they\n"
+    "                               are. Scopes in -filter are then from the submodule. Not\n"
+    "                               with -profile, -verify_only or -in_stream\n"
+    "\n"
     "  -in <file>                   The input file when -claim is not used.\n"
-    "  -in_prot <prot>              The expected protection. One of: none, sign, auto\n"
+    "  -in_prot <prot>              The expected protection. One of: none, sign, mac,\n"
+    "                               sign_encrypt, mac_encrypt, auto. With sign or mac, or\n"
+    "                               with a key to verify with, a UCCS is rejected\n"
     "  -in_form <form>              The input format. One of: cbor\n"
-    "  -in_verify_key <file>        A PEM format file with a verification key\n"
+    "  -in_verify_key <file>        A PEM or DER format file with a verification key, EC or\n"
+    "                               Ed25519. An Ed25519 key is for tokens signed with EdDSA\n"
+    "  -in_mac_key <file>           Symmetric key to check a COSE_Mac0 (HMAC-SHA256) with. The\n"
+    "                               file has the raw key or the key in hex, at least 16 bytes\n"
+    "  -in_decrypt_key <file>       AES key to decrypt a COSE_Encrypt0 with, 16 or 32 bytes raw\n"
+    "                               or in hex. The signature or MAC inside is then checked as\n"
+    "                               usual\n"
+    "  -in_verify_cert <file>       Trusted CA certs, a PEM file or a directory prepared with\n"
+    "                               openssl rehash. The verification key comes from the\n"
+    "                               x5chain or x5t header in each token, which must chain to\n"
+    "                               one of these. Validated chains are cached, so a signer\n"
+    "                               seen before costs no X.509 work. An x5t only works for a\n"
+    "                               cert already seen in an x5chain\n"
+    "  -in_stream                   Output the claims from -in as they arrive rather than\n"
+    "                               reading all of the input first, e.g. from a slow pipe.\n"
+    "                               The signature is checked when the last byte arrives, so\n"
+    "                               the output is only to be trusted if the exit status is 0.\n"
+    "                               Output is JSON only. Not with -filter, -profile, -submod, -replay_window,\n"
+    "                               -verify_only or more than one -out\n"
+    "  -in_dir <dir>                Process every file in a directory rather than one -in file.\n"
+    "                               Many files are read at once and processed in parallel\n"
+    "  -in_glob <pattern>           With -in_dir, only files whose names match, e.g. '*.cbor'\n"
+    "  -in_recursive                With -in_dir, also process files in subdirectories\n"
+    "  -out_dir <dir>               With -in_dir, put the output for each input file in a\n"
+    "                               file of the same name here. Without it, all output goes\n"
+    "                               to -out or stdout\n"
+    "  -workers <n>                 With -in_dir, the number of threads that process files.\n"
+    "                               The default is one per CPU. With -in_shm the default is 1\n"
+    "  -io_depth <n>                With -in_dir, the number of file reads in flight. The\n"
+    "                               default is 256\n"
+    "  -in_shm <name>               Take tokens from a producer on the same host through lock-\n"
+    "                               free rings in the POSIX shared memory object name, e.g.\n"
+    "                               /collector. The output for each goes in the response ring.\n"
+    "                               There's no syscall or copy per token. Runs until the\n"
+    "                               producer sets the shutdown flag. See shm_ring.h for the\n"
+    "                               layout\n"
+    "  -out_archive <file>          Add the -in token, or CBOR sequence of tokens, to the end\n"
+    "                               of a token archive instead of converting it. The tokens\n"
+    "                               are stored as they are and verified when taken out. An\n"
+    "                               index of the ueid, cti and iat, <file>.idx, is kept next\n"
+    "                               to it\n"
+    "  -in_archive <file>           Verify and output only the tokens in an archive that\n"
+    "                               match the -archive_ options, found through the index\n"
+    "                               without reading the others. All of them without any\n"
+    "  -archive_ueid <hex>          With -in_archive, only tokens with this ueid\n"
+    "  -archive_cti <hex>           With -in_archive, only the token with this cti\n"
+    "  -archive_from <secs>         With -in_archive, only tokens with an iat at or after this\n"
+    "  -archive_to <secs>           With -in_archive, only tokens with an iat at or before this.\n"
+    "                               Tokens are output in iat order\n"
+    "\n"
+    "  -verify_only                 Only verify the input. Claims are not decoded and there\n"
+    "                               is no output token. The exit status is 0 if the input is\n"
+    "                               valid, 2 if it is not and 1 for other errors. If the input\n"
+    "                               is a CBOR sequence of tokens, each is verified and a line\n"
+    "                               with the token number and pass or fail is output for each.\n"
+    "                               The exit status is 2 if any fail.\n"
+    "  -verify_time                 With -verify_only, also check the exp and nbf claims\n"
+    "  -verify_reason               With -verify_only, output a one-line reason even for a\n"
+    "                               single token\n"
+    "  -verify_cache <n>            Number of verification results to cache when there are\n"
+    "                               many tokens. A repeated token costs a hash rather than a\n"
+    "                               signature verification. With -in_dir, -in_shm and\n"
+    "                               -in_archive one cache is shared by all the tokens,\n"
+    "                               whether verified or converted. 0 turns the cache off. The\n"
+    "                               default is 1024\n"
+    "  -replay_window <secs>        Reject a token if its cti, or nonce if there is no cti,\n"
+    "                               was seen within this many seconds. Also rejects tokens\n"
+    "                               with a cti or nonce and no iat, with an iat older than\n"
+    "                               this or with an iat more than 60 seconds in the future.\n"
+    "                               Checked for -verify_only and when decoding a token\n"
+    "  -replay_capacity <n>         Max number of tokens per replay window. At least 8.\n"
+    "                               Default 1048576\n"
+    "  -replay_file <file>          Keep the replay state in this file so it lasts between\n"
+    "                               runs of xclaim. Otherwise it is only in memory\n"
+    "  -max_depth <n>               Reject tokens with submodules nested deeper than this.\n"
+    "                               The default and maximum is 16\n"
+    "  -max_claims <n>              Reject tokens with more claims than this, counting all\n"
+    "                               submodules. The default is 100000\n"
+    "  -max_submods <n>             Reject tokens with more submodules and nested tokens than\n"
+    "                               this. The default is 10000\n"
+    "  -max_nested_bytes <n>        Reject tokens whose nested tokens add up to more bytes\n"
+    "                               than this. The default is 16777216\n"
+    "  -stats                       Output statistics, like the cache hit rate, to stderr\n"
     "\n"
     "  -out <file>                  The output file. The default is stdout\n"
-    "  -out_form <form>             The output format. One of: cbor, json\n"
-    "  -out_prot <prot>             The output protection. One of: none, sign\n"
-    "  -out_sign_alg <alg>          Alg is one of the COSE signing algorithms\n"
-    "  -out_sign_key <file>         Private key to sign with\n"
+    "  -out_form <form>             The output format. One of: cbor, json, columnar, csv, tsv\n"
+    "                               -out and -out_form may be given several times to output\n"
+    "                               several formats from one verify and decode. The nth -out\n"
+    "                               goes with the nth -out_form\n"
+    "                               columnar puts all the tokens from -in_dir or -in_archive\n"
+    "                               in one file with a column per claim and a row per token\n"
+    "                               for bulk loading. The format is described in\n"
+    "                               src/columnar_encode.h. It must be the only output\n"
+    "                               csv and tsv put each token on one line with the columns\n"
+    "                               given by -columns and a header line first. They must be\n"
+    "                               the only output\n"
+    "  -columns <list>              The columns for -out_form csv and tsv, separated by commas.\n"
+    "                               Each is a claim name or integer label after the names of\n"
+    "                               the submodules it is in, each followed by a dot, like\n"
+    "                               iat,ueid,tee.nonce. Byte strings are output in hex. The\n"
+    "                               default is iss,sub,aud,exp,nbf,iat,cti,ueid,nonce\n"
+    "  -out_prot <prot>             The output protection. One of: none, sign, mac,\n"
+    "                               sign_encrypt, mac_encrypt\n"
+    "  -out_mac_key <file>          Symmetric key for -out_prot mac. Same format as -in_mac_key.\n"
+    "                               A COSE_Mac0 costs much less to make and check than a\n"
+    "                               signature. -out_sign_kid sets its kid\n"
+    "  -out_encrypt_key <file>      AES key for -out_prot sign_encrypt and mac_encrypt, 16 or 32\n"
+    "                               bytes raw or in hex for A128GCM or A256GCM. The COSE_Sign1\n"
+    "                               or COSE_Mac0 is put in a COSE_Encrypt0\n"
+    "  -out_sign_alg <alg>          Alg is one of the COSE signing algorithms: -7 (ES256),\n"
+    "                               -35 (ES384), -36 (ES512) or -8 (EdDSA)\n"
+    "  -out_sign_key <file>         Private key to sign with, PEM or DER. With an Ed25519\n"
+    "                               key the alg is EdDSA\n"
     "  -out_sign_kid <kid>          Key ID associated with -out_sign_key\n"
     "  -out_sign_certs <file>       Cert to include in the output token for use when verifying\n"
     "  -out_sign_short_circuit      Use short-circuit signature to sign with\n"
+    "  -out_tag <tagging>           CBOR tagging. One of: cwt, cose, none. The default is cwt\n"
     "\n"
     "\n"
     "PLANNED OPTIONS\n"
-    "  -in_prot <prot>              The expected protection. One of: none, sign, mac, sign_encrypt, mac_encrypt, auto\n"
     "  -in_form <form>              The input format. One of: cbor, json\n"
     "\n"
-    "  -in_verify_cert <cert_file>  Certificates to chain up to\n"
-    "  -in_decrypt_key <key_file>   Private key for decryption.\n"
     "  -in_no_verify                The input file will be decoded, but any signature or mac will not be verified. No need to supply key material\n"
-    "  -out_encrypt_alg <alg>       Alg is one of the COSE signing algorithms\n"
-    "  -out_encrypt_key <file>      Public key to encrypt with\n"
-    "  -out_tag <tagging>           CBOR tagging. One of: none, full, cose\n"
-    "  -out_prot <prot>             The output protection. One of: none, sign, mac, sign_encrypt, mac_encrypt\n"
+    "  -out_encrypt_alg <alg>       Alg is one of the COSE content encryption algorithms\n"
     "\n"
     "\n"
     "SUPPORTED CLAIMS (lots more needed. You can help! https://github.com/laurencelundblade/xclaim)\n"
@@ -0,0 +1,155 @@
+/*
+ * json_escape.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "json_escape.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+static inline int needs_escape(uint8_t c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+
+/* Index of the lowest set bit. x must not be 0. */
+static inline unsigned lowest_bit(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctz(x);
+#else
+    unsigned n = 0;
+    while(!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+/*
+ * Public function. See json_escape.h
+ */
+size_t json_escape_scan(const uint8_t *string, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i max_ctrl  = _mm_set1_epi8(0x1f);
+    __m128i       chunk;
+    __m128i       hits;
+    uint32_t      mask;
+
+    for(; i + 16 <= len; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i *)(string + i));
+        hits  = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                             _mm_cmpeq_epi8(chunk, backslash));
+        /* Unsigned c <= 0x1f is max(c, 0x1f) == 0x1f */
+        hits  = _mm_or_si128(hits,
+                             _mm_cmpeq_epi8(_mm_max_epu8(chunk, max_ctrl), max_ctrl));
+        mask  = (uint32_t)_mm_movemask_epi8(hits);
+        if(mask) {
+            return i + lowest_bit(mask);
+        }
+    }
+#else
+    /* Eight bytes at a time in a 64-bit word. For each test the high
+     * bit of a byte is set if it might match. A zero word means none
+     * of the eight bytes need escaping, which is the usual case. */
+    const uint64_t ones  = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t       word;
+    uint64_t       hits;
+
+    for(; i + 8 <= len; i += 8) {
+        memcpy(&word, string + i, sizeof(word));
+        hits = ((word - ones * 0x20) & ~word) |                           /* < 0x20 */
+               (((word ^ (ones * '"')) - ones) & ~(word ^ (ones * '"'))) |
+               (((word ^ (ones * '\\')) - ones) & ~(word ^ (ones * '\\')));
+        if(hits & highs) {
+            break;
+        }
+    }
+#endif
+
+    /* The tail and, without SSE2, the word with the hit */
+    for(; i < len; i++) {
+        if(needs_escape(string[i])) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+
+/*
+ * Public function. See json_escape.h
+ */
+void json_write_string(FILE *out_file, struct q_useful_buf_c string)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    const uint8_t *bytes = string.ptr;
+    size_t         len   = string.len;
+    size_t         run;
+    uint8_t        c;
+    char           escape[6];
+    size_t         escape_len;
+
+    fputc('"', out_file);
+
+    while(len > 0) {
+        run = json_escape_scan(bytes, len);
+        if(run > 0) {
+            fwrite(bytes, 1, run, out_file);
+            bytes += run;
+            len   -= run;
+            if(len == 0) {
+                break;
+            }
+        }
+
+        c = *bytes;
+        escape[0]  = '\\';
+        escape_len = 2;
+        switch(c) {
+            case '"':  escape[1] = '"';  break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b';  break;
+            case '\f': escape[1] = 'f';  break;
+            case '\n': escape[1] = 'n';  break;
+            case '\r': escape[1] = 'r';  break;
+            case '\t': escape[1] = 't';  break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0x0f];
+                escape_len = 6;
+                break;
+        }
+        fwrite(escape, 1, escape_len, out_file);
+        bytes++;
+        len--;
+    }
+
+    fputc('"', out_file);
+}
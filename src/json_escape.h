@@ -0,0 +1,56 @@
+/*
+ * json_escape.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef json_escape_h
+#define json_escape_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* JSON string escaping as in RFC 8259 section 7. A quote, backslash
+ * or control character (less than 0x20) is escaped. Everything else,
+ * including UTF-8 multi-byte sequences, is output as is.
+ *
+ * Most claim text has nothing to escape so the scan for the bytes
+ * that need it is done 16 bytes at a time with SSE2 where available
+ * and 8 bytes at a time otherwise. Runs of bytes that need no
+ * escaping are written out with one fwrite().
+ */
+
+
+/* Returns the offset of the first byte in string that must be
+ * escaped, or len if there is none. */
+size_t json_escape_scan(const uint8_t *string, size_t len);
+
+
+/* Outputs string in quotes, escaped. */
+void json_write_string(FILE *out_file, struct q_useful_buf_c string);
+
+
+/* Same as json_write_string() for a NULL-terminated string. */
+static void json_write_string_z(FILE *out_file, const char *string);
+
+
+
+/* ===========================================================================
+   BEGINNING OF PRIVATE INLINE IMPLEMENTATION
+   ========================================================================== */
+
+static inline void json_write_string_z(FILE *out_file, const char *string)
+{
+    json_write_string(out_file, q_useful_buf_from_sz(string));
+}
+
+#endif /* json_escape_h */
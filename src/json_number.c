@@ -0,0 +1,498 @@
+/*
+ * json_number.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "json_number.h"
+
+#include <string.h>
+
+
+/* "00" "01" ... "99" so two digits are produced per division */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+/*
+ * Public function. See json_number.h
+ */
+size_t json_format_uint64(uint64_t value, char *buffer)
+{
+    char   digits[20];
+    char  *p = digits + sizeof(digits);
+    size_t len;
+
+    /* Digits are produced backwards from the end of digits[] */
+    while(value >= 100) {
+        const unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if(value >= 10) {
+        const unsigned pair = (unsigned)value * 2;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    len = (size_t)(digits + sizeof(digits) - p);
+    memcpy(buffer, p, len);
+    buffer[len] = '\0';
+
+    return len;
+}
+
+
+/*
+ * Public function. See json_number.h
+ */
+size_t json_format_int64(int64_t value, char *buffer)
+{
+    if(value < 0) {
+        *buffer = '-';
+        /* Negating as unsigned works for INT64_MIN too */
+        return 1 + json_format_uint64(0 - (uint64_t)value, buffer + 1);
+    }
+
+    return json_format_uint64((uint64_t)value, buffer);
+}
+
+
+
+/* The rest of this is Grisu2 from "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers" by Florian Loitsch, 2010,
+ * arranged as in Milo Yip's implementation. */
+
+
+/* A floating-point number f * 2^e with a 64-bit significand */
+struct diy_fp {
+    uint64_t f;
+    int      e;
+};
+
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS    (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_MIN_EXPONENT     (-DP_EXPONENT_BIAS)
+#define DP_EXPONENT_MASK    0x7FF0000000000000ULL
+#define DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define DP_HIDDEN_BIT       0x0010000000000000ULL
+
+
+static struct diy_fp diy_fp_from_double(double d)
+{
+    struct diy_fp result;
+    uint64_t      bits;
+    int           biased_e;
+
+    memcpy(&bits, &d, sizeof(bits));
+    biased_e = (int)((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+    result.f = bits & DP_SIGNIFICAND_MASK;
+    if(biased_e != 0) {
+        result.f += DP_HIDDEN_BIT;
+        result.e  = biased_e - DP_EXPONENT_BIAS;
+    } else {
+        /* Subnormal */
+        result.e = DP_MIN_EXPONENT + 1;
+    }
+
+    return result;
+}
+
+
+static struct diy_fp diy_fp_multiply(struct diy_fp x, struct diy_fp y)
+{
+    const uint64_t M32 = 0xFFFFFFFF;
+    const uint64_t a   = x.f >> 32;
+    const uint64_t b   = x.f & M32;
+    const uint64_t c   = y.f >> 32;
+    const uint64_t d   = y.f & M32;
+    const uint64_t ac  = a * c;
+    const uint64_t bc  = b * c;
+    const uint64_t ad  = a * d;
+    const uint64_t bd  = b * d;
+    uint64_t       tmp;
+    struct diy_fp  result;
+
+    tmp  = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1U << 31; /* Round */
+
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    result.e = x.e + y.e + 64;
+
+    return result;
+}
+
+
+static struct diy_fp diy_fp_normalize(struct diy_fp x)
+{
+    while(!(x.f & (1ULL << 63))) {
+        x.f <<= 1;
+        x.e--;
+    }
+
+    return x;
+}
+
+
+/* The boundaries m- and m+ halfway to the neighboring doubles,
+ * normalized and with the same exponent. */
+static void normalized_boundaries(struct diy_fp  v,
+                                  struct diy_fp *minus,
+                                  struct diy_fp *plus)
+{
+    struct diy_fp p;
+    struct diy_fp m;
+
+    p.f = (v.f << 1) + 1;
+    p.e = v.e - 1;
+    while(!(p.f & (DP_HIDDEN_BIT << 1))) {
+        p.f <<= 1;
+        p.e--;
+    }
+    p.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+    p.e  -= 64 - DP_SIGNIFICAND_SIZE - 2;
+
+    if(v.f == DP_HIDDEN_BIT) {
+        /* The gap below a power of two is half the gap above it */
+        m.f = (v.f << 2) - 1;
+        m.e = v.e - 2;
+    } else {
+        m.f = (v.f << 1) - 1;
+        m.e = v.e - 1;
+    }
+    m.f <<= m.e - p.e;
+    m.e   = p.e;
+
+    *plus  = p;
+    *minus = m;
+}
+
+
+/* 10^-348, 10^-340, ..., 10^340 normalized */
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+
+/* Gets the cached power c = 10^-k so that c * 2^e is in a range that
+ * makes digit generation work with 64-bit integers. */
+static struct diy_fp get_cached_power(int e, int *k)
+{
+    struct diy_fp result;
+    double        dk;
+    int           ik;
+    unsigned      index;
+
+    dk = (-61 - e) * 0.30102999566398114 + 347; /* log10(2) */
+    ik = (int)dk;
+    if(dk - ik > 0.0) {
+        ik++;
+    }
+
+    index = (unsigned)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+
+    result.f = cached_powers_f[index];
+    result.e = cached_powers_e[index];
+
+    return result;
+}
+
+
+static const uint64_t pow10_u64[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+
+static void grisu_round(char    *buffer,
+                        int      len,
+                        uint64_t delta,
+                        uint64_t rest,
+                        uint64_t ten_kappa,
+                        uint64_t wp_w)
+{
+    /* Move the last digit down while that is closer to the exact
+     * value and still within the boundaries */
+    while(rest < wp_w && delta - rest >= ten_kappa &&
+          (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+
+static int count_decimal_digits32(uint32_t n)
+{
+    int digits = 1;
+
+    while(n >= 10) {
+        n /= 10;
+        digits++;
+    }
+
+    return digits;
+}
+
+
+static void digit_gen(struct diy_fp w,
+                      struct diy_fp mp,
+                      uint64_t      delta,
+                      char         *buffer,
+                      int          *len,
+                      int          *k)
+{
+    const struct diy_fp one = {1ULL << -mp.e, mp.e};
+    const uint64_t      wp_w = mp.f - w.f;
+    uint32_t            p1;
+    uint64_t            p2;
+    uint64_t            tmp;
+    int                 kappa;
+    int                 index;
+    unsigned            d;
+
+    p1    = (uint32_t)(mp.f >> -one.e);
+    p2    = mp.f & (one.f - 1);
+    kappa = count_decimal_digits32(p1);
+    *len  = 0;
+
+    /* The integer part */
+    while(kappa > 0) {
+        d   = p1 / (uint32_t)pow10_u64[kappa - 1];
+        p1 %= (uint32_t)pow10_u64[kappa - 1];
+        if(d || *len) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        kappa--;
+        tmp = ((uint64_t)p1 << -one.e) + p2;
+        if(tmp <= delta) {
+            *k += kappa;
+            grisu_round(buffer, *len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    /* The fractional part */
+    while(1) {
+        p2    *= 10;
+        delta *= 10;
+        d = (unsigned)(p2 >> -one.e);
+        if(d || *len) {
+            buffer[(*len)++] = (char)('0' + d);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if(p2 < delta) {
+            *k += kappa;
+            index = -kappa;
+            grisu_round(buffer,
+                        *len,
+                        delta,
+                        p2,
+                        one.f,
+                        wp_w * (index < 20 ? pow10_u64[index] : 0));
+            return;
+        }
+    }
+}
+
+
+/* Produces the digits and decimal exponent k. value must be
+ * positive. */
+static void grisu2(double value, char *buffer, int *len, int *k)
+{
+    const struct diy_fp v = diy_fp_from_double(value);
+    struct diy_fp       w_m;
+    struct diy_fp       w_p;
+    struct diy_fp       c_mk;
+    struct diy_fp       w;
+    struct diy_fp       wp;
+    struct diy_fp       wm;
+
+    normalized_boundaries(v, &w_m, &w_p);
+
+    c_mk = get_cached_power(w_p.e, k);
+    w    = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    wp   = diy_fp_multiply(w_p, c_mk);
+    wm   = diy_fp_multiply(w_m, c_mk);
+
+    /* Shrink the boundaries by an ulp for the multiply error */
+    wm.f++;
+    wp.f--;
+
+    digit_gen(w, wp, wp.f - wm.f, buffer, len, k);
+}
+
+
+static int write_exponent(int k, char *buffer)
+{
+    char *start = buffer;
+
+    if(k < 0) {
+        *buffer++ = '-';
+        k = -k;
+    }
+
+    if(k >= 100) {
+        *buffer++ = (char)('0' + k / 100);
+        k %= 100;
+        *buffer++ = digit_pairs[k * 2];
+        *buffer++ = digit_pairs[k * 2 + 1];
+    } else if(k >= 10) {
+        *buffer++ = digit_pairs[k * 2];
+        *buffer++ = digit_pairs[k * 2 + 1];
+    } else {
+        *buffer++ = (char)('0' + k);
+    }
+
+    return (int)(buffer - start);
+}
+
+
+/* Lays out the digits as decimal or exponential notation, whichever
+ * is more readable. 10^(kk-1) <= value < 10^kk. */
+static int prettify(char *buffer, int len, int k)
+{
+    const int kk = len + k;
+    int       i;
+    int       offset;
+
+    if(k >= 0 && kk <= 21) {
+        /* 1234e7 -> 12340000000.0 */
+        for(i = len; i < kk; i++) {
+            buffer[i] = '0';
+        }
+        buffer[kk]     = '.';
+        buffer[kk + 1] = '0';
+        return kk + 2;
+
+    } else if(kk > 0 && kk <= 21) {
+        /* 1234e-2 -> 12.34 */
+        memmove(&buffer[kk + 1], &buffer[kk], (size_t)(len - kk));
+        buffer[kk] = '.';
+        return len + 1;
+
+    } else if(kk > -6 && kk <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        offset = 2 - kk;
+        memmove(&buffer[offset], &buffer[0], (size_t)len);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        for(i = 2; i < offset; i++) {
+            buffer[i] = '0';
+        }
+        return len + offset;
+
+    } else if(len == 1) {
+        /* 1e30 */
+        buffer[1] = 'e';
+        return 2 + write_exponent(kk - 1, &buffer[2]);
+
+    } else {
+        /* 1234e30 -> 1.234e33 */
+        memmove(&buffer[2], &buffer[1], (size_t)(len - 1));
+        buffer[1]       = '.';
+        buffer[len + 1] = 'e';
+        return len + 2 + write_exponent(kk - 1, &buffer[len + 2]);
+    }
+}
+
+
+/*
+ * Public function. See json_number.h
+ */
+size_t json_format_double(double value, char *buffer)
+{
+    uint64_t bits;
+    char    *p;
+    int      len;
+    int      k;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    if((bits & DP_EXPONENT_MASK) == DP_EXPONENT_MASK) {
+        /* NaN and infinity */
+        memcpy(buffer, "null", 5);
+        return 4;
+    }
+
+    p = buffer;
+    if(bits >> 63) {
+        *p++ = '-';
+        value = -value;
+    }
+
+    if(value == 0.0) {
+        memcpy(p, "0.0", 4);
+        return (size_t)(p - buffer) + 3;
+    }
+
+    grisu2(value, p, &len, &k);
+    len = prettify(p, len, k);
+    p[len] = '\0';
+
+    return (size_t)(p - buffer) + (size_t)len;
+}
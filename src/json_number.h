@@ -0,0 +1,46 @@
+/*
+ * json_number.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef json_number_h
+#define json_number_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* Number formatting for JSON output. This is faster than printf()
+ * and doesn't depend on the locale, so the decimal point is always a
+ * period.
+ *
+ * Doubles are formatted with the Grisu2 algorithm. The output always
+ * converts back to exactly the same double, and is the shortest
+ * such string in nearly all cases. A double always has a decimal
+ * point or exponent so it is not mistaken for an integer when read
+ * back. JSON has no NaN or infinity so they are output as null.
+ */
+
+
+/* Big enough for any number these output, including the
+ * terminating NULL. */
+#define JSON_NUMBER_MAX_LEN 32
+
+
+/* Each of these writes a NULL-terminated number to buffer, which must
+ * be at least JSON_NUMBER_MAX_LEN long, and returns its length. */
+size_t json_format_uint64(uint64_t value, char *buffer);
+
+size_t json_format_int64(int64_t value, char *buffer);
+
+size_t json_format_double(double value, char *buffer);
+
+
+#endif /* json_number_h */
@@ -113,11 +113,13 @@ jtoken_output_claim(void *ctx, const struct xclaim *claim)
             break;
 
         default:
-            xclaim_encode_generic(me, &(claim->qcbor_item));
+            if(xclaim_encode_generic(me, &(claim->qcbor_item))) {
+                return XCLAIM_ERR_CLAIM_TYPE;
+            }
             break;
     }
 
-    return 0;
+    return XCLAIM_SUCCESS;
 }
 
 
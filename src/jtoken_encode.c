@@ -12,6 +12,8 @@
 
 #include "jtoken_encode.h"
 #include "base64.h"
+#include "json_escape.h"
+#include "json_number.h"
 
 #include <stdlib.h>
 
@@ -41,24 +43,44 @@ void jtoken_encode_finish(struct jtoken_encode_ctx *me)
 }
 
 
-void jtoken_encode_int64(struct jtoken_encode_ctx *me, const char *claim_name, int64_t claim_value)
+/* Outputs a claim whose value has been formatted by json_number.h */
+static void write_number_claim(struct jtoken_encode_ctx *me,
+                               const char               *claim_name,
+                               const char               *number,
+                               size_t                    number_len)
 {
     indent(me);
-    fprintf(me->out_file, "\"%s\": %lld\n", claim_name, claim_value);
+    json_write_string_z(me->out_file, claim_name);
+    fputs(": ", me->out_file);
+    fwrite(number, 1, number_len, me->out_file);
+    fputc('\n', me->out_file);
+}
+
+
+void jtoken_encode_int64(struct jtoken_encode_ctx *me, const char *claim_name, int64_t claim_value)
+{
+    char   number[JSON_NUMBER_MAX_LEN];
+    size_t len = json_format_int64(claim_value, number);
+
+    write_number_claim(me, claim_name, number, len);
 }
 
 
 void jtoken_encode_uint64(struct jtoken_encode_ctx *me, const char *claim_name, uint64_t claim_value)
 {
-    indent(me);
-    fprintf(me->out_file, "\"%s\": %llu\n", claim_name, claim_value);
+    char   number[JSON_NUMBER_MAX_LEN];
+    size_t len = json_format_uint64(claim_value, number);
+
+    write_number_claim(me, claim_name, number, len);
 }
 
 
 void jtoken_encode_double(struct jtoken_encode_ctx *me, const char *claim_name, double claim_value)
 {
-    indent(me);
-    fprintf(me->out_file, "\"%s\": %f\n", claim_name, claim_value);
+    char   number[JSON_NUMBER_MAX_LEN];
+    size_t len = json_format_double(claim_value, number);
+
+    write_number_claim(me, claim_name, number, len);
 }
 
 
@@ -67,9 +89,10 @@ void jtoken_encode_text_string(struct jtoken_encode_ctx *me,
                                struct q_useful_buf_c     claim_value)
 {
     indent(me);
-    fprintf(me->out_file, "\"%s\":\"", claim_name);
-    fwrite(claim_value.ptr, 1, claim_value.len, me->out_file);
-    fprintf(me->out_file, "\"\n");
+    json_write_string_z(me->out_file, claim_name);
+    fputc(':', me->out_file);
+    json_write_string(me->out_file, claim_value);
+    fputc('\n', me->out_file);
 }
 
 
@@ -78,7 +101,8 @@ void jtoken_encode_byte_string(struct jtoken_encode_ctx *me,
                                struct q_useful_buf_c     claim_value)
 {
     indent(me);
-    fprintf(me->out_file, "\"%s\":\"", claim_name);
+    json_write_string_z(me->out_file, claim_name);
+    fprintf(me->out_file, ":\"");
 
     size_t output_size;
     char *b64 = base64_encode(claim_value.ptr, claim_value.len, &output_size);
@@ -96,9 +120,8 @@ void jtoken_encode_byte_string2(struct jtoken_encode_ctx *me,
     size_t output_size;
 
     indent(me);
-    fprintf(me->out_file, "\"");
-    fwrite(claim_name.ptr, 1, claim_name.len, me->out_file);
-    fprintf(me->out_file, "\": \"");
+    json_write_string(me->out_file, claim_name);
+    fprintf(me->out_file, ": \"");
 
     char *b64 = base64_encode(claim_value.ptr, claim_value.len, &output_size);
 
@@ -114,7 +137,8 @@ void jtoken_encode_simple(struct jtoken_encode_ctx *me,
                           enum jtoken_simple_t      simple)
 {
     indent(me);
-    fprintf(me->out_file, "\"%s\":\"", claim_name);
+    json_write_string_z(me->out_file, claim_name);
+    fprintf(me->out_file, ":\"");
 
     switch(simple) {
         case JSON_TRUE:  fprintf(me->out_file, "true");  break;
@@ -131,10 +155,8 @@ void jtoken_encode_bool(struct jtoken_encode_ctx *me,
                         bool                     value)
 {
     indent(me);
-    fprintf(me->out_file,
-            "\"%s\":\"%s\"\n",
-            claim_name,
-            value ? "true" : "false");;
+    json_write_string_z(me->out_file, claim_name);
+    fprintf(me->out_file, ":\"%s\"\n", value ? "true" : "false");
 }
 
 
@@ -142,9 +164,8 @@ void jtoken_encode_null(struct jtoken_encode_ctx *me,
                         const char               *claim_name)
 {
     indent(me);
-    fprintf(me->out_file,
-            "\"%s\":\"null\"\n",
-            claim_name);;
+    json_write_string_z(me->out_file, claim_name);
+    fprintf(me->out_file, ":\"null\"\n");
 }
 
 struct integer_string_map_t {
@@ -223,12 +244,16 @@ jtoken_encode_debug_state(struct jtoken_encode_ctx  *me,
 /* outputs location claim in json format */
 int jtoken_encode_location(struct jtoken_encode_ctx *me, const struct ctoken_location_t *location)
 {
+    char number[JSON_NUMBER_MAX_LEN];
+
     indent(me);
     fprintf(me->out_file, "\"location\" : {\n");
     indent(me);
-    fprintf(me->out_file, "   \"latitude\": %f,\n", location->eat_loc_latitude);
+    json_format_double(location->eat_loc_latitude, number);
+    fprintf(me->out_file, "   \"latitude\": %s,\n", number);
     indent(me);
-    fprintf(me->out_file, "   \"longitude\": %f\n", location->eat_loc_longitude);
+    json_format_double(location->eat_loc_longitude, number);
+    fprintf(me->out_file, "   \"longitude\": %s\n", number);
     indent(me);
     fprintf(me->out_file, "}\n");
 
@@ -258,9 +283,8 @@ void jtoken_encode_open_submod(struct jtoken_encode_ctx   *me,
                                const struct q_useful_buf_c submod_name)
 {
     indent(me);
-    fprintf(me->out_file, "\"");
-    fwrite(submod_name.ptr, 1, submod_name.len, me->out_file);
-    fprintf(me->out_file, "\" : {\n");
+    json_write_string(me->out_file, submod_name);
+    fprintf(me->out_file, " : {\n");
     me->indent_level++;
 }
 
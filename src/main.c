@@ -17,6 +17,8 @@
 #include <sys/errno.h>
 #include "ctoken/ctoken_encode.h"
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "arg_decode.h"
 
@@ -27,12 +29,307 @@
 
 #include "useful_file_io.h"
 #include "openssl_keys.h"
+#include "cose_envelope.h"
+#include "cose_eddsa.h"
+#include "cose_mac0.h"
+#include "cose_encrypt0.h"
+#include "cbor_seq.h"
+#include "token_verify.h"
+#include "dir_batch.h"
+#include "claim_filter.h"
+#include "eat_profile.h"
+#include "tee_encode.h"
+#include "token_stream.h"
+#include "cert_chain.h"
+#include "shm_ring.h"
+#include "token_archive.h"
+#include "columnar_encode.h"
+#include "csv_encode.h"
+#include "useful_buf_malloc.h"
 
 #include "xclaim.h"
 
 
 
 
+/* The output protection, algorithm and keys from the arguments */
+struct output_wrap {
+    enum ctoken_protection_t protection;
+    int32_t                  cose_algorithm_id;
+    uint32_t                 t_cose_opt_flags;
+    struct t_cose_key        sign_key;    /* Signing or MAC key */
+    struct t_cose_key        encrypt_key; /* AES key for the *_ENCRYPT0 protections */
+};
+
+
+/* -out_form columnar, csv and tsv put all the tokens in one output
+ * with a row for each, so their writer is shared by all the tokens.
+ * The one for the -out_form is set. */
+struct row_output {
+    struct columnar_writer *columnar;
+    struct csv_writer      *csv;
+};
+
+
+static bool is_row_output(enum out_format_t format)
+{
+    return format == OUT_FORMAT_COLUMNAR || format == OUT_FORMAT_CSV || format == OUT_FORMAT_TSV;
+}
+
+
+static void output_wrap_free(struct output_wrap *wrap)
+{
+    free_ec_key(wrap->sign_key);
+    free_ec_key(wrap->encrypt_key);
+}
+
+
+/* Works out the output protection, algorithm and keys from the
+ * arguments. This is common to encode_as_cbor() and
+ * encode_passthrough(). Returns 0 on success. The caller frees the
+ * keys with output_wrap_free(). */
+static int get_output_protection(const struct ctoken_arguments *arguments,
+                                 struct output_wrap            *wrap)
+{
+    bool is_mac;
+    bool is_encrypted;
+
+    memset(wrap, 0, sizeof(struct output_wrap));
+    wrap->cose_algorithm_id = T_COSE_ALGORITHM_ES256;
+
+    switch(arguments->output_protection) {
+        case OUT_PROT_NONE:
+            wrap->protection = CTOKEN_PROTECTION_NONE;
+            // TODO: could complain if key file and such are set
+            break;
+
+        case OUT_PROT_SIGN:
+        case OUT_PROT_SIGN_ENCRYPT:
+            if(arguments->output_protection == OUT_PROT_SIGN) {
+                wrap->protection = CTOKEN_PROTECTION_COSE_SIGN1;
+            } else {
+                wrap->protection = CTOKEN_PROTECTION_SIGN1_ENCRYPT0;
+            }
+            wrap->cose_algorithm_id = arguments->out_sign_algorithm;
+            if(wrap->cose_algorithm_id == 0) {
+                wrap->cose_algorithm_id = T_COSE_ALGORITHM_ES256;
+            }
+            if(arguments->out_sign_short_circuit) {
+                // TODO: warn if key and such are set
+                wrap->t_cose_opt_flags |= T_COSE_OPT_SHORT_CIRCUIT_SIG;
+
+            }
+            // TODO: need to set up further...
+            break;
+
+        case OUT_PROT_MAC:
+            wrap->protection        = CTOKEN_PROTECTION_COSE_MAC0;
+            wrap->cose_algorithm_id = COSE_ALGORITHM_HMAC256;
+            break;
+
+        case OUT_PROT_MAC_ENCRYPT:
+            wrap->protection        = CTOKEN_PROTECTION_MAC0_ENCRYPT0;
+            wrap->cose_algorithm_id = COSE_ALGORITHM_HMAC256;
+            break;
+
+        default:
+            return 1;
+    }
+
+    is_mac       = wrap->protection == CTOKEN_PROTECTION_COSE_MAC0 ||
+                   wrap->protection == CTOKEN_PROTECTION_MAC0_ENCRYPT0;
+    is_encrypted = wrap->protection == CTOKEN_PROTECTION_SIGN1_ENCRYPT0 ||
+                   wrap->protection == CTOKEN_PROTECTION_MAC0_ENCRYPT0;
+
+    if(is_encrypted) {
+        if(arguments->out_encrypt_key_file == NULL) {
+            fprintf(stderr, "-out_prot sign_encrypt and mac_encrypt need -out_encrypt_key\n");
+            return 1;
+        }
+        if(read_aes_key_from_file(arguments->out_encrypt_key_file, &wrap->encrypt_key)) {
+            return 1;
+        }
+    }
+
+    if(is_mac) {
+        if(arguments->out_mac_key_file == NULL) {
+            fprintf(stderr, "-out_prot mac and mac_encrypt need -out_mac_key\n");
+            goto Fail;
+        }
+        if(read_hmac_key_from_file(arguments->out_mac_key_file, &wrap->sign_key)) {
+            goto Fail;
+        }
+        return 0;
+    }
+
+    if(arguments->out_sign_key_file != NULL) {
+        int err = read_private_ec_key_from_file(arguments->out_sign_key_file, &wrap->sign_key);
+        if(err) {
+            goto Fail;
+        }
+    }
+
+    if(wrap->protection == CTOKEN_PROTECTION_NONE) {
+        return 0;
+    }
+
+    if(key_is_ed25519(wrap->sign_key)) {
+        /* The algorithm follows from an Ed25519 key */
+        if(arguments->out_sign_algorithm != 0 &&
+           arguments->out_sign_algorithm != COSE_ALGORITHM_EDDSA) {
+            fprintf(stderr, "an Ed25519 key can only be used with -out_sign_alg -8\n");
+            goto Fail;
+        }
+        wrap->cose_algorithm_id = COSE_ALGORITHM_EDDSA;
+
+    } else if(wrap->cose_algorithm_id == COSE_ALGORITHM_EDDSA) {
+        fprintf(stderr, "-out_sign_alg -8 (EdDSA) needs an Ed25519 key\n");
+        goto Fail;
+    }
+
+    return 0;
+
+Fail:
+    output_wrap_free(wrap);
+    return 1;
+}
+
+
+/* The tagging for cose_envelope_wrap() from -out_tag */
+static enum cose_envelope_tag_t get_output_tagging(const struct ctoken_arguments *arguments)
+{
+    switch(arguments->output_tagging) {
+        case OUT_TAG_CWT:  return COSE_ENVELOPE_TAG_CWT;
+        case OUT_TAG_COSE: return COSE_ENVELOPE_TAG_COSE;
+        default:           return COSE_ENVELOPE_TAG_NONE;
+    }
+}
+
+
+/* Returns true if the input token must be signed or MACed, because
+ * -in_prot says so or because there is a key to verify it with. A
+ * UCCS is then rejected. Otherwise claims with the COSE_Sign1 taken
+ * off would be output, perhaps re-signed, as if they were verified. */
+static bool input_must_be_protected(const struct ctoken_arguments *arguments,
+                                    struct t_cose_key              verification_key)
+{
+    switch(arguments->input_protection) {
+        case IN_PROT_SIGN:
+        case IN_PROT_MAC:
+        case IN_PROT_SIGN_ENCRYPT:
+        case IN_PROT_MAC_ENCRYPT:
+            return true;
+
+        default:
+            return verification_key.k.key_ptr != NULL && !arguments->no_verify;
+    }
+}
+
+
+/* Sets up a ctoken encoder with the protection, algorithm and key
+ * from the arguments. Returns 0 on success.
+ *
+ * ctoken can't sign with EdDSA, make a COSE_Mac0 or encrypt, so for
+ * those the encoder is set up for a UCCS that write_cbor_token()
+ * wraps according to wrap. Otherwise wrap->protection is
+ * CTOKEN_PROTECTION_NONE and the token is written as is. The caller
+ * frees the keys with output_wrap_free() either way. */
+static int setup_ctoken_encoder(struct ctoken_encode_ctx      *ctoken_encoder,
+                                const struct ctoken_arguments *arguments,
+                                struct output_wrap            *wrap)
+{
+    enum ctoken_protection_t  protection_type;
+    uint32_t                  ctoken_opt_flags;
+
+    // TODO: this should not be necessary
+    memset(ctoken_encoder, 0, sizeof(struct ctoken_encode_ctx));
+
+    ctoken_opt_flags = 0;
+
+    if(get_output_protection(arguments, wrap)) {
+        return 1;
+    }
+
+    if(wrap->protection == CTOKEN_PROTECTION_COSE_SIGN1 && !key_is_ed25519(wrap->sign_key)) {
+        /* ctoken does this itself */
+        protection_type  = wrap->protection;
+        wrap->protection = CTOKEN_PROTECTION_NONE;
+    } else {
+        protection_type  = CTOKEN_PROTECTION_NONE;
+    }
+
+
+    /* Set up the ctoken encoder with all the necessary options.
+       This is a lot. There is a lot of work to do. */
+    // TODO: further set up needed.
+    ctoken_encode_init(ctoken_encoder,
+                       wrap->t_cose_opt_flags,
+                       ctoken_opt_flags,
+                       protection_type,
+                       wrap->cose_algorithm_id);
+
+    if(arguments->out_sign_key_file != NULL && protection_type == CTOKEN_PROTECTION_COSE_SIGN1) {
+        ctoken_encode_set_key(ctoken_encoder,
+                              wrap->sign_key,
+                              arguments->out_sign_kid);
+
+    }
+
+    return 0;
+}
+
+
+/* Writes a token made by a ctoken encoder from
+ * setup_ctoken_encoder(). If wrap->protection is not
+ * CTOKEN_PROTECTION_NONE, the token is a UCCS that is put in a
+ * COSE_Sign1, COSE_Mac0 or COSE_Encrypt0 first. Returns 0 on
+ * success. */
+static int write_cbor_token(FILE                          *output_file,
+                            struct q_useful_buf_c          token,
+                            const struct output_wrap      *wrap,
+                            const struct ctoken_arguments *arguments)
+{
+    struct q_useful_buf_c    claims_set;
+    struct q_useful_buf_c    completed_token;
+    struct q_useful_buf      out_buf;
+    int                      return_value;
+
+    if(wrap->protection == CTOKEN_PROTECTION_NONE) {
+        write_bytes(output_file, token);
+        return 0;
+    }
+
+    /* The UCCS tag, if any, is not wanted inside */
+    if(cose_envelope_unwrap(token, COSE_ENVELOPE_OPT_NO_VERIFY, wrap->sign_key, &claims_set)) {
+        return 1;
+    }
+
+    out_buf = useful_malloc(cose_envelope_wrap_size(claims_set.len,
+                                                    arguments->out_sign_kid.len));
+    if(q_useful_buf_is_null(out_buf)) {
+        return 1;
+    }
+
+    return_value = cose_envelope_wrap(claims_set,
+                                      wrap->protection,
+                                      get_output_tagging(arguments),
+                                      wrap->cose_algorithm_id,
+                                      wrap->t_cose_opt_flags,
+                                      wrap->sign_key,
+                                      arguments->out_sign_kid,
+                                      wrap->encrypt_key,
+                                      out_buf,
+                                      &completed_token);
+    if(return_value == 0) {
+        write_bytes(output_file, completed_token);
+    }
+
+    useful_buf_free(out_buf);
+
+    return return_value;
+}
+
+
 /* This drives the encoding of the output in CBOR using ctoken. */
 int encode_as_cbor(xclaim_decoder                *xclaim_decoder,
                    FILE                          *output_file,
@@ -42,232 +339,1458 @@ int encode_as_cbor(xclaim_decoder                *xclaim_decoder,
     struct ctoken_encode_ctx  ctoken_encoder;
     struct q_useful_buf       out_buf;
     struct q_useful_buf_c     completed_token;
-    enum ctoken_protection_t  protection_type;
     enum xclaim_error_t       xclaim_err;
-    int32_t                   cose_signing_alg;
-    uint32_t                  t_cose_opt_flags;
-    uint32_t                  ctoken_opt_flags;
     enum ctoken_err_t         ctoken_err;
-    struct t_cose_key         out_sign_key;
+    int                       return_value;
+    struct output_wrap        wrap;
 
+    if(setup_ctoken_encoder(&ctoken_encoder, arguments, &wrap)) {
+        return 1;
+    }
 
-    // TODO: this should not be necessary
-    memset(&ctoken_encoder, 0, sizeof(struct ctoken_encode_ctx));
+    /* Set up the xclaim decoder to work with ctoken. */
+    xclaim_ctoken_encode_init(&xclaim_encoder, &ctoken_encoder);
 
-    cose_signing_alg = T_COSE_ALGORITHM_ES256;
-    t_cose_opt_flags = 0;
-    ctoken_opt_flags = 0;
 
-    switch(arguments->output_protection) {
-        case OUT_PROT_NONE:
-            protection_type = CTOKEN_PROTECTION_NONE;
-            // TODO: could complain if key file and such are set
+    /* Loop only executes twice, once to compute size then to actually
+     * created token */
+    out_buf = (struct q_useful_buf){NULL, SIZE_MAX};
+    return_value = 1;
+
+    while(1) {
+        ctoken_encode_start(&ctoken_encoder, out_buf);
+
+        xclaim_err = xclaim_processor_with_limits(xclaim_decoder,
+                                                  &xclaim_encoder,
+                                                  &arguments->limits);
+        if(xclaim_err != XCLAIM_SUCCESS) {
+            fprintf(stderr, "Error processing claims: %s\n", xclaim_error_string(xclaim_err));
+            goto Done;
+        }
+
+        ctoken_err = ctoken_encode_finish(&ctoken_encoder, &completed_token);
+        if(ctoken_err != CTOKEN_ERR_SUCCESS) {
+            goto Done;
+        }
+
+        if(out_buf.ptr != NULL) {
+            /* Normal exit from loop */
+            break;
+        }
+
+        out_buf.ptr = malloc(completed_token.len);
+        out_buf.len = completed_token.len;
+    }
+
+    return_value = write_cbor_token(output_file, completed_token, &wrap, arguments);
+
+Done:
+    if(out_buf.ptr != NULL) {
+        free(out_buf.ptr);
+    }
+    output_wrap_free(&wrap);
+
+    return return_value;
+}
+
+
+
+enum cached_verify_t {
+    CACHED_VERIFY_MISS,
+    CACHED_VERIFY_VALID,
+    CACHED_VERIFY_INVALID
+};
+
+
+/* A token's place in the verification cache when converting */
+struct cached_verify {
+    struct verify_cache *cache;
+    bool                 have_digest;
+    uint8_t              digest[VERIFY_CACHE_DIGEST_LEN];
+};
+
+
+/* Looks for the token in the verification cache. cache may be NULL.
+ * On a miss, cached_verify_insert() is called once the token has
+ * been checked. */
+static enum cached_verify_t cached_verify_lookup(struct cached_verify *me,
+                                                 struct verify_cache  *cache,
+                                                 struct q_useful_buf_c token)
+{
+    struct verify_cache_result result;
+
+    me->cache       = cache;
+    me->have_digest = cache != NULL && verify_cache_digest(cache, token, me->digest) == 0;
+
+    if(!me->have_digest || !verify_cache_lookup(cache, me->digest, &result)) {
+        return CACHED_VERIFY_MISS;
+    }
+
+    return result.verdict == TOKEN_VERIFY_OK ? CACHED_VERIFY_VALID : CACHED_VERIFY_INVALID;
+}
+
+
+/* Remembers whether the signature or MAC of a token that missed was
+ * good. Only that is cached. Conversion doesn't check the time
+ * claims. */
+static void cached_verify_insert(const struct cached_verify *me, bool valid)
+{
+    struct verify_cache_result result;
+
+    if(!me->have_digest) {
+        return;
+    }
+
+    memset(&result, 0, sizeof(result));
+    result.verdict = valid ? TOKEN_VERIFY_OK : TOKEN_VERIFY_INVALID;
+    result.exp     = INT64_MAX;
+    result.nbf     = INT64_MIN;
+    result.iat     = INT64_MIN;
+
+    verify_cache_insert(me->cache, me->digest, &result);
+}
+
+
+
+/* This drives re-signing, un-signing or re-tagging of a UCCS or CWT
+ * without decoding and re-encoding the claims. Only the outer tags
+ * and COSE_Sign1 are touched so this costs one verify and one sign no
+ * matter how many claims there are. Claims xclaim doesn't understand
+ * are carried over too. With cache, a token that has been verified
+ * before is not verified again. */
+int encode_passthrough(struct q_useful_buf_c          input_bytes,
+                       FILE                          *output_file,
+                       const struct ctoken_arguments *arguments,
+                       struct t_cose_key              verification_key,
+                       struct verify_cache           *cache)
+{
+    struct q_useful_buf_c     claims_set;
+    struct q_useful_buf       out_buf;
+    struct q_useful_buf_c     completed_token;
+    uint32_t                  unwrap_opt_flags;
+    struct output_wrap        wrap;
+    struct cached_verify      cached;
+    enum cached_verify_t      cached_result;
+    int                       unwrap_result;
+    int                       return_value;
+
+    unwrap_opt_flags = arguments->no_verify ? COSE_ENVELOPE_OPT_NO_VERIFY : 0;
+    if(input_must_be_protected(arguments, verification_key)) {
+        /* Also when the cache says the token is valid */
+        unwrap_opt_flags |= COSE_ENVELOPE_OPT_REQUIRE_PROTECTED;
+    }
+
+    cached_result = cached_verify_lookup(&cached, cache, input_bytes);
+    if(cached_result == CACHED_VERIFY_INVALID) {
+        fprintf(stderr, "token validation failed (cached result)\n");
+        return 1;
+    }
+    if(cached_result == CACHED_VERIFY_VALID) {
+        unwrap_opt_flags |= COSE_ENVELOPE_OPT_NO_VERIFY;
+    }
+
+    unwrap_result = cose_envelope_unwrap(input_bytes, unwrap_opt_flags, verification_key, &claims_set);
+    if(cached_result == CACHED_VERIFY_MISS) {
+        cached_verify_insert(&cached, unwrap_result == 0);
+    }
+    if(unwrap_result) {
+        return 1;
+    }
+
+    if(get_output_protection(arguments, &wrap)) {
+        return 1;
+    }
+
+    out_buf = useful_malloc(cose_envelope_wrap_size(claims_set.len,
+                                                    arguments->out_sign_kid.len));
+    if(q_useful_buf_is_null(out_buf)) {
+        return_value = 1;
+        goto Done;
+    }
+
+    return_value = cose_envelope_wrap(claims_set,
+                                      wrap.protection,
+                                      get_output_tagging(arguments),
+                                      wrap.cose_algorithm_id,
+                                      wrap.t_cose_opt_flags,
+                                      wrap.sign_key,
+                                      arguments->out_sign_kid,
+                                      wrap.encrypt_key,
+                                      out_buf,
+                                      &completed_token);
+    if(return_value == 0) {
+        write_bytes(output_file, completed_token);
+    }
+
+    useful_buf_free(out_buf);
+
+Done:
+    output_wrap_free(&wrap);
+
+    return return_value;
+}
+
+
+
+/* Exit status for -verify_only when a token is not valid. 1 is used
+ * for all other errors, bad arguments, files that can't be read... */
+#define EXIT_TOKEN_INVALID 2
+
+
+/* Outputs the one-line result for -verify_only. token_number is 0
+ * when there is only one token. */
+static void print_verify_result(FILE                        *output_file,
+                                size_t                       token_number,
+                                const struct token_verifier *verifier,
+                                enum token_verify_result_t   result)
+{
+    if(token_number) {
+        fprintf(output_file, "%zu ", token_number);
+    }
+
+    if(result == TOKEN_VERIFY_OK) {
+        fprintf(output_file, "pass\n");
+    } else if(verifier->ctoken_error != CTOKEN_ERR_SUCCESS) {
+        fprintf(output_file,
+                "fail %s (ctoken error %d)\n",
+                token_verify_result_string(result),
+                verifier->ctoken_error);
+    } else {
+        fprintf(output_file, "fail %s\n", token_verify_result_string(result));
+    }
+}
+
+
+/* Decrypts token in place if it is a COSE_Encrypt0. token must be in
+ * writable memory. With -in_prot sign_encrypt or mac_encrypt it must
+ * be a COSE_Encrypt0. Returns 0 with the inner token in token on
+ * success. */
+static int decrypt_input(struct q_useful_buf_c         *token,
+                         struct t_cose_key              decryption_key,
+                         const struct ctoken_arguments *arguments)
+{
+    if(!cose_encrypt0_is_encrypt0(*token)) {
+        if(arguments->input_protection == IN_PROT_SIGN_ENCRYPT ||
+           arguments->input_protection == IN_PROT_MAC_ENCRYPT) {
+            fprintf(stderr, "input token is not a COSE_Encrypt0\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    if(decryption_key.k.key_ptr == NULL) {
+        fprintf(stderr, "encrypted input token needs -in_decrypt_key\n");
+        return 1;
+    }
+
+    if(cose_encrypt0_decrypt(*token, decryption_key, token)) {
+        fprintf(stderr, "input token could not be decrypted\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* This is for -verify_only. The signature and optionally exp and nbf
+ * are checked and nothing else. No claims are iterated over and no
+ * output encoder is set up. The input may be one token or a CBOR
+ * sequence of them in which case there's a line of output per token.
+ */
+int verify_only(struct q_useful_buf_c          input_bytes,
+                FILE                          *output_file,
+                const struct ctoken_arguments *arguments,
+                struct t_cose_key              verification_key,
+                struct t_cose_key              decryption_key,
+                struct cert_chain_cache       *certs,
+                struct replay_store           *replay,
+                struct verify_cache           *shared_cache)
+{
+    struct token_verifier      verifier;
+    enum token_verify_result_t result;
+    enum ctoken_protection_t   protection;
+    struct q_useful_buf_c      remaining;
+    struct q_useful_buf_c      token;
+    size_t                     token_number;
+    bool                       is_sequence;
+    int                        seq_error;
+    int                        return_value;
+    struct verify_cache        cache;
+    uint8_t                    key_fingerprint[VERIFY_CACHE_DIGEST_LEN];
+    struct t_cose_key          cert_key;
+
+    switch(arguments->input_protection) {
+        case IN_PROT_NONE:
+            protection = CTOKEN_PROTECTION_NONE;
+            break;
+
+        case IN_PROT_DETECT:
+        case IN_PROT_SIGN:
+        case IN_PROT_SIGN_ENCRYPT:
+            /* Protection is not detected from the token here because
+             * that would let a token with the signature stripped off
+             * pass. */
+            protection = CTOKEN_PROTECTION_COSE_SIGN1;
+            break;
+
+        case IN_PROT_MAC:
+        case IN_PROT_MAC_ENCRYPT:
+            /* The MAC is checked because the key is a MAC key */
+            protection = CTOKEN_PROTECTION_COSE_MAC0;
+            break;
+
+        default:
+            fprintf(stderr, "-verify_only doesn't support this -in_prot\n");
+            return 1;
+    }
+
+    token_verifier_init(&verifier, protection, verification_key, arguments->verify_time);
+
+    is_sequence  = cbor_item_length(input_bytes) != input_bytes.len;
+    remaining    = input_bytes;
+    return_value = 0;
+    memset(&cache, 0, sizeof(cache));
+
+    /* The same token may appear many times in a sequence, so cache
+     * the verification results. Not for UCCSs. Checking one is
+     * cheaper than hashing it and the hashing would be the only
+     * crypto used. The batch inputs share one cache across all their
+     * tokens. */
+    if(shared_cache != NULL) {
+        token_verifier_set_cache(&verifier, shared_cache);
+    } else if(is_sequence && arguments->verify_cache_size > 0 && protection != CTOKEN_PROTECTION_NONE) {
+        if(certs != NULL) {
+            /* The key comes from the certs in each token and those
+             * are in the cache digest, so one key ID does for all. */
+            memset(key_fingerprint, 0, sizeof(key_fingerprint));
+        } else if(get_key_fingerprint(verification_key, key_fingerprint)) {
+            fprintf(stderr, "can't set up verification cache\n");
+            token_verifier_free(&verifier);
+            return 1;
+        }
+        if(verify_cache_init(&cache, (uint32_t)arguments->verify_cache_size, key_fingerprint)) {
+            fprintf(stderr, "can't set up verification cache\n");
+            token_verifier_free(&verifier);
+            return 1;
+        }
+        token_verifier_set_cache(&verifier, &cache);
+    }
+
+    if(replay != NULL) {
+        token_verifier_set_replay_store(&verifier, replay);
+    }
+
+    for(token_number = 1; ; token_number++) {
+        seq_error = cbor_seq_next(&remaining, &token);
+        if(seq_error == 1) {
+            /* Normal end of the tokens */
+            break;
+        }
+        if(seq_error != 0) {
+            /* Can't find the start of the next token so stop */
+            fprintf(output_file, "%zu fail not well-formed CBOR\n", token_number);
+            return_value = EXIT_TOKEN_INVALID;
+            break;
+        }
+
+        if(decrypt_input(&token, decryption_key, arguments)) {
+            verifier.ctoken_error = CTOKEN_ERR_SUCCESS;
+            result = TOKEN_VERIFY_NOT_DECRYPTED;
+        } else if(certs == NULL) {
+            result = token_verify(&verifier, token);
+        } else if(cert_chain_get_key(certs, token, (int64_t)time(NULL), &cert_key)) {
+            /* The chain is checked even when the result is cached so
+             * an expired cert is never passed. */
+            verifier.ctoken_error = CTOKEN_ERR_SUCCESS;
+            result = TOKEN_VERIFY_UNTRUSTED_CERT;
+        } else {
+            verifier.verification_key = cert_key;
+            result = token_verify(&verifier, token);
+            free_ec_key(cert_key);
+        }
+        if(result != TOKEN_VERIFY_OK) {
+            return_value = EXIT_TOKEN_INVALID;
+        }
+
+        if(is_sequence) {
+            print_verify_result(output_file, token_number, &verifier, result);
+        } else if(arguments->verify_reason) {
+            print_verify_result(output_file, 0, &verifier, result);
+        }
+    }
+
+    if(arguments->stats) {
+        fprintf(stderr, "tokens: %zu\n", token_number - 1);
+        if(certs != NULL) {
+            fprintf(stderr,
+                    "cert chain cache hits: %llu of %llu\n",
+                    (unsigned long long)certs->hits,
+                    (unsigned long long)certs->lookups);
+        }
+        if(cache.lookups) {
+            fprintf(stderr,
+                    "verify cache hits: %llu of %llu (%.1f%%)\n",
+                    (unsigned long long)cache.hits,
+                    (unsigned long long)cache.lookups,
+                    100.0 * (double)cache.hits / (double)cache.lookups);
+        }
+        if(replay != NULL) {
+            fprintf(stderr,
+                    "replay checks: %llu, replays: %llu\n",
+                    (unsigned long long)replay->checks,
+                    (unsigned long long)replay->duplicates);
+        }
+    }
+
+    verify_cache_free(&cache);
+    token_verifier_free(&verifier);
+
+    return return_value;
+}
+
+
+
+/* This drives the encoding of the output in JSONB using jtoken.
+ * Unlike ctoken, jtoken is a limited and primitive encoder. It
+ * doesn't support signing or decoding
+ */
+int encode_as_json(xclaim_decoder             *in,
+                   FILE                       *output_file,
+                   const struct xclaim_limits *limits)
+{
+    xclaim_encoder           output;
+    struct jtoken_encode_ctx jo;
+    enum xclaim_error_t      xclaim_error;
+
+    jo.out_file = output_file;
+
+    xclaim_jtoken_encode_init(&output, &jo);
+
+    jtoken_encode_start(&jo);
+
+    xclaim_error = xclaim_processor_with_limits(in, &output, limits);
+    if(xclaim_error != XCLAIM_SUCCESS) {
+        fprintf(stderr, "Error processing claims: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+        goto Done;
+    }
+
+    jtoken_encode_finish(&jo);
+
+    // TODO: error handling
+Done:
+    return xclaim_error;
+}
+
+
+/* This adds the claims to the -out_form columnar output as one row.
+ * Nothing is added for a token that fails part way. */
+static int encode_as_columnar(xclaim_decoder             *in,
+                              struct columnar_writer     *writer,
+                              const struct xclaim_limits *limits)
+{
+    xclaim_encoder      output;
+    struct columnar_row row;
+    enum xclaim_error_t xclaim_error;
+    int                 return_value;
+
+    xclaim_columnar_encode_init(&output, &row, writer);
+
+    xclaim_error = xclaim_processor_with_limits(in, &output, limits);
+    if(xclaim_error != XCLAIM_SUCCESS) {
+        fprintf(stderr, "Error processing claims: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+        return_value = 1;
+        goto Done;
+    }
+
+    return_value = columnar_row_add(&row);
+
+Done:
+    columnar_row_free(&row);
+    return return_value;
+}
+
+
+/* This adds the claims to the -out_form csv or tsv output as one
+ * line. Nothing is added for a token that fails part way. */
+static int encode_as_csv(xclaim_decoder             *in,
+                         struct csv_writer          *writer,
+                         const struct xclaim_limits *limits)
+{
+    xclaim_encoder      output;
+    struct csv_row      row;
+    enum xclaim_error_t xclaim_error;
+
+    xclaim_csv_encode_init(&output, &row, writer);
+
+    xclaim_error = xclaim_processor_with_limits(in, &output, limits);
+    if(xclaim_error != XCLAIM_SUCCESS) {
+        fprintf(stderr, "Error processing claims: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+        return 1;
+    }
+
+    return csv_row_add(&row);
+}
+
+
+/* Room for the COSE headers and signature on top of the claims when
+ * guessing the size of a CBOR output */
+#define CBOR_OUTPUT_OVERHEAD 1024
+
+
+/* Where the claims come from when a CBOR output from encode_tee() is
+ * redone. It is the claims before the EAT profile so the profile
+ * isn't checked a second time and its violations are only printed
+ * once. */
+struct claims_source {
+    /* An input token that has been verified, or NULL_Q_USEFUL_BUF_C
+     * when the claims come from decoder. */
+    struct q_useful_buf_c            token;
+    struct t_cose_key                verification_key;
+    xclaim_decoder                  *decoder;
+    const struct claim_filter_rules *filter_rules;
+};
+
+
+/* Outputs the claims from source in CBOR on their own. A token is
+ * decoded again from the start, without checking the signature or
+ * MAC again, and the filter is applied again so the output is the
+ * same as it would have been from the tee. */
+static int encode_cbor_again(const struct claims_source    *source,
+                             FILE                          *output_file,
+                             const struct ctoken_arguments *arguments)
+{
+    struct ctoken_decode_ctx    cctx;
+    xclaim_decoder              decoder;
+    xclaim_decoder              filtered_decoder;
+    struct claim_filter         filter;
+    xclaim_decoder             *claims_decoder;
+    struct xclaim_submod_cursor submod;
+    int                         return_value;
+
+    claims_decoder = source->decoder;
+
+    if(source->token.ptr != NULL) {
+        if(xclaim_ctoken_decode_init_verified(&decoder, &cctx, source->token, source->verification_key)) {
+            return 1;
+        }
+        if(arguments->submod_path_len > 0 &&
+           xclaim_ctoken_seek_submod(&cctx,
+                                     arguments->submod_path,
+                                     arguments->submod_path_len,
+                                     &submod) != XCLAIM_SUCCESS) {
+            return 1;
+        }
+        claims_decoder = &decoder;
+    }
+
+    if(source->filter_rules != NULL) {
+        claim_filter_init(&filtered_decoder, &filter, claims_decoder, source->filter_rules);
+        claims_decoder = &filtered_decoder;
+    }
+
+    return_value = encode_as_cbor(claims_decoder, output_file, arguments);
+
+    if(source->filter_rules != NULL) {
+        claim_filter_finish(&filter);
+    }
+
+    return return_value;
+}
+
+
+/* This drives output in several formats from one pass over the
+ * decoder with a tee encoder. encode_as_cbor() makes two passes, one
+ * to compute the size. That would run the other encoders twice, so
+ * instead each CBOR output gets a buffer of size_guess plus
+ * CBOR_OUTPUT_OVERHEAD. In the rare case that isn't enough, that
+ * output is redone on its own from source with
+ * encode_cbor_again(). */
+static int encode_tee(xclaim_decoder                *decoder,
+                      const struct claims_source    *source,
+                      FILE                    *const *output_files,
+                      const struct ctoken_arguments *arguments,
+                      size_t                         size_guess)
+{
+    xclaim_encoder           encoders[MAX_OUTPUTS];
+    struct jtoken_encode_ctx json_encoders[MAX_OUTPUTS];
+    struct ctoken_encode_ctx cbor_encoders[MAX_OUTPUTS];
+    struct q_useful_buf      cbor_bufs[MAX_OUTPUTS];
+    struct output_wrap       wraps[MAX_OUTPUTS];
+    xclaim_encoder           tee;
+    struct xclaim_tee_ctx    tee_ctx;
+    struct q_useful_buf_c    completed_token;
+    enum xclaim_error_t      xclaim_error;
+    enum ctoken_err_t        ctoken_err;
+    uint32_t                 count;
+    uint32_t                 i;
+    int                      return_value;
+
+    count = arguments->output_count;
+    for(i = 0; i < count; i++) {
+        cbor_bufs[i] = NULL_Q_USEFUL_BUF;
+        memset(&wraps[i], 0, sizeof(struct output_wrap));
+    }
+
+    return_value = 1;
+
+    for(i = 0; i < count; i++) {
+        if(arguments->output_formats[i] == OUT_FORMAT_CBOR) {
+            if(setup_ctoken_encoder(&cbor_encoders[i], arguments, &wraps[i])) {
+                goto Done;
+            }
+            cbor_bufs[i].len = size_guess + CBOR_OUTPUT_OVERHEAD;
+            cbor_bufs[i].ptr = malloc(cbor_bufs[i].len);
+            if(cbor_bufs[i].ptr == NULL) {
+                goto Done;
+            }
+            ctoken_encode_start(&cbor_encoders[i], cbor_bufs[i]);
+            xclaim_ctoken_encode_init(&encoders[i], &cbor_encoders[i]);
+        } else {
+            json_encoders[i].out_file = output_files[i];
+            xclaim_jtoken_encode_init(&encoders[i], &json_encoders[i]);
+            jtoken_encode_start(&json_encoders[i]);
+        }
+    }
+
+    if(xclaim_tee_encode_init(&tee, &tee_ctx, encoders, count)) {
+        goto Done;
+    }
+
+    xclaim_error = xclaim_processor_with_limits(decoder, &tee, &arguments->limits);
+    if(xclaim_error != XCLAIM_SUCCESS) {
+        fprintf(stderr, "Error processing claims: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+        goto Done;
+    }
+
+    for(i = 0; i < count; i++) {
+        if(arguments->output_formats[i] == OUT_FORMAT_JSON) {
+            jtoken_encode_finish(&json_encoders[i]);
+            continue;
+        }
+
+        ctoken_err = ctoken_encode_finish(&cbor_encoders[i], &completed_token);
+        if(ctoken_err == CTOKEN_ERR_TOO_SMALL) {
+            if(encode_cbor_again(source, output_files[i], arguments)) {
+                goto Done;
+            }
+        } else if(ctoken_err != CTOKEN_ERR_SUCCESS) {
+            goto Done;
+        } else if(write_cbor_token(output_files[i], completed_token, &wraps[i], arguments)) {
+            goto Done;
+        }
+    }
+
+    return_value = 0;
+
+Done:
+    for(i = 0; i < count; i++) {
+        free(cbor_bufs[i].ptr);
+        output_wrap_free(&wraps[i]);
+    }
+
+    return return_value;
+}
+
+
+/* Outputs the claims from the decoder in each of the -out_form
+ * formats. size_guess is roughly the size of the claims and source is
+ * where to get them again, both for when there is more than one
+ * output. rows is only for the forms that put all the tokens in one
+ * output, which are never one of several outputs. */
+static int encode_outputs(xclaim_decoder                *decoder,
+                          const struct claims_source    *source,
+                          FILE                    *const *output_files,
+                          const struct row_output       *rows,
+                          const struct ctoken_arguments *arguments,
+                          size_t                         size_guess)
+{
+    if(arguments->output_count > 1) {
+        return encode_tee(decoder, source, output_files, arguments, size_guess);
+    }
+
+    if(arguments->output_format == OUT_FORMAT_CBOR) {
+        return encode_as_cbor(decoder, output_files[0], arguments);
+    } else if(arguments->output_format == OUT_FORMAT_COLUMNAR) {
+        return encode_as_columnar(decoder, rows->columnar, &arguments->limits);
+    } else if(arguments->output_format == OUT_FORMAT_CSV ||
+              arguments->output_format == OUT_FORMAT_TSV) {
+        return encode_as_csv(decoder, rows->csv, &arguments->limits);
+    } else {
+        return encode_as_json(decoder, output_files[0], &arguments->limits);
+    }
+}
+
+
+
+/* For -submod when the submodule is a nested token. It is output as
+ * it is, whatever the -out_form, as xclaim doesn't verify nested
+ * tokens. */
+static int output_nested_token(struct q_useful_buf_c          nested_token,
+                               FILE                    *const *output_files,
+                               const struct ctoken_arguments *arguments)
+{
+    uint32_t i;
+
+    for(i = 0; i < arguments->output_count; i++) {
+        if(fwrite(nested_token.ptr, 1, nested_token.len, output_files[i]) != nested_token.len) {
+            fprintf(stderr, "error writing nested token (%s)\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* Verifies, decodes and outputs one input token with the given
+ * verification key. With cache, a token that has been verified before
+ * is only decoded. */
+static int convert_token(struct q_useful_buf_c            input_bytes,
+                         FILE                      *const *output_files,
+                         const struct row_output         *rows,
+                         const struct ctoken_arguments   *arguments,
+                         struct t_cose_key                verification_key,
+                         struct verify_cache             *cache,
+                         struct replay_store             *replay,
+                         const struct claim_filter_rules *filter_rules,
+                         const struct eat_profile        *profile)
+{
+    struct ctoken_decode_ctx     cctx;
+    xclaim_decoder               decoder;
+    xclaim_decoder               filtered_decoder;
+    struct claim_filter          filter;
+    xclaim_decoder               profiled_decoder;
+    struct eat_profile_validator validator;
+    xclaim_decoder              *claims_decoder;
+    struct xclaim_submod_cursor  submod;
+    enum token_verify_result_t   replay_result;
+    enum xclaim_error_t          xclaim_error;
+    struct cached_verify         cached;
+    enum cached_verify_t         cached_result;
+    struct claims_source         source;
+    int                          decode_result;
+    int                          return_value;
+
+    if(arguments->output_count == 1 &&
+       arguments->output_format == OUT_FORMAT_CBOR &&
+       filter_rules == NULL &&
+       profile == NULL &&
+       replay == NULL &&
+       arguments->submod_path_len == 0) {
+        /* No claims are being transformed or checked, so the claims-set
+         * goes straight through without being decoded. With more
+         * than one output it is cheaper to verify and decode once
+         * for all of them. The replay check needs the cti and iat
+         * decoded so it doesn't go this way. */
+        return encode_passthrough(input_bytes, output_files[0], arguments, verification_key, cache);
+    }
+
+    if(input_must_be_protected(arguments, verification_key) && cose_envelope_is_uccs(input_bytes)) {
+        fprintf(stderr, "input token is a UCCS, but it must be signed or MACed\n");
+        return 1;
+    }
+
+    cached_result = cached_verify_lookup(&cached, cache, input_bytes);
+    if(cached_result == CACHED_VERIFY_INVALID) {
+        fprintf(stderr, "token validation failed (cached result)\n");
+        return 1;
+    }
+
+    // TODO: need to handle JSON input too. This assumes file is CBOR for now
+    if(cached_result == CACHED_VERIFY_VALID) {
+        decode_result = xclaim_ctoken_decode_init_verified(&decoder, &cctx, input_bytes, verification_key);
+    } else {
+        decode_result = xclaim_ctoken_decode_init(&decoder, &cctx, input_bytes, verification_key);
+        cached_verify_insert(&cached, decode_result == 0);
+    }
+    if(decode_result) {
+        return 1;
+    }
+
+    if(replay != NULL) {
+        /* A replayed token is dropped. Nothing is output for it. */
+        replay_result = token_replay_check(replay, &cctx);
+        if(replay_result != TOKEN_VERIFY_OK) {
+            fprintf(stderr, "token rejected: %s\n", token_verify_result_string(replay_result));
+            return EXIT_TOKEN_INVALID;
+        }
+    }
+
+    if(arguments->submod_path_len > 0) {
+        /* Everything off the path is skipped without being decoded */
+        xclaim_error = xclaim_ctoken_seek_submod(&cctx,
+                                                 arguments->submod_path,
+                                                 arguments->submod_path_len,
+                                                 &submod);
+        if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN && rows != NULL) {
+            fprintf(stderr, "submodule \"%s\" is a nested token which can't be output as a row\n", arguments->submod);
+            return 1;
+        } else if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+            return output_nested_token(submod.nested_token, output_files, arguments);
+        } else if(xclaim_error == XCLAIM_NO_MORE) {
+            fprintf(stderr, "no submodule \"%s\" in the token\n", arguments->submod);
+            return 1;
+        } else if(xclaim_error != XCLAIM_SUCCESS) {
+            fprintf(stderr, "Error finding submodule: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+            return 1;
+        }
+    }
+
+    /* The profile is checked against the claims as they are in the
+     * token, before any filter changes them */
+    claims_decoder = &decoder;
+    if(profile != NULL) {
+        eat_profile_validator_init(&profiled_decoder, &validator, claims_decoder, profile, arguments->profile_fail_fast);
+        claims_decoder = &profiled_decoder;
+    }
+    if(filter_rules != NULL) {
+        claim_filter_init(&filtered_decoder, &filter, claims_decoder, filter_rules);
+        claims_decoder = &filtered_decoder;
+    }
+
+    source.token            = input_bytes;
+    source.verification_key = verification_key;
+    source.decoder          = NULL;
+    source.filter_rules     = filter_rules;
+
+    return_value = encode_outputs(claims_decoder, &source, output_files, rows, arguments, input_bytes.len);
+
+    if(filter_rules != NULL) {
+        claim_filter_finish(&filter);
+    }
+
+    if(profile != NULL && validator.violations > 0) {
+        return EXIT_TOKEN_INVALID;
+    }
+
+    return return_value;
+}
+
+
+/* Size of the reads for -in_stream. Small enough that the first
+ * claims come out soon, big enough that there aren't many reads. */
+#define STREAM_READ_SIZE 16384
+
+
+/* This is for -in_stream. The claims are output in JSON as they
+ * arrive. The signature is checked when the last of the token
+ * arrives. Until then the output must not be trusted, which is why
+ * a bad signature is EXIT_TOKEN_INVALID. */
+static int process_stream(int                            file_descriptor,
+                          FILE                          *output_file,
+                          const struct ctoken_arguments *arguments,
+                          struct t_cose_key              verification_key)
+{
+    struct token_stream        stream;
+    enum token_stream_status_t status;
+    struct xclaim              claim;
+    uint8_t                    chunk[STREAM_READ_SIZE];
+    ssize_t                    amount_read;
+    uint32_t                   claim_count;
+    xclaim_encoder             output;
+    struct jtoken_encode_ctx   jo;
+    xclaim_decoder             submods_decoder;
+    struct ctoken_decode_ctx   submods_ctx;
+    enum xclaim_error_t        xclaim_error;
+    uint32_t                   stream_opt_flags;
+    int                        return_value;
+
+    stream_opt_flags = arguments->no_verify ? TOKEN_STREAM_OPT_NO_VERIFY : 0;
+    if(input_must_be_protected(arguments, verification_key)) {
+        stream_opt_flags |= TOKEN_STREAM_OPT_REQUIRE_PROTECTED;
+    }
+    token_stream_init(&stream, stream_opt_flags, verification_key);
+
+    jo.out_file = output_file;
+    xclaim_jtoken_encode_init(&output, &jo);
+    jtoken_encode_start(&jo);
+
+    return_value = 1;
+    claim_count  = 0;
+
+    while(1) {
+        status = token_stream_next(&stream, &claim);
+        if(status == TOKEN_STREAM_CLAIM) {
+            if(++claim_count > arguments->limits.max_claims) {
+                fprintf(stderr, "Error processing claims: %s\n",
+                        xclaim_error_string(XCLAIM_ERR_TOO_MANY_CLAIMS));
+                goto Done;
+            }
+            xclaim_error = output.output_claim(output.ctx, &claim);
+            if(xclaim_error != XCLAIM_SUCCESS) {
+                fprintf(stderr, "Error processing claims: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+                goto Done;
+            }
+            continue;
+        } else if(status == TOKEN_STREAM_DONE) {
             break;
+        } else if(status == TOKEN_STREAM_ERROR) {
+            return_value = EXIT_TOKEN_INVALID;
+            goto Done;
+        }
 
-        case OUT_PROT_SIGN:
-            protection_type = CTOKEN_PROTECTION_COSE_SIGN1;
-            cose_signing_alg = arguments->out_sign_algorithm;
-            if(cose_signing_alg == 0) {
-                cose_signing_alg = T_COSE_ALGORITHM_ES256;
+        /* Flush what's been output before waiting for more */
+        fflush(output_file);
+        amount_read = read(file_descriptor, chunk, sizeof(chunk));
+        if(amount_read < 0) {
+            if(errno == EINTR) {
+                continue;
             }
-            if(arguments->out_sign_short_circuit) {
-                // TODO: warn if key and such are set
-                t_cose_opt_flags |= T_COSE_OPT_SHORT_CIRCUIT_SIG;
+            fprintf(stderr, "error reading input (%s)\n", strerror(errno));
+            goto Done;
+        }
+        if(amount_read == 0) {
+            fprintf(stderr, "input ended before the end of the token or the token is not well-formed\n");
+            return_value = EXIT_TOKEN_INVALID;
+            goto Done;
+        }
+        if(token_stream_feed(&stream, (struct q_useful_buf_c){chunk, (size_t)amount_read}) == TOKEN_STREAM_ERROR) {
+            goto Done;
+        }
+    }
 
+    /* The submods section is kept back and done last with the full
+     * xclaim_processor() */
+    switch(token_stream_submods(&stream, &submods_decoder, &submods_ctx)) {
+        case 0:
+            xclaim_error = xclaim_processor_with_limits(&submods_decoder, &output, &arguments->limits);
+            if(xclaim_error != XCLAIM_SUCCESS) {
+                fprintf(stderr, "Error processing claims: %s (%d)\n", xclaim_error_string(xclaim_error), xclaim_error);
+                goto Done;
             }
-            // TODO: will have to handle sign and protect combo
-            // TODO: need to set up further...
+            break;
+
+        case 1:
             break;
 
         default:
-            return 1;
+            goto Done;
     }
 
+    jtoken_encode_finish(&jo);
+    return_value = 0;
 
-    memset(&out_sign_key, 0, sizeof(struct t_cose_key));
-
-    if(arguments->out_sign_key_file != NULL) {
-        int err = read_private_ec_key_from_file(arguments->out_sign_key_file, &out_sign_key);
-        if(err) {
-            return 1;
-        }
-    }
+Done:
+    token_stream_finish(&stream);
+    return return_value;
+}
 
 
-    /* Set up the ctoken encoder with all the necessary options.
-       This is a lot. There is a lot of work to do. */
-    // TODO: further set up needed.
-    ctoken_encode_init(&ctoken_encoder,
-                       t_cose_opt_flags,
-                       ctoken_opt_flags,
-                       protection_type,
-                       cose_signing_alg);
+/* Verifies, decodes and outputs one input token. This is the part of
+ * xclaim_main() that is done for each input file so it is also what
+ * the -in_dir workers run. It is thread safe. With certs the
+ * verification key comes from the x5chain or x5t in the token. A
+ * COSE_Encrypt0 is decrypted in place, so input_bytes must be in
+ * writable memory. cache is NULL or the verification cache shared by
+ * the workers. */
+static int process_token(struct q_useful_buf_c            input_bytes,
+                         FILE                      *const *output_files,
+                         const struct row_output         *rows,
+                         const struct ctoken_arguments   *arguments,
+                         struct t_cose_key                verification_key,
+                         struct t_cose_key                decryption_key,
+                         struct cert_chain_cache         *certs,
+                         struct verify_cache             *cache,
+                         struct replay_store             *replay,
+                         const struct claim_filter_rules *filter_rules,
+                         const struct eat_profile        *profile)
+{
+    struct t_cose_key cert_key;
+    int               return_value;
 
-    if(arguments->out_sign_key_file != NULL) {
-        ctoken_encode_set_key(&ctoken_encoder,
-                              out_sign_key,
-                              arguments->out_sign_kid);
+    if(arguments->verify_only) {
+        return verify_only(input_bytes, output_files[0], arguments, verification_key, decryption_key, certs, replay, cache);
+    }
 
+    if(decrypt_input(&input_bytes, decryption_key, arguments)) {
+        return EXIT_TOKEN_INVALID;
     }
 
-    /* Set up the xclaim decoder to work with ctoken. */
-    xclaim_ctoken_encode_init(&xclaim_encoder, &ctoken_encoder);
+    if(certs == NULL) {
+        return convert_token(input_bytes, output_files, rows, arguments, verification_key, cache, replay, filter_rules, profile);
+    }
 
+    if(cert_chain_get_key(certs, input_bytes, (int64_t)time(NULL), &cert_key)) {
+        return EXIT_TOKEN_INVALID;
+    }
 
-    /* Loop only executes twice, once to compute size then to actually
-     * created token */
-    out_buf = (struct q_useful_buf){NULL, SIZE_MAX};
+    return_value = convert_token(input_bytes, output_files, rows, arguments, cert_key, cache, replay, filter_rules, profile);
 
-    while(1) {
-        ctoken_encode_start(&ctoken_encoder, out_buf);
+    free_ec_key(cert_key);
 
-        xclaim_err = xclaim_processor(xclaim_decoder, &xclaim_encoder);
-        if(xclaim_err != XCLAIM_SUCCESS) {
-            goto Done;
-        }
+    return return_value;
+}
 
-        ctoken_err = ctoken_encode_finish(&ctoken_encoder, &completed_token);
-        if(ctoken_err != CTOKEN_ERR_SUCCESS) {
-            goto Done;
-        }
 
-        if(out_buf.ptr != NULL) {
-            /* Normal exit from loop */
-            break;
-        }
+/* What the -in_dir and -in_shm workers share */
+struct batch_context {
+    const struct ctoken_arguments   *arguments;
+    FILE                     *const *output_files; /* For -in_archive */
+    const struct row_output         *rows;
+    struct t_cose_key                verification_key;
+    struct t_cose_key                decryption_key;
+    struct cert_chain_cache         *certs;
+    struct verify_cache             *cache;
+    struct replay_store             *replay;
+    const struct claim_filter_rules *filter_rules;
+    const struct eat_profile        *profile;
+};
+
+
+/* The dir_batch_process_t for -in_dir */
+static int process_batch_file(void                 *context,
+                              const char           *path,
+                              struct q_useful_buf_c input_bytes,
+                              FILE                 *output)
+{
+    struct batch_context *batch = context;
 
-        out_buf.ptr = malloc(completed_token.len);
-        out_buf.len = completed_token.len;
+    if(batch->arguments->verify_only) {
+        /* So the results can be told apart in the combined output */
+        fprintf(output, "%s ", path);
     }
 
-    write_bytes(output_file, completed_token);
+    return process_token(input_bytes,
+                         &output,
+                         batch->rows,
+                         batch->arguments,
+                         batch->verification_key,
+                         batch->decryption_key,
+                         batch->certs,
+                         batch->cache,
+                         batch->replay,
+                         batch->filter_rules,
+                         batch->profile);
+}
 
-Done:
-    if(out_buf.ptr != NULL) {
-        free(out_buf.ptr);
-    }
 
-    return 0;
+/* Runs process_token() on every file in -in_dir. */
+static int process_dir(const struct ctoken_arguments   *arguments,
+                       FILE                            *output_file,
+                       const struct row_output         *rows,
+                       struct t_cose_key                verification_key,
+                       struct t_cose_key                decryption_key,
+                       struct cert_chain_cache         *certs,
+                       struct verify_cache             *cache,
+                       struct replay_store             *replay,
+                       const struct claim_filter_rules *filter_rules,
+                       const struct eat_profile        *profile)
+{
+    struct dir_batch_options options;
+    struct batch_context     context;
+    struct ctoken_arguments  batch_arguments;
+
+    /* Stats are for the whole batch, not each file */
+    batch_arguments       = *arguments;
+    batch_arguments.stats = false;
+
+    context.arguments        = &batch_arguments;
+    context.rows             = rows;
+    context.verification_key = verification_key;
+    context.decryption_key   = decryption_key;
+    context.certs            = certs;
+    context.cache            = cache;
+    context.replay           = replay;
+    context.filter_rules     = filter_rules;
+    context.profile          = profile;
+
+    memset(&options, 0, sizeof(options));
+    options.in_dir          = arguments->input_dir;
+    options.glob            = arguments->input_glob;
+    options.recursive       = arguments->input_recursive;
+    options.out_dir         = arguments->output_dir;
+    options.out_suffix      = arguments->output_format == OUT_FORMAT_CBOR ? ".cbor" : ".json";
+    options.combined_output = output_file;
+    options.workers         = arguments->workers;
+    options.io_depth        = arguments->io_depth;
+
+    return dir_batch_run(&options, process_batch_file, &context);
 }
 
 
+/* The shm_ring_process_t for -in_shm */
+static int process_shm_request(void                 *context,
+                               struct q_useful_buf_c input_bytes,
+                               FILE                 *output)
+{
+    struct batch_context *batch = context;
+
+    return process_token(input_bytes,
+                         &output,
+                         NULL,
+                         batch->arguments,
+                         batch->verification_key,
+                         batch->decryption_key,
+                         batch->certs,
+                         batch->cache,
+                         batch->replay,
+                         batch->filter_rules,
+                         batch->profile);
+}
 
-/* This drives the encoding of the output in JSONB using jtoken.
- * Unlike ctoken, jtoken is a limited and primitive encoder. It
- * doesn't support signing or decoding
- */
-int encode_as_json(xclaim_decoder *in, FILE *output_file)
+
+/* Runs process_token() on every token put in the -in_shm request
+ * ring. The tokens are worked on in place in the shared memory. */
+static int process_shm(const struct ctoken_arguments   *arguments,
+                       struct t_cose_key                verification_key,
+                       struct t_cose_key                decryption_key,
+                       struct cert_chain_cache         *certs,
+                       struct verify_cache             *cache,
+                       struct replay_store             *replay,
+                       const struct claim_filter_rules *filter_rules,
+                       const struct eat_profile        *profile)
 {
-    xclaim_encoder           output;
-    struct jtoken_encode_ctx jo;
-    enum xclaim_error_t      xclaim_error;
+    struct batch_context     context;
+    struct ctoken_arguments  shm_arguments;
+
+    /* As for -in_dir */
+    shm_arguments       = *arguments;
+    shm_arguments.stats = false;
+
+    context.arguments        = &shm_arguments;
+    context.verification_key = verification_key;
+    context.decryption_key   = decryption_key;
+    context.certs            = certs;
+    context.cache            = cache;
+    context.replay           = replay;
+    context.filter_rules     = filter_rules;
+    context.profile          = profile;
+
+    return shm_ring_run(arguments->input_shm, arguments->workers, process_shm_request, &context);
+}
 
-    jo.out_file = output_file;
 
-    xclaim_jtoken_encode_init(&output, &jo);
+/* The token_archive_callback for -in_archive */
+static int process_archive_token(void *context, struct q_useful_buf token)
+{
+    struct batch_context *batch = context;
+
+    return process_token((struct q_useful_buf_c){token.ptr, token.len},
+                         batch->output_files,
+                         batch->rows,
+                         batch->arguments,
+                         batch->verification_key,
+                         batch->decryption_key,
+                         batch->certs,
+                         batch->cache,
+                         batch->replay,
+                         batch->filter_rules,
+                         batch->profile);
+}
 
-    jtoken_encode_start(&jo);
 
-    xclaim_error = xclaim_processor(in, &output);
-    if(xclaim_error != XCLAIM_SUCCESS) {
-        fprintf(stderr, "Error processing claims %d\n", xclaim_error);
-        goto Done;
+/* Runs process_token() on the tokens in -in_archive that match the
+ * -archive_ options. Only those are read. */
+static int process_archive(const struct ctoken_arguments   *arguments,
+                           FILE                     *const *output_files,
+                           const struct row_output         *rows,
+                           struct t_cose_key                verification_key,
+                           struct t_cose_key                decryption_key,
+                           struct cert_chain_cache         *certs,
+                           struct verify_cache             *cache,
+                           struct replay_store             *replay,
+                           const struct claim_filter_rules *filter_rules,
+                           const struct eat_profile        *profile)
+{
+    struct token_archive       archive;
+    struct token_archive_query query;
+    struct batch_context       context;
+    uint64_t                   match_count;
+    int                        return_value;
+
+    context.arguments        = arguments;
+    context.output_files     = output_files;
+    context.rows             = rows;
+    context.verification_key = verification_key;
+    context.decryption_key   = decryption_key;
+    context.certs            = certs;
+    context.cache            = cache;
+    context.replay           = replay;
+    context.filter_rules     = filter_rules;
+    context.profile          = profile;
+
+    query.ueid = arguments->archive_ueid;
+    query.cti  = arguments->archive_cti;
+    query.from = arguments->archive_from;
+    query.to   = arguments->archive_to;
+
+    return_value = 1;
+    if(token_archive_open(&archive, arguments->input_archive) == 0) {
+        return_value = token_archive_query(&archive, &query, process_archive_token, &context, &match_count);
+        if(arguments->stats) {
+            fprintf(stderr, "tokens matched: %llu\n", (unsigned long long)match_count);
+        }
     }
+    token_archive_close(&archive);
 
-    jtoken_encode_finish(&jo);
-
-    // TODO: error handling
-Done:
-    return xclaim_error;
+    return return_value;
 }
 
 
-
 /* Does the main work of xclaim aside from argument parsing. */
 int xclaim_main(const struct ctoken_arguments *arguments)
 {
     struct q_useful_buf_c         input_bytes;
-    FILE                         *output_file;
-    struct ctoken_decode_ctx      cctx;
+    FILE                         *output_files[MAX_OUTPUTS];
+    uint32_t                      i;
+    size_t                        claims_size;
+    const char                  **claim;
     struct claim_argument_decoder parg;
     struct t_cose_key             verification_key;
+    struct t_cose_key             decryption_key;
     xclaim_decoder                decoder;
     int                           return_value;
+    struct replay_store           replay_store;
+    struct replay_store          *replay;
+    struct cert_chain_cache       cert_cache;
+    struct cert_chain_cache      *certs;
+    struct claim_filter_rules    *filter_rules;
+    xclaim_decoder                filtered_decoder;
+    struct claim_filter           filter;
+    struct eat_profile           *profile;
+    xclaim_decoder                profiled_decoder;
+    struct eat_profile_validator  validator;
+    xclaim_decoder               *claims_decoder;
+    struct claims_source          source;
+    int                           stream_descriptor;
+    struct columnar_writer        columnar_writer;
+    struct csv_writer             csv_writer;
+    struct row_output             row_output;
+    struct row_output            *rows;
+    struct verify_cache           verify_cache;
+    struct verify_cache          *cache;
+    uint8_t                       key_fingerprint[VERIFY_CACHE_DIGEST_LEN];
 
     verification_key.crypto_lib = T_COSE_CRYPTO_LIB_OPENSSL;
     verification_key.k.key_ptr = NULL;
 
-    output_file = NULL;
+    memset(&decryption_key, 0, sizeof(decryption_key));
+
+    for(i = 0; i < MAX_OUTPUTS; i++) {
+        output_files[i] = NULL;
+    }
 
     input_bytes = NULL_Q_USEFUL_BUF_C;
 
     return_value = 0;
 
+    replay = NULL;
+
+    certs = NULL;
+
+    memset(&verify_cache, 0, sizeof(verify_cache));
+    cache = NULL;
+
+    filter_rules = NULL;
+    memset(&filter, 0, sizeof(filter));
+    profile = NULL;
+    claims_decoder = &decoder;
+    stream_descriptor = -1;
+    memset(&row_output, 0, sizeof(row_output));
+    rows = NULL;
+
+    /* The filter rules are compiled once and used for every token */
+    if(arguments->filters) {
+        filter_rules = malloc(sizeof(*filter_rules));
+        if(filter_rules == NULL || claim_filter_compile(arguments->filters, filter_rules)) {
+            return_value = 1;
+            goto Done;
+        }
+    }
+
+    /* So is the profile */
+    if(arguments->profile) {
+        profile = malloc(sizeof(*profile));
+        if(profile == NULL) {
+            return_value = 1;
+            goto Done;
+        }
+        if(eat_profile_load(arguments->profile, profile)) {
+            return_value = 1;
+            goto Done;
+        }
+    }
 
     /* Set up the xlaim_decoder object first. The type of this object
      * depends on the input type (e.g. CBOR or command line arguments
      * (eventually JWT too)). The decoder object will be called by
      *   (eventually JWT too)). The decoder object will be called by
      * the outputter to iterate over all the claims. */
-    if(arguments->input_file) {
+    if(arguments->input_file || arguments->input_dir || arguments->input_shm || arguments->input_archive) {
 
         /* Input is a file, not claim arguments */
         if(arguments->claims) {
             fprintf(stderr, "Can't give -in option and -claim option at the same time (yet)\n");
-            fprintf(stderr, "\xclaim -help\" for xclaim options\n");
+            fprintf(stderr, "\"xclaim -help\" for xclaim options\n");
             return_value = 1;
             goto Done;
         }
 
-        int file_descriptor;
-        if(!strcmp(arguments->input_file, "-")) {
-            file_descriptor = 0;
-        } else {
-            file_descriptor = open(arguments->input_file, O_RDONLY);
-            if(file_descriptor < 0) {
-                fprintf(stderr,
-                        "can't open input file \"%s\" (%s)\n",
-                        arguments->input_file,
-                        strerror(errno));
+        if((arguments->input_file != NULL) +
+           (arguments->input_dir != NULL) +
+           (arguments->input_shm != NULL) +
+           (arguments->input_archive != NULL) > 1) {
+            fprintf(stderr, "Can only give one of -in, -in_dir, -in_shm and -in_archive\n");
+            return_value = 1;
+            goto Done;
+        }
+
+        if(arguments->input_file) {
+            int file_descriptor;
+            if(!strcmp(arguments->input_file, "-")) {
+                file_descriptor = 0;
+            } else {
+                file_descriptor = open(arguments->input_file, O_RDONLY);
+                if(file_descriptor < 0) {
+                    fprintf(stderr,
+                            "can't open input file \"%s\" (%s)\n",
+                            arguments->input_file,
+                            strerror(errno));
+                    return_value = 1;
+                    goto Done;
+                }
+            }
+            if(arguments->input_stream) {
+                /* Read as it is decoded by process_stream() */
+                stream_descriptor = file_descriptor;
+            } else {
+                input_bytes = read_file(file_descriptor);
+                if(UsefulBuf_IsNULLC(input_bytes)) {
+                    fprintf(stderr,
+                            "error reading input file \"%s\" (%s)\n",
+                            arguments->input_file,
+                            strerror(errno));
+                    return_value = 1;
+                    goto Done;
+                }
+                if(UsefulBuf_IsEmptyC(input_bytes)){
+                    fprintf(stderr,
+                            "input  \"%s\" is empty\n",
+                            arguments->input_file);
+                    return_value = 1;
+                    goto Done;
+                }
+            }
+        }
+
+        if(arguments->in_verify_key_file) {
+            int x = read_pub_ec_key_from_file(arguments->in_verify_key_file, &verification_key);
+            if(x) {
                 return_value = 1;
                 goto Done;
             }
+
         }
-        input_bytes = read_file(file_descriptor);
-        if(UsefulBuf_IsNULLC(input_bytes)) {
-            fprintf(stderr,
-                    "error reading input file \"%s\" (%s)\n",
-                    arguments->input_file,
-                    strerror(errno));
+
+        if(arguments->in_mac_key_file) {
+            if(arguments->in_verify_key_file || arguments->in_verify_cert_file) {
+                fprintf(stderr, "Can't give -in_mac_key with -in_verify_key or -in_verify_cert\n");
+                return_value = 1;
+                goto Done;
+            }
+            if(arguments->input_protection != IN_PROT_DETECT &&
+               arguments->input_protection != IN_PROT_MAC &&
+               arguments->input_protection != IN_PROT_MAC_ENCRYPT) {
+                fprintf(stderr, "-in_mac_key only works with -in_prot mac, mac_encrypt or auto\n");
+                return_value = 1;
+                goto Done;
+            }
+            /* The key is processed once here for all the tokens */
+            if(read_hmac_key_from_file(arguments->in_mac_key_file, &verification_key)) {
+                return_value = 1;
+                goto Done;
+            }
+        } else if((arguments->input_protection == IN_PROT_MAC ||
+                   arguments->input_protection == IN_PROT_MAC_ENCRYPT) && !arguments->no_verify) {
+            fprintf(stderr, "-in_prot mac and mac_encrypt need -in_mac_key\n");
             return_value = 1;
             goto Done;
         }
-        if(UsefulBuf_IsEmptyC(input_bytes)){
-            fprintf(stderr,
-                    "input  \"%s\" is empty\n",
-                    arguments->input_file);
+
+        if(arguments->in_decrypt_key_file) {
+            if(read_aes_key_from_file(arguments->in_decrypt_key_file, &decryption_key)) {
+                return_value = 1;
+                goto Done;
+            }
+        } else if(arguments->input_protection == IN_PROT_SIGN_ENCRYPT ||
+                  arguments->input_protection == IN_PROT_MAC_ENCRYPT) {
+            fprintf(stderr, "-in_prot sign_encrypt and mac_encrypt need -in_decrypt_key\n");
             return_value = 1;
             goto Done;
         }
 
-        // TODO: need to handle JSON input too. This assumes file is CBOR for now
-        if(arguments->in_verify_key_file) {
-            int x = read_pub_ec_key_from_file(arguments->in_verify_key_file, &verification_key);
-            if(x) {
+        if(arguments->in_verify_cert_file) {
+            if(arguments->in_verify_key_file) {
+                fprintf(stderr, "Can't give -in_verify_key and -in_verify_cert at the same time\n");
+                return_value = 1;
+                goto Done;
+            }
+            /* The trust store is loaded once and validated chains are
+             * cached for all the tokens */
+            if(cert_chain_init(&cert_cache, arguments->in_verify_cert_file, CERT_CHAIN_CACHE_SIZE)) {
+                return_value = 1;
+                goto Done;
+            }
+            certs = &cert_cache;
+        }
+
+        if(arguments->replay_window) {
+            if(replay_store_open(&replay_store,
+                                 arguments->replay_file,
+                                 arguments->replay_window,
+                                 arguments->replay_capacity)) {
                 return_value = 1;
                 goto Done;
             }
+            replay = &replay_store;
+        }
 
+        /* The same token may come in more than once, a retry, a
+         * duplicate file..., so the workers share one cache of
+         * verification results. For -in, verify_only() has its own
+         * for a sequence. */
+        if((arguments->input_dir || arguments->input_shm || arguments->input_archive) &&
+           arguments->verify_cache_size > 0 &&
+           !arguments->no_verify &&
+           (verification_key.k.key_ptr != NULL || certs != NULL)) {
+            if(certs != NULL) {
+                /* As in verify_only(), the certs are in the digest */
+                memset(key_fingerprint, 0, sizeof(key_fingerprint));
+            } else if(get_key_fingerprint(verification_key, key_fingerprint)) {
+                fprintf(stderr, "can't set up verification cache\n");
+                return_value = 1;
+                goto Done;
+            }
+            if(verify_cache_init(&verify_cache, (uint32_t)arguments->verify_cache_size, key_fingerprint)) {
+                fprintf(stderr, "can't set up verification cache\n");
+                return_value = 1;
+                goto Done;
+            }
+            cache = &verify_cache;
         }
-        if(xclaim_ctoken_decode_init(&decoder, &cctx, input_bytes, verification_key)) {
+
+    } else {
+        if(arguments->verify_only) {
+            fprintf(stderr, "-verify_only needs an input token given with -in\n");
+            return_value = 1;
+            goto Done;
+        }
+        if(arguments->submod) {
+            fprintf(stderr, "-submod needs an input token\n");
             return_value = 1;
             goto Done;
         }
-
-    } else {
         if(arguments->claims) {
             /* input is some claim arguments. */
             xclaim_argument_decode_init(&decoder, &parg, arguments->claims);
+            if(profile != NULL) {
+                eat_profile_validator_init(&profiled_decoder, &validator, claims_decoder, profile, arguments->profile_fail_fast);
+                claims_decoder = &profiled_decoder;
+            }
+            if(filter_rules != NULL) {
+                claim_filter_init(&filtered_decoder, &filter, claims_decoder, filter_rules);
+                claims_decoder = &filtered_decoder;
+            }
 
         } else {
             fprintf(stderr, "No input given (neither -in or -claim given)\n");
@@ -277,35 +1800,236 @@ int xclaim_main(const struct ctoken_arguments *arguments)
     }
 
 
-    /* Set up output file to for CBOR, JSON... */
-    if(arguments->output_file) {
-        output_file = fopen(arguments->output_file, "w");
-        if(output_file == NULL) {
-            fprintf(stderr, "error opening output file \"%s\" (%s)\n",
-                    arguments->output_file,
-                    strerror(errno));
+    if(arguments->output_count > 1 && (arguments->input_dir || arguments->input_shm || arguments->verify_only)) {
+        fprintf(stderr, "Can't give more than one -out or -out_form with -in_dir, -in_shm or -verify_only\n");
+        return_value = 1;
+        goto Done;
+    }
+
+
+    /* These have rows from many tokens in one output. It isn't per
+     * token like the other outputs. */
+    if(is_row_output(arguments->output_format) &&
+       (arguments->output_count > 1 ||
+        arguments->output_dir ||
+        arguments->input_shm ||
+        arguments->verify_only)) {
+        fprintf(stderr, "-out_form columnar, csv and tsv must be the only output and can't be given with -out_dir, -in_shm or -verify_only\n");
+        return_value = 1;
+        goto Done;
+    }
+
+
+    if(profile != NULL && arguments->verify_only) {
+        fprintf(stderr, "-profile needs the claims decoded so it can't be given with -verify_only\n");
+        return_value = 1;
+        goto Done;
+    }
+
+
+    /* A profile is for whole tokens, not a submodule taken out of one */
+    if(arguments->submod && (profile != NULL || arguments->verify_only)) {
+        fprintf(stderr, "-submod can't be given with -profile or -verify_only\n");
+        return_value = 1;
+        goto Done;
+    }
+
+
+    if(arguments->input_stream &&
+       (stream_descriptor < 0 ||
+        arguments->output_count > 1 ||
+        arguments->output_format != OUT_FORMAT_JSON ||
+        filter_rules != NULL ||
+        profile != NULL ||
+        arguments->submod != NULL ||
+        replay != NULL ||
+        certs != NULL ||
+        decryption_key.k.key_ptr != NULL ||
+        arguments->verify_only)) {
+        fprintf(stderr, "-in_stream needs -in and only works with one JSON output and without -filter, -profile, -submod, -replay_window, -in_verify_cert, -in_decrypt_key or -verify_only\n");
+        return_value = 1;
+        goto Done;
+    }
+
+
+    if(arguments->input_archive == NULL &&
+       (!q_useful_buf_c_is_null(arguments->archive_ueid) ||
+        !q_useful_buf_c_is_null(arguments->archive_cti) ||
+        arguments->archive_from != INT64_MIN ||
+        arguments->archive_to != INT64_MAX)) {
+        fprintf(stderr, "-archive_ueid, -archive_cti, -archive_from and -archive_to are for -in_archive\n");
+        return_value = 1;
+        goto Done;
+    }
+
+
+    if(arguments->output_archive) {
+        /* The tokens are stored as they are. They are verified when
+         * they are taken out with -in_archive. */
+        if(input_bytes.ptr == NULL || arguments->verify_only) {
+            fprintf(stderr, "-out_archive needs -in and can't be given with -in_stream or -verify_only\n");
+            return_value = 1;
             goto Done;
         }
-    } else {
-        output_file = stdout;
+        return_value = token_archive_add(arguments->output_archive, input_bytes);
+        goto Done;
+    }
+
+
+    /* Set up output files for CBOR, JSON... */
+    for(i = 0; i < arguments->output_count; i++) {
+        if(arguments->output_files[i]) {
+            output_files[i] = fopen(arguments->output_files[i], "w");
+            if(output_files[i] == NULL) {
+                fprintf(stderr, "error opening output file \"%s\" (%s)\n",
+                        arguments->output_files[i],
+                        strerror(errno));
+                return_value = 1;
+                goto Done;
+            }
+        } else if(i == 0) {
+            output_files[i] = stdout;
+        } else {
+            fprintf(stderr, "each -out_form after the first needs its own -out\n");
+            return_value = 1;
+            goto Done;
+        }
+    }
+
+    if(arguments->columns != NULL &&
+       arguments->output_format != OUT_FORMAT_CSV &&
+       arguments->output_format != OUT_FORMAT_TSV) {
+        fprintf(stderr, "-columns is for -out_form csv and tsv\n");
+        return_value = 1;
+        goto Done;
+    }
+
+    if(arguments->output_format == OUT_FORMAT_COLUMNAR) {
+        row_output.columnar = &columnar_writer;
+        if(columnar_writer_init(&columnar_writer, output_files[0], COLUMNAR_ROW_GROUP_ROWS)) {
+            return_value = 1;
+            goto Done;
+        }
+        rows = &row_output;
+    } else if(arguments->output_format == OUT_FORMAT_CSV ||
+              arguments->output_format == OUT_FORMAT_TSV) {
+        row_output.csv = &csv_writer;
+        if(csv_writer_init(&csv_writer,
+                           output_files[0],
+                           arguments->output_format == OUT_FORMAT_TSV ? CSV_FORM_TSV : CSV_FORM_CSV,
+                           arguments->columns ? arguments->columns : CSV_DEFAULT_COLUMNS)) {
+            return_value = 1;
+            goto Done;
+        }
+        rows = &row_output;
     }
 
 
     /* Call the outputter to do the actual work */
-    if(arguments->output_format == OUT_FORMAT_CBOR) {
-        return_value = encode_as_cbor(&decoder, output_file, arguments);
+    if(arguments->input_dir) {
+        return_value = process_dir(arguments, output_files[0], rows, verification_key, decryption_key, certs, cache, replay, filter_rules, profile);
+
+    } else if(arguments->input_shm) {
+        return_value = process_shm(arguments, verification_key, decryption_key, certs, cache, replay, filter_rules, profile);
+
+    } else if(arguments->input_archive) {
+        return_value = process_archive(arguments, output_files, rows, verification_key, decryption_key, certs, cache, replay, filter_rules, profile);
+
+    } else if(stream_descriptor >= 0) {
+        return_value = process_stream(stream_descriptor, output_files[0], arguments, verification_key);
+
+    } else if(arguments->input_file) {
+        return_value = process_token(input_bytes,
+                                     output_files,
+                                     rows,
+                                     arguments,
+                                     verification_key,
+                                     decryption_key,
+                                     certs,
+                                     NULL,
+                                     replay,
+                                     filter_rules,
+                                     profile);
 
     } else {
-        return_value = encode_as_json(&decoder, output_file);
+        /* A guess at the size of the claims for encode_outputs() */
+        claims_size = 0;
+        for(claim = arguments->claims; *claim; claim++) {
+            claims_size += strlen(*claim);
+        }
+        source.token            = NULL_Q_USEFUL_BUF_C;
+        source.verification_key = verification_key;
+        source.decoder          = &decoder;
+        source.filter_rules     = filter_rules;
+        return_value = encode_outputs(claims_decoder, &source, output_files, rows, arguments, claims_size);
+        if(profile != NULL && validator.violations > 0) {
+            return_value = EXIT_TOKEN_INVALID;
+        }
 
     }
 
+    if(cache != NULL && arguments->stats && cache->lookups) {
+        fprintf(stderr,
+                "verify cache hits: %llu of %llu (%.1f%%)\n",
+                (unsigned long long)cache->hits,
+                (unsigned long long)cache->lookups,
+                100.0 * (double)cache->hits / (double)cache->lookups);
+    }
+
+    /* The output is finished even if some tokens failed so the rows
+     * that were added can be read */
+    if(row_output.columnar != NULL) {
+        if(columnar_writer_finish(row_output.columnar) && return_value == 0) {
+            return_value = 1;
+        }
+    }
+    if(row_output.csv != NULL) {
+        if(csv_writer_finish(row_output.csv) && return_value == 0) {
+            return_value = 1;
+        }
+    }
+
 Done:
-    if(output_file != NULL) {
-        fclose(output_file);
+    if(row_output.columnar != NULL) {
+        columnar_writer_free(row_output.columnar);
+    }
+    if(row_output.csv != NULL) {
+        csv_writer_free(row_output.csv);
+    }
+
+    if(stream_descriptor > 0) {
+        close(stream_descriptor);
+    }
+
+    for(i = 0; i < MAX_OUTPUTS; i++) {
+        if(output_files[i] != NULL) {
+            fclose(output_files[i]);
+        }
     }
 
     free_ec_key(verification_key);
+    free_ec_key(decryption_key);
+
+    if(replay != NULL) {
+        replay_store_close(replay);
+    }
+
+    if(certs != NULL) {
+        cert_chain_free(certs);
+    }
+
+    verify_cache_free(&verify_cache);
+
+    claim_filter_finish(&filter);
+    if(filter_rules != NULL) {
+        claim_filter_free_rules(filter_rules);
+        free(filter_rules);
+    }
+
+    if(profile != NULL) {
+        eat_profile_free(profile);
+        free(profile);
+    }
 
     return return_value;
 }
@@ -10,64 +10,409 @@
  * See BSD-3-Clause license in README.md
  */
 
+/* The t_cose boundary uses the EC_KEY API, which is deprecated in
+ * OpenSSL 3. It is all in this file, see set_evp_pkey() and
+ * get_evp_pkey(). Nothing outside this file uses it. */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include "openssl_keys.h"
 #include <stdio.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <sys/errno.h>
 
 
-int read_private_ec_key_from_file(const char *file_name, struct t_cose_key *k)
+/* Reads a PEM or DER key file. For a public key the file may hold
+ * either the private key or just the public key. */
+static EVP_PKEY *read_key_file(const char *file_name, bool public_key)
 {
     FILE     *key_file;
-    EVP_PKEY *openssl_generic_private_key;
-    EC_KEY   *ec_private_key;
+    EVP_PKEY *key;
 
     key_file = fopen(file_name, "r");
     if(key_file == NULL) {
         fprintf(stderr, "Error %s opening key file \"%s\"\n", strerror(errno), file_name);
-        return 1;
+        return NULL;
     }
 
     // TODO: perhaps provide the password_cb so encrypted key files so encrypted files can work
-    openssl_generic_private_key = PEM_read_PrivateKey(key_file,
-                                                       NULL,
-                                                       NULL, // pem_password_cb *cb,
-                                                       NULL  // void *u;
-                                                       );
+    key = PEM_read_PrivateKey(key_file, NULL, NULL, NULL);
+
+    if(key == NULL && public_key) {
+        rewind(key_file);
+        key = PEM_read_PUBKEY(key_file, NULL, NULL, NULL);
+    }
+    if(key == NULL) {
+        rewind(key_file);
+        key = d2i_PrivateKey_fp(key_file, NULL);
+    }
+    if(key == NULL && public_key) {
+        rewind(key_file);
+        key = d2i_PUBKEY_fp(key_file, NULL);
+    }
 
     fclose(key_file);
 
-    if(openssl_generic_private_key == NULL) {
+    if(key == NULL) {
         fprintf(stderr, "Unable to parse contents of key file \"%s\"\n", file_name);
-        return 1;
     }
 
-    ec_private_key = EVP_PKEY_get1_EC_KEY(openssl_generic_private_key);
+    return key;
+}
+
+
+/*
+ * Public function. See openssl_keys.h
+ */
+int set_evp_pkey(EVP_PKEY *key, struct t_cose_key *k)
+{
+    EC_KEY *ec_key;
+
+    if(EVP_PKEY_id(key) == EVP_PKEY_ED25519) {
+        k->crypto_lib = OPENSSL_KEY_ED25519;
+        k->k.key_ptr  = key;
+        return 0;
+    }
+
+    ec_key = EVP_PKEY_get1_EC_KEY(key);
+    EVP_PKEY_free(key);
 
-    if(ec_private_key == NULL) {
-        fprintf(stderr, "Key file \"%s\" does not contain a valid EC key\n", file_name);
+    if(ec_key == NULL) {
         return 1;
     }
 
     k->crypto_lib = T_COSE_CRYPTO_LIB_OPENSSL;
-    k->k.key_ptr = ec_private_key;
+    k->k.key_ptr = ec_key;
 
     return 0;
 }
 
 
+/* As set_evp_pkey() for a key read from file_name */
+static int set_key(EVP_PKEY *key, const char *file_name, struct t_cose_key *k)
+{
+    if(set_evp_pkey(key, k)) {
+        fprintf(stderr, "Key file \"%s\" does not contain a valid EC or Ed25519 key\n", file_name);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int read_private_ec_key_from_file(const char *file_name, struct t_cose_key *k)
+{
+    EVP_PKEY *key;
+
+    key = read_key_file(file_name, false);
+    if(key == NULL) {
+        return 1;
+    }
+
+    return set_key(key, file_name, k);
+}
+
+
 
 int read_pub_ec_key_from_file(const char *file_name, struct t_cose_key *k)
 {
-    return read_private_ec_key_from_file(file_name, k);
+    EVP_PKEY *key;
+
+    key = read_key_file(file_name, true);
+    if(key == NULL) {
+        return 1;
+    }
+
+    return set_key(key, file_name, k);
+}
+
+
+/* The biggest symmetric key file. An HMAC key over the SHA-256 block
+ * size is hashed down anyway. */
+#define SYMMETRIC_KEY_FILE_MAX 1024
+
+
+/* Decodes key_bytes in place if it is all hex digits, allowing for a
+ * trailing newline. Returns the key length. */
+static size_t hex_to_key(uint8_t *key_bytes, size_t len)
+{
+    size_t i;
+    char   hex[3];
+
+    while(len > 0 && isspace(key_bytes[len - 1])) {
+        len--;
+    }
+    if(len == 0 || len % 2) {
+        return 0;
+    }
+    for(i = 0; i < len; i++) {
+        if(!isxdigit(key_bytes[i])) {
+            return 0;
+        }
+    }
+
+    hex[2] = '\0';
+    for(i = 0; i < len / 2; i++) {
+        hex[0] = (char)key_bytes[i * 2];
+        hex[1] = (char)key_bytes[i * 2 + 1];
+        key_bytes[i] = (uint8_t)strtoul(hex, NULL, 16);
+    }
+
+    return len / 2;
+}
+
+
+/* Reads a file with a symmetric key in raw bytes or hex into
+ * key_bytes which must be SYMMETRIC_KEY_FILE_MAX + 1 bytes. Returns
+ * the key length or 0 after printing an error. The caller cleanses
+ * key_bytes. */
+static size_t read_symmetric_key(const char *file_name, uint8_t *key_bytes)
+{
+    FILE   *key_file;
+    size_t  len;
+    size_t  hex_len;
+
+    key_file = fopen(file_name, "r");
+    if(key_file == NULL) {
+        fprintf(stderr, "Error %s opening key file \"%s\"\n", strerror(errno), file_name);
+        return 0;
+    }
+    len = fread(key_bytes, 1, SYMMETRIC_KEY_FILE_MAX + 1, key_file);
+    fclose(key_file);
+
+    if(len > SYMMETRIC_KEY_FILE_MAX) {
+        fprintf(stderr, "key file \"%s\" is too big\n", file_name);
+        return 0;
+    }
+
+    hex_len = hex_to_key(key_bytes, len);
+    if(hex_len) {
+        len = hex_len;
+    }
+    if(len == 0) {
+        fprintf(stderr, "key file \"%s\" is empty\n", file_name);
+    }
+
+    return len;
+}
+
+
+int read_hmac_key_from_file(const char *file_name, struct t_cose_key *k)
+{
+    uint8_t                  key_bytes[SYMMETRIC_KEY_FILE_MAX + 1];
+    size_t                   len;
+    struct openssl_hmac_key *hmac_key;
+    EVP_MAC                 *mac;
+    EVP_MAC_CTX             *fingerprint_ctx;
+    OSSL_PARAM               params[2];
+    size_t                   fingerprint_len;
+    int                      return_value;
+
+    return_value    = 1;
+    hmac_key        = NULL;
+    fingerprint_ctx = NULL;
+
+    len = read_symmetric_key(file_name, key_bytes);
+    if(len == 0) {
+        goto Done;
+    }
+    if(len < OPENSSL_HMAC_KEY_MIN_LEN) {
+        fprintf(stderr, "MAC key in \"%s\" is shorter than %d bytes\n", file_name, OPENSSL_HMAC_KEY_MIN_LEN);
+        goto Done;
+    }
+
+    hmac_key = calloc(1, sizeof(struct openssl_hmac_key));
+    if(hmac_key == NULL) {
+        goto Done;
+    }
+
+    mac = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_HMAC, NULL);
+    if(mac != NULL) {
+        /* The context holds its own reference to mac */
+        hmac_key->mac_ctx = EVP_MAC_CTX_new(mac);
+        EVP_MAC_free(mac);
+    }
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *)OSSL_DIGEST_NAME_SHA2_256, 0);
+    params[1] = OSSL_PARAM_construct_end();
+
+    /* The fingerprint is the MAC of nothing, made with a copy of the
+     * keyed context. */
+    if(hmac_key->mac_ctx == NULL ||
+       !EVP_MAC_init(hmac_key->mac_ctx, key_bytes, len, params) ||
+       (fingerprint_ctx = EVP_MAC_CTX_dup(hmac_key->mac_ctx)) == NULL ||
+       !EVP_MAC_final(fingerprint_ctx, hmac_key->fingerprint, &fingerprint_len, sizeof(hmac_key->fingerprint))) {
+        fprintf(stderr, "Unable to set up MAC key from \"%s\"\n", file_name);
+        goto Done;
+    }
+
+    k->crypto_lib = OPENSSL_KEY_HMAC;
+    k->k.key_ptr  = hmac_key;
+    hmac_key      = NULL;
+    return_value  = 0;
+
+Done:
+    OPENSSL_cleanse(key_bytes, sizeof(key_bytes));
+    EVP_MAC_CTX_free(fingerprint_ctx);
+    if(hmac_key != NULL) {
+        EVP_MAC_CTX_free(hmac_key->mac_ctx);
+        free(hmac_key);
+    }
+
+    return return_value;
+}
+
+
+int read_aes_key_from_file(const char *file_name, struct t_cose_key *k)
+{
+    uint8_t                 key_bytes[SYMMETRIC_KEY_FILE_MAX + 1];
+    size_t                  len;
+    struct openssl_aes_key *aes_key;
+    const EVP_CIPHER       *cipher;
+    int                     return_value;
+
+    return_value = 1;
+    aes_key      = NULL;
+
+    len = read_symmetric_key(file_name, key_bytes);
+    if(len == 0) {
+        goto Done;
+    }
+    if(len == 16) {
+        cipher = EVP_aes_128_gcm();
+    } else if(len == 32) {
+        cipher = EVP_aes_256_gcm();
+    } else {
+        fprintf(stderr, "AES key in \"%s\" must be 16 or 32 bytes\n", file_name);
+        goto Done;
+    }
+
+    aes_key = calloc(1, sizeof(struct openssl_aes_key));
+    if(aes_key == NULL) {
+        goto Done;
+    }
+    aes_key->key_len    = len;
+    aes_key->cipher_ctx = EVP_CIPHER_CTX_new();
+    if(aes_key->cipher_ctx == NULL ||
+       !EVP_CipherInit_ex(aes_key->cipher_ctx, cipher, NULL, key_bytes, NULL, -1)) {
+        fprintf(stderr, "Unable to set up AES key from \"%s\"\n", file_name);
+        goto Done;
+    }
+
+    k->crypto_lib = OPENSSL_KEY_AES;
+    k->k.key_ptr  = aes_key;
+    aes_key       = NULL;
+    return_value  = 0;
+
+Done:
+    OPENSSL_cleanse(key_bytes, sizeof(key_bytes));
+    if(aes_key != NULL) {
+        EVP_CIPHER_CTX_free(aes_key->cipher_ctx);
+        free(aes_key);
+    }
+
+    return return_value;
 }
 
 
 void free_ec_key(struct t_cose_key k)
 {
-    if(k.crypto_lib == T_COSE_CRYPTO_LIB_OPENSSL &&
-       k.k.key_ptr != NULL) {
+    struct openssl_hmac_key *hmac_key;
+    struct openssl_aes_key  *aes_key;
+
+    if(k.k.key_ptr == NULL) {
+        return;
+    }
+
+    if(k.crypto_lib == T_COSE_CRYPTO_LIB_OPENSSL) {
         EC_KEY_free(k.k.key_ptr);
+    } else if(k.crypto_lib == OPENSSL_KEY_ED25519) {
+        EVP_PKEY_free(k.k.key_ptr);
+    } else if(k.crypto_lib == OPENSSL_KEY_HMAC) {
+        hmac_key = k.k.key_ptr;
+        EVP_MAC_CTX_free(hmac_key->mac_ctx);
+        free(hmac_key);
+    } else if(k.crypto_lib == OPENSSL_KEY_AES) {
+        aes_key = k.k.key_ptr;
+        EVP_CIPHER_CTX_free(aes_key->cipher_ctx);
+        free(aes_key);
     }
 }
+
+
+/*
+ * Public function. See openssl_keys.h
+ */
+EVP_PKEY *get_evp_pkey(struct t_cose_key k)
+{
+    EVP_PKEY *key;
+
+    if(k.k.key_ptr == NULL) {
+        return NULL;
+    }
+
+    if(k.crypto_lib == OPENSSL_KEY_ED25519) {
+        key = k.k.key_ptr;
+        return EVP_PKEY_up_ref(key) ? key : NULL;
+    }
+
+    if(k.crypto_lib != T_COSE_CRYPTO_LIB_OPENSSL) {
+        return NULL;
+    }
+
+    key = EVP_PKEY_new();
+    if(key != NULL && !EVP_PKEY_set1_EC_KEY(key, k.k.key_ptr)) {
+        EVP_PKEY_free(key);
+        key = NULL;
+    }
+
+    return key;
+}
+
+
+int get_key_fingerprint(struct t_cose_key k, uint8_t fingerprint[32])
+{
+    unsigned char *der;
+    int            der_len;
+    EVP_PKEY      *key;
+
+    memset(fingerprint, 0, SHA256_DIGEST_LENGTH);
+
+    if(k.k.key_ptr == NULL) {
+        return 0;
+    }
+
+    if(k.crypto_lib == OPENSSL_KEY_HMAC) {
+        memcpy(fingerprint, ((struct openssl_hmac_key *)k.k.key_ptr)->fingerprint, SHA256_DIGEST_LENGTH);
+        return 0;
+    }
+
+    if(k.crypto_lib != T_COSE_CRYPTO_LIB_OPENSSL && k.crypto_lib != OPENSSL_KEY_ED25519) {
+        return 0;
+    }
+
+    key = get_evp_pkey(k);
+    if(key == NULL) {
+        return 1;
+    }
+
+    der     = NULL;
+    der_len = i2d_PUBKEY(key, &der);
+    EVP_PKEY_free(key);
+    if(der_len <= 0) {
+        return 1;
+    }
+
+    SHA256(der, (size_t)der_len, fingerprint);
+
+    OPENSSL_free(der);
+
+    return 0;
+}
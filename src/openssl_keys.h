@@ -13,13 +13,110 @@
 #define openssl_keys_h
 
 #include <t_cose/t_cose_common.h>
+#include <openssl/opensslv.h>
+#include <openssl/evp.h>
+#include <stdbool.h>
 
 
+/* EVP_MAC for COSE_Mac0, EVP_PKEY_is_a() for certificate keys and
+ * EVP_PKEY_get_bits() for -in_stream are all OpenSSL 3 APIs. */
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+#error "xclaim needs OpenSSL 3.0 or later"
+#endif
+
+
+/* t_cose only does EC keys with OpenSSL, as an EC_KEY. An Ed25519
+ * key is an EVP_PKEY and is marked with this in crypto_lib so it is
+ * never given to t_cose. See cose_eddsa.h. */
+#define OPENSSL_KEY_ED25519 ((enum t_cose_crypto_lib_t)0x4544)
+
+static inline bool key_is_ed25519(struct t_cose_key k)
+{
+    return k.crypto_lib == OPENSSL_KEY_ED25519 && k.k.key_ptr != NULL;
+}
+
+
+/* An HMAC key from -in_mac_key or -out_mac_key for COSE_Mac0. The
+ * key_ptr of the t_cose_key points to a struct openssl_hmac_key and
+ * crypto_lib is this. See cose_mac0.h. */
+#define OPENSSL_KEY_HMAC ((enum t_cose_crypto_lib_t)0x484d)
+
+struct openssl_hmac_key {
+    /* An EVP_MAC_CTX for HMAC-SHA256 with the key already set. It is
+     * duplicated for each use so the key isn't processed again. It is
+     * not changed so one key can be used by several threads. */
+    void   *mac_ctx;
+
+    /* HMAC of the empty string to identify the key for caching
+     * without revealing anything about it */
+    uint8_t fingerprint[32];
+};
+
+static inline bool key_is_hmac(struct t_cose_key k)
+{
+    return k.crypto_lib == OPENSSL_KEY_HMAC && k.k.key_ptr != NULL;
+}
+
+
+/* An AES key from -out_encrypt_key or -in_decrypt_key for
+ * COSE_Encrypt0. key_ptr points to a struct openssl_aes_key. See
+ * cose_encrypt0.h. */
+#define OPENSSL_KEY_AES ((enum t_cose_crypto_lib_t)0x4145)
+
+struct openssl_aes_key {
+    /* An EVP_CIPHER_CTX for AES-GCM with the key schedule already
+     * set up. It is copied for each token and only the IV is set. It
+     * is not changed so one key can be used by several threads. */
+    void   *cipher_ctx;
+    size_t  key_len;
+};
+
+static inline bool key_is_aes(struct t_cose_key k)
+{
+    return k.crypto_lib == OPENSSL_KEY_AES && k.k.key_ptr != NULL;
+}
+
+
+/* These read an EC or Ed25519 key from a PEM or DER file. The public
+ * key file may have the private key or only the public key. */
 int read_private_ec_key_from_file(const char *file_name, struct t_cose_key *k);
 
 int read_pub_ec_key_from_file(const char *file_name, struct t_cose_key *k);
 
+/* Reads a symmetric key for HMAC-SHA256. The file has either the raw
+ * key bytes or the key in hex. It must be at least
+ * OPENSSL_HMAC_KEY_MIN_LEN bytes. */
+int read_hmac_key_from_file(const char *file_name, struct t_cose_key *k);
+
+#define OPENSSL_HMAC_KEY_MIN_LEN 16
+
+/* Reads a 16 or 32 byte AES key in the same format. */
+int read_aes_key_from_file(const char *file_name, struct t_cose_key *k);
+
+
+/* Frees any of the above */
 void free_ec_key(struct t_cose_key k);
 
 
+/* t_cose needs an EC key as an EC_KEY, which is deprecated in
+ * OpenSSL 3. Everywhere else keys are an EVP_PKEY and they are only
+ * converted by these two functions at the t_cose boundary. */
+
+/* Puts an EC or Ed25519 key into a t_cose_key. key is consumed. The
+ * t_cose_key is freed with free_ec_key(). Returns 1 without printing
+ * anything if key is not an EC or Ed25519 key. */
+int set_evp_pkey(EVP_PKEY *key, struct t_cose_key *k);
+
+/* Returns the EC or Ed25519 key in k as an EVP_PKEY for use with the
+ * EVP API. The caller frees the result with EVP_PKEY_free(). Returns
+ * NULL if k is not an EC or Ed25519 key. */
+EVP_PKEY *get_evp_pkey(struct t_cose_key k);
+
+
+/* Computes the SHA-256 of the DER-encoded public key. This identifies
+ * a key for caching. A key that is not set gives all zeros. Returns 0
+ * on success. */
+int get_key_fingerprint(struct t_cose_key k, uint8_t fingerprint[32]);
+
+
 #endif /* openssl_keys_h */
@@ -0,0 +1,324 @@
+/*
+ * replay_store.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "replay_store.h"
+
+#include <stdio.h> /* For error prints */
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+
+
+#define REPLAY_STORE_MAGIC   0x78636c6d72706c79ULL /* "xclmrply" */
+#define REPLAY_STORE_VERSION 1
+
+/* An ID of 0 marks an empty slot. */
+#define EMPTY_SLOT 0
+
+
+/* This is the layout at the start of the file. The two tables follow
+ * it. It is 64 bytes so the tables start cache-line aligned. */
+struct replay_store_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t window;
+    uint32_t current;
+    uint64_t seed;
+    int64_t  generation_start;
+    uint32_t count[2];
+    uint8_t  pad[8];
+};
+
+
+static size_t store_size(uint32_t capacity)
+{
+    return sizeof(struct replay_store_header) + 2 * (size_t)capacity * sizeof(uint64_t);
+}
+
+
+static void init_header(struct replay_store_header *header,
+                        uint32_t                    window_seconds,
+                        uint32_t                    capacity)
+{
+    uint64_t seed;
+
+    memset(header, 0, sizeof(*header));
+
+    /* The seed keeps anyone from crafting IDs that collide. */
+    if(RAND_bytes((unsigned char *)&seed, sizeof(seed)) != 1) {
+        seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+
+    header->magic    = REPLAY_STORE_MAGIC;
+    header->version  = REPLAY_STORE_VERSION;
+    header->capacity = capacity;
+    header->window   = window_seconds;
+    header->seed     = seed;
+}
+
+
+/*
+ * Public function. See replay_store.h
+ */
+int replay_store_open(struct replay_store *me,
+                      const char          *file_name,
+                      uint32_t             window_seconds,
+                      uint32_t             capacity)
+{
+    uint32_t    rounded;
+    struct stat file_stat;
+    void       *map;
+    bool        fresh;
+
+    memset(me, 0, sizeof(*me));
+    me->fd = -1;
+
+    if(window_seconds == 0 || capacity == 0 || capacity > (1U << 30)) {
+        fprintf(stderr, "bad replay window or capacity\n");
+        return 1;
+    }
+    for(rounded = REPLAY_STORE_MIN_CAPACITY; rounded < capacity; rounded <<= 1);
+    capacity = rounded;
+
+    me->map_len = store_size(capacity);
+
+    if(file_name == NULL) {
+        map = calloc(1, me->map_len);
+        if(map == NULL) {
+            fprintf(stderr, "can't allocate replay store\n");
+            return 1;
+        }
+        fresh = true;
+
+    } else {
+        me->fd = open(file_name, O_RDWR | O_CREAT, 0600);
+        if(me->fd < 0) {
+            fprintf(stderr, "can't open replay file \"%s\" (%s)\n", file_name, strerror(errno));
+            return 1;
+        }
+        if(flock(me->fd, LOCK_EX) || fstat(me->fd, &file_stat)) {
+            fprintf(stderr, "can't lock replay file \"%s\" (%s)\n", file_name, strerror(errno));
+            goto Fail;
+        }
+        fresh = (size_t)file_stat.st_size != me->map_len;
+        if(fresh && ftruncate(me->fd, (off_t)me->map_len)) {
+            fprintf(stderr, "can't size replay file \"%s\" (%s)\n", file_name, strerror(errno));
+            goto Fail;
+        }
+        map = mmap(NULL, me->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, me->fd, 0);
+        if(map == MAP_FAILED) {
+            fprintf(stderr, "can't map replay file \"%s\" (%s)\n", file_name, strerror(errno));
+            goto Fail;
+        }
+    }
+
+    me->header    = map;
+    me->tables[0] = (uint64_t *)(me->header + 1);
+    me->tables[1] = me->tables[0] + capacity;
+
+    if(fresh ||
+       me->header->magic    != REPLAY_STORE_MAGIC ||
+       me->header->version  != REPLAY_STORE_VERSION ||
+       me->header->capacity != capacity ||
+       me->header->window   != window_seconds) {
+        memset(map, 0, me->map_len);
+        init_header(me->header, window_seconds, capacity);
+    }
+
+    pthread_mutex_init(&me->lock, NULL);
+
+    return 0;
+
+Fail:
+    close(me->fd);
+    me->fd = -1;
+    return 1;
+}
+
+
+/* The final mix from MurmurHash3. Spreads the bits so the low ones
+ * can be used as the table index. */
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+/*
+ * Public function. See replay_store.h
+ */
+uint64_t replay_store_id(const struct replay_store *me,
+                         int64_t                    label,
+                         struct q_useful_buf_c      value)
+{
+    const uint8_t *bytes = value.ptr;
+    uint64_t       h;
+    size_t         i;
+
+    /* FNV-1a, seeded and then mixed. Fast for the short cti and
+     * nonce values this is used for. */
+    h = 0xcbf29ce484222325ULL ^ me->header->seed ^ mix64((uint64_t)label);
+    for(i = 0; i < value.len; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    h = mix64(h);
+
+    return h == EMPTY_SLOT ? 1 : h;
+}
+
+
+/* Move to a new generation if the current one is older than the
+ * window. */
+static void rotate(struct replay_store *me, int64_t now)
+{
+    struct replay_store_header *header = me->header;
+    uint32_t                    previous;
+
+    if(now - header->generation_start < (int64_t)header->window) {
+        return;
+    }
+
+    previous = header->current ^ 1;
+
+    if(now - header->generation_start >= 2 * (int64_t)header->window) {
+        /* Nothing seen for a long time. Everything is stale. */
+        memset(me->tables[header->current], 0, header->capacity * sizeof(uint64_t));
+        header->count[header->current] = 0;
+    }
+
+    memset(me->tables[previous], 0, header->capacity * sizeof(uint64_t));
+    header->count[previous] = 0;
+    header->current          = previous;
+    header->generation_start = now;
+}
+
+
+/* Linear probe for an ID. Returns the slot it is in or the empty slot
+ * where it would go. The tables are never more than 3/4 full so this
+ * always ends. */
+static inline uint64_t *probe(uint64_t *table, uint32_t capacity, uint64_t id)
+{
+    uint32_t mask  = capacity - 1;
+    uint32_t index = (uint32_t)id & mask;
+
+    while(table[index] != EMPTY_SLOT && table[index] != id) {
+        index = (index + 1) & mask;
+    }
+
+    return &table[index];
+}
+
+
+/*
+ * Public function. See replay_store.h
+ */
+enum replay_check_t replay_store_check(struct replay_store *me,
+                                       uint64_t             id,
+                                       int64_t              iat,
+                                       int64_t              now)
+{
+    struct replay_store_header *header = me->header;
+    uint64_t                   *slot;
+    int64_t                     skew;
+    enum replay_check_t         result;
+
+    skew = header->window / 2;
+    if(skew > REPLAY_STORE_MAX_SKEW) {
+        skew = REPLAY_STORE_MAX_SKEW;
+    }
+
+    pthread_mutex_lock(&me->lock);
+
+    me->checks++;
+
+    rotate(me, now);
+
+    if(*probe(me->tables[header->current ^ 1], header->capacity, id) == id) {
+        result = REPLAY_DUPLICATE;
+        goto Done;
+    }
+
+    slot = probe(me->tables[header->current], header->capacity, id);
+    if(*slot == id) {
+        result = REPLAY_DUPLICATE;
+        goto Done;
+    }
+
+    /* An ID inserted now is remembered until at least now + window.
+     * With iat up to now + skew, a token must be no older than
+     * window - skew to be sure it is still remembered. */
+    if(iat < now - (int64_t)header->window + skew) {
+        result = REPLAY_TOO_OLD;
+        goto Done;
+    }
+    if(iat > now + skew) {
+        result = REPLAY_IAT_IN_FUTURE;
+        goto Done;
+    }
+
+    if(header->count[header->current] >= header->capacity / 4 * 3) {
+        result = REPLAY_STORE_FULL;
+        goto Done;
+    }
+
+    *slot = id;
+    header->count[header->current]++;
+    result = REPLAY_NEW;
+
+Done:
+    if(result == REPLAY_DUPLICATE) {
+        me->duplicates++;
+    }
+    pthread_mutex_unlock(&me->lock);
+
+    return result;
+}
+
+
+/*
+ * Public function. See replay_store.h
+ */
+void replay_store_close(struct replay_store *me)
+{
+    if(me->header == NULL) {
+        return;
+    }
+
+    if(me->fd >= 0) {
+        msync(me->header, me->map_len, MS_ASYNC);
+        munmap(me->header, me->map_len);
+        close(me->fd);  /* Also releases the lock */
+    } else {
+        free(me->header);
+    }
+
+    pthread_mutex_destroy(&me->lock);
+
+    me->header = NULL;
+    me->fd     = -1;
+}
@@ -0,0 +1,131 @@
+/*
+ * replay_store.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef replay_store_h
+#define replay_store_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+
+/* This remembers the cti or nonce of recently seen tokens so a
+ * replayed token can be rejected.
+ *
+ * There are two open-addressing hash tables of 64-bit token IDs, the
+ * current one and the previous one. New IDs go into the current one
+ * and lookups check both. Every window seconds the previous one is
+ * cleared and becomes the current one. An ID is thus remembered for
+ * at least window seconds and at most twice that, and memory is sized
+ * by how many tokens arrive in a window, not by all of history.
+ *
+ * Every token must have an iat, and it must be within the window. A
+ * token whose iat is older than that is rejected as its ID may already
+ * have been forgotten. So is one with an iat in the future as it would
+ * still be accepted after its ID is forgotten. To allow for clocks
+ * that differ a little, the iat may be up to the skew in the future,
+ * and the oldest iat allowed is moved up by the same amount so the ID
+ * is still remembered as long as the token can be accepted. The skew
+ * is REPLAY_STORE_MAX_SKEW seconds or half the window if that is less.
+ *
+ * The tables can be in a memory-mapped file so they survive
+ * restarts. The file is locked while it is open so only one xclaim
+ * uses it at a time.
+ *
+ * replay_store_check() is thread safe so one store can be shared by
+ * the -in_dir workers.
+ */
+
+
+enum replay_check_t {
+    /* Not seen before. It has now been remembered. */
+    REPLAY_NEW = 0,
+
+    /* Seen before within the window */
+    REPLAY_DUPLICATE,
+
+    /* The iat is older than the window. */
+    REPLAY_TOO_OLD,
+
+    /* The iat is further in the future than the skew allowed */
+    REPLAY_IAT_IN_FUTURE,
+
+    /* The current table is too full to take any more. The capacity
+     * is too small for the rate tokens arrive at. */
+    REPLAY_STORE_FULL
+};
+
+
+/* The most seconds an iat may be ahead of the current time */
+#define REPLAY_STORE_MAX_SKEW 60
+
+/* Smaller capacities are rounded up to this so the tables always have
+ * room for some IDs at 3/4 full. */
+#define REPLAY_STORE_MIN_CAPACITY 8
+
+
+struct replay_store_header;
+
+struct replay_store {
+    struct replay_store_header *header;
+    uint64_t                   *tables[2];
+    size_t                      map_len;
+    int                         fd;
+    pthread_mutex_t             lock;
+
+    /* Statistics for -stats */
+    uint64_t                    checks;
+    uint64_t                    duplicates;
+};
+
+
+/* Open or create a replay store. If file_name is NULL the store is
+ * only in memory. window_seconds is the replay window. capacity is
+ * the number of IDs that can be remembered per window. It is rounded
+ * up to a power of two and to at least REPLAY_STORE_MIN_CAPACITY.
+ *
+ * An existing file made with a different capacity or window is
+ * re-initialized.
+ *
+ * Returns 0 on success. On failure a message is printed and non-zero
+ * is returned.
+ */
+int replay_store_open(struct replay_store *me,
+                      const char          *file_name,
+                      uint32_t             window_seconds,
+                      uint32_t             capacity);
+
+
+/* Compute the 64-bit ID for a cti or nonce. label is the claim label
+ * the value came from so a cti and a nonce with the same bytes are
+ * different. The hash is seeded per store.
+ */
+uint64_t replay_store_id(const struct replay_store *me,
+                         int64_t                    label,
+                         struct q_useful_buf_c      value);
+
+
+/* Check for and remember a token ID. iat is the token's issued-at
+ * time. A token without one can't be checked for replay and should be
+ * rejected by the caller. now is the current time.
+ */
+enum replay_check_t replay_store_check(struct replay_store *me,
+                                       uint64_t             id,
+                                       int64_t              iat,
+                                       int64_t              now);
+
+
+void replay_store_close(struct replay_store *me);
+
+
+#endif /* replay_store_h */
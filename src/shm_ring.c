@@ -0,0 +1,556 @@
+/*
+ * shm_ring.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "shm_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+
+/* Times to look at an empty ring before sleeping. A token arriving
+ * in this time is picked up with no syscall. */
+#define SPINS_BEFORE_SLEEP 4000
+
+/* The longest sleep before looking at the ring and the shutdown flag
+ * again, in case a wake up is missed */
+#define SLEEP_NANOSECONDS 100000000
+
+/* Sleep while waiting for a free response slot */
+#define FULL_SLEEP_NANOSECONDS 20000
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax()
+#endif
+
+
+static size_t slot_stride(uint32_t slot_size)
+{
+    size_t stride;
+
+    stride = sizeof(struct shm_ring_slot) + slot_size;
+
+    return (stride + SHM_RING_CACHE_LINE - 1) & ~(size_t)(SHM_RING_CACHE_LINE - 1);
+}
+
+
+static size_t header_size(void)
+{
+    return (sizeof(struct shm_ring_header) + SHM_RING_CACHE_LINE - 1) & ~(size_t)(SHM_RING_CACHE_LINE - 1);
+}
+
+
+static void set_up_mapping(struct shm_ring *me, void *map, size_t map_size)
+{
+    me->header         = map;
+    me->map_size       = map_size;
+    me->slot_stride    = slot_stride(me->header->slot_size);
+    me->request_slots  = (uint8_t *)map + header_size();
+    me->response_slots = me->request_slots + me->slot_stride * me->header->slot_count;
+}
+
+
+static inline struct shm_ring_queue *get_queue(struct shm_ring *me, enum shm_ring_which_t which)
+{
+    return which == SHM_RING_REQUEST ? &me->header->request : &me->header->response;
+}
+
+
+static inline struct shm_ring_slot *get_slot(struct shm_ring       *me,
+                                             enum shm_ring_which_t  which,
+                                             uint64_t               position)
+{
+    uint8_t *slots;
+
+    slots = which == SHM_RING_REQUEST ? me->request_slots : me->response_slots;
+
+    return (struct shm_ring_slot *)(slots + me->slot_stride * (position & (me->header->slot_count - 1)));
+}
+
+
+static void sleep_nanoseconds(long nanoseconds)
+{
+    struct timespec duration;
+
+    duration.tv_sec  = 0;
+    duration.tv_nsec = nanoseconds;
+    nanosleep(&duration, NULL);
+}
+
+
+/* Sleeps until *word is not seen, it is woken or the timeout */
+static void futex_wait(_Atomic uint32_t *word, uint32_t seen)
+{
+#ifdef __linux__
+    struct timespec timeout;
+
+    timeout.tv_sec  = 0;
+    timeout.tv_nsec = SLEEP_NANOSECONDS;
+    /* Not FUTEX_PRIVATE_FLAG because the waker is in another process */
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+    (void)word;
+    (void)seen;
+    sleep_nanoseconds(FULL_SLEEP_NANOSECONDS);
+#endif
+}
+
+
+static void futex_wake(_Atomic uint32_t *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+int shm_ring_create(struct shm_ring *me,
+                    const char      *name,
+                    uint32_t         slot_count,
+                    uint32_t         slot_size)
+{
+    struct shm_ring_header *header;
+    size_t                  map_size;
+    uint32_t                i;
+    void                   *map;
+    int                     descriptor;
+
+    if(slot_count == 0 || (slot_count & (slot_count - 1)) || slot_size == 0) {
+        fprintf(stderr, "shared memory ring slot count must be a power of two\n");
+        return 1;
+    }
+
+    map_size = header_size() + 2 * (size_t)slot_count * slot_stride(slot_size);
+
+    descriptor = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(descriptor < 0) {
+        fprintf(stderr, "can't make shared memory \"%s\" (%s)\n", name, strerror(errno));
+        return 1;
+    }
+    if(ftruncate(descriptor, (off_t)map_size)) {
+        fprintf(stderr, "can't size shared memory \"%s\" (%s)\n", name, strerror(errno));
+        close(descriptor);
+        shm_unlink(name);
+        return 1;
+    }
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "can't map shared memory \"%s\" (%s)\n", name, strerror(errno));
+        shm_unlink(name);
+        return 1;
+    }
+
+    /* ftruncate() zeroed it all */
+    header = map;
+    header->slot_count  = slot_count;
+    header->slot_size   = slot_size;
+    header->region_size = map_size;
+    set_up_mapping(me, map, map_size);
+
+    for(i = 0; i < slot_count; i++) {
+        atomic_init(&get_slot(me, SHM_RING_REQUEST, i)->sequence, i);
+        atomic_init(&get_slot(me, SHM_RING_RESPONSE, i)->sequence, i);
+    }
+
+    /* Last so an attach never sees a half made ring */
+    header->version = SHM_RING_VERSION;
+    atomic_thread_fence(memory_order_release);
+    header->magic   = SHM_RING_MAGIC;
+
+    return 0;
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+int shm_ring_attach(struct shm_ring *me, const char *name)
+{
+    struct shm_ring_header *header;
+    struct stat             file_info;
+    void                   *map;
+    int                     descriptor;
+
+    descriptor = shm_open(name, O_RDWR, 0);
+    if(descriptor < 0) {
+        fprintf(stderr, "can't open shared memory \"%s\" (%s)\n", name, strerror(errno));
+        return 1;
+    }
+    if(fstat(descriptor, &file_info) ||
+       (size_t)file_info.st_size < header_size()) {
+        fprintf(stderr, "shared memory \"%s\" is too small\n", name);
+        close(descriptor);
+        return 1;
+    }
+    map = mmap(NULL, (size_t)file_info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if(map == MAP_FAILED) {
+        fprintf(stderr, "can't map shared memory \"%s\" (%s)\n", name, strerror(errno));
+        return 1;
+    }
+
+    header = map;
+    if(header->magic != SHM_RING_MAGIC ||
+       header->version != SHM_RING_VERSION ||
+       header->slot_count == 0 ||
+       (header->slot_count & (header->slot_count - 1)) ||
+       header->slot_size == 0 ||
+       header->region_size != header_size() + 2 * (size_t)header->slot_count * slot_stride(header->slot_size) ||
+       header->region_size > (uint64_t)file_info.st_size) {
+        fprintf(stderr, "shared memory \"%s\" is not an xclaim ring\n", name);
+        munmap(map, (size_t)file_info.st_size);
+        return 1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    set_up_mapping(me, map, (size_t)file_info.st_size);
+
+    return 0;
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+void shm_ring_detach(struct shm_ring *me)
+{
+    if(me->header != NULL) {
+        munmap(me->header, me->map_size);
+        me->header = NULL;
+    }
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ *
+ * A slot is free for the put at position when its sequence is
+ * position and full for the get at position when it is position + 1.
+ */
+struct shm_ring_slot *shm_ring_put_start(struct shm_ring       *me,
+                                         enum shm_ring_which_t  which,
+                                         uint64_t              *position)
+{
+    struct shm_ring_queue *queue;
+    struct shm_ring_slot  *slot;
+    uint64_t               put_position;
+    int64_t                difference;
+
+    queue        = get_queue(me, which);
+    put_position = atomic_load_explicit(&queue->put_position, memory_order_relaxed);
+
+    while(1) {
+        slot       = get_slot(me, which, put_position);
+        difference = (int64_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - put_position);
+        if(difference == 0) {
+            if(atomic_compare_exchange_weak_explicit(&queue->put_position,
+                                                     &put_position,
+                                                     put_position + 1,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+                *position = put_position;
+                return slot;
+            }
+        } else if(difference < 0) {
+            /* Full */
+            return NULL;
+        } else {
+            put_position = atomic_load_explicit(&queue->put_position, memory_order_relaxed);
+        }
+    }
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+void shm_ring_put_finish(struct shm_ring       *me,
+                         enum shm_ring_which_t  which,
+                         uint64_t               position)
+{
+    struct shm_ring_queue *queue;
+
+    queue = get_queue(me, which);
+
+    atomic_store_explicit(&get_slot(me, which, position)->sequence, position + 1, memory_order_release);
+
+    /* Pairs with the waiters increment and signal load in
+     * shm_ring_wait() so either the waiter sees the new signal or
+     * this sees the waiter. */
+    atomic_fetch_add(&queue->signal, 1);
+    if(atomic_load(&queue->waiters) != 0) {
+        futex_wake(&queue->signal);
+    }
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+struct shm_ring_slot *shm_ring_get_start(struct shm_ring       *me,
+                                         enum shm_ring_which_t  which,
+                                         uint64_t              *position)
+{
+    struct shm_ring_queue *queue;
+    struct shm_ring_slot  *slot;
+    uint64_t               get_position;
+    int64_t                difference;
+
+    queue        = get_queue(me, which);
+    get_position = atomic_load_explicit(&queue->get_position, memory_order_relaxed);
+
+    while(1) {
+        slot       = get_slot(me, which, get_position);
+        difference = (int64_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - (get_position + 1));
+        if(difference == 0) {
+            if(atomic_compare_exchange_weak_explicit(&queue->get_position,
+                                                     &get_position,
+                                                     get_position + 1,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+                *position = get_position;
+                return slot;
+            }
+        } else if(difference < 0) {
+            /* Empty */
+            return NULL;
+        } else {
+            get_position = atomic_load_explicit(&queue->get_position, memory_order_relaxed);
+        }
+    }
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+void shm_ring_get_finish(struct shm_ring       *me,
+                         enum shm_ring_which_t  which,
+                         uint64_t               position)
+{
+    atomic_store_explicit(&get_slot(me, which, position)->sequence,
+                          position + me->header->slot_count,
+                          memory_order_release);
+}
+
+
+static bool ring_is_empty(struct shm_ring *me, enum shm_ring_which_t which)
+{
+    uint64_t position;
+
+    position = atomic_load_explicit(&get_queue(me, which)->get_position, memory_order_relaxed);
+
+    return atomic_load_explicit(&get_slot(me, which, position)->sequence, memory_order_acquire) != position + 1;
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+void shm_ring_wait(struct shm_ring *me, enum shm_ring_which_t which)
+{
+    struct shm_ring_queue *queue;
+    uint32_t               seen;
+    int                    spins;
+
+    for(spins = 0; spins < SPINS_BEFORE_SLEEP; spins++) {
+        if(!ring_is_empty(me, which) || atomic_load(&me->header->shutdown)) {
+            return;
+        }
+        cpu_relax();
+    }
+
+    queue = get_queue(me, which);
+    atomic_fetch_add(&queue->waiters, 1);
+    seen = atomic_load(&queue->signal);
+    if(ring_is_empty(me, which) && !atomic_load(&me->header->shutdown)) {
+        futex_wait(&queue->signal, seen);
+    }
+    atomic_fetch_sub(&queue->waiters, 1);
+}
+
+
+
+struct ring_worker {
+    pthread_t           thread;
+    struct shm_ring    *ring;
+    shm_ring_process_t  process;
+    void               *context;
+    int                 status;
+};
+
+
+/* Runs process on a request and puts the output in a response slot */
+static int process_request(struct ring_worker *worker, struct shm_ring_slot *request)
+{
+    struct shm_ring      *ring = worker->ring;
+    struct shm_ring_slot *response;
+    uint64_t              response_position;
+    FILE                 *output;
+    long                  output_len;
+    int                   status;
+
+    /* The request is held until the response is done because the
+     * work is done in place */
+    while((response = shm_ring_put_start(ring, SHM_RING_RESPONSE, &response_position)) == NULL) {
+        sleep_nanoseconds(FULL_SLEEP_NANOSECONDS);
+    }
+
+    response->id  = request->id;
+    response->len = 0;
+
+    output_len = 0;
+    if(request->len > ring->header->slot_size) {
+        fprintf(stderr, "shared memory request %llu is longer than a slot\n",
+                (unsigned long long)request->id);
+        status = 1;
+    } else if((output = fmemopen(shm_ring_slot_data(response), ring->header->slot_size, "w")) == NULL) {
+        status = 1;
+    } else {
+        status = (*worker->process)(worker->context,
+                                    (struct q_useful_buf_c){shm_ring_slot_data(request), request->len},
+                                    output);
+        fflush(output);
+        output_len = ftell(output);
+        if(ferror(output) || output_len < 0 || (size_t)output_len >= ring->header->slot_size) {
+            /* fmemopen() needs room for a NUL so a full slot is taken
+             * to be too small */
+            fprintf(stderr, "output for shared memory request %llu doesn't fit in a slot\n",
+                    (unsigned long long)request->id);
+            output_len = 0;
+            if(status == 0) {
+                status = 1;
+            }
+        }
+        fclose(output);
+    }
+
+    response->len    = (uint32_t)output_len;
+    response->status = status;
+    shm_ring_put_finish(ring, SHM_RING_RESPONSE, response_position);
+
+    return status;
+}
+
+
+static void *ring_worker_thread(void *arg)
+{
+    struct ring_worker   *worker = arg;
+    struct shm_ring      *ring   = worker->ring;
+    struct shm_ring_slot *request;
+    uint64_t              position;
+    uint32_t              shutdown;
+    int                   status;
+
+    while(1) {
+        /* Loaded before looking at the ring so a request put before
+         * the shutdown flag is never missed */
+        shutdown = atomic_load(&ring->header->shutdown);
+
+        request = shm_ring_get_start(ring, SHM_RING_REQUEST, &position);
+        if(request == NULL) {
+            if(shutdown) {
+                break;
+            }
+            shm_ring_wait(ring, SHM_RING_REQUEST);
+            continue;
+        }
+
+        status = process_request(worker, request);
+        if(status > worker->status) {
+            worker->status = status;
+        }
+
+        shm_ring_get_finish(ring, SHM_RING_REQUEST, position);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Public function. See shm_ring.h
+ */
+int shm_ring_run(const char         *name,
+                 unsigned            workers,
+                 shm_ring_process_t  process,
+                 void               *context)
+{
+    struct shm_ring     ring;
+    struct ring_worker *worker_list;
+    unsigned            worker_count;
+    unsigned            i;
+    int                 return_value;
+
+    if(workers == 0) {
+        workers = 1;
+    }
+
+    if(shm_ring_attach(&ring, name)) {
+        return 1;
+    }
+
+    worker_list = calloc(workers, sizeof(struct ring_worker));
+    if(worker_list == NULL) {
+        shm_ring_detach(&ring);
+        return 1;
+    }
+
+    for(worker_count = 0; worker_count < workers; worker_count++) {
+        worker_list[worker_count].ring    = &ring;
+        worker_list[worker_count].process = process;
+        worker_list[worker_count].context = context;
+        if(pthread_create(&worker_list[worker_count].thread, NULL, ring_worker_thread, &worker_list[worker_count])) {
+            break;
+        }
+    }
+
+    return_value = 0;
+    if(worker_count == 0) {
+        fprintf(stderr, "can't start worker threads\n");
+        return_value = 1;
+    }
+
+    for(i = 0; i < worker_count; i++) {
+        pthread_join(worker_list[i].thread, NULL);
+        if(worker_list[i].status > return_value) {
+            return_value = worker_list[i].status;
+        }
+    }
+
+    free(worker_list);
+    shm_ring_detach(&ring);
+
+    return return_value;
+}
@@ -0,0 +1,213 @@
+/*
+ * shm_ring.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef shm_ring_h
+#define shm_ring_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/* This is for -in_shm. A producer on the same host, such as a
+ * collector, puts tokens in a request ring in POSIX shared memory and
+ * xclaim puts the output for each in a response ring. There is no
+ * syscall or copy per token. The token is verified and converted
+ * right where the producer put it, and the output is written right
+ * into the response slot.
+ *
+ * Each ring is a bounded queue of fixed-size slots with a sequence
+ * number in each slot, as in Dmitry Vyukov's bounded MPMC queue. Any
+ * number of producers and consumers can use a ring without locks. A
+ * put or get costs a compare-and-swap on the ring position and a
+ * store to the slot, so a few cache-line transfers per token.
+ *
+ * When a ring is empty the consumer spins for a while and then
+ * sleeps on a futex in the shared memory, so an idle xclaim uses no
+ * CPU. The futex is only woken when someone is sleeping on it, so
+ * there is no syscall per token when busy. Without Linux futexes the
+ * sleep is a short nanosleep().
+ *
+ * The producer makes the shared memory object with shm_ring_create()
+ * or lays it out as described here itself. This is the layout, all
+ * in native byte order:
+ *
+ *   struct shm_ring_header
+ *   slot_count request slots
+ *   slot_count response slots
+ *
+ * Each slot is a struct shm_ring_slot followed by slot_size bytes of
+ * data, rounded up to SHM_RING_CACHE_LINE.
+ */
+
+
+#define SHM_RING_MAGIC   0x78636c72 /* "xclr" */
+#define SHM_RING_VERSION 1
+
+#define SHM_RING_CACHE_LINE 64
+
+
+/* One end of a ring. The positions are on their own cache lines so
+ * that producers and consumers don't contend for the same line. */
+struct shm_ring_queue {
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t put_position;
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t get_position;
+
+    /* Bumped on each put. The futex word. */
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t signal;
+    /* Number of consumers sleeping on signal */
+    _Atomic uint32_t waiters;
+};
+
+
+struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;  /* A power of two */
+    uint32_t slot_size;   /* Bytes of data in each slot */
+    uint64_t region_size;
+
+    /* Set by the producer to tell xclaim to finish once the request
+     * ring is empty */
+    _Atomic uint32_t shutdown;
+
+    struct shm_ring_queue request;
+    struct shm_ring_queue response;
+};
+
+
+struct shm_ring_slot {
+    /* Private to the queue. It says whether the slot is free or
+     * full and for which lap of the ring. */
+    _Atomic uint64_t sequence;
+
+    /* Set by the producer of a request and copied to its response so
+     * they can be matched up */
+    uint64_t         id;
+
+    /* Length of data */
+    uint32_t         len;
+
+    /* For a response, the exit status for the token: 0 for success,
+     * 2 if the token is not valid, 1 for other errors. The data is
+     * not complete unless it is 0. */
+    int32_t          status;
+
+    /* slot_size bytes follow */
+};
+
+
+/* A mapping of a shared memory ring */
+struct shm_ring {
+    struct shm_ring_header *header;
+    uint8_t                *request_slots;
+    uint8_t                *response_slots;
+    size_t                  slot_stride;
+    size_t                  map_size;
+};
+
+
+enum shm_ring_which_t {
+    SHM_RING_REQUEST,
+    SHM_RING_RESPONSE
+};
+
+
+/* Makes a new shared memory object called name, as for shm_open(),
+ * with slot_count slots of slot_size bytes in each ring and maps it.
+ * slot_count must be a power of two. Returns 0 on success. On failure
+ * a message is printed and 1 is returned. */
+int shm_ring_create(struct shm_ring *me,
+                    const char      *name,
+                    uint32_t         slot_count,
+                    uint32_t         slot_size);
+
+
+/* Maps an existing shared memory object made by a producer and checks
+ * its layout. Returns 0 on success. On failure a message is printed
+ * and 1 is returned. */
+int shm_ring_attach(struct shm_ring *me, const char *name);
+
+
+/* Unmaps. The shared memory object is not removed. */
+void shm_ring_detach(struct shm_ring *me);
+
+
+/* Data of a slot */
+static inline uint8_t *shm_ring_slot_data(struct shm_ring_slot *slot)
+{
+    return (uint8_t *)(slot + 1);
+}
+
+
+/* Gets a free slot to put in. Returns NULL if the ring is full.
+ * position is for shm_ring_put_finish(). */
+struct shm_ring_slot *shm_ring_put_start(struct shm_ring       *me,
+                                         enum shm_ring_which_t  which,
+                                         uint64_t              *position);
+
+
+/* Makes the slot visible to consumers and wakes any that are
+ * sleeping. */
+void shm_ring_put_finish(struct shm_ring       *me,
+                         enum shm_ring_which_t  which,
+                         uint64_t               position);
+
+
+/* Gets a full slot to take from. Returns NULL if the ring is empty.
+ * The slot stays owned by the caller until shm_ring_get_finish() so
+ * its data can be worked on in place. */
+struct shm_ring_slot *shm_ring_get_start(struct shm_ring       *me,
+                                         enum shm_ring_which_t  which,
+                                         uint64_t              *position);
+
+
+/* Gives the slot back to the producers. */
+void shm_ring_get_finish(struct shm_ring       *me,
+                         enum shm_ring_which_t  which,
+                         uint64_t               position);
+
+
+/* Waits until the ring might not be empty, the shutdown flag is set
+ * or a while has passed. */
+void shm_ring_wait(struct shm_ring *me, enum shm_ring_which_t which);
+
+
+/* Processes one token. This is called from the worker threads so it
+ * must be thread safe. input_bytes is in the shared memory and may be
+ * changed. output writes into the response slot. Returns 0 on
+ * success, otherwise an exit status. */
+typedef int (*shm_ring_process_t)(void                 *context,
+                                  struct q_useful_buf_c input_bytes,
+                                  FILE                 *output);
+
+
+/* Attaches to name and runs workers threads that take requests, run
+ * process on them and put the responses, until the shutdown flag is
+ * set and the request ring is empty. Output that doesn't fit in a
+ * slot is an error for that token. workers 0 is one thread. The
+ * producer must keep taking responses or the workers stop when the
+ * response ring is full.
+ *
+ * Returns 0 if all tokens were processed successfully, 1 if the
+ * shared memory can't be used, otherwise the largest exit status
+ * returned by process.
+ */
+int shm_ring_run(const char         *name,
+                 unsigned            workers,
+                 shm_ring_process_t  process,
+                 void               *context);
+
+
+#endif /* shm_ring_h */
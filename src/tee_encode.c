@@ -0,0 +1,147 @@
+/*
+ * tee_encode.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "tee_encode.h"
+
+
+static enum xclaim_error_t tee_output_claim(void *ctx, const struct xclaim *claim)
+{
+    struct xclaim_tee_ctx *me = (struct xclaim_tee_ctx *)ctx;
+    enum xclaim_error_t    xclaim_error;
+    size_t                 i;
+
+    for(i = 0; i < me->count; i++) {
+        xclaim_error = (me->encoders[i].output_claim)(me->encoders[i].ctx, claim);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t tee_start_submods_section(void *ctx)
+{
+    struct xclaim_tee_ctx *me = (struct xclaim_tee_ctx *)ctx;
+    enum xclaim_error_t    xclaim_error;
+    size_t                 i;
+
+    for(i = 0; i < me->count; i++) {
+        xclaim_error = (me->encoders[i].start_submods_section)(me->encoders[i].ctx);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t tee_end_submods_section(void *ctx)
+{
+    struct xclaim_tee_ctx *me = (struct xclaim_tee_ctx *)ctx;
+    enum xclaim_error_t    xclaim_error;
+    size_t                 i;
+
+    for(i = 0; i < me->count; i++) {
+        xclaim_error = (me->encoders[i].end_submods_section)(me->encoders[i].ctx);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t tee_open_submod(void *ctx, const struct q_useful_buf_c submod_name)
+{
+    struct xclaim_tee_ctx *me = (struct xclaim_tee_ctx *)ctx;
+    enum xclaim_error_t    xclaim_error;
+    size_t                 i;
+
+    for(i = 0; i < me->count; i++) {
+        xclaim_error = (me->encoders[i].open_submod)(me->encoders[i].ctx, submod_name);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t tee_close_submod(void *ctx)
+{
+    struct xclaim_tee_ctx *me = (struct xclaim_tee_ctx *)ctx;
+    enum xclaim_error_t    xclaim_error;
+    size_t                 i;
+
+    for(i = 0; i < me->count; i++) {
+        xclaim_error = (me->encoders[i].close_submod)(me->encoders[i].ctx);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t tee_output_nested(void                       *ctx,
+                                             const struct q_useful_buf_c submod_name,
+                                             struct q_useful_buf_c       nested_token)
+{
+    struct xclaim_tee_ctx *me = (struct xclaim_tee_ctx *)ctx;
+    enum xclaim_error_t    xclaim_error;
+    size_t                 i;
+
+    for(i = 0; i < me->count; i++) {
+        xclaim_error = (me->encoders[i].output_nested)(me->encoders[i].ctx,
+                                                       submod_name,
+                                                       nested_token);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/*
+ * Public function. See tee_encode.h
+ */
+int xclaim_tee_encode_init(xclaim_encoder        *out,
+                           struct xclaim_tee_ctx *ctx,
+                           xclaim_encoder        *encoders,
+                           size_t                 count)
+{
+    if(count > XCLAIM_TEE_MAX) {
+        return 1;
+    }
+
+    ctx->encoders = encoders;
+    ctx->count    = count;
+
+    out->ctx = ctx;
+
+    out->output_claim          = tee_output_claim;
+    out->start_submods_section = tee_start_submods_section;
+    out->end_submods_section   = tee_end_submods_section;
+    out->open_submod           = tee_open_submod;
+    out->close_submod          = tee_close_submod;
+    out->output_nested         = tee_output_nested;
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * tee_encode.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef tee_encode_h
+#define tee_encode_h
+
+#include "xclaim.h"
+#include <stddef.h>
+
+
+/* This is an xclaim_encoder that passes every call on to several
+ * other encoders, for example one for JSON and one for CBOR. With it
+ * a token is verified and decoded once no matter how many outputs
+ * there are.
+ *
+ * The encoders are called in order. The first error stops the
+ * call and is returned. The encoders after that one don't get the
+ * call.
+ */
+
+
+/* The most encoders a tee can pass calls on to */
+#define XCLAIM_TEE_MAX 8
+
+
+struct xclaim_tee_ctx {
+    xclaim_encoder *encoders;
+    size_t          count;
+};
+
+
+/* Sets up out to pass calls on to the count encoders in
+ * encoders. The encoders must stay valid while out is used. Returns
+ * 0 on success or 1 if count is more than XCLAIM_TEE_MAX. */
+int xclaim_tee_encode_init(xclaim_encoder        *out,
+                           struct xclaim_tee_ctx *ctx,
+                           xclaim_encoder        *encoders,
+                           size_t                 count);
+
+
+#endif /* tee_encode_h */
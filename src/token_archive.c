@@ -0,0 +1,918 @@
+/*
+ * token_archive.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "token_archive.h"
+#include "cbor_seq.h"
+#include "cose_envelope.h"
+
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+#include "qcbor/qcbor_spiffy_decode.h"
+
+#include <stdio.h> /* For error prints */
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+
+
+#define TOKEN_ARCHIVE_MAGIC   0x78636c6d61726978ULL /* "xclmarix" */
+#define TOKEN_ARCHIVE_VERSION 1
+
+/* The hash in an entry is 0 if the token has no ueid or cti. The hash
+ * in a slot is 0 if the slot is empty. */
+#define NO_HASH 0
+
+
+/* This is the layout at the start of the index file. It is 64 bytes.
+ * The entries, the postings and the slots follow it. */
+struct token_archive_index_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint64_t seed;
+    uint64_t data_len;
+    uint64_t entry_count;
+    uint64_t posting_count;
+    uint8_t  pad[16];
+};
+
+
+/* One per token, sorted by iat and then offset */
+struct token_archive_entry {
+    uint64_t offset;
+    uint64_t ueid_hash;
+    uint64_t cti_hash;
+    int64_t  iat;
+    uint32_t len;
+    uint32_t pad;
+};
+
+
+/* The tokens for one ueid or cti are the entries listed in
+ * postings[start] to postings[start + count - 1] */
+struct token_archive_slot {
+    uint64_t key_hash;
+    uint32_t start;
+    uint32_t count;
+};
+
+
+/* The claims the index is on */
+struct archive_keys {
+    struct q_useful_buf_c ueid;
+    struct q_useful_buf_c cti;
+    int64_t               iat;
+};
+
+
+/* The postings are padded to a multiple of 8 bytes so the slots are
+ * aligned. The counts have been checked so this can't overflow. */
+static size_t index_size(uint64_t entry_count, uint64_t posting_count, uint32_t slot_count)
+{
+    return sizeof(struct token_archive_index_header) +
+           entry_count * sizeof(struct token_archive_entry) +
+           ((posting_count + 1) & ~1ULL) * sizeof(uint32_t) +
+           (size_t)slot_count * sizeof(struct token_archive_slot);
+}
+
+
+/* Returns the malloced name of the index file or NULL */
+static char *index_file_name(const char *name, const char *suffix)
+{
+    char *index_name;
+
+    index_name = malloc(strlen(name) + strlen(suffix) + 1);
+    if(index_name != NULL) {
+        strcpy(index_name, name);
+        strcat(index_name, suffix);
+    }
+
+    return index_name;
+}
+
+
+static uint64_t new_seed(void)
+{
+    uint64_t seed;
+
+    /* The seed keeps anyone from crafting ueids that collide. */
+    if(RAND_bytes((unsigned char *)&seed, sizeof(seed)) != 1) {
+        seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+
+    return seed;
+}
+
+
+/* The final mix from MurmurHash3, as in replay_store.c */
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+
+/* Seeded FNV-1a of the label and value, never NO_HASH */
+static uint64_t key_hash(uint64_t seed, int64_t label, struct q_useful_buf_c value)
+{
+    const uint8_t *bytes = value.ptr;
+    uint64_t       h;
+    size_t         i;
+
+    h = 0xcbf29ce484222325ULL ^ seed ^ mix64((uint64_t)label);
+    for(i = 0; i < value.len; i++) {
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    h = mix64(h);
+
+    return h == NO_HASH ? 1 : h;
+}
+
+
+/* Gets the ueid, cti and iat from a token without verifying it. No
+ * crypto is done. Those not in the token, or in a token that can't
+ * be read without a key like a COSE_Encrypt0, are left as
+ * NULL_Q_USEFUL_BUF_C and INT64_MIN. */
+static void get_keys(struct q_useful_buf_c token, struct archive_keys *keys)
+{
+    struct cose_sign1_parts parts;
+    QCBORDecodeContext      decode_context;
+    QCBORItem               items[4];
+    uint8_t                 major_type;
+    uint8_t                 additional_info;
+    uint64_t                argument;
+    size_t                  head_len;
+
+    keys->ueid = NULL_Q_USEFUL_BUF_C;
+    keys->cti  = NULL_Q_USEFUL_BUF_C;
+    keys->iat  = INT64_MIN;
+
+    /* Skip over the tags as cose_envelope_unwrap() does */
+    while(1) {
+        head_len = cbor_decode_head(token, &major_type, &additional_info, &argument);
+        if(head_len == 0) {
+            return;
+        }
+        if(major_type != CBOR_MAJOR_TYPE_TAG) {
+            break;
+        }
+        token = q_useful_buf_tail(token, head_len);
+    }
+
+    if(major_type == CBOR_MAJOR_TYPE_ARRAY) {
+        /* A COSE_Sign1 or COSE_Mac0. A COSE_Encrypt0 fails here. */
+        if(cose_envelope_split_sign1(token, &parts)) {
+            return;
+        }
+        token = parts.payload;
+    } else if(major_type != CBOR_MAJOR_TYPE_MAP) {
+        return;
+    }
+
+    /* All three in one pass over the claims */
+    items[0].uLabelType  = QCBOR_TYPE_INT64;
+    items[0].label.int64 = CTOKEN_EAT_LABEL_UEID;
+    items[0].uDataType   = QCBOR_TYPE_ANY;
+    items[1].uLabelType  = QCBOR_TYPE_INT64;
+    items[1].label.int64 = CTOKEN_CWT_LABEL_CTI;
+    items[1].uDataType   = QCBOR_TYPE_ANY;
+    items[2].uLabelType  = QCBOR_TYPE_INT64;
+    items[2].label.int64 = CTOKEN_CWT_LABEL_IAT;
+    items[2].uDataType   = QCBOR_TYPE_ANY;
+    items[3].uLabelType  = QCBOR_TYPE_NONE;
+
+    QCBORDecode_Init(&decode_context, token, QCBOR_DECODE_MODE_NORMAL);
+    QCBORDecode_EnterMap(&decode_context, NULL);
+    QCBORDecode_GetItemsInMap(&decode_context, items);
+    if(QCBORDecode_GetError(&decode_context) != QCBOR_SUCCESS) {
+        return;
+    }
+
+    if(items[0].uDataType == QCBOR_TYPE_BYTE_STRING) {
+        keys->ueid = items[0].val.string;
+    }
+    if(items[1].uDataType == QCBOR_TYPE_BYTE_STRING) {
+        keys->cti = items[1].val.string;
+    }
+    if(items[2].uDataType == QCBOR_TYPE_INT64) {
+        keys->iat = items[2].val.int64;
+    }
+}
+
+
+static void make_entry(uint64_t                    seed,
+                       struct q_useful_buf_c       token,
+                       uint64_t                    offset,
+                       struct token_archive_entry *entry)
+{
+    struct archive_keys keys;
+
+    get_keys(token, &keys);
+
+    memset(entry, 0, sizeof(*entry));
+    entry->offset = offset;
+    entry->len    = (uint32_t)token.len;
+    entry->iat    = keys.iat;
+    if(!q_useful_buf_c_is_null(keys.ueid)) {
+        entry->ueid_hash = key_hash(seed, CTOKEN_EAT_LABEL_UEID, keys.ueid);
+    }
+    if(!q_useful_buf_c_is_null(keys.cti)) {
+        entry->cti_hash = key_hash(seed, CTOKEN_CWT_LABEL_CTI, keys.cti);
+    }
+}
+
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct token_archive_entry *x = a;
+    const struct token_archive_entry *y = b;
+
+    if(x->iat != y->iat) {
+        return x->iat < y->iat ? -1 : 1;
+    }
+
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+/* Maps the index and checks it goes with the data. Leaves me->header
+ * NULL if there isn't one that does. */
+static void map_index(struct token_archive *me, const char *name)
+{
+    const struct token_archive_index_header *header;
+    char                                    *index_name;
+    struct stat                              file_stat;
+    void                                    *map;
+    int                                      fd;
+
+    index_name = index_file_name(name, ".idx");
+    if(index_name == NULL) {
+        return;
+    }
+    fd = open(index_name, O_RDONLY);
+    free(index_name);
+    if(fd < 0) {
+        return;
+    }
+    if(fstat(fd, &file_stat) || (size_t)file_stat.st_size < sizeof(*header)) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return;
+    }
+    me->index_map = map;
+    me->index_len = (size_t)file_stat.st_size;
+
+    header = map;
+    if(header->magic       != TOKEN_ARCHIVE_MAGIC ||
+       header->version     != TOKEN_ARCHIVE_VERSION ||
+       header->data_len     > me->data_len ||
+       header->entry_count  > UINT32_MAX ||
+       header->posting_count > 2 * header->entry_count ||
+       header->slot_count  == 0 ||
+       (header->slot_count & (header->slot_count - 1)) != 0 ||
+       header->slot_count   > (1U << 31) ||
+       index_size(header->entry_count, header->posting_count, header->slot_count) != me->index_len) {
+        return;
+    }
+
+    me->header   = header;
+    me->seed     = header->seed;
+    me->entries  = (const struct token_archive_entry *)(header + 1);
+    me->postings = (const uint32_t *)(me->entries + header->entry_count);
+    me->slots    = (const struct token_archive_slot *)(me->postings + ((header->posting_count + 1) & ~1ULL));
+}
+
+
+/* Makes entries for the tokens after the end of the index */
+static int scan_tail(struct token_archive *me)
+{
+    struct q_useful_buf_c       remaining;
+    struct q_useful_buf_c       token;
+    struct token_archive_entry *new_tail;
+    size_t                      capacity;
+    size_t                      start;
+    int                         seq_error;
+
+    start     = me->header != NULL ? (size_t)me->header->data_len : 0;
+    remaining = (struct q_useful_buf_c){me->data + start, me->data_len - start};
+    capacity  = 0;
+
+    while(1) {
+        seq_error = cbor_seq_next(&remaining, &token);
+        if(seq_error == 1) {
+            break;
+        }
+        if(seq_error != 0 || token.len > UINT32_MAX) {
+            fprintf(stderr, "archive data is not well-formed at offset %zu\n", me->data_len - remaining.len);
+            return 1;
+        }
+
+        if(me->tail_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            new_tail = realloc(me->tail, capacity * sizeof(struct token_archive_entry));
+            if(new_tail == NULL) {
+                fprintf(stderr, "out of memory reading archive\n");
+                return 1;
+            }
+            me->tail = new_tail;
+        }
+        make_entry(me->seed,
+                   token,
+                   (uint64_t)((const uint8_t *)token.ptr - me->data),
+                   &me->tail[me->tail_count++]);
+    }
+
+    return 0;
+}
+
+
+/* Maps the data file, which is open and locked, and the index, and
+ * makes entries for what the index doesn't cover. */
+static int map_archive(struct token_archive *me, const char *name, int data_fd)
+{
+    struct stat file_stat;
+    void       *map;
+
+    if(fstat(data_fd, &file_stat)) {
+        fprintf(stderr, "can't read archive \"%s\" (%s)\n", name, strerror(errno));
+        return 1;
+    }
+    me->data_len = (size_t)file_stat.st_size;
+
+    if(me->data_len > 0) {
+        map = mmap(NULL, me->data_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, data_fd, 0);
+        if(map == MAP_FAILED) {
+            fprintf(stderr, "can't map archive \"%s\" (%s)\n", name, strerror(errno));
+            me->data_len = 0;
+            return 1;
+        }
+        me->data = map;
+    }
+
+    map_index(me, name);
+    if(me->header == NULL) {
+        me->seed = new_seed();
+    }
+
+    return scan_tail(me);
+}
+
+
+/* A ueid or cti hash and one of its entries, for sorting */
+struct posting_pair {
+    uint64_t key_hash;
+    uint32_t entry;
+};
+
+
+static int compare_pairs(const void *a, const void *b)
+{
+    const struct posting_pair *x = a;
+    const struct posting_pair *y = b;
+
+    if(x->key_hash != y->key_hash) {
+        return x->key_hash < y->key_hash ? -1 : 1;
+    }
+
+    return (x->entry > y->entry) - (x->entry < y->entry);
+}
+
+
+/* Writes a new index covering all the data in me. The old entries are
+ * already sorted and none of the tokens in them are decoded again, so
+ * this costs a merge and a sort of the postings. */
+static int write_index(struct token_archive *me, const char *name)
+{
+    struct token_archive_index_header  header;
+    struct token_archive_entry        *entries;
+    struct posting_pair               *pairs;
+    uint32_t                          *postings;
+    struct token_archive_slot         *slots;
+    char                              *index_name;
+    char                              *temp_name;
+    FILE                              *index_file;
+    uint64_t                           old_count;
+    uint64_t                           entry_count;
+    uint64_t                           pair_count;
+    uint64_t                           key_count;
+    uint64_t                           i;
+    uint64_t                           j;
+    uint64_t                           k;
+    uint32_t                           slot_count;
+    uint32_t                           slot;
+    uint32_t                           zero;
+    int                                return_value;
+
+    entries    = NULL;
+    pairs      = NULL;
+    postings   = NULL;
+    slots      = NULL;
+    index_name = index_file_name(name, ".idx");
+    temp_name  = index_file_name(name, ".idx.tmp");
+    index_file = NULL;
+
+    return_value = 1;
+
+    old_count   = me->header != NULL ? me->header->entry_count : 0;
+    entry_count = old_count + me->tail_count;
+    if(entry_count > UINT32_MAX) {
+        fprintf(stderr, "too many tokens in archive \"%s\"\n", name);
+        goto Done;
+    }
+
+    entries  = malloc((entry_count ? entry_count : 1) * sizeof(struct token_archive_entry));
+    pairs    = malloc((entry_count ? entry_count : 1) * 2 * sizeof(struct posting_pair));
+    postings = malloc((entry_count ? entry_count : 1) * 2 * sizeof(uint32_t));
+    if(entries == NULL || pairs == NULL || postings == NULL || index_name == NULL || temp_name == NULL) {
+        fprintf(stderr, "out of memory indexing archive \"%s\"\n", name);
+        goto Done;
+    }
+
+    /* Merge the new ones into the ones already in time order */
+    qsort(me->tail, me->tail_count, sizeof(struct token_archive_entry), compare_entries);
+    for(i = 0, j = 0, k = 0; k < entry_count; k++) {
+        if(j == me->tail_count ||
+           (i < old_count && compare_entries(&me->entries[i], &me->tail[j]) <= 0)) {
+            entries[k] = me->entries[i++];
+        } else {
+            entries[k] = me->tail[j++];
+        }
+    }
+
+    /* Group the entries by ueid and cti. Within a group they stay in
+     * time order. */
+    pair_count = 0;
+    for(k = 0; k < entry_count; k++) {
+        if(entries[k].ueid_hash != NO_HASH) {
+            pairs[pair_count++] = (struct posting_pair){entries[k].ueid_hash, (uint32_t)k};
+        }
+        if(entries[k].cti_hash != NO_HASH) {
+            pairs[pair_count++] = (struct posting_pair){entries[k].cti_hash, (uint32_t)k};
+        }
+    }
+    qsort(pairs, pair_count, sizeof(struct posting_pair), compare_pairs);
+
+    key_count = 0;
+    for(k = 0; k < pair_count; k++) {
+        if(k == 0 || pairs[k].key_hash != pairs[k-1].key_hash) {
+            key_count++;
+        }
+    }
+
+    /* At most half full */
+    for(slot_count = 16; slot_count < 2 * key_count; slot_count <<= 1);
+    slots = calloc(slot_count, sizeof(struct token_archive_slot));
+    if(slots == NULL) {
+        fprintf(stderr, "out of memory indexing archive \"%s\"\n", name);
+        goto Done;
+    }
+
+    for(i = 0; i < pair_count; i = j) {
+        for(j = i; j < pair_count && pairs[j].key_hash == pairs[i].key_hash; j++) {
+            postings[j] = pairs[j].entry;
+        }
+        slot = (uint32_t)pairs[i].key_hash & (slot_count - 1);
+        while(slots[slot].key_hash != NO_HASH) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot].key_hash = pairs[i].key_hash;
+        slots[slot].start    = (uint32_t)i;
+        slots[slot].count    = (uint32_t)(j - i);
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic         = TOKEN_ARCHIVE_MAGIC;
+    header.version       = TOKEN_ARCHIVE_VERSION;
+    header.slot_count    = slot_count;
+    header.seed          = me->seed;
+    header.data_len      = me->data_len;
+    header.entry_count   = entry_count;
+    header.posting_count = pair_count;
+
+    /* Readers that have the old one mapped keep it until they are
+     * done */
+    index_file = fopen(temp_name, "w");
+    if(index_file == NULL) {
+        fprintf(stderr, "can't make archive index \"%s\" (%s)\n", temp_name, strerror(errno));
+        goto Done;
+    }
+    zero = 0;
+    fwrite(&header, sizeof(header), 1, index_file);
+    fwrite(entries, sizeof(struct token_archive_entry), entry_count, index_file);
+    fwrite(postings, sizeof(uint32_t), pair_count, index_file);
+    if(pair_count & 1) {
+        fwrite(&zero, sizeof(zero), 1, index_file);
+    }
+    fwrite(slots, sizeof(struct token_archive_slot), slot_count, index_file);
+    if(fflush(index_file) || ferror(index_file) || fsync(fileno(index_file))) {
+        fprintf(stderr, "error writing archive index \"%s\" (%s)\n", temp_name, strerror(errno));
+        goto Done;
+    }
+    if(rename(temp_name, index_name)) {
+        fprintf(stderr, "can't replace archive index \"%s\" (%s)\n", index_name, strerror(errno));
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    if(index_file != NULL) {
+        fclose(index_file);
+        if(return_value) {
+            unlink(temp_name);
+        }
+    }
+    free(entries);
+    free(pairs);
+    free(postings);
+    free(slots);
+    free(index_name);
+    free(temp_name);
+
+    return return_value;
+}
+
+
+/* Brings the index up to date if enough has been added since it was
+ * made. The data file is locked. */
+static int update_index(const char *name, int data_fd)
+{
+    struct token_archive archive;
+    size_t               indexed_len;
+    int                  return_value;
+
+    memset(&archive, 0, sizeof(archive));
+
+    return_value = map_archive(&archive, name, data_fd);
+    if(return_value) {
+        goto Done;
+    }
+
+    indexed_len = archive.header != NULL ? (size_t)archive.header->data_len : 0;
+    if(archive.header != NULL && archive.data_len - indexed_len < TOKEN_ARCHIVE_MAX_TAIL) {
+        goto Done;
+    }
+
+    return_value = write_index(&archive, name);
+
+Done:
+    token_archive_close(&archive);
+
+    return return_value;
+}
+
+
+/*
+ * Public function. See token_archive.h
+ */
+int token_archive_add(const char *name, struct q_useful_buf_c tokens)
+{
+    struct q_useful_buf_c remaining;
+    struct q_useful_buf_c token;
+    struct stat           file_stat;
+    const uint8_t        *bytes;
+    size_t                left;
+    ssize_t               amount_written;
+    int                   seq_error;
+    int                   fd;
+    int                   return_value;
+
+    /* All are checked before any are added */
+    remaining = tokens;
+    while((seq_error = cbor_seq_next(&remaining, &token)) == 0) {
+        if(token.len > UINT32_MAX) {
+            seq_error = -1;
+            break;
+        }
+    }
+    if(seq_error != 1 || tokens.len == 0) {
+        fprintf(stderr, "input is not a token or a CBOR sequence of tokens\n");
+        return 1;
+    }
+
+    fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "can't open archive \"%s\" (%s)\n", name, strerror(errno));
+        return 1;
+    }
+
+    return_value = 1;
+
+    if(flock(fd, LOCK_EX) || fstat(fd, &file_stat)) {
+        fprintf(stderr, "can't lock archive \"%s\" (%s)\n", name, strerror(errno));
+        goto Done;
+    }
+
+    bytes = tokens.ptr;
+    left  = tokens.len;
+    while(left > 0) {
+        amount_written = write(fd, bytes, left);
+        if(amount_written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "error adding to archive \"%s\" (%s)\n", name, strerror(errno));
+            /* So the data stays a sequence of whole tokens */
+            if(ftruncate(fd, file_stat.st_size)) {
+                fprintf(stderr, "archive \"%s\" may have part of a token at the end\n", name);
+            }
+            goto Done;
+        }
+        bytes += amount_written;
+        left  -= (size_t)amount_written;
+    }
+
+    return_value = update_index(name, fd);
+
+Done:
+    close(fd);
+
+    return return_value;
+}
+
+
+/*
+ * Public function. See token_archive.h
+ */
+int token_archive_open(struct token_archive *me, const char *name)
+{
+    int fd;
+    int return_value;
+
+    memset(me, 0, sizeof(*me));
+
+    fd = open(name, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "can't open archive \"%s\" (%s)\n", name, strerror(errno));
+        return 1;
+    }
+
+    /* Only while mapping. What has been mapped doesn't change when
+     * more is added. */
+    if(flock(fd, LOCK_SH)) {
+        fprintf(stderr, "can't lock archive \"%s\" (%s)\n", name, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    return_value = map_archive(me, name, fd);
+
+    close(fd);
+
+    if(return_value == 0 && me->header == NULL && me->data_len > 0) {
+        fprintf(stderr, "archive \"%s\" has no index so every token is read\n", name);
+    }
+
+    return return_value;
+}
+
+
+/* Finds the slot for a ueid or cti hash or returns NULL */
+static const struct token_archive_slot *
+find_slot(const struct token_archive *me, uint64_t hash)
+{
+    const struct token_archive_slot *slot;
+    uint32_t                         mask;
+    uint32_t                         index;
+    uint32_t                         probes;
+
+    mask  = me->header->slot_count - 1;
+    index = (uint32_t)hash & mask;
+
+    /* The table is never full, but the index file could be damaged */
+    for(probes = 0; probes <= mask; probes++) {
+        slot = &me->slots[index];
+        if(slot->key_hash == NO_HASH) {
+            break;
+        }
+        if(slot->key_hash == hash) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+
+    return NULL;
+}
+
+
+/* Checks a slot's postings are in the index and all refer to an
+ * entry. Only the postings used are checked so opening a large
+ * archive doesn't cost a pass over all of them. */
+static bool postings_valid(const struct token_archive      *me,
+                           const struct token_archive_slot *slot)
+{
+    const uint32_t *list;
+    uint32_t        i;
+
+    if((uint64_t)slot->start + slot->count > me->header->posting_count) {
+        return false;
+    }
+
+    list = me->postings + slot->start;
+    for(i = 0; i < slot->count; i++) {
+        if(list[i] >= me->header->entry_count) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* The first of the count entries in list, or of all the entries if
+ * list is NULL, that has an iat of at least iat. list must be from a
+ * slot checked with postings_valid(). */
+static size_t first_at_or_after(const struct token_archive *me,
+                                const uint32_t             *list,
+                                size_t                      count,
+                                int64_t                     iat)
+{
+    size_t low;
+    size_t high;
+    size_t mid;
+
+    low  = 0;
+    high = count;
+    while(low < high) {
+        mid = low + (high - low) / 2;
+        if(me->entries[list ? list[mid] : mid].iat < iat) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+
+/* Checks an entry against the query. The hashes only say it might be
+ * the ueid or cti wanted so the token itself is checked too. */
+static bool entry_matches(const struct token_archive       *me,
+                          const struct token_archive_entry *entry,
+                          const struct token_archive_query *query,
+                          uint64_t                          ueid_hash,
+                          uint64_t                          cti_hash)
+{
+    struct archive_keys keys;
+
+    if(entry->iat < query->from || entry->iat > query->to) {
+        return false;
+    }
+    if(ueid_hash != NO_HASH && entry->ueid_hash != ueid_hash) {
+        return false;
+    }
+    if(cti_hash != NO_HASH && entry->cti_hash != cti_hash) {
+        return false;
+    }
+    if(entry->offset > me->data_len || entry->len > me->data_len - entry->offset) {
+        return false;
+    }
+
+    if(ueid_hash == NO_HASH && cti_hash == NO_HASH) {
+        return true;
+    }
+
+    get_keys((struct q_useful_buf_c){me->data + entry->offset, entry->len}, &keys);
+    if(ueid_hash != NO_HASH && q_useful_buf_compare(keys.ueid, query->ueid)) {
+        return false;
+    }
+    if(cti_hash != NO_HASH && q_useful_buf_compare(keys.cti, query->cti)) {
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Public function. See token_archive.h
+ */
+int token_archive_query(const struct token_archive       *me,
+                        const struct token_archive_query *query,
+                        token_archive_callback           *callback,
+                        void                             *context,
+                        uint64_t                         *match_count)
+{
+    const struct token_archive_slot  *slot;
+    const struct token_archive_entry *entry;
+    const uint32_t                   *list;
+    uint64_t                          ueid_hash;
+    uint64_t                          cti_hash;
+    size_t                            count;
+    size_t                            first;
+    size_t                            end;
+    size_t                            i;
+    int                               result;
+    int                               return_value;
+
+    *match_count = 0;
+    return_value = 0;
+
+    ueid_hash = NO_HASH;
+    if(!q_useful_buf_c_is_null(query->ueid)) {
+        ueid_hash = key_hash(me->seed, CTOKEN_EAT_LABEL_UEID, query->ueid);
+    }
+    cti_hash = NO_HASH;
+    if(!q_useful_buf_c_is_null(query->cti)) {
+        cti_hash = key_hash(me->seed, CTOKEN_CWT_LABEL_CTI, query->cti);
+    }
+
+    if(me->header != NULL) {
+        /* The candidates are the tokens for the ueid or cti or else
+         * all of them. Either way they are in time order. */
+        list  = NULL;
+        count = (size_t)me->header->entry_count;
+        if(ueid_hash != NO_HASH || cti_hash != NO_HASH) {
+            slot  = find_slot(me, ueid_hash != NO_HASH ? ueid_hash : cti_hash);
+            count = 0;
+            if(slot != NULL && !postings_valid(me, slot)) {
+                /* The index is damaged. Every entry is checked
+                 * instead so nothing is missed. */
+                count = (size_t)me->header->entry_count;
+            } else if(slot != NULL) {
+                list  = me->postings + slot->start;
+                count = slot->count;
+            }
+        }
+
+        first = 0;
+        if(query->from != INT64_MIN) {
+            first = first_at_or_after(me, list, count, query->from);
+        }
+        end = count;
+        if(query->to != INT64_MAX) {
+            end = first_at_or_after(me, list, count, query->to + 1);
+        }
+
+        for(i = first; i < end; i++) {
+            entry = &me->entries[list ? list[i] : i];
+            if(!entry_matches(me, entry, query, ueid_hash, cti_hash)) {
+                continue;
+            }
+            (*match_count)++;
+            result = (*callback)(context, (struct q_useful_buf){me->data + entry->offset, entry->len});
+            if(result > return_value) {
+                return_value = result;
+            }
+        }
+    }
+
+    for(i = 0; i < me->tail_count; i++) {
+        entry = &me->tail[i];
+        if(!entry_matches(me, entry, query, ueid_hash, cti_hash)) {
+            continue;
+        }
+        (*match_count)++;
+        result = (*callback)(context, (struct q_useful_buf){me->data + entry->offset, entry->len});
+        if(result > return_value) {
+            return_value = result;
+        }
+    }
+
+    return return_value;
+}
+
+
+/*
+ * Public function. See token_archive.h
+ */
+void token_archive_close(struct token_archive *me)
+{
+    if(me->data != NULL) {
+        munmap(me->data, me->data_len);
+    }
+    if(me->index_map != NULL) {
+        munmap(me->index_map, me->index_len);
+    }
+    free(me->tail);
+
+    memset(me, 0, sizeof(*me));
+}
@@ -0,0 +1,138 @@
+/*
+ * token_archive.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef token_archive_h
+#define token_archive_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* This is a store of many tokens that can be searched by ueid, cti
+ * and iat without decoding every token in it.
+ *
+ * The archive is two files. The data file is the tokens one after
+ * another as they were given, a CBOR sequence that only ever has
+ * tokens added to the end. The index file, the data file name with
+ * ".idx" added, is made from the data file and can always be made
+ * again from it. It has
+ *
+ *   - an entry for each token with its offset, length, iat and hashes
+ *     of its ueid and cti, sorted by iat so a time range is a binary
+ *     search
+ *   - for each ueid and cti, a list of its tokens in iat order
+ *   - an open-addressing hash table from the ueid or cti hash to its
+ *     list
+ *
+ * Both files are memory-mapped when opened, so opening costs nothing
+ * however many tokens there are. Finding the tokens for a ueid is one
+ * table probe and a binary search. Each match is checked against the
+ * token itself so a hash collision can't give a wrong result.
+ *
+ * The index is brought up to date when tokens are added, but only
+ * once the tokens after the end of what it covers add up to
+ * TOKEN_ARCHIVE_MAX_TAIL bytes. Rewriting it costs about as much as
+ * reading it, so this keeps adding tokens cheap. The tokens after the
+ * end of the index are looked at one by one when the archive is
+ * opened.
+ *
+ * The index is built without verifying the tokens and without any
+ * keys. The tokens are verified when they are queried. The claims in
+ * a COSE_Encrypt0 can't be read without the key, so those tokens are
+ * only found by a query with no ueid, cti or time.
+ *
+ * Adding locks the data file so only one xclaim adds at a time.
+ * Opening takes a shared lock for just long enough to map the files
+ * so a query never sees half of an added token. The index is
+ * replaced by renaming a new one over it.
+ *
+ * The index is in the byte order of the machine that made it.
+ */
+
+
+/* See above */
+#define TOKEN_ARCHIVE_MAX_TAIL (4 * 1024 * 1024)
+
+
+struct token_archive_entry;
+struct token_archive_slot;
+struct token_archive_index_header;
+
+
+struct token_archive {
+    /* The data file. It is mapped private and writable so a token can
+     * be decrypted in place. */
+    uint8_t                                 *data;
+    size_t                                   data_len;
+
+    /* The index. header is NULL if there is no up-to-date index. */
+    void                                    *index_map;
+    size_t                                   index_len;
+    const struct token_archive_index_header *header;
+    const struct token_archive_entry        *entries;
+    const uint32_t                          *postings;
+    const struct token_archive_slot         *slots;
+    uint64_t                                 seed;
+
+    /* The tokens after the end of what the index covers */
+    struct token_archive_entry              *tail;
+    size_t                                   tail_count;
+};
+
+
+/* The tokens to find. Each part that is given must match. */
+struct token_archive_query {
+    /* NULL_Q_USEFUL_BUF_C for any */
+    struct q_useful_buf_c ueid;
+    struct q_useful_buf_c cti;
+
+    /* iat from and to, inclusive. INT64_MIN and INT64_MAX for any.
+     * Tokens with no iat only match when from is INT64_MIN. */
+    int64_t               from;
+    int64_t               to;
+};
+
+
+/* Called for each token that matches. token is in memory that can be
+ * written. The return value is as for process_token() in main.c. */
+typedef int token_archive_callback(void *context, struct q_useful_buf token);
+
+
+/* Adds the token or CBOR sequence of tokens in tokens to the end of
+ * the archive, making it if it doesn't exist. The tokens are stored
+ * as they are. Nothing is added if any of them is not well-formed.
+ * Returns 0 on success or 1 on error after printing it. */
+int token_archive_add(const char *name, struct q_useful_buf_c tokens);
+
+
+/* Opens an archive for token_archive_query(). Returns 0 on success or
+ * 1 on error after printing it. token_archive_close() must be called
+ * even on error. */
+int token_archive_open(struct token_archive *me, const char *name);
+
+
+/* Calls callback for each token that matches query. Those covered by
+ * the index come in iat order, then any after it in the order they
+ * were added. Returns the highest value callback returned or 0 if
+ * nothing matched. match_count is set to the number that matched. */
+int token_archive_query(const struct token_archive       *me,
+                        const struct token_archive_query *query,
+                        token_archive_callback           *callback,
+                        void                             *context,
+                        uint64_t                         *match_count);
+
+
+void token_archive_close(struct token_archive *me);
+
+
+#endif /* token_archive_h */
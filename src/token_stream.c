@@ -0,0 +1,631 @@
+/*
+ * token_stream.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "token_stream.h"
+#include "cbor_seq.h"
+#include "ctoken_adapt.h"
+#include "openssl_keys.h"
+#include "ctoken/ctoken_eat_labels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/ecdsa.h>
+
+
+/* The COSE header label for the algorithm */
+#define COSE_HEADER_PARAM_ALG 1
+
+/* Claims and the submods section are wrapped in a map of one entry to
+ * decode them */
+#define CBOR_MAP_OF_ONE 0xa1
+
+/* Biggest CBOR head */
+#define CBOR_HEAD_MAX 9
+
+
+/*
+ * Public function. See token_stream.h
+ */
+void token_stream_init(struct token_stream *me,
+                       uint32_t             option_flags,
+                       struct t_cose_key    verification_key)
+{
+    memset(me, 0, sizeof(*me));
+    me->state            = TOKEN_STREAM_STATE_HEAD;
+    me->option_flags     = option_flags;
+    me->verification_key = verification_key;
+}
+
+
+/*
+ * Public function. See token_stream.h
+ */
+void token_stream_finish(struct token_stream *me)
+{
+    EVP_MD_CTX_free(me->md_ctx);
+    free(me->buf);
+    free(me->scratch);
+    me->md_ctx  = NULL;
+    me->buf     = NULL;
+    me->scratch = NULL;
+}
+
+
+static inline bool checking_signature(const struct token_stream *me)
+{
+    return me->is_signed && !(me->option_flags & TOKEN_STREAM_OPT_NO_VERIFY);
+}
+
+
+/* Hashes the payload bytes that have arrived since last time. */
+static int hash_payload(struct token_stream *me)
+{
+    size_t end;
+
+    if(me->md_ctx == NULL) {
+        return 0;
+    }
+
+    end = me->len < me->payload_end ? me->len : me->payload_end;
+    if(end > me->hashed) {
+        if(!EVP_DigestVerifyUpdate(me->md_ctx, me->buf + me->hashed, end - me->hashed)) {
+            fprintf(stderr, "hashing the payload failed\n");
+            return 1;
+        }
+        me->hashed = end;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See token_stream.h
+ */
+enum token_stream_status_t
+token_stream_feed(struct token_stream *me, struct q_useful_buf_c bytes)
+{
+    size_t   new_size;
+    uint8_t *new_buf;
+
+    if(me->state == TOKEN_STREAM_STATE_DONE) {
+        /* Bytes after the token are ignored */
+        return TOKEN_STREAM_NEED_MORE;
+    }
+
+    if(bytes.len > TOKEN_STREAM_MAX_SIZE - me->len) {
+        fprintf(stderr, "streamed token is larger than %d bytes\n", TOKEN_STREAM_MAX_SIZE);
+        return TOKEN_STREAM_ERROR;
+    }
+
+    if(me->len + bytes.len > me->size) {
+        new_size = me->size ? me->size : 4096;
+        while(new_size < me->len + bytes.len) {
+            new_size *= 2;
+        }
+        new_buf = realloc(me->buf, new_size);
+        if(new_buf == NULL) {
+            fprintf(stderr, "out of memory buffering streamed token\n");
+            return TOKEN_STREAM_ERROR;
+        }
+        me->buf  = new_buf;
+        me->size = new_size;
+    }
+
+    memcpy(me->buf + me->len, bytes.ptr, bytes.len);
+    me->len += bytes.len;
+
+    if(hash_payload(me)) {
+        return TOKEN_STREAM_ERROR;
+    }
+
+    return TOKEN_STREAM_NEED_MORE;
+}
+
+
+/* The bytes that have arrived and not been parsed yet */
+static inline struct q_useful_buf_c unparsed(const struct token_stream *me)
+{
+    return (struct q_useful_buf_c){me->buf + me->position, me->len - me->position};
+}
+
+
+/* Gets the length of the next complete item. Returns 0 if it hasn't
+ * all arrived. A malformed item also returns 0 and shows up as a
+ * truncated token when the input ends. */
+static inline size_t next_item_length(const struct token_stream *me)
+{
+    return cbor_item_length(unparsed(me));
+}
+
+
+/* Gets the algorithm ID out of the protected headers. Only the alg
+ * is looked at. Returns 0 on success. */
+static int get_protected_alg(struct q_useful_buf_c protected_headers, int64_t *alg)
+{
+    uint8_t  major_type;
+    uint8_t  additional_info;
+    uint64_t argument;
+    uint64_t entries;
+    size_t   len;
+
+    *alg = 0;
+
+    len = cbor_decode_head(protected_headers, &major_type, &additional_info, &argument);
+    if(len == 0 ||
+       major_type != CBOR_MAJOR_TYPE_MAP ||
+       additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE) {
+        return 1;
+    }
+    protected_headers = q_useful_buf_tail(protected_headers, len);
+
+    for(entries = argument; entries > 0; entries--) {
+        len = cbor_decode_head(protected_headers, &major_type, &additional_info, &argument);
+        if(len == 0) {
+            return 1;
+        }
+        if(major_type == CBOR_MAJOR_TYPE_POSITIVE_INT && argument == COSE_HEADER_PARAM_ALG) {
+            protected_headers = q_useful_buf_tail(protected_headers, len);
+            len = cbor_decode_head(protected_headers, &major_type, &additional_info, &argument);
+            if(len == 0 || argument > INT64_MAX) {
+                return 1;
+            }
+            if(major_type == CBOR_MAJOR_TYPE_POSITIVE_INT) {
+                *alg = (int64_t)argument;
+            } else if(major_type == CBOR_MAJOR_TYPE_NEGATIVE_INT) {
+                *alg = -1 - (int64_t)argument;
+            } else {
+                return 1;
+            }
+            return 0;
+        }
+
+        /* Skip the label and the value */
+        len = cbor_item_length(protected_headers);
+        if(len == 0) {
+            return 1;
+        }
+        protected_headers = q_useful_buf_tail(protected_headers, len);
+        len = cbor_item_length(protected_headers);
+        if(len == 0) {
+            return 1;
+        }
+        protected_headers = q_useful_buf_tail(protected_headers, len);
+    }
+
+    return 1;
+}
+
+
+static const EVP_MD *alg_to_md(int64_t cose_algorithm_id)
+{
+    switch(cose_algorithm_id) {
+        case T_COSE_ALGORITHM_ES256: return EVP_sha256();
+        case T_COSE_ALGORITHM_ES384: return EVP_sha384();
+        case T_COSE_ALGORITHM_ES512: return EVP_sha512();
+        default: return NULL;
+    }
+}
+
+
+/* Starts the verification of the Sig_structure from RFC 8152 section
+ * 4.4 with the bytes up to the payload bytes, which are hashed as they
+ * arrive.
+ *
+ *   [ "Signature1", protected bstr, external_aad bstr, payload bstr ]
+ */
+static int start_hash(struct token_stream   *me,
+                      struct q_useful_buf_c  protected_headers,
+                      uint64_t               payload_len)
+{
+    static const uint8_t context[] = {
+        0x84, 0x6a, 'S', 'i', 'g', 'n', 'a', 't', 'u', 'r', 'e', '1'
+    };
+    static const uint8_t empty_aad = 0x40;
+
+    uint8_t   head[CBOR_HEAD_MAX];
+    size_t    head_len;
+    EVP_PKEY *key;
+    int       ok;
+
+    key = get_evp_pkey(me->verification_key);
+    if(key == NULL) {
+        return 1;
+    }
+
+    me->md_ctx = EVP_MD_CTX_new();
+
+    /* The context holds its own reference to key */
+    ok = me->md_ctx != NULL &&
+         EVP_DigestVerifyInit(me->md_ctx, NULL, alg_to_md(me->cose_algorithm_id), NULL, key) &&
+         EVP_DigestVerifyUpdate(me->md_ctx, context, sizeof(context));
+
+    EVP_PKEY_free(key);
+
+    head_len = cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, protected_headers.len, head);
+    ok = ok &&
+         EVP_DigestVerifyUpdate(me->md_ctx, head, head_len) &&
+         EVP_DigestVerifyUpdate(me->md_ctx, protected_headers.ptr, protected_headers.len) &&
+         EVP_DigestVerifyUpdate(me->md_ctx, &empty_aad, 1);
+
+    head_len = cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, payload_len, head);
+    ok = ok && EVP_DigestVerifyUpdate(me->md_ctx, head, head_len);
+
+    return !ok;
+}
+
+
+/* Finishes the hash and checks the signature, which is r and s
+ * concatenated as in RFC 8152 section 8.1. OpenSSL wants it DER
+ * encoded. Returns 0 if it is good. */
+static int check_signature(struct token_stream *me, struct q_useful_buf_c signature)
+{
+    EVP_PKEY      *key;
+    ECDSA_SIG     *sig;
+    BIGNUM        *r;
+    BIGNUM        *s;
+    unsigned char *der;
+    int            der_len;
+    size_t         half;
+    int            result;
+
+    key  = EVP_PKEY_CTX_get0_pkey(EVP_MD_CTX_get_pkey_ctx(me->md_ctx));
+    half = ((size_t)EVP_PKEY_get_bits(key) + 7) / 8;
+    if(signature.len != 2 * half) {
+        return 1;
+    }
+
+    sig = ECDSA_SIG_new();
+    r   = BN_bin2bn(signature.ptr, (int)half, NULL);
+    s   = BN_bin2bn((const uint8_t *)signature.ptr + half, (int)half, NULL);
+    if(sig == NULL || r == NULL || s == NULL || !ECDSA_SIG_set0(sig, r, s)) {
+        BN_free(r);
+        BN_free(s);
+        ECDSA_SIG_free(sig);
+        return 1;
+    }
+
+    der     = NULL;
+    der_len = i2d_ECDSA_SIG(sig, &der);
+    ECDSA_SIG_free(sig);
+    if(der_len <= 0) {
+        return 1;
+    }
+
+    /* The hash has been going since start_hash() so this only
+     * finishes it */
+    result = EVP_DigestVerifyFinal(me->md_ctx, der, (size_t)der_len);
+
+    OPENSSL_free(der);
+
+    return result != 1;
+}
+
+
+/* Puts entry, a label and value, in a map of one in scratch */
+static int wrap_entry(struct token_stream   *me,
+                      struct q_useful_buf_c  entry,
+                      struct q_useful_buf_c *map)
+{
+    uint8_t *new_scratch;
+
+    if(entry.len + 1 > me->scratch_size) {
+        new_scratch = realloc(me->scratch, entry.len + 1);
+        if(new_scratch == NULL) {
+            fprintf(stderr, "out of memory decoding streamed claim\n");
+            return 1;
+        }
+        me->scratch      = new_scratch;
+        me->scratch_size = entry.len + 1;
+    }
+
+    me->scratch[0] = CBOR_MAP_OF_ONE;
+    memcpy(me->scratch + 1, entry.ptr, entry.len);
+    *map = (struct q_useful_buf_c){me->scratch, entry.len + 1};
+
+    return 0;
+}
+
+
+/* Returns the next claim from the payload map if all of it has
+ * arrived. */
+static enum token_stream_status_t
+next_claim(struct token_stream *me, struct xclaim *claim)
+{
+    struct q_useful_buf_c entry;
+    struct q_useful_buf_c map;
+    struct t_cose_key     no_key;
+    size_t                label_len;
+    size_t                value_len;
+    uint8_t               major_type;
+    uint8_t               additional_info;
+    uint64_t              argument;
+
+    while(1) {
+        if(me->claims_left == 0) {
+            return TOKEN_STREAM_DONE;
+        }
+        if(me->position >= me->len) {
+            return TOKEN_STREAM_NEED_MORE;
+        }
+        if(me->claims_left == UINT64_MAX && me->buf[me->position] == 0xff) {
+            /* The break at the end of an indefinite-length map */
+            me->position++;
+            return TOKEN_STREAM_DONE;
+        }
+
+        label_len = next_item_length(me);
+        if(label_len == 0) {
+            return TOKEN_STREAM_NEED_MORE;
+        }
+        value_len = cbor_item_length(q_useful_buf_tail(unparsed(me), label_len));
+        if(value_len == 0) {
+            return TOKEN_STREAM_NEED_MORE;
+        }
+
+        entry = (struct q_useful_buf_c){me->buf + me->position, label_len + value_len};
+        if(me->is_signed && me->position + entry.len > me->payload_end) {
+            fprintf(stderr, "claims run past the end of the payload\n");
+            return TOKEN_STREAM_ERROR;
+        }
+        me->position += entry.len;
+        if(me->claims_left != UINT64_MAX) {
+            me->claims_left--;
+        }
+
+        cbor_decode_head(entry, &major_type, &additional_info, &argument);
+        if(major_type == CBOR_MAJOR_TYPE_POSITIVE_INT &&
+           argument == CTOKEN_EAT_LABEL_SUBMODS) {
+            /* Kept for token_stream_submods() */
+            me->submods_offset = me->position - entry.len;
+            me->submods_len    = entry.len;
+            continue;
+        }
+
+        if(wrap_entry(me, entry, &map)) {
+            return TOKEN_STREAM_ERROR;
+        }
+
+        no_key.crypto_lib = T_COSE_CRYPTO_LIB_OPENSSL;
+        no_key.k.key_ptr  = NULL;
+        if(xclaim_ctoken_decode_init(&me->claim_decoder, &me->claim_ctx, map, no_key)) {
+            return TOKEN_STREAM_ERROR;
+        }
+        if(me->claim_decoder.next_claim(me->claim_decoder.ctx, claim) != XCLAIM_SUCCESS) {
+            fprintf(stderr, "streamed claim is not valid\n");
+            return TOKEN_STREAM_ERROR;
+        }
+
+        return TOKEN_STREAM_CLAIM;
+    }
+}
+
+
+/*
+ * Public function. See token_stream.h
+ *
+ * Each state waits for the bytes it needs. Nothing is ever re-parsed,
+ * so the work is linear in the size of the token no matter how it is
+ * split into chunks.
+ */
+enum token_stream_status_t
+token_stream_next(struct token_stream *me, struct xclaim *claim)
+{
+    enum token_stream_status_t status;
+    struct q_useful_buf_c      item;
+    size_t                     len;
+    uint8_t                    major_type;
+    uint8_t                    additional_info;
+    uint64_t                   argument;
+
+    while(1) {
+        switch(me->state) {
+            case TOKEN_STREAM_STATE_HEAD:
+                /* Tags, then the map of a UCCS or the array of a
+                 * COSE_Sign1 */
+                len = cbor_decode_head(unparsed(me), &major_type, &additional_info, &argument);
+                if(len == 0) {
+                    if(me->len - me->position < CBOR_HEAD_MAX) {
+                        return TOKEN_STREAM_NEED_MORE;
+                    }
+                    fprintf(stderr, "streamed token is not well-formed\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                if(major_type == CBOR_MAJOR_TYPE_TAG) {
+                    me->position += len;
+                } else if(major_type == CBOR_MAJOR_TYPE_MAP) {
+                    if((me->option_flags & TOKEN_STREAM_OPT_REQUIRE_PROTECTED) ||
+                       (!(me->option_flags & TOKEN_STREAM_OPT_NO_VERIFY) &&
+                        me->verification_key.k.key_ptr != NULL)) {
+                        fprintf(stderr, "streamed token is a UCCS, but it must be signed\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    me->is_signed = false;
+                    me->state     = TOKEN_STREAM_STATE_CLAIMS_MAP;
+                } else if(major_type == CBOR_MAJOR_TYPE_ARRAY && argument == 4) {
+                    if(!(me->option_flags & TOKEN_STREAM_OPT_NO_VERIFY) &&
+                       me->verification_key.k.key_ptr == NULL) {
+                        fprintf(stderr, "no verification key for signed streamed token\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    if(checking_signature(me) && key_is_ed25519(me->verification_key)) {
+                        /* Ed25519 can't be computed incrementally */
+                        fprintf(stderr, "EdDSA is not supported for streamed tokens\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    if(checking_signature(me) && key_is_hmac(me->verification_key)) {
+                        fprintf(stderr, "COSE_Mac0 is not supported for streamed tokens\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    me->is_signed = true;
+                    me->position += len;
+                    me->state     = TOKEN_STREAM_STATE_PROTECTED;
+                } else if(major_type == CBOR_MAJOR_TYPE_ARRAY && argument == 3) {
+                    /* The GCM tag is at the end, so nothing could be
+                     * output before it arrives */
+                    fprintf(stderr, "COSE_Encrypt0 is not supported for streamed tokens\n");
+                    return TOKEN_STREAM_ERROR;
+                } else {
+                    fprintf(stderr, "streamed token is not a UCCS or COSE_Sign1\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                break;
+
+            case TOKEN_STREAM_STATE_PROTECTED:
+                len = next_item_length(me);
+                if(len == 0) {
+                    return TOKEN_STREAM_NEED_MORE;
+                }
+                item = (struct q_useful_buf_c){me->buf + me->position, len};
+                len = cbor_decode_head(item, &major_type, &additional_info, &argument);
+                if(major_type != CBOR_MAJOR_TYPE_BYTE_STRING ||
+                   additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE) {
+                    fprintf(stderr, "COSE_Sign1 protected headers are not a byte string\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                me->position += item.len;
+                if(checking_signature(me)) {
+                    item = q_useful_buf_tail(item, len);
+                    if(get_protected_alg(item, &me->cose_algorithm_id) ||
+                       alg_to_md(me->cose_algorithm_id) == NULL) {
+                        fprintf(stderr, "streamed tokens must be signed with ES256, ES384 or ES512\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    /* The protected headers are hashed once the
+                     * payload length is known */
+                    me->protected_offset = me->position - item.len;
+                    me->protected_len    = item.len;
+                }
+                me->state = TOKEN_STREAM_STATE_UNPROTECTED;
+                break;
+
+            case TOKEN_STREAM_STATE_UNPROTECTED:
+                len = next_item_length(me);
+                if(len == 0) {
+                    return TOKEN_STREAM_NEED_MORE;
+                }
+                me->position += len;
+                me->state = TOKEN_STREAM_STATE_PAYLOAD;
+                break;
+
+            case TOKEN_STREAM_STATE_PAYLOAD:
+                len = cbor_decode_head(unparsed(me), &major_type, &additional_info, &argument);
+                if(len == 0) {
+                    return TOKEN_STREAM_NEED_MORE;
+                }
+                if(major_type != CBOR_MAJOR_TYPE_BYTE_STRING ||
+                   additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE ||
+                   argument > TOKEN_STREAM_MAX_SIZE) {
+                    fprintf(stderr, "COSE_Sign1 payload is not a byte string\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                me->position   += len;
+                me->payload_end = me->position + (size_t)argument;
+                if(checking_signature(me)) {
+                    item = (struct q_useful_buf_c){me->buf + me->protected_offset, me->protected_len};
+                    if(start_hash(me, item, argument)) {
+                        fprintf(stderr, "hashing the payload failed\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    me->hashed         = me->position;
+                    if(hash_payload(me)) {
+                        return TOKEN_STREAM_ERROR;
+                    }
+                }
+                me->state = TOKEN_STREAM_STATE_CLAIMS_MAP;
+                break;
+
+            case TOKEN_STREAM_STATE_CLAIMS_MAP:
+                len = cbor_decode_head(unparsed(me), &major_type, &additional_info, &argument);
+                if(len == 0) {
+                    return TOKEN_STREAM_NEED_MORE;
+                }
+                if(major_type != CBOR_MAJOR_TYPE_MAP) {
+                    fprintf(stderr, "streamed token payload is not a map\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                me->position   += len;
+                me->claims_left = additional_info == CBOR_ADDITIONAL_INFO_INDEFINITE ?
+                                      UINT64_MAX : argument;
+                me->state = TOKEN_STREAM_STATE_CLAIMS;
+                break;
+
+            case TOKEN_STREAM_STATE_CLAIMS:
+                status = next_claim(me, claim);
+                if(status != TOKEN_STREAM_DONE) {
+                    return status;
+                }
+                if(me->is_signed) {
+                    if(me->position != me->payload_end) {
+                        fprintf(stderr, "COSE_Sign1 payload has more than the claims\n");
+                        return TOKEN_STREAM_ERROR;
+                    }
+                    me->state = TOKEN_STREAM_STATE_SIGNATURE;
+                } else {
+                    me->state = TOKEN_STREAM_STATE_DONE;
+                }
+                break;
+
+            case TOKEN_STREAM_STATE_SIGNATURE:
+                len = next_item_length(me);
+                if(len == 0) {
+                    return TOKEN_STREAM_NEED_MORE;
+                }
+                item = (struct q_useful_buf_c){me->buf + me->position, len};
+                len = cbor_decode_head(item, &major_type, &additional_info, &argument);
+                if(major_type != CBOR_MAJOR_TYPE_BYTE_STRING) {
+                    fprintf(stderr, "COSE_Sign1 signature is not a byte string\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                me->position += item.len;
+                if(checking_signature(me) &&
+                   check_signature(me, q_useful_buf_tail(item, len))) {
+                    fprintf(stderr, "streamed token signature verification failed\n");
+                    return TOKEN_STREAM_ERROR;
+                }
+                me->state = TOKEN_STREAM_STATE_DONE;
+                break;
+
+            case TOKEN_STREAM_STATE_DONE:
+                return TOKEN_STREAM_DONE;
+        }
+    }
+}
+
+
+/*
+ * Public function. See token_stream.h
+ */
+int token_stream_submods(struct token_stream      *me,
+                         xclaim_decoder           *decoder,
+                         struct ctoken_decode_ctx *ctx)
+{
+    struct q_useful_buf_c map;
+    struct t_cose_key     no_key;
+
+    if(me->state != TOKEN_STREAM_STATE_DONE || me->submods_len == 0) {
+        return 1;
+    }
+
+    if(wrap_entry(me, (struct q_useful_buf_c){me->buf + me->submods_offset, me->submods_len}, &map)) {
+        return -1;
+    }
+
+    no_key.crypto_lib = T_COSE_CRYPTO_LIB_OPENSSL;
+    no_key.k.key_ptr  = NULL;
+    if(xclaim_ctoken_decode_init(decoder, ctx, map, no_key)) {
+        return -1;
+    }
+
+    return 0;
+}
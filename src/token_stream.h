@@ -0,0 +1,170 @@
+/*
+ * token_stream.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef token_stream_h
+#define token_stream_h
+
+#include "xclaim.h"
+#include "ctoken/ctoken_decode.h"
+#include "t_cose/t_cose_common.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* This is a push decoder for a UCCS or CWT that arrives a piece at a
+ * time, for example over a pipe or socket. The bytes are given to it
+ * with token_stream_feed() as they arrive and each top-level claim is
+ * returned by token_stream_next() as soon as all its bytes are in.
+ * There's no need to wait for the whole token before starting.
+ *
+ * For a COSE_Sign1 the payload is hashed as it arrives, so when the
+ * signature arrives all that is left is the public key operation.
+ * Only ES256, ES384 and ES512 are supported here, not EdDSA.
+ *
+ * IMPORTANT: the claims are returned BEFORE the signature is checked
+ * because the signature is the last thing in the token. They must
+ * not be acted on until token_stream_next() returns
+ * TOKEN_STREAM_DONE. If the signature is not valid it returns
+ * TOKEN_STREAM_ERROR instead.
+ *
+ * The submodules section is not returned by token_stream_next(). It
+ * is kept and can be processed with token_stream_submods() once the
+ * token is done.
+ *
+ * Only definite-length arrays and strings are handled for the
+ * COSE_Sign1 layer. The payload map may be indefinite-length.
+ */
+
+
+/* The most bytes that will be buffered. A longer token is an error. */
+#define TOKEN_STREAM_MAX_SIZE (64 * 1024 * 1024)
+
+
+enum token_stream_status_t {
+    /* A claim was returned */
+    TOKEN_STREAM_CLAIM,
+
+    /* More bytes are needed before anything more can be done */
+    TOKEN_STREAM_NEED_MORE,
+
+    /* All the claims have been returned and the signature, if any, is
+     * good */
+    TOKEN_STREAM_DONE,
+
+    /* The token is not well-formed, not supported or the signature
+     * is not valid. A message has been printed. */
+    TOKEN_STREAM_ERROR
+};
+
+
+/* The state of the token_stream. Private. */
+enum token_stream_state_t {
+    TOKEN_STREAM_STATE_HEAD,
+    TOKEN_STREAM_STATE_PROTECTED,
+    TOKEN_STREAM_STATE_UNPROTECTED,
+    TOKEN_STREAM_STATE_PAYLOAD,
+    TOKEN_STREAM_STATE_CLAIMS_MAP,
+    TOKEN_STREAM_STATE_CLAIMS,
+    TOKEN_STREAM_STATE_SIGNATURE,
+    TOKEN_STREAM_STATE_DONE
+};
+
+
+struct token_stream {
+    enum token_stream_state_t state;
+    uint32_t                  option_flags;
+    struct t_cose_key         verification_key;
+
+    /* All the bytes fed so far. Positions are offsets because the
+     * buffer moves when it grows. */
+    uint8_t                  *buf;
+    size_t                    len;
+    size_t                    size;
+    size_t                    position;
+
+    /* For a COSE_Sign1 */
+    bool                      is_signed;
+    int64_t                   cose_algorithm_id;
+    size_t                    protected_offset;
+    size_t                    protected_len;
+    void                     *md_ctx;
+    size_t                    payload_end;
+    size_t                    hashed;
+
+    /* The claims left in the payload map or UINT64_MAX for an
+     * indefinite-length map */
+    uint64_t                  claims_left;
+
+    /* The submods label and value from the payload map */
+    size_t                    submods_offset;
+    size_t                    submods_len;
+
+    /* One claim at a time is wrapped in a map in scratch and decoded
+     * with ctoken so claims come out the same as they do for a whole
+     * token. */
+    uint8_t                  *scratch;
+    size_t                    scratch_size;
+    struct ctoken_decode_ctx  claim_ctx;
+    xclaim_decoder            claim_decoder;
+};
+
+
+/* Option flag for token_stream_init() to decode a COSE_Sign1 without
+ * checking the signature. The same value as
+ * COSE_ENVELOPE_OPT_NO_VERIFY. */
+#define TOKEN_STREAM_OPT_NO_VERIFY 0x01
+
+/* Option flag for token_stream_init() to reject a UCCS even with
+ * TOKEN_STREAM_OPT_NO_VERIFY. The same value as
+ * COSE_ENVELOPE_OPT_REQUIRE_PROTECTED. */
+#define TOKEN_STREAM_OPT_REQUIRE_PROTECTED 0x02
+
+
+/* Sets up to decode one token. verification_key is an OpenSSL EC key
+ * as from read_pub_ec_key_from_file(). It is not needed with
+ * TOKEN_STREAM_OPT_NO_VERIFY. With a key a UCCS is rejected as there
+ * is nothing to verify. token_stream_finish() must be called when
+ * done. */
+void token_stream_init(struct token_stream *me,
+                       uint32_t             option_flags,
+                       struct t_cose_key    verification_key);
+
+
+/* Adds bytes that have arrived. They are copied. Returns
+ * TOKEN_STREAM_NEED_MORE or TOKEN_STREAM_ERROR. */
+enum token_stream_status_t
+token_stream_feed(struct token_stream *me, struct q_useful_buf_c bytes);
+
+
+/* Returns the next claim if all of it has arrived. Strings in claim
+ * point into the token_stream and are good until the next call. When
+ * TOKEN_STREAM_NEED_MORE is returned, feed more bytes and call
+ * again. If the input ends before TOKEN_STREAM_DONE, the token is
+ * truncated. */
+enum token_stream_status_t
+token_stream_next(struct token_stream *me, struct xclaim *claim);
+
+
+/* After TOKEN_STREAM_DONE, sets up decoder over a map that has only
+ * the submods section of the token. xclaim_processor() on it outputs
+ * the submods section and nothing else. Returns 0 on success, 1 if
+ * there is no submods section and -1 on error. */
+int token_stream_submods(struct token_stream      *me,
+                         xclaim_decoder           *decoder,
+                         struct ctoken_decode_ctx *ctx);
+
+
+/* Frees everything allocated. */
+void token_stream_finish(struct token_stream *me);
+
+
+#endif /* token_stream_h */
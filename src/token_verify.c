@@ -0,0 +1,299 @@
+/*
+ * token_verify.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "token_verify.h"
+#include "cose_mac0.h"
+#include "openssl_keys.h"
+
+#include <time.h>
+
+
+/*
+ * Public function. See token_verify.h
+ */
+void token_verifier_init(struct token_verifier   *me,
+                         enum ctoken_protection_t protection,
+                         struct t_cose_key        verification_key,
+                         bool                     check_time)
+{
+    me->protection       = protection;
+    me->verification_key = verification_key;
+    me->check_time       = check_time;
+    me->now              = (int64_t)time(NULL);
+    me->cache            = NULL;
+    me->replay           = NULL;
+    me->ctoken_error     = CTOKEN_ERR_SUCCESS;
+
+    cose_eddsa_verifier_init(&(me->eddsa), verification_key);
+}
+
+
+/*
+ * Public function. See token_verify.h
+ */
+void token_verifier_free(struct token_verifier *me)
+{
+    cose_eddsa_verifier_free(&(me->eddsa));
+}
+
+
+/* Gets an optional time claim. Returns false and sets ctoken_error if
+ * it is absent or can't be decoded. */
+static bool
+get_time_claim(struct token_verifier *me,
+               void (*decode)(struct ctoken_decode_ctx *, int64_t *),
+               int64_t               *time_value)
+{
+    (*decode)(&(me->decode_ctx), time_value);
+    me->ctoken_error = ctoken_decode_get_and_reset_error(&(me->decode_ctx));
+
+    return me->ctoken_error == CTOKEN_ERR_SUCCESS;
+}
+
+
+/* Gets what is needed for a replay check from a validated token. The
+ * cti is used if present, otherwise the nonce. */
+static void
+get_replay_id(struct replay_store      *replay,
+              struct ctoken_decode_ctx *decode_ctx,
+              uint64_t                 *replay_id,
+              int64_t                  *iat)
+{
+    struct q_useful_buf_c value;
+
+    *replay_id = 0;
+
+    ctoken_decode_iat(decode_ctx, iat);
+    if(ctoken_decode_get_and_reset_error(decode_ctx) != CTOKEN_ERR_SUCCESS) {
+        *iat = INT64_MIN;
+    }
+
+    ctoken_decode_cti(decode_ctx, &value);
+    if(ctoken_decode_get_and_reset_error(decode_ctx) == CTOKEN_ERR_SUCCESS) {
+        *replay_id = replay_store_id(replay, CTOKEN_CWT_LABEL_CTI, value);
+        return;
+    }
+
+    ctoken_decode_nonce(decode_ctx, &value);
+    if(ctoken_decode_get_and_reset_error(decode_ctx) == CTOKEN_ERR_SUCCESS) {
+        *replay_id = replay_store_id(replay, CTOKEN_EAT_LABEL_NONCE, value);
+    }
+}
+
+
+/* Map the replay store check to a verify result. */
+static enum token_verify_result_t
+check_replay(struct replay_store *replay, uint64_t replay_id, int64_t iat)
+{
+    int64_t now;
+
+    if(replay_id == 0) {
+        /* Nothing to check against */
+        return TOKEN_VERIFY_OK;
+    }
+
+    if(iat == INT64_MIN) {
+        /* Taking it as now would let it be accepted again once it
+         * has aged out of the store */
+        return TOKEN_VERIFY_REPLAY_NO_IAT;
+    }
+    now = (int64_t)time(NULL);
+
+    switch(replay_store_check(replay, replay_id, iat, now)) {
+        case REPLAY_NEW:           return TOKEN_VERIFY_OK;
+        case REPLAY_DUPLICATE:     return TOKEN_VERIFY_REPLAYED;
+        case REPLAY_TOO_OLD:       return TOKEN_VERIFY_REPLAY_TOO_OLD;
+        case REPLAY_IAT_IN_FUTURE: return TOKEN_VERIFY_REPLAY_FUTURE_IAT;
+        default:                   return TOKEN_VERIFY_REPLAY_STORE_FULL;
+    }
+}
+
+
+/*
+ * Public function. See token_verify.h
+ */
+enum token_verify_result_t token_replay_check(struct replay_store      *replay,
+                                              struct ctoken_decode_ctx *decode_ctx)
+{
+    uint64_t replay_id;
+    int64_t  iat;
+
+    get_replay_id(replay, decode_ctx, &replay_id, &iat);
+
+    return check_replay(replay, replay_id, iat);
+}
+
+
+/* This is the expensive part that is cached, the signature
+ * verification with ctoken plus getting exp and nbf. */
+static void
+verify_signature(struct token_verifier      *me,
+                 struct q_useful_buf_c       token,
+                 struct verify_cache_result *result)
+{
+    int64_t                  time_value;
+    struct q_useful_buf_c    payload;
+    uint32_t                 t_cose_opt_flags;
+    enum ctoken_protection_t protection;
+    struct t_cose_key        verification_key;
+
+    result->exp       = INT64_MAX;
+    result->nbf       = INT64_MIN;
+    result->replay_id = 0;
+    result->iat       = INT64_MIN;
+
+    t_cose_opt_flags = 0;
+    protection       = me->protection;
+    verification_key = me->verification_key;
+    if(key_is_hmac(verification_key)) {
+        /* Neither ctoken nor t_cose do COSE_Mac0 so the MAC is
+         * checked here and ctoken decodes the payload as a UCCS. */
+        if(cose_mac0_verify(token, verification_key, &payload)) {
+            me->ctoken_error = CTOKEN_ERR_COSE_SIGN1_VALIDATION;
+            result->verdict  = TOKEN_VERIFY_INVALID;
+            goto Done;
+        }
+        token                      = payload;
+        protection                 = CTOKEN_PROTECTION_NONE;
+        verification_key.k.key_ptr = NULL;
+
+    } else if(key_is_ed25519(verification_key)) {
+        /* t_cose doesn't do EdDSA so the signature is checked here and
+         * ctoken only decodes. The key may have been changed since
+         * the last token, as it is for -in_verify_cert. */
+        me->eddsa.key = verification_key;
+        if(cose_eddsa_verify(&(me->eddsa), token, &payload)) {
+            me->ctoken_error = CTOKEN_ERR_COSE_SIGN1_VALIDATION;
+            result->verdict  = TOKEN_VERIFY_INVALID;
+            goto Done;
+        }
+        t_cose_opt_flags = T_COSE_OPT_DECODE_ONLY;
+    }
+
+    ctoken_decode_init(&(me->decode_ctx), t_cose_opt_flags, 0, protection);
+
+    if(verification_key.k.key_ptr != NULL && t_cose_opt_flags == 0) {
+        ctoken_decode_set_verification_key(&(me->decode_ctx), verification_key);
+    }
+
+    ctoken_decode_validate_token(&(me->decode_ctx), token);
+    me->ctoken_error = ctoken_decode_get_and_reset_error(&(me->decode_ctx));
+    if(me->ctoken_error != CTOKEN_ERR_SUCCESS) {
+        result->verdict = TOKEN_VERIFY_INVALID;
+        goto Done;
+    }
+
+    result->verdict = TOKEN_VERIFY_OK;
+
+    if(me->replay != NULL) {
+        get_replay_id(me->replay, &(me->decode_ctx), &(result->replay_id), &(result->iat));
+    }
+
+    if(!me->check_time) {
+        goto Done;
+    }
+
+    if(get_time_claim(me, ctoken_decode_expiration, &time_value)) {
+        result->exp = time_value;
+    } else if(me->ctoken_error != CTOKEN_ERR_CLAIM_NOT_PRESENT) {
+        result->verdict = TOKEN_VERIFY_BAD_TIME_CLAIM;
+        goto Done;
+    }
+
+    if(get_time_claim(me, ctoken_decode_not_before, &time_value)) {
+        result->nbf = time_value;
+    } else if(me->ctoken_error != CTOKEN_ERR_CLAIM_NOT_PRESENT) {
+        result->verdict = TOKEN_VERIFY_BAD_TIME_CLAIM;
+        goto Done;
+    }
+
+    me->ctoken_error = CTOKEN_ERR_SUCCESS;
+
+Done:
+    result->ctoken_error = me->ctoken_error;
+}
+
+
+/*
+ * Public function. See token_verify.h
+ */
+enum token_verify_result_t token_verify(struct token_verifier *me,
+                                        struct q_useful_buf_c  token)
+{
+    struct verify_cache_result result;
+    uint8_t                    digest[VERIFY_CACHE_DIGEST_LEN];
+    bool                       have_digest;
+
+    have_digest = false;
+
+    if(me->cache != NULL) {
+        have_digest = verify_cache_digest(me->cache, token, digest) == 0;
+        if(have_digest && verify_cache_lookup(me->cache, digest, &result)) {
+            goto CheckTime;
+        }
+    }
+
+    verify_signature(me, token, &result);
+
+    if(have_digest) {
+        verify_cache_insert(me->cache, digest, &result);
+    }
+
+CheckTime:
+    me->ctoken_error = (enum ctoken_err_t)result.ctoken_error;
+
+    if(result.verdict != TOKEN_VERIFY_OK) {
+        return (enum token_verify_result_t)result.verdict;
+    }
+
+    if(me->check_time) {
+        /* Done for every token, even cache hits, so something cached
+         * is never valid past its exp. */
+        me->now = (int64_t)time(NULL);
+        if(result.exp <= me->now) {
+            return TOKEN_VERIFY_EXPIRED;
+        }
+        if(result.nbf > me->now) {
+            return TOKEN_VERIFY_NOT_YET_VALID;
+        }
+    }
+
+    /* Last so only tokens that are otherwise valid are remembered */
+    if(me->replay != NULL) {
+        return check_replay(me->replay, result.replay_id, result.iat);
+    }
+
+    return TOKEN_VERIFY_OK;
+}
+
+
+/*
+ * Public function. See token_verify.h
+ */
+const char *token_verify_result_string(enum token_verify_result_t result)
+{
+    switch(result) {
+        case TOKEN_VERIFY_OK:                return "valid";
+        case TOKEN_VERIFY_INVALID:           return "invalid signature or format";
+        case TOKEN_VERIFY_EXPIRED:           return "expired";
+        case TOKEN_VERIFY_NOT_YET_VALID:     return "not yet valid";
+        case TOKEN_VERIFY_BAD_TIME_CLAIM:    return "bad exp or nbf claim";
+        case TOKEN_VERIFY_REPLAYED:          return "replayed";
+        case TOKEN_VERIFY_REPLAY_TOO_OLD:    return "iat older than replay window";
+        case TOKEN_VERIFY_REPLAY_FUTURE_IAT: return "iat in the future";
+        case TOKEN_VERIFY_REPLAY_NO_IAT:     return "no iat for replay check";
+        case TOKEN_VERIFY_REPLAY_STORE_FULL: return "replay store full";
+        case TOKEN_VERIFY_UNTRUSTED_CERT:    return "signer cert not trusted";
+        case TOKEN_VERIFY_NOT_DECRYPTED:     return "not decrypted";
+        default:                             return "unknown";
+    }
+}
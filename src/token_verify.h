@@ -0,0 +1,167 @@
+/*
+ * token_verify.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef token_verify_h
+#define token_verify_h
+
+#include "ctoken/ctoken_decode.h"
+#include "t_cose/t_cose_common.h"
+#include "cose_eddsa.h"
+#include "verify_cache.h"
+#include "replay_store.h"
+#include <stdbool.h>
+
+
+/* This is for checking a token is valid and nothing more. The
+ * signature is checked and optionally the exp and nbf claims. None of
+ * the other claims are decoded and no output is set up, so the cost
+ * is just that of the signature verification. It is what -verify_only
+ * uses.
+ */
+
+
+enum token_verify_result_t {
+    TOKEN_VERIFY_OK = 0,
+
+    /* ctoken_decode_validate_token() failed. The signature is bad,
+     * the key is wrong, the token is not well-formed or such. The
+     * ctoken error is in ctoken_error. */
+    TOKEN_VERIFY_INVALID,
+
+    /* The exp claim is in the past */
+    TOKEN_VERIFY_EXPIRED,
+
+    /* The nbf claim is in the future */
+    TOKEN_VERIFY_NOT_YET_VALID,
+
+    /* The exp or nbf claim is present, but not an integer */
+    TOKEN_VERIFY_BAD_TIME_CLAIM,
+
+    /* The cti or nonce has been seen before within the replay
+     * window */
+    TOKEN_VERIFY_REPLAYED,
+
+    /* The iat is older than the replay window so it can't be checked
+     * for replay */
+    TOKEN_VERIFY_REPLAY_TOO_OLD,
+
+    /* The iat is in the future so the token would outlive the replay
+     * window */
+    TOKEN_VERIFY_REPLAY_FUTURE_IAT,
+
+    /* There is a cti or nonce but no iat, so it isn't known how long
+     * the ID must be remembered */
+    TOKEN_VERIFY_REPLAY_NO_IAT,
+
+    /* Too many tokens in the replay window for the replay store */
+    TOKEN_VERIFY_REPLAY_STORE_FULL,
+
+    /* With -in_verify_cert, the x5chain or x5t is missing or doesn't
+     * chain to a trusted cert. This is set by the caller, not by
+     * token_verify(). */
+    TOKEN_VERIFY_UNTRUSTED_CERT,
+
+    /* The token is a COSE_Encrypt0 that can't be decrypted or it
+     * isn't one and -in_prot says it should be. This is set by the
+     * caller, not by token_verify(). */
+    TOKEN_VERIFY_NOT_DECRYPTED,
+};
+
+
+struct token_verifier {
+    /* Configuration */
+    enum ctoken_protection_t protection;
+    struct t_cose_key        verification_key;
+    bool                     check_time;
+    int64_t                  now;
+
+    /* Optional. NULL if there is no cache */
+    struct verify_cache     *cache;
+
+    /* Optional. NULL if there is no replay checking */
+    struct replay_store     *replay;
+
+    /* The error from the last call to token_verify() if it returned
+     * TOKEN_VERIFY_INVALID or TOKEN_VERIFY_BAD_TIME_CLAIM. */
+    enum ctoken_err_t        ctoken_error;
+
+    struct ctoken_decode_ctx decode_ctx;
+
+    /* For an Ed25519 verification_key. Kept from one token to the
+     * next. */
+    struct cose_eddsa_verifier eddsa;
+};
+
+
+/* Set up to verify tokens. protection is the type of token expected,
+ * usually CTOKEN_PROTECTION_COSE_SIGN1. If check_time is true, exp
+ * and nbf are checked against the current time. The same verifier can
+ * be used for any number of tokens.
+ */
+void token_verifier_init(struct token_verifier   *me,
+                         enum ctoken_protection_t protection,
+                         struct t_cose_key        verification_key,
+                         bool                     check_time);
+
+
+/* Free what was allocated for verification. */
+void token_verifier_free(struct token_verifier *me);
+
+
+/* Use a cache of verification results. Worthwhile when the same
+ * token may be seen more than once. The cache must have been set up
+ * for the same verification key. */
+static void token_verifier_set_cache(struct token_verifier *me,
+                                     struct verify_cache   *cache);
+
+
+/* Check tokens for replay. Valid tokens with a cti or nonce are
+ * checked against and added to the store. */
+static void token_verifier_set_replay_store(struct token_verifier *me,
+                                            struct replay_store   *replay);
+
+
+/* Verify one token. */
+enum token_verify_result_t token_verify(struct token_verifier *me,
+                                        struct q_useful_buf_c  token);
+
+
+/* Check a token that has already been validated by a ctoken decoder
+ * for replay. This is for when a token is decoded and converted
+ * rather than just verified. Returns TOKEN_VERIFY_OK or one of the
+ * replay results. */
+enum token_verify_result_t token_replay_check(struct replay_store      *replay,
+                                              struct ctoken_decode_ctx *decode_ctx);
+
+
+/* A short text description of a result suitable for printing. */
+const char *token_verify_result_string(enum token_verify_result_t result);
+
+
+
+/* ===========================================================================
+   BEGINNING OF PRIVATE INLINE IMPLEMENTATION
+   ========================================================================== */
+
+static inline void token_verifier_set_cache(struct token_verifier *me,
+                                            struct verify_cache   *cache)
+{
+    me->cache = cache;
+}
+
+static inline void token_verifier_set_replay_store(struct token_verifier *me,
+                                                   struct replay_store   *replay)
+{
+    me->replay = replay;
+}
+
+#endif /* token_verify_h */
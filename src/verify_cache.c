@@ -0,0 +1,218 @@
+/*
+ * verify_cache.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "verify_cache.h"
+
+#include <openssl/evp.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Marks the end of a hash chain */
+#define NO_ENTRY UINT32_MAX
+
+
+static inline uint32_t bucket_of(const struct verify_cache *me, const uint8_t *digest)
+{
+    uint32_t h;
+
+    /* The digest is already uniformly distributed so any part of it
+     * works as a hash. */
+    memcpy(&h, digest, sizeof(h));
+
+    return h & me->bucket_mask;
+}
+
+
+/*
+ * Public function. See verify_cache.h
+ */
+int verify_cache_init(struct verify_cache *me,
+                      uint32_t             capacity,
+                      const uint8_t        key_id[VERIFY_CACHE_DIGEST_LEN])
+{
+    uint32_t bucket_count;
+    uint32_t i;
+
+    memset(me, 0, sizeof(*me));
+
+    if(capacity == 0 || capacity >= NO_ENTRY / 2) {
+        return 1;
+    }
+
+    /* About two buckets per entry keeps chains short */
+    for(bucket_count = 1; bucket_count < capacity * 2; bucket_count <<= 1);
+
+    me->entries = calloc(capacity, sizeof(struct verify_cache_entry));
+    me->buckets = malloc(bucket_count * sizeof(uint32_t));
+    if(me->entries == NULL || me->buckets == NULL) {
+        free(me->entries);
+        free(me->buckets);
+        me->entries = NULL;
+        me->buckets = NULL;
+        return 1;
+    }
+
+    for(i = 0; i < bucket_count; i++) {
+        me->buckets[i] = NO_ENTRY;
+    }
+
+    me->capacity    = capacity;
+    me->bucket_mask = bucket_count - 1;
+    memcpy(me->key_id, key_id, VERIFY_CACHE_DIGEST_LEN);
+    pthread_mutex_init(&(me->lock), NULL);
+
+    return 0;
+}
+
+
+/*
+ * Public function. See verify_cache.h
+ */
+int verify_cache_digest(const struct verify_cache *me,
+                        struct q_useful_buf_c      token,
+                        uint8_t                    digest[VERIFY_CACHE_DIGEST_LEN])
+{
+    EVP_MD_CTX *md_ctx;
+    int         ok;
+
+    md_ctx = EVP_MD_CTX_new();
+    if(md_ctx == NULL) {
+        return 1;
+    }
+
+    ok = EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) &&
+         EVP_DigestUpdate(md_ctx, me->key_id, VERIFY_CACHE_DIGEST_LEN) &&
+         EVP_DigestUpdate(md_ctx, token.ptr, token.len) &&
+         EVP_DigestFinal_ex(md_ctx, digest, NULL);
+
+    EVP_MD_CTX_free(md_ctx);
+
+    return ok ? 0 : 1;
+}
+
+
+/*
+ * Public function. See verify_cache.h
+ */
+bool verify_cache_lookup(struct verify_cache        *me,
+                         const uint8_t               digest[VERIFY_CACHE_DIGEST_LEN],
+                         struct verify_cache_result *result)
+{
+    uint32_t                   i;
+    struct verify_cache_entry *entry;
+    bool                       found;
+
+    found = false;
+
+    pthread_mutex_lock(&(me->lock));
+
+    me->lookups++;
+
+    for(i = me->buckets[bucket_of(me, digest)]; i != NO_ENTRY; i = entry->next) {
+        entry = &(me->entries[i]);
+        if(!memcmp(entry->digest, digest, VERIFY_CACHE_DIGEST_LEN)) {
+            entry->referenced = 1;
+            *result = entry->result;
+            me->hits++;
+            found = true;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&(me->lock));
+
+    return found;
+}
+
+
+/* Take an entry out of its hash chain so it can be reused. */
+static void unlink_entry(struct verify_cache *me, uint32_t index)
+{
+    uint32_t *link;
+
+    link = &(me->buckets[bucket_of(me, me->entries[index].digest)]);
+    while(*link != index) {
+        link = &(me->entries[*link].next);
+    }
+    *link = me->entries[index].next;
+}
+
+
+/*
+ * Public function. See verify_cache.h
+ */
+void verify_cache_insert(struct verify_cache              *me,
+                         const uint8_t                     digest[VERIFY_CACHE_DIGEST_LEN],
+                         const struct verify_cache_result *result)
+{
+    struct verify_cache_entry *entry;
+    uint32_t                   victim;
+    uint32_t                   bucket;
+    uint32_t                   i;
+
+    pthread_mutex_lock(&(me->lock));
+
+    /* Another thread may have verified the same token at the same
+     * time and got it in first */
+    bucket = bucket_of(me, digest);
+    for(i = me->buckets[bucket]; i != NO_ENTRY; i = me->entries[i].next) {
+        if(!memcmp(me->entries[i].digest, digest, VERIFY_CACHE_DIGEST_LEN)) {
+            me->entries[i].result = *result;
+            goto Done;
+        }
+    }
+
+    /* The CLOCK sweep. Referenced entries get a second chance. This
+     * always ends within two trips around. */
+    while(1) {
+        victim = me->clock_hand;
+        me->clock_hand = (me->clock_hand + 1) % me->capacity;
+
+        entry = &(me->entries[victim]);
+        if(!entry->in_use) {
+            break;
+        }
+        if(!entry->referenced) {
+            unlink_entry(me, victim);
+            break;
+        }
+        entry->referenced = 0;
+    }
+
+    memcpy(entry->digest, digest, VERIFY_CACHE_DIGEST_LEN);
+    entry->result     = *result;
+    entry->in_use     = 1;
+    entry->referenced = 0;
+
+    entry->next = me->buckets[bucket];
+    me->buckets[bucket] = victim;
+
+Done:
+    pthread_mutex_unlock(&(me->lock));
+}
+
+
+/*
+ * Public function. See verify_cache.h
+ */
+void verify_cache_free(struct verify_cache *me)
+{
+    if(me->entries != NULL) {
+        pthread_mutex_destroy(&(me->lock));
+    }
+    free(me->entries);
+    free(me->buckets);
+    me->entries  = NULL;
+    me->buckets  = NULL;
+    me->capacity = 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * verify_cache.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef verify_cache_h
+#define verify_cache_h
+
+#include "t_cose/q_useful_buf.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+
+/* This is a bounded in-memory cache of token verification results so
+ * a token that is seen again, a retry, a duplicate in a stream, ...,
+ * costs a SHA-256 of the token rather than a full signature
+ * verification.
+ *
+ * Entries are keyed by the SHA-256 of the verification key identity
+ * and the token bytes. Replacement is by the CLOCK algorithm which is
+ * close to LRU, but needs only a bit per entry and no list updates on
+ * a hit.
+ *
+ * The cache stores the result of the signature check and the exp and
+ * nbf values so the time checks are redone on every hit. A cached
+ * token that has since expired is never reported as valid.
+ *
+ * verify_cache_lookup() and verify_cache_insert() are thread safe so
+ * one cache can be shared by the -in_dir, -in_shm and -in_archive
+ * workers.
+ */
+
+
+#define VERIFY_CACHE_DIGEST_LEN 32
+
+
+/* The cached part of a verification. Time checks are not cached. */
+struct verify_cache_result {
+    /* An enum token_verify_result_t, but only OK, INVALID and
+     * BAD_TIME_CLAIM. */
+    int     verdict;
+    int     ctoken_error;
+    int64_t exp; /* INT64_MAX if there's no exp claim */
+    int64_t nbf; /* INT64_MIN if there's no nbf claim */
+
+    /* For replay checking. replay_id is 0 if there's no replay store
+     * or the token has neither a cti nor a nonce. */
+    uint64_t replay_id;
+    int64_t  iat; /* INT64_MIN if there's no iat claim */
+};
+
+
+struct verify_cache_entry {
+    uint8_t                    digest[VERIFY_CACHE_DIGEST_LEN];
+    struct verify_cache_result result;
+    uint32_t                   next;   /* Next in hash chain */
+    uint8_t                    in_use;
+    uint8_t                    referenced;
+};
+
+
+struct verify_cache {
+    struct verify_cache_entry *entries;
+    uint32_t                  *buckets;
+    uint32_t                   capacity;
+    uint32_t                   bucket_mask;
+    uint32_t                   clock_hand;
+    pthread_mutex_t            lock;
+
+    uint8_t                    key_id[VERIFY_CACHE_DIGEST_LEN];
+
+    /* Statistics for -stats */
+    uint64_t                   lookups;
+    uint64_t                   hits;
+};
+
+
+/* Allocate a cache with room for capacity results. key_id identifies
+ * the verification key, see get_key_fingerprint(), so results for
+ * different keys never collide.
+ *
+ * Returns 0 on success and 1 if memory can't be allocated.
+ */
+int verify_cache_init(struct verify_cache *me,
+                      uint32_t             capacity,
+                      const uint8_t        key_id[VERIFY_CACHE_DIGEST_LEN]);
+
+
+/* Compute the digest used as the cache key for a token. */
+int verify_cache_digest(const struct verify_cache *me,
+                        struct q_useful_buf_c      token,
+                        uint8_t                    digest[VERIFY_CACHE_DIGEST_LEN]);
+
+
+/* Look up a result by digest. Returns true and fills in result on a
+ * hit. */
+bool verify_cache_lookup(struct verify_cache        *me,
+                         const uint8_t               digest[VERIFY_CACHE_DIGEST_LEN],
+                         struct verify_cache_result *result);
+
+
+/* Add a result, evicting an old one if the cache is full. */
+void verify_cache_insert(struct verify_cache              *me,
+                         const uint8_t                     digest[VERIFY_CACHE_DIGEST_LEN],
+                         const struct verify_cache_result *result);
+
+
+void verify_cache_free(struct verify_cache *me);
+
+
+#endif /* verify_cache_h */
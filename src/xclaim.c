@@ -12,69 +12,280 @@
 
 #include "xclaim.h"
 
+#include <stdio.h>
 
-enum xclaim_error_t xclaim_processor(xclaim_decoder *decoder, xclaim_encoder *encoder)
+
+/* The state for one level of submodule nesting */
+struct submod_frame {
+    struct xclaim_submod_cursor cursor;
+
+    /* Only for decoders without a cursor */
+    uint32_t                    index;
+
+    /* If start_submods_section has been output for this level */
+    bool                        section_started;
+};
+
+
+/* Running totals for checking the limits */
+struct totals {
+    uint32_t claims;
+    uint32_t submods;
+    size_t   nested_bytes;
+};
+
+
+/* These two hide the difference between decoders with a cursor and
+ * ones with only the index-based methods. The index-based ones get
+ * the same behavior from enter_submod, get_nested and exit_submod. */
+static enum xclaim_error_t
+get_submod(xclaim_decoder *decoder, struct submod_frame *frame)
 {
-    struct q_useful_buf_c submod_name;
-    struct q_useful_buf_c token;
-    enum ctoken_type_t    type;
-    enum xclaim_error_t   xclaim_error;
-    struct                xclaim claim;
-    uint32_t              submod_index;
+    enum xclaim_error_t xclaim_error;
 
-    /* rewind the decoder to start from the beginning. */
-    (decoder->rewind)(decoder->ctx);
+    xclaim_error = (decoder->enter_submod)(decoder->ctx, frame->index, &(frame->cursor.name));
+    if(xclaim_error == XCLAIM_SUCCESS) {
+        frame->cursor.entered = true;
+    } else if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        xclaim_error = (decoder->get_nested)(decoder->ctx,
+                                             frame->index,
+                                             &(frame->cursor.nested_type),
+                                             &(frame->cursor.name),
+                                             &(frame->cursor.nested_token));
+        if(xclaim_error == XCLAIM_SUCCESS) {
+            xclaim_error = XCLAIM_SUBMOD_IS_TOKEN;
+        }
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t
+first_submod(xclaim_decoder *decoder, struct submod_frame *frame)
+{
+    frame->section_started = false;
+    frame->cursor.entered  = false;
+
+    if(decoder->first_submod != NULL) {
+        return (decoder->first_submod)(decoder->ctx, &(frame->cursor));
+    }
+
+    frame->index = 0;
+    return get_submod(decoder, frame);
+}
+
+
+static enum xclaim_error_t
+next_submod(xclaim_decoder *decoder, struct submod_frame *frame)
+{
+    enum xclaim_error_t xclaim_error;
+
+    if(decoder->next_submod != NULL) {
+        return (decoder->next_submod)(decoder->ctx, &(frame->cursor));
+    }
+
+    if(frame->cursor.entered) {
+        frame->cursor.entered = false;
+        xclaim_error = (decoder->exit_submod)(decoder->ctx);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+    }
+
+    frame->index++;
+    return get_submod(decoder, frame);
+}
+
+
+/* Outputs the regular claims at the current level */
+static enum xclaim_error_t
+process_claims(xclaim_decoder             *decoder,
+               xclaim_encoder             *encoder,
+               const struct xclaim_limits *limits,
+               struct totals              *totals)
+{
+    enum xclaim_error_t xclaim_error;
+    struct xclaim       claim;
 
-    /* First output the regular claims */
     while(1) {
         xclaim_error = (decoder->next_claim)(decoder->ctx, &claim);
         if(xclaim_error != XCLAIM_SUCCESS) {
             break;
         }
-        (encoder->output_claim)(encoder->ctx, &claim);
+        if(++totals->claims > limits->max_claims) {
+            return XCLAIM_ERR_TOO_MANY_CLAIMS;
+        }
+        xclaim_error = (encoder->output_claim)(encoder->ctx, &claim);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
     }
-    if(xclaim_error != XCLAIM_NO_MORE) {
-        /* Error out */
+
+    return xclaim_error == XCLAIM_NO_MORE ? XCLAIM_SUCCESS : xclaim_error;
+}
+
+
+/*
+ * Public function. See xclaim.h
+ */
+void xclaim_limits_default(struct xclaim_limits *limits)
+{
+    limits->max_depth        = XCLAIM_MAX_NESTING;
+    limits->max_claims       = 100000;
+    limits->max_submods      = 10000;
+    limits->max_nested_bytes = 16 * 1024 * 1024;
+}
+
+
+/*
+ * Public function. See xclaim.h
+ */
+enum xclaim_error_t
+xclaim_processor_with_limits(xclaim_decoder             *decoder,
+                             xclaim_encoder             *encoder,
+                             const struct xclaim_limits *limits)
+{
+    struct submod_frame  stack[XCLAIM_MAX_NESTING + 1];
+    struct submod_frame *frame;
+    struct totals        totals;
+    uint32_t             max_depth;
+    uint32_t             depth;
+    enum xclaim_error_t  xclaim_error;
+    enum xclaim_error_t  encoder_error;
+
+    max_depth = limits->max_depth;
+    if(max_depth > XCLAIM_MAX_NESTING) {
+        max_depth = XCLAIM_MAX_NESTING;
+    }
+
+    totals.claims       = 0;
+    totals.submods      = 0;
+    totals.nested_bytes = 0;
+
+    /* rewind the decoder to start from the beginning. */
+    (decoder->rewind)(decoder->ctx);
+
+    /* First output the regular claims */
+    xclaim_error = process_claims(decoder, encoder, limits, &totals);
+    if(xclaim_error != XCLAIM_SUCCESS) {
         return xclaim_error;
     }
 
-    submod_index = 0;
-    xclaim_error = (decoder->enter_submod(decoder->ctx, submod_index, &submod_name));
-    if(xclaim_error == XCLAIM_SUCCESS || xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
-        /* There are submods */
-        (encoder->start_submods_section)(encoder->ctx);
-        do {
-            if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
-                /* It is a nested token. This can be processed as an opaque blob
-                 * or there can be recursion, but it recursion must be at a
-                 * larger level because it key material and such need to be
-                 * supplied. */
-                (decoder->get_nested)(decoder->ctx, submod_index, &type,  &submod_name, &token);
-                (encoder->output_nested)(encoder->ctx, submod_name, token);
-            } else {
-                /* It is a submodule with claims and maybe further
-                 * submodules that are processed by recursion. */
-                (encoder->open_submod)(encoder->ctx, submod_name); // TODO: fix this
-                xclaim_error = xclaim_processor(decoder, encoder);
+    /* Then the submodules. stack[depth] is the submodules section
+     * being worked through at each level. Entering a submodule pushes
+     * and getting to the end of a section pops. */
+    depth = 0;
+    xclaim_error = first_submod(decoder, &stack[0]);
+
+    while(1) {
+        frame = &stack[depth];
+
+        if(xclaim_error == XCLAIM_NO_MORE) {
+            /* End of the submods section at this level */
+            if(frame->section_started) {
+                xclaim_error = (encoder->end_submods_section)(encoder->ctx);
                 if(xclaim_error != XCLAIM_SUCCESS) {
-                    break;
+                    return xclaim_error;
                 }
-                (encoder->close_submod)(encoder->ctx);
-                (decoder->exit_submod)(decoder->ctx);
+            }
+            if(depth == 0) {
+                return XCLAIM_SUCCESS;
             }
 
-            submod_index++;
-            xclaim_error = (decoder->enter_submod(decoder->ctx, submod_index, &submod_name));
-        } while (xclaim_error == XCLAIM_SUCCESS || xclaim_error == XCLAIM_SUBMOD_IS_TOKEN);
-        (encoder->end_submods_section)(encoder->ctx);
-        if(xclaim_error == XCLAIM_NO_MORE) {
-            xclaim_error = XCLAIM_SUCCESS;
+            /* Pop back to the submodule this section was in */
+            depth--;
+            xclaim_error = (encoder->close_submod)(encoder->ctx);
+            if(xclaim_error != XCLAIM_SUCCESS) {
+                return xclaim_error;
+            }
+            xclaim_error = next_submod(decoder, &stack[depth]);
+            continue;
+        }
+
+        if(xclaim_error != XCLAIM_SUCCESS && xclaim_error != XCLAIM_SUBMOD_IS_TOKEN) {
+            return xclaim_error;
+        }
+
+        if(++totals.submods > limits->max_submods) {
+            return XCLAIM_ERR_TOO_MANY_SUBMODS;
+        }
+
+        if(!frame->section_started) {
+            frame->section_started = true;
+            encoder_error = (encoder->start_submods_section)(encoder->ctx);
+            if(encoder_error != XCLAIM_SUCCESS) {
+                return encoder_error;
+            }
+        }
+
+        if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+            /* It is a nested token. This can be processed as an opaque blob
+             * or there can be recursion, but it recursion must be at a
+             * larger level because it key material and such need to be
+             * supplied. */
+            totals.nested_bytes += frame->cursor.nested_token.len;
+            if(totals.nested_bytes > limits->max_nested_bytes) {
+                return XCLAIM_ERR_NESTED_TOO_BIG;
+            }
+            xclaim_error = (encoder->output_nested)(encoder->ctx,
+                                                    frame->cursor.name,
+                                                    frame->cursor.nested_token);
+            if(xclaim_error != XCLAIM_SUCCESS) {
+                return xclaim_error;
+            }
+            xclaim_error = next_submod(decoder, frame);
+            continue;
+        }
+
+        /* It is a submodule with claims and maybe further submodules.
+         * Its claims are output and then its submods section is
+         * pushed. */
+        if(depth + 1 > max_depth) {
+            return XCLAIM_ERR_NESTING_TOO_DEEP;
+        }
+        xclaim_error = (encoder->open_submod)(encoder->ctx, frame->cursor.name);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
         }
-        
-    } else if(xclaim_error == XCLAIM_NO_MORE) {
-        xclaim_error = XCLAIM_SUCCESS;
+        xclaim_error = process_claims(decoder, encoder, limits, &totals);
+        if(xclaim_error != XCLAIM_SUCCESS) {
+            return xclaim_error;
+        }
+
+        depth++;
+        xclaim_error = first_submod(decoder, &stack[depth]);
     }
+}
 
-    return xclaim_error;
+
+/*
+ * Public function. See xclaim.h
+ */
+enum xclaim_error_t xclaim_processor(xclaim_decoder *decoder, xclaim_encoder *encoder)
+{
+    struct xclaim_limits limits;
+
+    xclaim_limits_default(&limits);
+
+    return xclaim_processor_with_limits(decoder, encoder, &limits);
 }
 
+
+/*
+ * Public function. See xclaim.h
+ */
+const char *xclaim_error_string(enum xclaim_error_t error)
+{
+    switch(error) {
+        case XCLAIM_SUCCESS:              return "success";
+        case XCLAIM_ERR_NESTING_TOO_DEEP: return "submodules nested too deep";
+        case XCLAIM_ERR_TOO_MANY_CLAIMS:  return "too many claims";
+        case XCLAIM_ERR_TOO_MANY_SUBMODS: return "too many submodules";
+        case XCLAIM_ERR_NESTED_TOO_BIG:   return "nested tokens too big";
+        case XCLAIM_ERR_FILTER:           return "claim filter failed";
+        case XCLAIM_ERR_PROFILE:          return "token doesn't meet the profile";
+        case XCLAIM_ERR_CLAIM_TYPE:       return "claim type can't be encoded";
+        default:                          return "error decoding or encoding claims";
+    }
+}
@@ -59,6 +59,23 @@ enum xclaim_error_t {
 
     XLCAIM_GENERAL_ERROR_BASE = 100,
 
+    /* These are for when a limit in struct xclaim_limits is hit. The
+     * token is abandoned at that point. */
+    XCLAIM_ERR_NESTING_TOO_DEEP = 101,
+    XCLAIM_ERR_TOO_MANY_CLAIMS = 102,
+    XCLAIM_ERR_TOO_MANY_SUBMODS = 103,
+    XCLAIM_ERR_NESTED_TOO_BIG = 104,
+
+    /* A claim filter stage failed, for example hashing a claim. */
+    XCLAIM_ERR_FILTER = 105,
+
+    /* The token doesn't meet the EAT profile. See eat_profile.h */
+    XCLAIM_ERR_PROFILE = 106,
+
+    /* A claim's data type is one the encoder can't output, for
+     * example an array. */
+    XCLAIM_ERR_CLAIM_TYPE = 107,
+
     XCLAIM_CTOKEN_ERROR_BASE = 200,
 
     XCLAIM_JTOKEN_ERROR_BASE = 300,
@@ -67,6 +84,24 @@ enum xclaim_error_t {
 };
 
 
+/* This is the state for iterating over the submodules at one level
+ * with first_submod and next_submod. It is owned by the caller, one
+ * per level of nesting, so decoders don't have to keep a stack.
+ */
+struct xclaim_submod_cursor {
+    /* The name of the current submodule */
+    struct q_useful_buf_c name;
+
+    /* When XCLAIM_SUBMOD_IS_TOKEN is returned this is the nested
+     * token. It is not entered. */
+    enum ctoken_type_t    nested_type;
+    struct q_useful_buf_c nested_token;
+
+    /* Private to the decoder */
+    bool                  entered;
+};
+
+
 /* This is an abstract base class for decoding a token. */
 typedef struct {
     /* vtable */
@@ -102,6 +137,29 @@ typedef struct {
                                       struct q_useful_buf_c *name,
                                       struct q_useful_buf_c *token);
 
+    /* Cursor-style iteration over the submodules. Each call moves
+     * forward from where the last one left off so all the submodules
+     * are visited in one linear pass. enter_submod and get_nested
+     * start from the beginning each time so visiting n submodules
+     * with them can cost O(n^2).
+     *
+     * first_submod goes to the first submodule and next_submod to the
+     * one after. The return values are as for enter_submod. On
+     * XCLAIM_SUCCESS the submodule has been entered. Its claims and
+     * submodules can be iterated over. It is exited by the next call
+     * to next_submod, not by exit_submod. On XCLAIM_SUBMOD_IS_TOKEN
+     * the nested token is in the cursor. On XCLAIM_NO_MORE the
+     * submodules section has been left.
+     *
+     * These are optional. If they are NULL, xclaim_processor() uses
+     * enter_submod and get_nested.
+     */
+    enum xclaim_error_t (*first_submod)(void                        *ctx,
+                                        struct xclaim_submod_cursor *cursor);
+
+    enum xclaim_error_t (*next_submod)(void                        *ctx,
+                                       struct xclaim_submod_cursor *cursor);
+
     /* Some decoders will iterate over the whole token twice. The
      * first time is to calculate the size of the output. This is
      * called after the first pass. All decoders must support
@@ -157,15 +215,60 @@ typedef struct  {
 
 
 
+/* The most submodule nesting xclaim_processor() can handle. Its
+ * stack is an array of this size, so it uses a fixed amount of
+ * memory however deep the token is. QCBOR's own nesting limit is
+ * lower than this in practice. */
+#define XCLAIM_MAX_NESTING 16
+
+
+/* Limits on the work done for one token so the cost of a hostile
+ * token is bounded. Processing stops with one of the XCLAIM_ERR_
+ * errors when one is exceeded. */
+struct xclaim_limits {
+    /* Levels of submodule nesting. No more than XCLAIM_MAX_NESTING. */
+    uint32_t max_depth;
+
+    /* Claims at all levels added together */
+    uint32_t max_claims;
+
+    /* Submodules and nested tokens at all levels added together */
+    uint32_t max_submods;
+
+    /* Bytes of nested tokens added together */
+    size_t   max_nested_bytes;
+};
+
+
+/* Fills in the limits used by xclaim_processor(). They are generous
+ * enough for any reasonable token. */
+void xclaim_limits_default(struct xclaim_limits *limits);
+
+
 /* This will call will iterate over all claims from the decoder and
  * pass them to the encoder. The main complexity of work is the
- * recursive handling of submodules.
+ * handling of submodules. This is not recursive. The submodule nesting
+ * is tracked on a fixed-size stack.
  *
  * Typical use is to configure the decoder object and the encoder
  * object and then call this.
+ *
+ * The default limits are used. An error from any encoder method
+ * stops processing.
  */
 enum xclaim_error_t
 xclaim_processor(xclaim_decoder *decoder, xclaim_encoder *encoder);
 
 
+/* Same as xclaim_processor(), but with the given limits. */
+enum xclaim_error_t
+xclaim_processor_with_limits(xclaim_decoder             *decoder,
+                             xclaim_encoder             *encoder,
+                             const struct xclaim_limits *limits);
+
+
+/* A short description of an error for printing. */
+const char *xclaim_error_string(enum xclaim_error_t error);
+
+
 #endif /* xclaim_h */
@@ -0,0 +1,376 @@
+/*
+ * xclaim_batch.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "xclaim_batch.h"
+#include "ctoken_adapt.h"
+#include "jtoken_adapt.h"
+#include "cose_envelope.h"
+#include "cose_eddsa.h"
+#include "openssl_keys.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+/* State for one worker. Everything here is set up once and used for
+ * each token the worker does. */
+struct batch_worker {
+    pthread_t                          thread;
+    const struct xclaim_batch_options *options;
+    const struct xclaim_limits        *limits;
+    const struct q_useful_buf_c       *inputs;
+    struct xclaim_batch_result        *results;
+    size_t                             count;
+
+    /* All this worker's outputs one after another */
+    FILE                              *output;
+    char                              *output_buf;
+    size_t                             output_len;
+
+    struct cose_eddsa_verifier         eddsa;
+    struct ctoken_decode_ctx           decode_ctx;
+    struct jtoken_encode_ctx           json_ctx;
+    struct q_useful_buf                scratch;
+};
+
+
+/* For CBOR output no claims are decoded. The claims-set is taken out
+ * of the token and given a UCCS tag, as encode_passthrough() in
+ * main.c does. */
+static enum xclaim_batch_status_t convert_to_cbor(struct batch_worker  *worker,
+                                                  struct q_useful_buf_c input)
+{
+    struct t_cose_key     verification_key;
+    struct q_useful_buf_c claims_set;
+    struct q_useful_buf_c uccs;
+    struct q_useful_buf   new_scratch;
+    size_t                needed;
+
+    verification_key = worker->options->verification_key;
+    if(key_is_ed25519(verification_key)) {
+        /* Done here so the verifier is kept from token to token. The
+         * payload is then a UCCS as far as unwrapping goes. */
+        if(cose_eddsa_verify(&worker->eddsa, input, &input)) {
+            fprintf(stderr, "token validation failed. EdDSA signature not valid\n");
+            return XCLAIM_BATCH_INVALID;
+        }
+        memset(&verification_key, 0, sizeof(verification_key));
+    }
+
+    /* A UCCS is rejected here if there is a key to verify it with */
+    if(cose_envelope_unwrap(input, 0, verification_key, &claims_set)) {
+        return XCLAIM_BATCH_INVALID;
+    }
+
+    needed = cose_envelope_wrap_size(claims_set.len, 0);
+    if(needed > worker->scratch.len) {
+        new_scratch.ptr = realloc(worker->scratch.ptr, needed);
+        if(new_scratch.ptr == NULL) {
+            return XCLAIM_BATCH_FAILED;
+        }
+        new_scratch.len = needed;
+        worker->scratch = new_scratch;
+    }
+
+    if(cose_envelope_wrap(claims_set,
+                          CTOKEN_PROTECTION_NONE,
+                          COSE_ENVELOPE_TAG_CWT,
+                          0,
+                          0,
+                          verification_key,
+                          NULL_Q_USEFUL_BUF_C,
+                          verification_key,
+                          worker->scratch,
+                          &uccs)) {
+        return XCLAIM_BATCH_FAILED;
+    }
+
+    fwrite(uccs.ptr, 1, uccs.len, worker->output);
+
+    return XCLAIM_BATCH_OK;
+}
+
+
+static enum xclaim_batch_status_t convert_to_json(struct batch_worker   *worker,
+                                                  struct q_useful_buf_c  input,
+                                                  enum xclaim_error_t   *error)
+{
+    xclaim_decoder decoder;
+    xclaim_encoder encoder;
+
+    if(xclaim_ctoken_decode_init_with_verifier(&decoder,
+                                               &worker->decode_ctx,
+                                               input,
+                                               worker->options->verification_key,
+                                               &worker->eddsa)) {
+        return XCLAIM_BATCH_INVALID;
+    }
+
+    worker->json_ctx.out_file = worker->output;
+    xclaim_jtoken_encode_init(&encoder, &worker->json_ctx);
+    jtoken_encode_start(&worker->json_ctx);
+
+    *error = xclaim_processor_with_limits(&decoder, &encoder, worker->limits);
+    if(*error != XCLAIM_SUCCESS) {
+        return XCLAIM_BATCH_FAILED;
+    }
+
+    jtoken_encode_finish(&worker->json_ctx);
+
+    return XCLAIM_BATCH_OK;
+}
+
+
+/* Converts one token appending the output to the worker's output. On
+ * failure anything output for it is taken back off. */
+static void convert_one(struct batch_worker        *worker,
+                        struct q_useful_buf_c       input,
+                        struct xclaim_batch_result *result)
+{
+    off_t start;
+
+    result->error  = XCLAIM_SUCCESS;
+    result->offset = 0;
+    result->len    = 0;
+
+    start = ftello(worker->output);
+    if(start < 0) {
+        result->status = XCLAIM_BATCH_FAILED;
+        return;
+    }
+
+    if(worker->options->output_format == XCLAIM_BATCH_CBOR) {
+        result->status = convert_to_cbor(worker, input);
+    } else {
+        result->status = convert_to_json(worker, input, &result->error);
+    }
+
+    if(result->status != XCLAIM_BATCH_OK) {
+        fseeko(worker->output, start, SEEK_SET);
+        return;
+    }
+
+    /* Relative to the worker's output until they are put in the
+     * arena */
+    result->offset = (size_t)start;
+    result->len    = (size_t)(ftello(worker->output) - start);
+}
+
+
+static void *batch_worker_thread(void *arg)
+{
+    struct batch_worker *worker = arg;
+    size_t               i;
+
+    for(i = 0; i < worker->count; i++) {
+        convert_one(worker, worker->inputs[i], &worker->results[i]);
+    }
+
+    /* This is what sets output_buf and output_len */
+    fclose(worker->output);
+    worker->output = NULL;
+
+    return NULL;
+}
+
+
+/* Puts each worker's output in the caller's arena, an item at a time
+ * so that as many fit as can. */
+static void fill_caller_arena(struct batch_worker *workers,
+                              unsigned             worker_count,
+                              struct xclaim_arena *arena)
+{
+    struct xclaim_batch_result *result;
+    unsigned                    w;
+    size_t                      i;
+
+    for(w = 0; w < worker_count; w++) {
+        for(i = 0; i < workers[w].count; i++) {
+            result = &workers[w].results[i];
+            if(result->status != XCLAIM_BATCH_OK) {
+                continue;
+            }
+            if(result->len > arena->size - arena->used) {
+                result->status = XCLAIM_BATCH_NO_ROOM;
+                continue;
+            }
+            memcpy(arena->ptr + arena->used, workers[w].output_buf + result->offset, result->len);
+            result->offset = arena->used;
+            arena->used   += result->len;
+        }
+    }
+}
+
+
+/* Puts all the workers' output in a new arena. With one worker its
+ * output buffer becomes the arena and nothing is copied. */
+static int fill_new_arena(struct batch_worker *workers,
+                          unsigned             worker_count,
+                          struct xclaim_arena *arena)
+{
+    size_t   total;
+    unsigned w;
+    size_t   i;
+
+    if(worker_count == 1) {
+        arena->ptr            = (uint8_t *)workers[0].output_buf;
+        arena->size           = workers[0].output_len;
+        arena->used           = workers[0].output_len;
+        arena->allocated      = true;
+        workers[0].output_buf = NULL;
+        return 0;
+    }
+
+    total = 0;
+    for(w = 0; w < worker_count; w++) {
+        total += workers[w].output_len;
+    }
+
+    /* Not zero so that a batch with no output still has an arena to
+     * free */
+    arena->ptr = malloc(total ? total : 1);
+    if(arena->ptr == NULL) {
+        return 1;
+    }
+    arena->size      = total;
+    arena->used      = 0;
+    arena->allocated = true;
+
+    for(w = 0; w < worker_count; w++) {
+        memcpy(arena->ptr + arena->used, workers[w].output_buf, workers[w].output_len);
+        for(i = 0; i < workers[w].count; i++) {
+            workers[w].results[i].offset += arena->used;
+        }
+        arena->used += workers[w].output_len;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See xclaim_batch.h
+ */
+size_t xclaim_convert_batch(const struct q_useful_buf_c       *inputs,
+                            size_t                             count,
+                            const struct xclaim_batch_options *options,
+                            struct xclaim_arena               *arena,
+                            struct xclaim_batch_result        *results)
+{
+    struct xclaim_limits  default_limits;
+    struct batch_worker  *workers;
+    unsigned              worker_count;
+    unsigned              started;
+    unsigned              w;
+    size_t                first;
+    size_t                ok_count;
+    size_t                i;
+    bool                  failed;
+
+    for(i = 0; i < count; i++) {
+        results[i].status = XCLAIM_BATCH_FAILED;
+        results[i].error  = XLCAIM_GENERAL_ERROR_BASE;
+        results[i].offset = 0;
+        results[i].len    = 0;
+    }
+
+    xclaim_limits_default(&default_limits);
+
+    worker_count = options->workers > 1 ? options->workers : 1;
+    if(worker_count > count) {
+        worker_count = count > 0 ? (unsigned)count : 1;
+    }
+
+    workers = calloc(worker_count, sizeof(struct batch_worker));
+    if(workers == NULL) {
+        return 0;
+    }
+
+    /* Each worker gets a contiguous run of the inputs */
+    failed = false;
+    first  = 0;
+    for(w = 0; w < worker_count; w++) {
+        workers[w].options = options;
+        workers[w].limits  = options->limits ? options->limits : &default_limits;
+        workers[w].inputs  = inputs + first;
+        workers[w].results = results + first;
+        workers[w].count   = (count * (w + 1)) / worker_count - first;
+        first             += workers[w].count;
+
+        cose_eddsa_verifier_init(&workers[w].eddsa, options->verification_key);
+        workers[w].output = open_memstream(&workers[w].output_buf, &workers[w].output_len);
+        if(workers[w].output == NULL) {
+            failed = true;
+        }
+    }
+
+    if(!failed) {
+        /* The calling thread is the first worker */
+        for(started = 1; started < worker_count; started++) {
+            if(pthread_create(&workers[started].thread, NULL, batch_worker_thread, &workers[started])) {
+                break;
+            }
+        }
+        batch_worker_thread(&workers[0]);
+        for(w = 1; w < started; w++) {
+            pthread_join(workers[w].thread, NULL);
+        }
+        /* Any that didn't start are done here */
+        for(w = started; w < worker_count; w++) {
+            batch_worker_thread(&workers[w]);
+        }
+
+        if(arena->ptr == NULL) {
+            failed = fill_new_arena(workers, worker_count, arena) != 0;
+        } else {
+            fill_caller_arena(workers, worker_count, arena);
+        }
+    }
+
+    ok_count = 0;
+    for(i = 0; i < count; i++) {
+        if(failed) {
+            results[i].status = XCLAIM_BATCH_FAILED;
+            results[i].error  = XLCAIM_GENERAL_ERROR_BASE;
+        } else if(results[i].status == XCLAIM_BATCH_OK) {
+            ok_count++;
+        }
+    }
+
+    for(w = 0; w < worker_count; w++) {
+        if(workers[w].output != NULL) {
+            fclose(workers[w].output);
+        }
+        free(workers[w].output_buf);
+        free(workers[w].scratch.ptr);
+        cose_eddsa_verifier_free(&workers[w].eddsa);
+    }
+    free(workers);
+
+    return ok_count;
+}
+
+
+/*
+ * Public function. See xclaim_batch.h
+ */
+void xclaim_arena_free(struct xclaim_arena *arena)
+{
+    if(arena->allocated) {
+        free(arena->ptr);
+        arena->ptr       = NULL;
+        arena->size      = 0;
+        arena->used      = 0;
+        arena->allocated = false;
+    }
+}
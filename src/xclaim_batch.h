@@ -0,0 +1,115 @@
+/*
+ * xclaim_batch.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef xclaim_batch_h
+#define xclaim_batch_h
+
+#include "xclaim.h"
+#include "t_cose/q_useful_buf.h"
+#include "t_cose/t_cose_common.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* This is a C API for programs that embed xclaim and convert tokens
+ * in bulk. xclaim_convert_batch() verifies and converts many tokens
+ * in one call. The decode and encode contexts, scratch buffers and
+ * the EdDSA verification context are set up once per worker thread
+ * and used for every token it does. All the outputs go in one arena,
+ * so the caller makes one call and one free per batch rather than a
+ * malloc per token.
+ *
+ * The worker threads are started for the call. For batches of more
+ * than a few hundred tokens their start up cost is small next to the
+ * verification. Each worker takes a contiguous run of the inputs so
+ * the outputs are in the arena in input order.
+ */
+
+
+enum xclaim_batch_format_t {
+    XCLAIM_BATCH_JSON,
+
+    /* An unsigned UCCS */
+    XCLAIM_BATCH_CBOR
+};
+
+
+struct xclaim_batch_options {
+    enum xclaim_batch_format_t  output_format;
+
+    /* As for xclaim_ctoken_decode_init(). It is used by all the
+     * workers at once. */
+    struct t_cose_key           verification_key;
+
+    /* NULL for the defaults from xclaim_limits_default() */
+    const struct xclaim_limits *limits;
+
+    /* Number of threads. 0 or 1 does all the work in the calling
+     * thread. */
+    unsigned                    workers;
+};
+
+
+/* Where the outputs go. For one the batch allocates, set ptr to NULL.
+ * It is then sized to fit and is freed with xclaim_arena_free().
+ * Otherwise ptr and size are a buffer from the caller and outputs
+ * are added at used. Set used to 0 to reuse it for another batch. */
+struct xclaim_arena {
+    uint8_t *ptr;
+    size_t   size;
+    size_t   used;
+    bool     allocated;
+};
+
+
+enum xclaim_batch_status_t {
+    XCLAIM_BATCH_OK = 0,
+
+    /* The token didn't verify or isn't well-formed. A message has
+     * been printed. */
+    XCLAIM_BATCH_INVALID,
+
+    /* Converting the claims failed. The reason is in error. */
+    XCLAIM_BATCH_FAILED,
+
+    /* The output doesn't fit in the caller's arena. len is how big it
+     * is. */
+    XCLAIM_BATCH_NO_ROOM
+};
+
+
+struct xclaim_batch_result {
+    enum xclaim_batch_status_t status;
+    enum xclaim_error_t        error;
+
+    /* The output is at arena->ptr + offset */
+    size_t                     offset;
+    size_t                     len;
+};
+
+
+/* Converts count tokens from inputs. results must have room for
+ * count results. Returns the number of tokens that were converted
+ * successfully. */
+size_t xclaim_convert_batch(const struct q_useful_buf_c       *inputs,
+                            size_t                             count,
+                            const struct xclaim_batch_options *options,
+                            struct xclaim_arena               *arena,
+                            struct xclaim_batch_result        *results);
+
+
+/* Frees an arena allocated by xclaim_convert_batch(). Nothing is done
+ * for one from the caller. */
+void xclaim_arena_free(struct xclaim_arena *arena);
+
+
+#endif /* xclaim_batch_h */
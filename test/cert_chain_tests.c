@@ -0,0 +1,426 @@
+/*
+ * cert_chain_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cert_chain_tests.h"
+#include "cert_chain.h"
+#include "cbor_seq.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+
+/* Makes a cert for key with the given common name, signed by
+ * issuer_key. The issuer is the cert itself if issuer is NULL. */
+static X509 *make_cert(const char *name,
+                       EVP_PKEY   *key,
+                       X509       *issuer,
+                       EVP_PKEY   *issuer_key,
+                       bool        is_ca)
+{
+    static long serial = 1;
+    X509       *cert;
+    X509V3_CTX  v3_ctx;
+    X509_EXTENSION *extension;
+    int         ok;
+
+    cert = X509_new();
+    if(cert == NULL) {
+        return NULL;
+    }
+
+    ok = X509_set_version(cert, 2) &&
+         ASN1_INTEGER_set(X509_get_serialNumber(cert), serial++) &&
+         X509_gmtime_adj(X509_getm_notBefore(cert), -60) &&
+         X509_gmtime_adj(X509_getm_notAfter(cert), 30L * 24 * 60 * 60) &&
+         X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+                                    (const unsigned char *)name, -1, -1, 0) &&
+         X509_set_issuer_name(cert, X509_get_subject_name(issuer ? issuer : cert)) &&
+         X509_set_pubkey(cert, key);
+
+    if(ok && is_ca) {
+        X509V3_set_ctx(&v3_ctx, issuer ? issuer : cert, cert, NULL, NULL, 0);
+        extension = X509V3_EXT_conf_nid(NULL, &v3_ctx, NID_basic_constraints, "critical,CA:TRUE");
+        ok = extension != NULL && X509_add_ext(cert, extension, -1);
+        X509_EXTENSION_free(extension);
+    }
+
+    ok = ok && X509_sign(cert, issuer_key, EVP_sha256());
+    if(!ok) {
+        X509_free(cert);
+        return NULL;
+    }
+
+    return cert;
+}
+
+
+/* The DER of a cert. The caller frees it with OPENSSL_free(). */
+static struct q_useful_buf_c cert_der(X509 *cert)
+{
+    unsigned char *der;
+    int            der_len;
+
+    der     = NULL;
+    der_len = i2d_X509(cert, &der);
+    if(der_len <= 0) {
+        return NULL_Q_USEFUL_BUF_C;
+    }
+
+    return (struct q_useful_buf_c){der, (size_t)der_len};
+}
+
+
+/* A COSE_Sign1 with only the unprotected header given. The payload
+ * and signature are made up as the signature isn't checked here. */
+struct test_token {
+    uint8_t bytes[2048];
+    size_t  len;
+};
+
+
+static void put_head(struct test_token *me, uint8_t major_type, uint64_t argument)
+{
+    me->len += cbor_encode_head(major_type, argument, me->bytes + me->len);
+}
+
+
+static void put_bstr(struct test_token *me, struct q_useful_buf_c bytes)
+{
+    put_head(me, CBOR_MAJOR_TYPE_BYTE_STRING, bytes.len);
+    memcpy(me->bytes + me->len, bytes.ptr, bytes.len);
+    me->len += bytes.len;
+}
+
+
+static void start_token(struct test_token *me)
+{
+    me->len = 0;
+    put_head(me, CBOR_MAJOR_TYPE_ARRAY, 4);
+    put_head(me, CBOR_MAJOR_TYPE_BYTE_STRING, 0);
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 1);
+}
+
+
+static void end_token(struct test_token *me)
+{
+    static const uint8_t signature[64];
+
+    put_bstr(me, (struct q_useful_buf_c){"\xa0", 1});
+    put_bstr(me, (struct q_useful_buf_c){signature, sizeof(signature)});
+}
+
+
+/* A token with an x5chain of the leaf and intermediate */
+static void make_x5chain_token(struct test_token    *me,
+                               struct q_useful_buf_c leaf,
+                               struct q_useful_buf_c intermediate)
+{
+    start_token(me);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, COSE_HEADER_PARAM_X5CHAIN);
+    put_head(me, CBOR_MAJOR_TYPE_ARRAY, 2);
+    put_bstr(me, leaf);
+    put_bstr(me, intermediate);
+    end_token(me);
+}
+
+
+/* A token with an x5t of the leaf */
+static void make_x5t_token(struct test_token *me, struct q_useful_buf_c leaf)
+{
+    uint8_t digest[CERT_CHAIN_DIGEST_LEN];
+
+    EVP_Digest(leaf.ptr, leaf.len, digest, NULL, EVP_sha256(), NULL);
+
+    start_token(me);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, COSE_HEADER_PARAM_X5T);
+    put_head(me, CBOR_MAJOR_TYPE_ARRAY, 2);
+    put_head(me, CBOR_MAJOR_TYPE_NEGATIVE_INT, 15); /* -16, SHA-256 */
+    put_bstr(me, (struct q_useful_buf_c){digest, sizeof(digest)});
+    end_token(me);
+}
+
+
+/* Gets the key for a token and checks it is expected_key. Returns 0 if
+ * it is, 1 if there is no key and 2 if it is the wrong key. */
+static int get_key(struct cert_chain_cache *cache,
+                   const struct test_token *token,
+                   int64_t                  now,
+                   EVP_PKEY                *expected_key)
+{
+    struct t_cose_key key;
+    EVP_PKEY         *pkey;
+    int               result;
+
+    if(cert_chain_get_key(cache, (struct q_useful_buf_c){token->bytes, token->len}, now, &key)) {
+        return 1;
+    }
+    pkey   = get_evp_pkey(key);
+    result = pkey == NULL || EVP_PKEY_eq(pkey, expected_key) != 1 ? 2 : 0;
+    EVP_PKEY_free(pkey);
+    free_ec_key(key);
+
+    return result;
+}
+
+
+/* Signers. There are LEAF_COUNT leaves under the one intermediate. */
+#define LEAF_COUNT 3
+
+struct test_pki {
+    EVP_PKEY             *ca_key;
+    X509                 *ca;
+    EVP_PKEY             *intermediate_key;
+    X509                 *intermediate;
+    EVP_PKEY             *leaf_keys[LEAF_COUNT];
+    struct q_useful_buf_c leaves[LEAF_COUNT];
+    struct q_useful_buf_c intermediate_der;
+
+    /* A leaf and intermediate from another CA */
+    EVP_PKEY             *rogue_ca_key;
+    EVP_PKEY             *rogue_intermediate_key;
+    X509                 *rogue_intermediate;
+    struct q_useful_buf_c rogue_leaf;
+    struct q_useful_buf_c rogue_intermediate_der;
+};
+
+
+static void free_pki(struct test_pki *me)
+{
+    int i;
+
+    EVP_PKEY_free(me->ca_key);
+    X509_free(me->ca);
+    EVP_PKEY_free(me->intermediate_key);
+    X509_free(me->intermediate);
+    OPENSSL_free((void *)me->intermediate_der.ptr);
+    for(i = 0; i < LEAF_COUNT; i++) {
+        EVP_PKEY_free(me->leaf_keys[i]);
+        OPENSSL_free((void *)me->leaves[i].ptr);
+    }
+    EVP_PKEY_free(me->rogue_ca_key);
+    EVP_PKEY_free(me->rogue_intermediate_key);
+    X509_free(me->rogue_intermediate);
+    OPENSSL_free((void *)me->rogue_leaf.ptr);
+    OPENSSL_free((void *)me->rogue_intermediate_der.ptr);
+}
+
+
+static EVP_PKEY *new_key(void)
+{
+    return EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-256");
+}
+
+
+/* Makes the certs and writes the CA cert to ca_file_name */
+static int make_pki(struct test_pki *me, char *ca_file_name)
+{
+    X509 *cert;
+    X509 *rogue_ca;
+    FILE *file;
+    int   fd;
+    int   i;
+    int   result;
+
+    memset(me, 0, sizeof(*me));
+
+    me->ca_key           = new_key();
+    me->intermediate_key = new_key();
+    if(me->ca_key == NULL || me->intermediate_key == NULL) {
+        return 1;
+    }
+    me->ca           = make_cert("test ca", me->ca_key, NULL, me->ca_key, true);
+    me->intermediate = make_cert("test intermediate", me->intermediate_key, me->ca, me->ca_key, true);
+    if(me->ca == NULL || me->intermediate == NULL) {
+        return 1;
+    }
+    me->intermediate_der = cert_der(me->intermediate);
+
+    for(i = 0; i < LEAF_COUNT; i++) {
+        me->leaf_keys[i] = new_key();
+        if(me->leaf_keys[i] == NULL) {
+            return 1;
+        }
+        cert = make_cert("test leaf", me->leaf_keys[i], me->intermediate, me->intermediate_key, false);
+        if(cert == NULL) {
+            return 1;
+        }
+        me->leaves[i] = cert_der(cert);
+        X509_free(cert);
+    }
+
+    me->rogue_ca_key           = new_key();
+    me->rogue_intermediate_key = new_key();
+    if(me->rogue_ca_key == NULL || me->rogue_intermediate_key == NULL) {
+        return 1;
+    }
+    rogue_ca = make_cert("test ca", me->rogue_ca_key, NULL, me->rogue_ca_key, true);
+    if(rogue_ca == NULL) {
+        return 1;
+    }
+    me->rogue_intermediate = make_cert("test intermediate", me->rogue_intermediate_key,
+                                       rogue_ca, me->rogue_ca_key, true);
+    X509_free(rogue_ca);
+    if(me->rogue_intermediate == NULL) {
+        return 1;
+    }
+    cert = make_cert("test leaf", me->leaf_keys[0], me->rogue_intermediate, me->rogue_intermediate_key, false);
+    if(cert == NULL) {
+        return 1;
+    }
+    me->rogue_leaf = cert_der(cert);
+    X509_free(cert);
+    me->rogue_intermediate_der = cert_der(me->rogue_intermediate);
+
+    fd = mkstemp(ca_file_name);
+    if(fd < 0) {
+        return 1;
+    }
+    file = fdopen(fd, "w");
+    if(file == NULL) {
+        close(fd);
+        return 1;
+    }
+    result = !PEM_write_X509(file, me->ca);
+    fclose(file);
+
+    return result;
+}
+
+
+/*
+ * Public function. See cert_chain_tests.h
+ */
+int32_t cert_chain_cache_test(void)
+{
+    static struct test_token token;
+    struct test_pki          pki;
+    struct cert_chain_cache  cache;
+    char                     ca_file_name[] = "/tmp/xclaim_ca_XXXXXX";
+    int64_t                  now;
+    int                      i;
+    int32_t                  return_value;
+
+    memset(&cache, 0, sizeof(cache));
+
+    return_value = 1;
+    if(make_pki(&pki, ca_file_name)) {
+        goto Done;
+    }
+    /* Room for only two chains */
+    if(cert_chain_init(&cache, ca_file_name, 2)) {
+        goto Done;
+    }
+    now = (int64_t)time(NULL);
+
+    /* An x5t is no good until the cert has come in an x5chain */
+    return_value = 2;
+    make_x5t_token(&token, pki.leaves[0]);
+    if(get_key(&cache, &token, now, pki.leaf_keys[0]) != 1) {
+        goto Done;
+    }
+
+    /* Validated once, then from the cache */
+    return_value = 3;
+    make_x5chain_token(&token, pki.leaves[0], pki.intermediate_der);
+    if(get_key(&cache, &token, now, pki.leaf_keys[0]) || cache.hits != 0) {
+        goto Done;
+    }
+    if(get_key(&cache, &token, now, pki.leaf_keys[0]) || cache.hits != 1) {
+        goto Done;
+    }
+    make_x5t_token(&token, pki.leaves[0]);
+    if(get_key(&cache, &token, now, pki.leaf_keys[0]) || cache.hits != 2) {
+        goto Done;
+    }
+
+    /* Not after CERT_CHAIN_MAX_AGE */
+    return_value = 4;
+    if(get_key(&cache, &token, now + CERT_CHAIN_MAX_AGE, pki.leaf_keys[0]) != 1) {
+        goto Done;
+    }
+
+    /* A chain to another CA isn't trusted, even for a key that is in
+     * a trusted chain, and isn't cached */
+    return_value = 5;
+    make_x5chain_token(&token, pki.rogue_leaf, pki.rogue_intermediate_der);
+    for(i = 0; i < 2; i++) {
+        if(get_key(&cache, &token, now, pki.leaf_keys[0]) != 1) {
+            goto Done;
+        }
+    }
+    make_x5t_token(&token, pki.rogue_leaf);
+    if(get_key(&cache, &token, now, pki.leaf_keys[0]) != 1) {
+        goto Done;
+    }
+
+    /* The expired first leaf is validated again */
+    make_x5chain_token(&token, pki.leaves[0], pki.intermediate_der);
+    if(get_key(&cache, &token, now + CERT_CHAIN_MAX_AGE, pki.leaf_keys[0]) || cache.hits != 2) {
+        goto Done;
+    }
+    make_x5t_token(&token, pki.leaves[0]);
+    if(get_key(&cache, &token, now + CERT_CHAIN_MAX_AGE, pki.leaf_keys[0]) || cache.hits != 3) {
+        goto Done;
+    }
+
+    /* The other two leaves fill the cache. The first leaf has been
+     * used so it gets a second chance and the second leaf, which
+     * hasn't, is replaced by the third. */
+    return_value = 6;
+    for(i = 1; i < LEAF_COUNT; i++) {
+        make_x5chain_token(&token, pki.leaves[i], pki.intermediate_der);
+        if(get_key(&cache, &token, now, pki.leaf_keys[i])) {
+            goto Done;
+        }
+    }
+    make_x5t_token(&token, pki.leaves[1]);
+    if(get_key(&cache, &token, now, pki.leaf_keys[1]) != 1) {
+        goto Done;
+    }
+    make_x5t_token(&token, pki.leaves[0]);
+    if(get_key(&cache, &token, now, pki.leaf_keys[0])) {
+        goto Done;
+    }
+    make_x5t_token(&token, pki.leaves[2]);
+    if(get_key(&cache, &token, now, pki.leaf_keys[2])) {
+        goto Done;
+    }
+
+    /* A token with neither */
+    return_value = 7;
+    start_token(&token);
+    put_head(&token, CBOR_MAJOR_TYPE_POSITIVE_INT, 4);
+    put_bstr(&token, (struct q_useful_buf_c){"kid", 3});
+    end_token(&token);
+    if(get_key(&cache, &token, now, pki.leaf_keys[0]) != 1) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    cert_chain_free(&cache);
+    free_pki(&pki);
+    unlink(ca_file_name);
+
+    return return_value;
+}
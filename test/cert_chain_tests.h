@@ -0,0 +1,26 @@
+/*
+ * cert_chain_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cert_chain_tests_h
+#define cert_chain_tests_h
+
+#include <stdint.h>
+
+
+/* Gets keys from x5chain and x5t headers through the cache of
+ * validated chains. Checks that a chain to an untrusted CA is
+ * rejected and not cached, that entries expire and that the CLOCK
+ * replacement keeps a recently used entry. */
+int32_t cert_chain_cache_test(void);
+
+
+#endif /* cert_chain_tests_h */
@@ -0,0 +1,565 @@
+/*
+ * claim_filter_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "claim_filter_tests.h"
+#include "claim_filter.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <openssl/evp.h>
+
+
+/* A decoder for a made-up token with the same claims at the top
+ * level and in two submodules, sm1 and sm2, so the rules can be
+ * seen to apply at some levels and not others. Level 0 is the top
+ * and levels 1 and 2 are the submodules. */
+
+#define TEST_LEVELS 3
+#define TEST_CLAIMS 3
+
+static const char *const submod_names[TEST_LEVELS] = {NULL, "sm1", "sm2"};
+
+struct test_decoder {
+    uint32_t level;
+    uint32_t next;
+};
+
+
+static void make_claim(int64_t label, struct xclaim *claim)
+{
+    static const uint8_t bytes[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+
+    memset(claim, 0, sizeof(*claim));
+    claim->qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim->qcbor_item.label.int64 = label;
+    if(label == CTOKEN_CWT_LABEL_ISSUER) {
+        claim->qcbor_item.uDataType = QCBOR_TYPE_TEXT_STRING;
+        claim->qcbor_item.val.string = (struct q_useful_buf_c){"issuer", 6};
+    } else {
+        claim->qcbor_item.uDataType = QCBOR_TYPE_BYTE_STRING;
+        claim->qcbor_item.val.string = (struct q_useful_buf_c){bytes, sizeof(bytes)};
+    }
+}
+
+
+static enum xclaim_error_t test_next_claim(void *ctx, struct xclaim *claim)
+{
+    static const int64_t labels[TEST_CLAIMS] = {
+        CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_NONCE, CTOKEN_EAT_LABEL_UEID
+    };
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    if(me->next >= TEST_CLAIMS) {
+        return XCLAIM_NO_MORE;
+    }
+    make_claim(labels[me->next++], claim);
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t
+test_enter_submod(void *ctx, uint32_t index, struct q_useful_buf_c *name)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    if(me->level != 0 || index + 1 >= TEST_LEVELS) {
+        return XCLAIM_NO_MORE;
+    }
+    me->level = index + 1;
+    me->next  = 0;
+    *name = q_useful_buf_from_sz(submod_names[me->level]);
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t test_exit_submod(void *ctx)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    me->level = 0;
+    me->next  = TEST_CLAIMS;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static void test_rewind(void *ctx)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    me->level = 0;
+    me->next  = 0;
+}
+
+
+static void test_decoder_init(xclaim_decoder *decoder, struct test_decoder *me)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    me->level = 0;
+    me->next  = 0;
+
+    decoder->ctx          = me;
+    decoder->next_claim   = test_next_claim;
+    decoder->enter_submod = test_enter_submod;
+    decoder->exit_submod  = test_exit_submod;
+    decoder->rewind       = test_rewind;
+}
+
+
+/* The labels expected at a level, ending with 0 */
+struct expected_level {
+    int64_t labels[TEST_CLAIMS + 1];
+};
+
+
+/* Runs the filter over the test token, checking the labels of the
+ * claims that come out at each level. Hashed iss claims are checked
+ * to be the hex of a hash. Returns 0 on success. */
+static int32_t check_filter(const char                  **rule_args,
+                            const struct expected_level  expected[TEST_LEVELS])
+{
+    struct claim_filter_rules rules;
+    struct test_decoder       test;
+    xclaim_decoder            inner;
+    xclaim_decoder            filtered;
+    struct claim_filter       filter;
+    struct xclaim             claim;
+    struct q_useful_buf_c     name;
+    enum xclaim_error_t       xclaim_error;
+    uint32_t                  level;
+    uint32_t                  i;
+    int32_t                   return_value;
+
+    if(claim_filter_compile(rule_args, &rules)) {
+        claim_filter_free_rules(&rules);
+        return 1;
+    }
+
+    test_decoder_init(&inner, &test);
+    claim_filter_init(&filtered, &filter, &inner, &rules);
+    (filtered.rewind)(filtered.ctx);
+
+    return_value = 0;
+
+    for(level = 0; level < TEST_LEVELS; level++) {
+        if(level > 0) {
+            if((filtered.enter_submod)(filtered.ctx, level - 1, &name) != XCLAIM_SUCCESS) {
+                return_value = 2;
+                goto Done;
+            }
+        }
+
+        for(i = 0; ; i++) {
+            xclaim_error = (filtered.next_claim)(filtered.ctx, &claim);
+            if(xclaim_error == XCLAIM_NO_MORE) {
+                break;
+            }
+            if(xclaim_error != XCLAIM_SUCCESS ||
+               claim.qcbor_item.label.int64 != expected[level].labels[i]) {
+                return_value = 10 + (int32_t)level;
+                goto Done;
+            }
+        }
+        if(expected[level].labels[i] != 0) {
+            return_value = 20 + (int32_t)level;
+            goto Done;
+        }
+
+        if(level > 0) {
+            (filtered.exit_submod)(filtered.ctx);
+        }
+    }
+
+Done:
+    claim_filter_finish(&filter);
+    claim_filter_free_rules(&rules);
+
+    return return_value;
+}
+
+
+/* Gets the iss at a level after the filter */
+static int get_filtered_iss(const char **rule_args, uint32_t level, char hex[65])
+{
+    struct claim_filter_rules rules;
+    struct test_decoder       test;
+    xclaim_decoder            inner;
+    xclaim_decoder            filtered;
+    struct claim_filter       filter;
+    struct xclaim             claim;
+    struct q_useful_buf_c     name;
+    int                       return_value;
+
+    if(claim_filter_compile(rule_args, &rules)) {
+        claim_filter_free_rules(&rules);
+        return 1;
+    }
+    test_decoder_init(&inner, &test);
+    claim_filter_init(&filtered, &filter, &inner, &rules);
+
+    return_value = 1;
+    if(level > 0 && (filtered.enter_submod)(filtered.ctx, level - 1, &name) != XCLAIM_SUCCESS) {
+        goto Done;
+    }
+    while((filtered.next_claim)(filtered.ctx, &claim) == XCLAIM_SUCCESS) {
+        if(claim.qcbor_item.label.int64 == CTOKEN_CWT_LABEL_ISSUER &&
+           claim.qcbor_item.uDataType == QCBOR_TYPE_TEXT_STRING &&
+           claim.qcbor_item.val.string.len == 64) {
+            memcpy(hex, claim.qcbor_item.val.string.ptr, 64);
+            hex[64] = '\0';
+            return_value = 0;
+            break;
+        }
+    }
+
+Done:
+    claim_filter_finish(&filter);
+    claim_filter_free_rules(&rules);
+
+    return return_value;
+}
+
+
+int32_t claim_filter_scope_test(void)
+{
+    static const char *drop_rules[] = {
+        "drop:/nonce",              /* Top level only */
+        "drop:sm1/ueid",            /* Only in sm1 */
+        "rename:sm2/nonce=-70000",  /* Only in sm2 */
+        NULL
+    };
+    static const struct expected_level drop_expected[TEST_LEVELS] = {
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_UEID, 0}},
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_NONCE, 0}},
+        {{CTOKEN_CWT_LABEL_ISSUER, -70000, CTOKEN_EAT_LABEL_UEID, 0}},
+    };
+
+    static const char *keep_rules[] = {
+        "keep:sm1/iss",
+        NULL
+    };
+    static const struct expected_level keep_expected[TEST_LEVELS] = {
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_NONCE, CTOKEN_EAT_LABEL_UEID, 0}},
+        {{CTOKEN_CWT_LABEL_ISSUER, 0}},
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_NONCE, CTOKEN_EAT_LABEL_UEID, 0}},
+    };
+
+    /* Not scoped so it applies everywhere. The first rule for a label
+     * is used, so nonce is dropped at the top and in sm2 but kept
+     * in sm1 where the scoped set rule comes first. */
+    static const char *all_rules[] = {
+        "set:sm1/nonce=0102",
+        "drop:nonce",
+        "hash:iss",
+        NULL
+    };
+    static const struct expected_level all_expected[TEST_LEVELS] = {
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_UEID, 0}},
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_NONCE, CTOKEN_EAT_LABEL_UEID, 0}},
+        {{CTOKEN_CWT_LABEL_ISSUER, CTOKEN_EAT_LABEL_UEID, 0}},
+    };
+
+    static const char *hash_top_rules[] = {
+        "hash:/iss",
+        NULL
+    };
+
+    char    top_hash[65];
+    char    sm2_hash[65];
+    int32_t result;
+
+    result = check_filter(drop_rules, drop_expected);
+    if(result) {
+        return 100 + result;
+    }
+
+    result = check_filter(keep_rules, keep_expected);
+    if(result) {
+        return 200 + result;
+    }
+
+    result = check_filter(all_rules, all_expected);
+    if(result) {
+        return 300 + result;
+    }
+
+    /* The unscoped hash is the same at every level */
+    if(get_filtered_iss(all_rules, 0, top_hash) ||
+       get_filtered_iss(all_rules, 2, sm2_hash) ||
+       strcmp(top_hash, sm2_hash)) {
+        return 400;
+    }
+
+    /* The top-level hash doesn't touch the submodules */
+    if(get_filtered_iss(hash_top_rules, 0, top_hash)) {
+        return 401;
+    }
+    if(!get_filtered_iss(hash_top_rules, 1, sm2_hash)) {
+        return 402;
+    }
+
+    return 0;
+}
+
+
+int32_t claim_filter_hash_test(void)
+{
+    static const char *salted_rules[] = {
+        "hash:iss=pepper",
+        NULL
+    };
+    static const char *unsalted_rules[] = {
+        "hash:iss",
+        NULL
+    };
+    static const char *const inputs[] = {"pepperissuer", "issuer"};
+    const char *const       *rule_args[] = {salted_rules, unsalted_rules};
+
+    char          hex[65];
+    char          expected[65];
+    unsigned char digest[32];
+    unsigned int  digest_len;
+    int           i;
+    int           j;
+    int           pass;
+
+    for(i = 0; i < 2; i++) {
+        if(!EVP_Digest(inputs[i], strlen(inputs[i]), digest, &digest_len, EVP_sha256(), NULL)) {
+            return 1;
+        }
+        for(j = 0; j < 32; j++) {
+            sprintf(expected + 2 * j, "%02x", digest[j]);
+        }
+
+        /* The second time the salted state in the rules is used
+         * again, so it must not have been changed by the first */
+        for(pass = 0; pass < 2; pass++) {
+            if(get_filtered_iss((const char **)rule_args[i], (uint32_t)pass, hex)) {
+                return 10 + i;
+            }
+            if(strcmp(hex, expected)) {
+                return 20 + i;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+/* A decoder for a token with no claims and three submodules, the
+ * nested tokens nt1 and nt2 with the submodule sm1 between them. It
+ * has both a cursor and get_nested. */
+
+static const char *const nested_names[] = {"nt1", "sm1", "nt2"};
+
+#define NESTED_SUBMODS 3
+
+struct nested_decoder {
+    uint32_t index;
+};
+
+
+static enum xclaim_error_t nested_next_claim(void *ctx, struct xclaim *claim)
+{
+    (void)ctx;
+    (void)claim;
+
+    return XCLAIM_NO_MORE;
+}
+
+
+static enum xclaim_error_t nested_at(struct nested_decoder *me, struct xclaim_submod_cursor *cursor)
+{
+    if(me->index >= NESTED_SUBMODS) {
+        return XCLAIM_NO_MORE;
+    }
+    cursor->name = q_useful_buf_from_sz(nested_names[me->index]);
+    if(me->index == 1) {
+        cursor->entered = true;
+        return XCLAIM_SUCCESS;
+    }
+    cursor->entered      = false;
+    cursor->nested_type  = CTOKEN_TYPE_CWT;
+    cursor->nested_token = (struct q_useful_buf_c){"\xa0", 1};
+
+    return XCLAIM_SUBMOD_IS_TOKEN;
+}
+
+
+static enum xclaim_error_t
+nested_first_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct nested_decoder *me = (struct nested_decoder *)ctx;
+
+    me->index = 0;
+
+    return nested_at(me, cursor);
+}
+
+
+static enum xclaim_error_t
+nested_next_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct nested_decoder *me = (struct nested_decoder *)ctx;
+
+    me->index++;
+
+    return nested_at(me, cursor);
+}
+
+
+static enum xclaim_error_t
+nested_get_nested(void                  *ctx,
+                  uint32_t               index,
+                  enum ctoken_type_t    *type,
+                  struct q_useful_buf_c *name,
+                  struct q_useful_buf_c *token)
+{
+    struct nested_decoder      *me = (struct nested_decoder *)ctx;
+    struct xclaim_submod_cursor cursor;
+    enum xclaim_error_t         xclaim_error;
+
+    me->index = index;
+    xclaim_error = nested_at(me, &cursor);
+    if(xclaim_error != XCLAIM_SUBMOD_IS_TOKEN) {
+        return XCLAIM_ERR_FILTER;
+    }
+    *type  = cursor.nested_type;
+    *name  = cursor.name;
+    *token = cursor.nested_token;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static void nested_rewind(void *ctx)
+{
+    ((struct nested_decoder *)ctx)->index = 0;
+}
+
+
+/* Walks the submodules with the filter's cursor and returns which
+ * came out as a bit mask of their index in nested_names, or -1 on an
+ * error. */
+static int visible_submods(const char **rule_args)
+{
+    struct claim_filter_rules   rules;
+    struct nested_decoder       nested;
+    xclaim_decoder              inner;
+    xclaim_decoder              filtered;
+    struct claim_filter         filter;
+    struct xclaim_submod_cursor cursor;
+    enum xclaim_error_t         xclaim_error;
+    uint32_t                    i;
+    int                         result;
+
+    if(claim_filter_compile(rule_args, &rules)) {
+        claim_filter_free_rules(&rules);
+        return -1;
+    }
+
+    memset(&inner, 0, sizeof(inner));
+    inner.ctx          = &nested;
+    inner.next_claim   = nested_next_claim;
+    inner.get_nested   = nested_get_nested;
+    inner.first_submod = nested_first_submod;
+    inner.next_submod  = nested_next_submod;
+    inner.rewind       = nested_rewind;
+    claim_filter_init(&filtered, &filter, &inner, &rules);
+    (filtered.rewind)(filtered.ctx);
+
+    result = 0;
+    memset(&cursor, 0, sizeof(cursor));
+    xclaim_error = (filtered.first_submod)(filtered.ctx, &cursor);
+    while(xclaim_error == XCLAIM_SUCCESS || xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        for(i = 0; i < NESTED_SUBMODS; i++) {
+            if(!q_useful_buf_compare(cursor.name, q_useful_buf_from_sz(nested_names[i]))) {
+                result |= 1 << i;
+            }
+        }
+        xclaim_error = (filtered.next_submod)(filtered.ctx, &cursor);
+    }
+    if(xclaim_error != XCLAIM_NO_MORE) {
+        result = -1;
+    }
+
+    claim_filter_finish(&filter);
+    claim_filter_free_rules(&rules);
+
+    return result;
+}
+
+
+int32_t claim_filter_nested_test(void)
+{
+    static const struct {
+        const char *rule_args[3];
+        int         visible;
+    } cases[] = {
+        /* Nothing that redacts, or only at other levels */
+        {{"rename:nonce=-70000", "set:iat=now", NULL}, 0x7},
+        {{"drop:/nonce", "hash:sm1/ueid", NULL},       0x7},
+        {{"keep:sm1/iss", NULL},                       0x7},
+
+        /* A rule for every level drops both */
+        {{"drop:nonce", NULL},                         0x2},
+        {{"hash:iss", NULL},                           0x2},
+        {{"keep:iss", NULL},                           0x2},
+
+        /* A rule in or below one drops only that one */
+        {{"hash:nt2/ueid", NULL},                      0x3},
+        {{"drop:nt1/deeper/nonce", NULL},              0x6},
+    };
+    static const char *drop_all_rules[] = {"drop:nonce", NULL};
+
+    struct claim_filter_rules rules;
+    struct nested_decoder     nested;
+    xclaim_decoder            inner;
+    xclaim_decoder            filtered;
+    struct claim_filter       filter;
+    enum ctoken_type_t        type;
+    struct q_useful_buf_c     name;
+    struct q_useful_buf_c     token;
+    enum xclaim_error_t       xclaim_error;
+    size_t                    i;
+
+    for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+        if(visible_submods((const char **)cases[i].rule_args) != cases[i].visible) {
+            return (int32_t)(1 + i);
+        }
+    }
+
+    /* Without the cursor it can't be skipped, so it is an error */
+    if(claim_filter_compile(drop_all_rules, &rules)) {
+        claim_filter_free_rules(&rules);
+        return 20;
+    }
+    memset(&inner, 0, sizeof(inner));
+    inner.ctx        = &nested;
+    inner.next_claim = nested_next_claim;
+    inner.get_nested = nested_get_nested;
+    inner.rewind     = nested_rewind;
+    claim_filter_init(&filtered, &filter, &inner, &rules);
+    xclaim_error = (filtered.get_nested)(filtered.ctx, 0, &type, &name, &token);
+    claim_filter_finish(&filter);
+    claim_filter_free_rules(&rules);
+    if(xclaim_error != XCLAIM_ERR_FILTER) {
+        return 21;
+    }
+
+    return 0;
+}
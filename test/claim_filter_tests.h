@@ -0,0 +1,34 @@
+/*
+ * claim_filter_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef claim_filter_tests_h
+#define claim_filter_tests_h
+
+#include <stdint.h>
+
+
+/* Rules with no scope, the top-level scope and a submodule scope
+ * apply only at the levels they should. */
+int32_t claim_filter_scope_test(void);
+
+
+/* A hash is the SHA-256 of the salt and the value, and stays the same
+ * for every claim hashed with the same rules. */
+int32_t claim_filter_hash_test(void);
+
+
+/* Nested tokens are dropped when a drop, keep or hash rule applies in
+ * them, and not otherwise. */
+int32_t claim_filter_nested_test(void);
+
+
+#endif /* claim_filter_tests_h */
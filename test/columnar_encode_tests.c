@@ -0,0 +1,392 @@
+/*
+ * columnar_encode_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "columnar_encode_tests.h"
+#include "columnar_encode.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A claim label that isn't registered */
+#define TEST_BOOL_LABEL -75000
+
+
+static void output_string(xclaim_encoder *encoder, int64_t label, uint8_t type, const char *value, size_t len)
+{
+    struct xclaim claim;
+
+    memset(&claim, 0, sizeof(claim));
+    claim.qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim.qcbor_item.label.int64 = label;
+    claim.qcbor_item.uDataType   = type;
+    claim.qcbor_item.val.string  = (struct q_useful_buf_c){value, len};
+
+    (encoder->output_claim)(encoder->ctx, &claim);
+}
+
+
+static void output_int(xclaim_encoder *encoder, int64_t label, uint8_t type, int64_t value)
+{
+    struct xclaim claim;
+
+    memset(&claim, 0, sizeof(claim));
+    claim.qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim.qcbor_item.label.int64 = label;
+    claim.qcbor_item.uDataType   = type;
+    claim.qcbor_item.val.int64   = value;
+
+    (encoder->output_claim)(encoder->ctx, &claim);
+}
+
+
+/* Adds a row that has been gathered and frees it */
+static int add_row(struct columnar_row *row)
+{
+    int result;
+
+    result = columnar_row_add(row);
+    columnar_row_free(row);
+
+    return result;
+}
+
+
+/* Three tokens with two rows per row group. The first has a
+ * duplicate label, a submodule and a nested token. The second has
+ * only some of the columns. The third is alone in the second row
+ * group and adds a column. */
+static int output_tokens(struct columnar_writer *writer)
+{
+    static const uint8_t nested[] = {0xa0};
+    xclaim_encoder       encoder;
+    struct columnar_row  row;
+
+    xclaim_columnar_encode_init(&encoder, &row, writer);
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "acme", 4);
+    output_int(&encoder, CTOKEN_CWT_LABEL_IAT, QCBOR_TYPE_INT64, 5);
+    output_int(&encoder, CTOKEN_CWT_LABEL_IAT, QCBOR_TYPE_INT64, 99);
+    output_string(&encoder, CTOKEN_EAT_LABEL_NONCE, QCBOR_TYPE_BYTE_STRING, "\x01\x02", 2);
+    (encoder.start_submods_section)(encoder.ctx);
+    (encoder.open_submod)(encoder.ctx, q_useful_buf_from_sz("tee"));
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "tee-co", 6);
+    (encoder.close_submod)(encoder.ctx);
+    (encoder.output_nested)(encoder.ctx,
+                            q_useful_buf_from_sz("nt"),
+                            (struct q_useful_buf_c){nested, sizeof(nested)});
+    (encoder.end_submods_section)(encoder.ctx);
+    if(add_row(&row)) {
+        return 1;
+    }
+
+    xclaim_columnar_encode_init(&encoder, &row, writer);
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "acme", 4);
+    output_int(&encoder, CTOKEN_CWT_LABEL_IAT, QCBOR_TYPE_INT64, 7);
+    if(add_row(&row)) {
+        return 1;
+    }
+
+    xclaim_columnar_encode_init(&encoder, &row, writer);
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "other", 5);
+    output_int(&encoder, TEST_BOOL_LABEL, QCBOR_TYPE_TRUE, 0);
+
+    return add_row(&row);
+}
+
+
+/* The expected file is built up in one of these */
+struct expected {
+    uint8_t bytes[1024];
+    size_t  len;
+};
+
+
+static void put_bytes(struct expected *me, const void *bytes, size_t len)
+{
+    memcpy(me->bytes + me->len, bytes, len);
+    me->len += len;
+}
+
+
+static void put_u8(struct expected *me, uint8_t n)
+{
+    put_bytes(me, &n, 1);
+}
+
+
+static void put_u32(struct expected *me, uint32_t n)
+{
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        put_u8(me, (uint8_t)(n >> (8 * i)));
+    }
+}
+
+
+static void put_u64(struct expected *me, uint64_t n)
+{
+    int i;
+
+    for(i = 0; i < 8; i++) {
+        put_u8(me, (uint8_t)(n >> (8 * i)));
+    }
+}
+
+
+static void put_chunk_head(struct expected *me, uint32_t column, uint64_t len)
+{
+    put_u32(me, column);
+    put_u64(me, len);
+}
+
+
+static void put_column(struct expected *me, int64_t label, uint8_t type, const char *path)
+{
+    put_u64(me, (uint64_t)label);
+    put_u8(me, type);
+    put_u8(me, 0);
+    put_u8(me, (uint8_t)strlen(path));
+    put_u8(me, 0);
+    put_bytes(me, path, strlen(path));
+}
+
+
+/* The file output_tokens() should make, worked out by hand from the
+ * format in columnar_encode.h */
+static void make_expected(struct expected *me)
+{
+    uint64_t footer_offset;
+
+    me->len = 0;
+    put_bytes(me, "XCLMCOL1", 8);
+
+    /* Row group of the first two tokens */
+    put_u32(me, 2);
+    put_u32(me, 5);
+
+    /* iss is DICT with one string. Both rows have code 0. */
+    put_chunk_head(me, 0, 1 + 4 + 8 + 4 + 8);
+    put_u8(me, 0x03);
+    put_u32(me, 1);
+    put_u32(me, 0);
+    put_u32(me, 4);
+    put_bytes(me, "acme", 4);
+    put_u32(me, 0);
+    put_u32(me, 0);
+
+    /* iat. The second iat in the first token isn't used. */
+    put_chunk_head(me, 1, 1 + 16);
+    put_u8(me, 0x03);
+    put_u64(me, 5);
+    put_u64(me, 7);
+
+    /* nonce only in the first row */
+    put_chunk_head(me, 2, 1 + 12 + 2);
+    put_u8(me, 0x01);
+    put_u32(me, 0);
+    put_u32(me, 2);
+    put_u32(me, 2);
+    put_bytes(me, "\x01\x02", 2);
+
+    /* tee/iss */
+    put_chunk_head(me, 3, 1 + 4 + 8 + 6 + 8);
+    put_u8(me, 0x01);
+    put_u32(me, 1);
+    put_u32(me, 0);
+    put_u32(me, 6);
+    put_bytes(me, "tee-co", 6);
+    put_u32(me, 0);
+    put_u32(me, 0);
+
+    /* The nested token */
+    put_chunk_head(me, 4, 1 + 12 + 1);
+    put_u8(me, 0x01);
+    put_u32(me, 0);
+    put_u32(me, 1);
+    put_u32(me, 1);
+    put_u8(me, 0xa0);
+
+    /* Row group of the third token. The dictionary starts again. */
+    put_u32(me, 1);
+    put_u32(me, 2);
+
+    put_chunk_head(me, 0, 1 + 4 + 8 + 5 + 4);
+    put_u8(me, 0x01);
+    put_u32(me, 1);
+    put_u32(me, 0);
+    put_u32(me, 5);
+    put_bytes(me, "other", 5);
+    put_u32(me, 0);
+
+    put_chunk_head(me, 5, 1 + 1);
+    put_u8(me, 0x01);
+    put_u8(me, 0x01);
+
+    /* Footer */
+    footer_offset = me->len;
+    put_u32(me, 6);
+    put_column(me, CTOKEN_CWT_LABEL_ISSUER, COLUMNAR_DICT,   "");
+    put_column(me, CTOKEN_CWT_LABEL_IAT,    COLUMNAR_INT64,  "");
+    put_column(me, CTOKEN_EAT_LABEL_NONCE,  COLUMNAR_BYTES,  "");
+    put_column(me, CTOKEN_CWT_LABEL_ISSUER, COLUMNAR_DICT,   "tee");
+    put_column(me, 0,                       COLUMNAR_NESTED, "nt");
+    put_column(me, TEST_BOOL_LABEL,         COLUMNAR_BOOL,   "");
+    put_u64(me, 3);
+    put_u64(me, footer_offset);
+    put_bytes(me, "XCLMCOL1", 8);
+}
+
+
+/*
+ * Public function. See columnar_encode_tests.h
+ */
+int32_t columnar_layout_test(void)
+{
+    static struct expected expected;
+    struct columnar_writer writer;
+    FILE                  *file;
+    char                  *output;
+    size_t                 output_len;
+    int32_t                return_value;
+
+    output = NULL;
+    file   = open_memstream(&output, &output_len);
+    if(file == NULL) {
+        return 1;
+    }
+
+    return_value = 2;
+    if(columnar_writer_init(&writer, file, 2) ||
+       output_tokens(&writer) ||
+       columnar_writer_finish(&writer)) {
+        goto Done;
+    }
+    fflush(file);
+
+    make_expected(&expected);
+    return_value = 3;
+    if(output_len != expected.len || memcmp(output, expected.bytes, output_len)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    columnar_writer_free(&writer);
+    fclose(file);
+    free(output);
+
+    return return_value;
+}
+
+
+static uint32_t get_u32(const char *bytes)
+{
+    const uint8_t *b = (const uint8_t *)bytes;
+
+    return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+
+/* Enough distinct columns and dictionary strings that the hash
+ * tables for both grow */
+#define MANY_ROWS    300
+#define MANY_STRINGS 200
+#define MANY_LABELS  100
+
+
+/*
+ * Public function. See columnar_encode_tests.h
+ */
+int32_t columnar_growth_test(void)
+{
+    struct columnar_writer writer;
+    struct columnar_row    row;
+    xclaim_encoder         encoder;
+    FILE                  *file;
+    char                  *output;
+    size_t                 output_len;
+    char                   iss[16];
+    const char            *chunk;
+    const char            *codes;
+    const char            *footer;
+    uint32_t               i;
+    int32_t                return_value;
+
+    output = NULL;
+    file   = open_memstream(&output, &output_len);
+    if(file == NULL) {
+        return 1;
+    }
+
+    /* Row i has iss "i<i % MANY_STRINGS>" and one of MANY_LABELS
+     * other labels, all in one row group */
+    return_value = 2;
+    if(columnar_writer_init(&writer, file, 0)) {
+        goto Done;
+    }
+    for(i = 0; i < MANY_ROWS; i++) {
+        snprintf(iss, sizeof(iss), "i%u", i % MANY_STRINGS);
+        xclaim_columnar_encode_init(&encoder, &row, &writer);
+        output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, iss, strlen(iss));
+        output_int(&encoder, -80000 - (int64_t)(i % MANY_LABELS), QCBOR_TYPE_INT64, i);
+        if(add_row(&row)) {
+            goto Done;
+        }
+    }
+    if(columnar_writer_finish(&writer)) {
+        goto Done;
+    }
+    fflush(file);
+
+    /* The first chunk is iss. It has MANY_STRINGS strings and rows
+     * with the same iss have the same code. */
+    return_value = 3;
+    if(get_u32(output + 8) != MANY_ROWS || get_u32(output + 12) != 1 + MANY_LABELS) {
+        goto Done;
+    }
+    chunk = output + 16;
+    if(get_u32(chunk) != 0) {
+        goto Done;
+    }
+    chunk += 4 + 8 + (MANY_ROWS + 7) / 8;
+    if(get_u32(chunk) != MANY_STRINGS) {
+        goto Done;
+    }
+    codes = chunk + 4 + (MANY_STRINGS + 1) * 4 + get_u32(chunk + 4 + MANY_STRINGS * 4);
+    return_value = 4;
+    for(i = 0; i < MANY_ROWS; i++) {
+        if(get_u32(codes + 4 * i) != i % MANY_STRINGS) {
+            goto Done;
+        }
+    }
+
+    /* Every label got its own column */
+    return_value = 5;
+    footer = output + get_u32(output + output_len - 16);
+    if(get_u32(footer) != 1 + MANY_LABELS) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    columnar_writer_free(&writer);
+    fclose(file);
+    free(output);
+
+    return return_value;
+}
@@ -0,0 +1,29 @@
+/*
+ * columnar_encode_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef columnar_encode_tests_h
+#define columnar_encode_tests_h
+
+#include <stdint.h>
+
+
+/* A few tokens over two row groups come out byte-for-byte as laid
+ * out in columnar_encode.h. */
+int32_t columnar_layout_test(void);
+
+
+/* Many columns and many dictionary strings, enough for the hash
+ * tables to grow, still each get one column or code. */
+int32_t columnar_growth_test(void);
+
+
+#endif /* columnar_encode_tests_h */
@@ -0,0 +1,195 @@
+/*
+ * cose_eddsa_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_eddsa_tests.h"
+#include "cose_eddsa.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
+
+#include <string.h>
+#include <openssl/evp.h>
+
+
+/* The payload is a claims-set {1: "issuer", 6: 1600000000} */
+static const uint8_t payload_bytes[] = {
+    0xa2, 0x01, 0x66, 'i', 's', 's', 'u', 'e', 'r',
+    0x06, 0x1a, 0x5f, 0x5e, 0x10, 0x00
+};
+
+#define PAYLOAD ((struct q_useful_buf_c){payload_bytes, sizeof(payload_bytes)})
+
+
+/* Makes a new Ed25519 key */
+static int make_test_key(struct t_cose_key *key)
+{
+    EVP_PKEY *pkey;
+
+    pkey = EVP_PKEY_Q_keygen(NULL, NULL, "ED25519");
+    if(pkey == NULL) {
+        return 1;
+    }
+
+    return set_evp_pkey(pkey, key) || !key_is_ed25519(*key);
+}
+
+
+static int same_bytes(struct q_useful_buf_c a, struct q_useful_buf_c b)
+{
+    return a.len == b.len && !memcmp(a.ptr, b.ptr, a.len);
+}
+
+
+int32_t cose_eddsa_test(void)
+{
+    struct t_cose_key          key_a;
+    struct t_cose_key          key_b;
+    struct t_cose_key          no_key;
+    struct cose_eddsa_verifier verifier;
+    uint8_t                    buffer[1 + sizeof(payload_bytes) + 5 + COSE_EDDSA_OVERHEAD];
+    uint8_t                    second[sizeof(buffer)];
+    uint8_t                    wrapped[1024];
+    struct q_useful_buf_c      token;
+    struct q_useful_buf_c      tokens[3];
+    struct q_useful_buf_c      payload;
+    bool                       valid[3];
+    size_t                     i;
+    int                        bit;
+    int32_t                    return_value;
+
+    memset(&key_a, 0, sizeof(key_a));
+    memset(&key_b, 0, sizeof(key_b));
+    memset(&no_key, 0, sizeof(no_key));
+    memset(&verifier, 0, sizeof(verifier));
+
+    return_value = 1;
+    if(make_test_key(&key_a) || make_test_key(&key_b)) {
+        goto Done;
+    }
+    cose_eddsa_verifier_init(&verifier, key_a);
+
+    /* With a kid, tagged and not */
+    return_value = 2;
+    if(cose_eddsa_sign(PAYLOAD,
+                       key_a,
+                       (struct q_useful_buf_c){"kid-1", 5},
+                       (struct q_useful_buf){buffer + 1, sizeof(buffer) - 1},
+                       &token)) {
+        goto Done;
+    }
+    return_value = 3;
+    if(cose_eddsa_verify_one(token, key_a, &payload) || !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+    buffer[0] = 0xd2; /* Tag 18 */
+    return_value = 4;
+    if(cose_eddsa_verify_one((struct q_useful_buf_c){buffer, token.len + 1}, key_a, &payload) ||
+       !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+    return_value = 5;
+    if(!cose_eddsa_verify_one(token, key_b, &payload)) {
+        goto Done;
+    }
+
+    /* Ed25519 signatures are deterministic */
+    return_value = 6;
+    if(cose_eddsa_sign(PAYLOAD,
+                       key_a,
+                       (struct q_useful_buf_c){"kid-1", 5},
+                       (struct q_useful_buf){second, sizeof(second)},
+                       &tokens[0]) ||
+       !same_bytes(tokens[0], token)) {
+        goto Done;
+    }
+
+    /* Without a kid every byte is signed or is the structure, so
+     * changing any bit must fail */
+    return_value = 7;
+    if(cose_eddsa_sign(PAYLOAD,
+                       key_a,
+                       NULL_Q_USEFUL_BUF_C,
+                       (struct q_useful_buf){buffer, sizeof(buffer)},
+                       &token)) {
+        goto Done;
+    }
+    return_value = 8;
+    for(i = 0; i < token.len; i++) {
+        for(bit = 0; bit < 8; bit++) {
+            buffer[i] ^= (uint8_t)(1 << bit);
+            if(!cose_eddsa_verify(&verifier, token, &payload)) {
+                goto Done;
+            }
+            buffer[i] ^= (uint8_t)(1 << bit);
+        }
+    }
+
+    /* The same verifier for several, one of them not valid */
+    tokens[1] = token;
+    tokens[2] = (struct q_useful_buf_c){token.ptr, token.len - 1};
+    return_value = 9;
+    if(cose_eddsa_verify_each(&verifier, tokens, 3, valid) != 2 ||
+       !valid[0] || !valid[1] || valid[2]) {
+        goto Done;
+    }
+
+    /* Through the envelope, which does EdDSA itself rather than with
+     * t_cose */
+    return_value = 10;
+    if(cose_envelope_wrap(PAYLOAD,
+                          CTOKEN_PROTECTION_COSE_SIGN1,
+                          COSE_ENVELOPE_TAG_CWT,
+                          COSE_ALGORITHM_EDDSA,
+                          0,
+                          key_a,
+                          NULL_Q_USEFUL_BUF_C,
+                          no_key,
+                          (struct q_useful_buf){wrapped, sizeof(wrapped)},
+                          &token)) {
+        goto Done;
+    }
+    return_value = 11;
+    if(token.len < 3 || memcmp(token.ptr, "\xd8\x3d\xd2", 3)) {
+        goto Done;
+    }
+    return_value = 12;
+    if(cose_envelope_unwrap(token, 0, key_a, &payload) || !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+    return_value = 13;
+    if(!cose_envelope_unwrap(token, 0, key_b, &payload)) {
+        goto Done;
+    }
+
+    /* EdDSA needs an Ed25519 key */
+    return_value = 14;
+    if(!cose_envelope_wrap(PAYLOAD,
+                           CTOKEN_PROTECTION_COSE_SIGN1,
+                           COSE_ENVELOPE_TAG_CWT,
+                           -7,
+                           0,
+                           key_a,
+                           NULL_Q_USEFUL_BUF_C,
+                           no_key,
+                           (struct q_useful_buf){wrapped, sizeof(wrapped)},
+                           &token)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    cose_eddsa_verifier_free(&verifier);
+    free_ec_key(key_a);
+    free_ec_key(key_b);
+
+    return return_value;
+}
@@ -0,0 +1,26 @@
+/*
+ * cose_eddsa_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_eddsa_tests_h
+#define cose_eddsa_tests_h
+
+#include <stdint.h>
+
+
+/* An EdDSA COSE_Sign1 verifies with the key it was signed with, tagged
+ * or not and with a reused verifier, and not with another key or after
+ * any byte of the signed part is changed. It also goes through
+ * cose_envelope_wrap() and cose_envelope_unwrap(). */
+int32_t cose_eddsa_test(void);
+
+
+#endif /* cose_eddsa_tests_h */
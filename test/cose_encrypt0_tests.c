@@ -0,0 +1,165 @@
+/*
+ * cose_encrypt0_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_encrypt0_tests.h"
+#include "cose_encrypt0.h"
+#include "cose_mac0.h"
+#include "openssl_keys.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define KEY_A "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+#define KEY_B "f0e0d0c0b0a090807060504030201000"
+
+
+/* The payload is a claims-set {1: "issuer", 6: 1600000000} */
+static const uint8_t payload_bytes[] = {
+    0xa2, 0x01, 0x66, 'i', 's', 's', 'u', 'e', 'r',
+    0x06, 0x1a, 0x5f, 0x5e, 0x10, 0x00
+};
+
+#define PAYLOAD ((struct q_useful_buf_c){payload_bytes, sizeof(payload_bytes)})
+
+
+/* Reads a key the way -in_verify_key and such do, from a file with
+ * the key in hex. */
+static int read_test_key(const char *hex,
+                         int (*reader)(const char *, struct t_cose_key *),
+                         struct t_cose_key *key)
+{
+    char  file_name[] = "/tmp/xclaim_key_XXXXXX";
+    int   fd;
+    int   return_value;
+
+    fd = mkstemp(file_name);
+    if(fd < 0) {
+        return 1;
+    }
+    return_value = write(fd, hex, strlen(hex)) != (ssize_t)strlen(hex);
+    close(fd);
+
+    if(!return_value) {
+        return_value = (*reader)(file_name, key);
+    }
+    unlink(file_name);
+
+    return return_value;
+}
+
+
+static int same_bytes(struct q_useful_buf_c a, struct q_useful_buf_c b)
+{
+    return a.len == b.len && !memcmp(a.ptr, b.ptr, a.len);
+}
+
+
+int32_t cose_encrypt0_test(void)
+{
+    struct t_cose_key     key_a;
+    struct t_cose_key     key_b;
+    struct t_cose_key     mac_key;
+    uint8_t               buffer[sizeof(payload_bytes) + COSE_MAC0_OVERHEAD + COSE_ENCRYPT0_OVERHEAD];
+    uint8_t               scratch[sizeof(buffer)];
+    struct q_useful_buf   plaintext_buf;
+    struct q_useful_buf_c token;
+    struct q_useful_buf_c mac0;
+    struct q_useful_buf_c plaintext;
+    struct q_useful_buf_c payload;
+    size_t                i;
+    int32_t               return_value;
+
+    memset(&key_a, 0, sizeof(key_a));
+    memset(&key_b, 0, sizeof(key_b));
+    memset(&mac_key, 0, sizeof(mac_key));
+
+    return_value = 1;
+    if(read_test_key(KEY_A, read_aes_key_from_file, &key_a) ||
+       read_test_key(KEY_B, read_aes_key_from_file, &key_b) ||
+       read_test_key(KEY_A, read_hmac_key_from_file, &mac_key)) {
+        goto Done;
+    }
+
+    /* The plaintext is written where the ciphertext goes */
+    plaintext_buf = cose_encrypt0_plaintext_buf((struct q_useful_buf){buffer, sizeof(buffer)});
+    return_value = 2;
+    if(plaintext_buf.len < sizeof(payload_bytes)) {
+        goto Done;
+    }
+    memcpy(plaintext_buf.ptr, payload_bytes, sizeof(payload_bytes));
+    return_value = 3;
+    if(cose_encrypt0_seal((struct q_useful_buf){buffer, sizeof(buffer)},
+                          sizeof(payload_bytes),
+                          key_a,
+                          NULL_Q_USEFUL_BUF_C,
+                          &token)) {
+        goto Done;
+    }
+    return_value = 4;
+    if(!cose_encrypt0_is_encrypt0(token) || cose_encrypt0_is_encrypt0(PAYLOAD)) {
+        goto Done;
+    }
+
+    /* Decryption is in place so each try is on a copy */
+    memcpy(scratch, token.ptr, token.len);
+    return_value = 5;
+    if(cose_encrypt0_decrypt((struct q_useful_buf_c){scratch, token.len}, key_a, &plaintext) ||
+       !same_bytes(plaintext, PAYLOAD)) {
+        goto Done;
+    }
+
+    memcpy(scratch, token.ptr, token.len);
+    return_value = 6;
+    if(!cose_encrypt0_decrypt((struct q_useful_buf_c){scratch, token.len}, key_b, &plaintext)) {
+        goto Done;
+    }
+
+    return_value = 7;
+    for(i = 0; i < token.len; i++) {
+        memcpy(scratch, token.ptr, token.len);
+        scratch[i] ^= 0x01;
+        if(!cose_encrypt0_decrypt((struct q_useful_buf_c){scratch, token.len}, key_a, &plaintext)) {
+            goto Done;
+        }
+    }
+
+    /* MAC-then-encrypt with the COSE_Mac0 made in place */
+    plaintext_buf = cose_encrypt0_plaintext_buf((struct q_useful_buf){buffer, sizeof(buffer)});
+    return_value = 8;
+    if(cose_mac0_create(PAYLOAD, mac_key, NULL_Q_USEFUL_BUF_C, plaintext_buf, &mac0) ||
+       cose_encrypt0_seal((struct q_useful_buf){buffer, sizeof(buffer)},
+                          mac0.len,
+                          key_a,
+                          NULL_Q_USEFUL_BUF_C,
+                          &token)) {
+        goto Done;
+    }
+    memcpy(scratch, token.ptr, token.len);
+    return_value = 9;
+    if(cose_encrypt0_decrypt((struct q_useful_buf_c){scratch, token.len}, key_a, &plaintext) ||
+       cose_mac0_verify(plaintext, mac_key, &payload) ||
+       !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    free_ec_key(key_a);
+    free_ec_key(key_b);
+    free_ec_key(mac_key);
+
+    return return_value;
+}
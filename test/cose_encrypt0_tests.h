@@ -0,0 +1,25 @@
+/*
+ * cose_encrypt0_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_encrypt0_tests_h
+#define cose_encrypt0_tests_h
+
+#include <stdint.h>
+
+
+/* A COSE_Encrypt0 decrypts to the plaintext, including a COSE_Mac0 in
+ * one, and doesn't decrypt after any byte is changed or with
+ * another key. */
+int32_t cose_encrypt0_test(void);
+
+
+#endif /* cose_encrypt0_tests_h */
@@ -0,0 +1,271 @@
+/*
+ * cose_envelope_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_envelope_tests.h"
+#include "cose_envelope.h"
+#include "cose_mac0.h"
+#include "openssl_keys.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define MAC_KEY "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+
+
+/* The claims-set is {1: "issuer", -70000: [1.5, 1234(h'00')]}. The
+ * second claim has a label, a half-precision float and a tag that
+ * aren't decoded anywhere in xclaim. */
+static const uint8_t claims_bytes[] = {
+    0xa2,
+    0x01, 0x66, 'i', 's', 's', 'u', 'e', 'r',
+    0x3a, 0x00, 0x01, 0x11, 0x6f,
+    0x82, 0xf9, 0x3e, 0x00, 0xd9, 0x04, 0xd2, 0x41, 0x00
+};
+
+#define CLAIMS ((struct q_useful_buf_c){claims_bytes, sizeof(claims_bytes)})
+
+
+/* Reads a key the way -in_verify_key and such do, from a file with
+ * the key in hex. */
+static int read_test_key(const char *hex,
+                         int (*reader)(const char *, struct t_cose_key *),
+                         struct t_cose_key *key)
+{
+    char  file_name[] = "/tmp/xclaim_key_XXXXXX";
+    int   fd;
+    int   return_value;
+
+    fd = mkstemp(file_name);
+    if(fd < 0) {
+        return 1;
+    }
+    return_value = write(fd, hex, strlen(hex)) != (ssize_t)strlen(hex);
+    close(fd);
+
+    if(!return_value) {
+        return_value = (*reader)(file_name, key);
+    }
+    unlink(file_name);
+
+    return return_value;
+}
+
+
+static int same_bytes(struct q_useful_buf_c a, struct q_useful_buf_c b)
+{
+    return a.len == b.len && !memcmp(a.ptr, b.ptr, a.len);
+}
+
+
+static int starts_with(struct q_useful_buf_c a, const char *head, size_t head_len)
+{
+    return a.len >= head_len && !memcmp(a.ptr, head, head_len);
+}
+
+
+int32_t cose_envelope_passthrough_test(void)
+{
+    static const struct {
+        enum ctoken_protection_t protection;
+        enum cose_envelope_tag_t tagging;
+        const char              *head;
+        size_t                   head_len;
+    } cases[] = {
+        {CTOKEN_PROTECTION_NONE,      COSE_ENVELOPE_TAG_CWT,  "\xd9\x02\x59\xa2", 4},
+        {CTOKEN_PROTECTION_NONE,      COSE_ENVELOPE_TAG_COSE, "\xa2",             1},
+        {CTOKEN_PROTECTION_NONE,      COSE_ENVELOPE_TAG_NONE, "\xa2",             1},
+        {CTOKEN_PROTECTION_COSE_MAC0, COSE_ENVELOPE_TAG_CWT,  "\xd8\x3d\xd1\x84", 4},
+        {CTOKEN_PROTECTION_COSE_MAC0, COSE_ENVELOPE_TAG_COSE, "\xd1\x84",         2},
+        {CTOKEN_PROTECTION_COSE_MAC0, COSE_ENVELOPE_TAG_NONE, "\x84",             1},
+    };
+    struct t_cose_key     mac_key;
+    struct t_cose_key     no_key;
+    uint8_t               buffer[1024];
+    struct q_useful_buf_c token;
+    struct q_useful_buf_c claims_set;
+    size_t                i;
+    int32_t               return_value;
+
+    memset(&mac_key, 0, sizeof(mac_key));
+    memset(&no_key, 0, sizeof(no_key));
+
+    if(cose_envelope_wrap_size(sizeof(claims_bytes), 5) > sizeof(buffer)) {
+        return 1;
+    }
+    return_value = 2;
+    if(read_test_key(MAC_KEY, read_hmac_key_from_file, &mac_key)) {
+        goto Done;
+    }
+
+    for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+        return_value = (int32_t)(10 + i * 10);
+        if(cose_envelope_wrap(CLAIMS,
+                              cases[i].protection,
+                              cases[i].tagging,
+                              0,
+                              0,
+                              cases[i].protection == CTOKEN_PROTECTION_NONE ? no_key : mac_key,
+                              (struct q_useful_buf_c){"kid-1", 5},
+                              no_key,
+                              (struct q_useful_buf){buffer, sizeof(buffer)},
+                              &token)) {
+            goto Done;
+        }
+        return_value++;
+        if(!starts_with(token, cases[i].head, cases[i].head_len)) {
+            goto Done;
+        }
+        return_value++;
+        if(cose_envelope_is_uccs(token) != (cases[i].protection == CTOKEN_PROTECTION_NONE)) {
+            goto Done;
+        }
+
+        /* The claims-set comes back out exactly as it went in */
+        return_value++;
+        if(cose_envelope_unwrap(token,
+                                0,
+                                cases[i].protection == CTOKEN_PROTECTION_NONE ? no_key : mac_key,
+                                &claims_set) ||
+           !same_bytes(claims_set, CLAIMS)) {
+            goto Done;
+        }
+    }
+
+    return_value = 0;
+
+Done:
+    free_ec_key(mac_key);
+
+    return return_value;
+}
+
+
+int32_t cose_envelope_unprotected_test(void)
+{
+    struct t_cose_key     mac_key;
+    struct t_cose_key     no_key;
+    uint8_t               buffer[1024];
+    uint8_t               payload[sizeof(claims_bytes) + 1];
+    struct q_useful_buf_c uccs;
+    struct q_useful_buf_c token;
+    struct q_useful_buf_c claims_set;
+    int32_t               return_value;
+
+    memset(&mac_key, 0, sizeof(mac_key));
+    memset(&no_key, 0, sizeof(no_key));
+
+    return_value = 1;
+    if(read_test_key(MAC_KEY, read_hmac_key_from_file, &mac_key)) {
+        goto Done;
+    }
+
+    /* A tagged UCCS with one spare byte after it in the buffer */
+    memcpy(buffer, "\xd9\x02\x59", 3);
+    memcpy(buffer + 3, claims_bytes, sizeof(claims_bytes));
+    buffer[3 + sizeof(claims_bytes)] = 0x00;
+    uccs = (struct q_useful_buf_c){buffer, 3 + sizeof(claims_bytes)};
+
+    /* OK with no key or with a key and no verification */
+    return_value = 2;
+    if(cose_envelope_unwrap(uccs, 0, no_key, &claims_set) ||
+       !same_bytes(claims_set, CLAIMS)) {
+        goto Done;
+    }
+    return_value = 3;
+    if(cose_envelope_unwrap(uccs, COSE_ENVELOPE_OPT_NO_VERIFY, mac_key, &claims_set) ||
+       !same_bytes(claims_set, CLAIMS)) {
+        goto Done;
+    }
+
+    /* Not OK when there is a key to verify with or protection is
+     * required, even without verification */
+    return_value = 4;
+    if(!cose_envelope_unwrap(uccs, 0, mac_key, &claims_set)) {
+        goto Done;
+    }
+    return_value = 5;
+    if(!cose_envelope_unwrap(uccs, COSE_ENVELOPE_OPT_REQUIRE_PROTECTED, no_key, &claims_set)) {
+        goto Done;
+    }
+    return_value = 6;
+    if(!cose_envelope_unwrap(uccs,
+                             COSE_ENVELOPE_OPT_NO_VERIFY | COSE_ENVELOPE_OPT_REQUIRE_PROTECTED,
+                             mac_key,
+                             &claims_set)) {
+        goto Done;
+    }
+
+    /* A byte after the UCCS */
+    return_value = 7;
+    if(!cose_envelope_unwrap((struct q_useful_buf_c){buffer, uccs.len + 1},
+                             0, no_key, &claims_set)) {
+        goto Done;
+    }
+
+    /* A byte after a COSE_Mac0 */
+    return_value = 8;
+    if(cose_envelope_wrap(CLAIMS, CTOKEN_PROTECTION_COSE_MAC0, COSE_ENVELOPE_TAG_CWT,
+                          0, 0, mac_key, NULL_Q_USEFUL_BUF_C, no_key,
+                          (struct q_useful_buf){buffer, sizeof(buffer) - 1},
+                          &token)) {
+        goto Done;
+    }
+    buffer[token.len] = 0x00;
+    return_value = 9;
+    if(cose_envelope_unwrap(token, 0, mac_key, &claims_set) ||
+       !cose_envelope_unwrap((struct q_useful_buf_c){buffer, token.len + 1},
+                             0, mac_key, &claims_set)) {
+        goto Done;
+    }
+    return_value = 10;
+    if(cose_envelope_is_uccs(token)) {
+        goto Done;
+    }
+
+    /* A correctly MACed payload that is a map with a byte after it and
+     * one that is only part of a map */
+    memcpy(payload, claims_bytes, sizeof(claims_bytes));
+    payload[sizeof(claims_bytes)] = 0x01;
+    return_value = 11;
+    if(cose_mac0_create((struct q_useful_buf_c){payload, sizeof(payload)},
+                        mac_key, NULL_Q_USEFUL_BUF_C,
+                        (struct q_useful_buf){buffer, sizeof(buffer)},
+                        &token) ||
+       !cose_envelope_unwrap(token, 0, mac_key, &claims_set)) {
+        goto Done;
+    }
+    return_value = 12;
+    if(cose_mac0_create((struct q_useful_buf_c){payload, 9},
+                        mac_key, NULL_Q_USEFUL_BUF_C,
+                        (struct q_useful_buf){buffer, sizeof(buffer)},
+                        &token) ||
+       !cose_envelope_unwrap(token, 0, mac_key, &claims_set)) {
+        goto Done;
+    }
+
+    /* Not CBOR at all */
+    return_value = 13;
+    if(cose_envelope_is_uccs((struct q_useful_buf_c){"\xff", 1}) ||
+       !cose_envelope_unwrap((struct q_useful_buf_c){"\xff", 1}, 0, no_key, &claims_set)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    free_ec_key(mac_key);
+
+    return return_value;
+}
@@ -0,0 +1,29 @@
+/*
+ * cose_envelope_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_envelope_tests_h
+#define cose_envelope_tests_h
+
+#include <stdint.h>
+
+
+/* A claims-set with claims xclaim doesn't understand comes out of
+ * every tagging of a UCCS and COSE_Mac0 byte-for-byte the same. */
+int32_t cose_envelope_passthrough_test(void);
+
+
+/* A UCCS is rejected when the input must be protected, and a token
+ * or claims-set with bytes after it is rejected. */
+int32_t cose_envelope_unprotected_test(void);
+
+
+#endif /* cose_envelope_tests_h */
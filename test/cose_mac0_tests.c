@@ -0,0 +1,148 @@
+/*
+ * cose_mac0_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "cose_mac0_tests.h"
+#include "cose_mac0.h"
+#include "openssl_keys.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define KEY_A "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+#define KEY_B "f0e0d0c0b0a090807060504030201000"
+
+
+/* The payload is a claims-set {1: "issuer", 6: 1600000000} */
+static const uint8_t payload_bytes[] = {
+    0xa2, 0x01, 0x66, 'i', 's', 's', 'u', 'e', 'r',
+    0x06, 0x1a, 0x5f, 0x5e, 0x10, 0x00
+};
+
+#define PAYLOAD ((struct q_useful_buf_c){payload_bytes, sizeof(payload_bytes)})
+
+
+/* Reads a key the way -in_verify_key and such do, from a file with
+ * the key in hex. */
+static int read_test_key(const char *hex,
+                         int (*reader)(const char *, struct t_cose_key *),
+                         struct t_cose_key *key)
+{
+    char  file_name[] = "/tmp/xclaim_key_XXXXXX";
+    int   fd;
+    int   return_value;
+
+    fd = mkstemp(file_name);
+    if(fd < 0) {
+        return 1;
+    }
+    return_value = write(fd, hex, strlen(hex)) != (ssize_t)strlen(hex);
+    close(fd);
+
+    if(!return_value) {
+        return_value = (*reader)(file_name, key);
+    }
+    unlink(file_name);
+
+    return return_value;
+}
+
+
+static int same_bytes(struct q_useful_buf_c a, struct q_useful_buf_c b)
+{
+    return a.len == b.len && !memcmp(a.ptr, b.ptr, a.len);
+}
+
+
+int32_t cose_mac0_test(void)
+{
+    struct t_cose_key     key_a;
+    struct t_cose_key     key_b;
+    uint8_t               buffer[sizeof(payload_bytes) + 5 + COSE_MAC0_OVERHEAD + 1];
+    struct q_useful_buf_c token;
+    struct q_useful_buf_c payload;
+    size_t                i;
+    int                   bit;
+    int32_t               return_value;
+
+    memset(&key_a, 0, sizeof(key_a));
+    memset(&key_b, 0, sizeof(key_b));
+
+    return_value = 1;
+    if(read_test_key(KEY_A, read_hmac_key_from_file, &key_a) ||
+       read_test_key(KEY_B, read_hmac_key_from_file, &key_b)) {
+        goto Done;
+    }
+
+    /* With a kid, tagged and not */
+    return_value = 2;
+    if(cose_mac0_create(PAYLOAD,
+                        key_a,
+                        (struct q_useful_buf_c){"kid-1", 5},
+                        (struct q_useful_buf){buffer + 1, sizeof(buffer) - 1},
+                        &token)) {
+        goto Done;
+    }
+    return_value = 3;
+    if(cose_mac0_verify(token, key_a, &payload) || !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+    buffer[0] = 0xd1; /* Tag 17 */
+    return_value = 4;
+    if(cose_mac0_verify((struct q_useful_buf_c){buffer, token.len + 1}, key_a, &payload) ||
+       !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+
+    /* Without a kid nothing is outside the MAC but the structure, so
+     * changing any bit of it must fail */
+    return_value = 5;
+    if(cose_mac0_create(PAYLOAD,
+                        key_a,
+                        NULL_Q_USEFUL_BUF_C,
+                        (struct q_useful_buf){buffer, sizeof(buffer)},
+                        &token)) {
+        goto Done;
+    }
+    return_value = 6;
+    if(cose_mac0_verify(token, key_a, &payload) || !same_bytes(payload, PAYLOAD)) {
+        goto Done;
+    }
+    return_value = 7;
+    if(!cose_mac0_verify(token, key_b, &payload)) {
+        goto Done;
+    }
+    return_value = 8;
+    for(i = 0; i < token.len; i++) {
+        for(bit = 0; bit < 8; bit++) {
+            buffer[i] ^= (uint8_t)(1 << bit);
+            if(!cose_mac0_verify(token, key_a, &payload)) {
+                goto Done;
+            }
+            buffer[i] ^= (uint8_t)(1 << bit);
+        }
+    }
+    return_value = 9;
+    if(!cose_mac0_verify((struct q_useful_buf_c){token.ptr, token.len - 1}, key_a, &payload)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    free_ec_key(key_a);
+    free_ec_key(key_b);
+
+    return return_value;
+}
@@ -0,0 +1,24 @@
+/*
+ * cose_mac0_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef cose_mac0_tests_h
+#define cose_mac0_tests_h
+
+#include <stdint.h>
+
+
+/* A COSE_Mac0 verifies with the key it was made with and not with
+ * another key or after any byte of it is changed. */
+int32_t cose_mac0_test(void);
+
+
+#endif /* cose_mac0_tests_h */
@@ -0,0 +1,156 @@
+/*
+ * csv_encode_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "csv_encode_tests.h"
+#include "csv_encode.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define COLUMNS "iss,iat,nonce,tee.iss,tee.ta1.nonce"
+
+
+static void output_string(xclaim_encoder *encoder, int64_t label, uint8_t type, const char *value, size_t len)
+{
+    struct xclaim claim;
+
+    memset(&claim, 0, sizeof(claim));
+    claim.qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim.qcbor_item.label.int64 = label;
+    claim.qcbor_item.uDataType   = type;
+    claim.qcbor_item.val.string  = (struct q_useful_buf_c){value, len};
+
+    (encoder->output_claim)(encoder->ctx, &claim);
+}
+
+
+static void output_int(xclaim_encoder *encoder, int64_t label, int64_t value)
+{
+    struct xclaim claim;
+
+    memset(&claim, 0, sizeof(claim));
+    claim.qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim.qcbor_item.label.int64 = label;
+    claim.qcbor_item.uDataType   = QCBOR_TYPE_INT64;
+    claim.qcbor_item.val.int64   = value;
+
+    (encoder->output_claim)(encoder->ctx, &claim);
+}
+
+
+/* Two tokens. The first has every column with the characters that
+ * need quoting or escaping and some claims that aren't columns. The
+ * second has only two columns. */
+static int output_tokens(struct csv_writer *writer)
+{
+    xclaim_encoder encoder;
+    struct csv_row row;
+
+    xclaim_csv_encode_init(&encoder, &row, writer);
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "a,\"b\"", 5);
+    output_int(&encoder, CTOKEN_CWT_LABEL_IAT, 5);
+    output_string(&encoder, CTOKEN_EAT_LABEL_NONCE, QCBOR_TYPE_BYTE_STRING, "\x01\xab", 2);
+    output_int(&encoder, CTOKEN_CWT_LABEL_EXPIRATION, 6);
+    (encoder.start_submods_section)(encoder.ctx);
+    (encoder.open_submod)(encoder.ctx, q_useful_buf_from_sz("tee"));
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "t\tb\nl\\", 6);
+    (encoder.start_submods_section)(encoder.ctx);
+    (encoder.open_submod)(encoder.ctx, q_useful_buf_from_sz("ta1"));
+    output_string(&encoder, CTOKEN_EAT_LABEL_NONCE, QCBOR_TYPE_BYTE_STRING, "\xff", 1);
+    (encoder.close_submod)(encoder.ctx);
+    (encoder.end_submods_section)(encoder.ctx);
+    (encoder.close_submod)(encoder.ctx);
+    (encoder.open_submod)(encoder.ctx, q_useful_buf_from_sz("other"));
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "not a column", 12);
+    (encoder.close_submod)(encoder.ctx);
+    (encoder.end_submods_section)(encoder.ctx);
+    if(csv_row_add(&row)) {
+        return 1;
+    }
+
+    xclaim_csv_encode_init(&encoder, &row, writer);
+    output_int(&encoder, CTOKEN_CWT_LABEL_IAT, 7);
+    output_string(&encoder, CTOKEN_CWT_LABEL_ISSUER, QCBOR_TYPE_TEXT_STRING, "x\ry", 3);
+
+    return csv_row_add(&row);
+}
+
+
+/* Outputs the test tokens in form and compares to expected */
+static int32_t check_output(enum csv_form_t form, const char *expected)
+{
+    struct csv_writer writer;
+    FILE             *file;
+    char             *output;
+    size_t            output_len;
+    int32_t           return_value;
+
+    output = NULL;
+    file   = open_memstream(&output, &output_len);
+    if(file == NULL) {
+        return 1;
+    }
+
+    return_value = 2;
+    if(csv_writer_init(&writer, file, form, COLUMNS) ||
+       output_tokens(&writer) ||
+       csv_writer_finish(&writer)) {
+        goto Done;
+    }
+    fflush(file);
+
+    return_value = 3;
+    if(output_len != strlen(expected) || memcmp(output, expected, output_len)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    csv_writer_free(&writer);
+    fclose(file);
+    free(output);
+
+    return return_value;
+}
+
+
+int32_t csv_quoting_test(void)
+{
+    static const char csv_expected[] =
+        "iss,iat,nonce,tee.iss,tee.ta1.nonce\n"
+        "\"a,\"\"b\"\"\",5,01ab,\"t\tb\nl\\\",ff\n"
+        "\"x\ry\",7,,,\n";
+
+    static const char tsv_expected[] =
+        "iss\tiat\tnonce\ttee.iss\ttee.ta1.nonce\n"
+        "a,\"b\"\t5\t01ab\tt\\tb\\nl\\\\\tff\n"
+        "x\\ry\t7\t\t\t\n";
+
+    int32_t result;
+
+    result = check_output(CSV_FORM_CSV, csv_expected);
+    if(result) {
+        return 10 + result;
+    }
+
+    result = check_output(CSV_FORM_TSV, tsv_expected);
+    if(result) {
+        return 20 + result;
+    }
+
+    return 0;
+}
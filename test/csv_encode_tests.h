@@ -0,0 +1,25 @@
+/*
+ * csv_encode_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef csv_encode_tests_h
+#define csv_encode_tests_h
+
+#include <stdint.h>
+
+
+/* The header and a line of CSV and of TSV for claims with commas,
+ * quotes, tabs, new lines and backslashes in them and claims in
+ * submodules. */
+int32_t csv_quoting_test(void);
+
+
+#endif /* csv_encode_tests_h */
@@ -0,0 +1,407 @@
+/*
+ * eat_profile_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "eat_profile_tests.h"
+#include "eat_profile.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <string.h>
+
+
+/* A decoder for a made-up token with some claims at the top level
+ * and a submodules section with a submodule, radio, and a nested
+ * token, tee. */
+
+#define TEST_MAX_CLAIMS 4
+
+struct test_level {
+    struct xclaim claims[TEST_MAX_CLAIMS];
+    uint32_t      count;
+};
+
+struct test_token {
+    struct test_level top;
+    struct test_level radio;
+};
+
+struct test_decoder {
+    const struct test_token *token;
+    bool                     in_radio;
+    uint32_t                 next;
+
+    /* The child of the top level for the cursor */
+    uint32_t                 position;
+};
+
+
+static const uint8_t nested_bytes[] = {0xa0};
+
+
+static enum xclaim_error_t test_next_claim(void *ctx, struct xclaim *claim)
+{
+    struct test_decoder     *me    = (struct test_decoder *)ctx;
+    const struct test_level *level = me->in_radio ? &me->token->radio : &me->token->top;
+
+    if(me->next >= level->count) {
+        return XCLAIM_NO_MORE;
+    }
+    *claim = level->claims[me->next++];
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* Child 0 is radio and child 1 is tee */
+static enum xclaim_error_t
+child_at(struct test_decoder *me, uint32_t index, struct q_useful_buf_c *name)
+{
+    if(me->in_radio || index > 1) {
+        return XCLAIM_NO_MORE;
+    }
+    if(index == 1) {
+        *name = q_useful_buf_from_sz("tee");
+        return XCLAIM_SUBMOD_IS_TOKEN;
+    }
+
+    *name        = q_useful_buf_from_sz("radio");
+    me->in_radio = true;
+    me->next     = 0;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t
+test_enter_submod(void *ctx, uint32_t index, struct q_useful_buf_c *name)
+{
+    return child_at((struct test_decoder *)ctx, index, name);
+}
+
+
+static enum xclaim_error_t test_exit_submod(void *ctx)
+{
+    ((struct test_decoder *)ctx)->in_radio = false;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t
+test_get_nested(void                  *ctx,
+                uint32_t               index,
+                enum ctoken_type_t    *type,
+                struct q_useful_buf_c *name,
+                struct q_useful_buf_c *token)
+{
+    (void)ctx;
+
+    if(index != 1) {
+        return XCLAIM_NO_MORE;
+    }
+    *type  = CTOKEN_TYPE_CWT;
+    *name  = q_useful_buf_from_sz("tee");
+    *token = (struct q_useful_buf_c){nested_bytes, sizeof(nested_bytes)};
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t cursor_at(struct test_decoder *me, struct xclaim_submod_cursor *cursor)
+{
+    enum xclaim_error_t xclaim_error;
+
+    xclaim_error = child_at(me, me->position, &(cursor->name));
+    cursor->entered = xclaim_error == XCLAIM_SUCCESS;
+    if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        cursor->nested_type  = CTOKEN_TYPE_CWT;
+        cursor->nested_token = (struct q_useful_buf_c){nested_bytes, sizeof(nested_bytes)};
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t test_first_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    if(me->in_radio) {
+        return XCLAIM_NO_MORE;
+    }
+    me->position = 0;
+
+    return cursor_at(me, cursor);
+}
+
+
+static enum xclaim_error_t test_next_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    if(cursor->entered) {
+        me->in_radio = false;
+    }
+    me->position++;
+
+    return cursor_at(me, cursor);
+}
+
+
+static void test_rewind(void *ctx)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    me->in_radio = false;
+    me->next     = 0;
+}
+
+
+static void test_decoder_init(xclaim_decoder          *decoder,
+                              struct test_decoder     *me,
+                              const struct test_token *token,
+                              bool                     with_cursor)
+{
+    memset(me, 0, sizeof(*me));
+    me->token = token;
+
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->ctx          = me;
+    decoder->next_claim   = test_next_claim;
+    decoder->enter_submod = test_enter_submod;
+    decoder->exit_submod  = test_exit_submod;
+    decoder->get_nested   = test_get_nested;
+    decoder->rewind       = test_rewind;
+    if(with_cursor) {
+        decoder->first_submod = test_first_submod;
+        decoder->next_submod  = test_next_submod;
+    }
+}
+
+
+/* An encoder that outputs nothing */
+static enum xclaim_error_t null_output_claim(void *ctx, const struct xclaim *claim)
+{
+    (void)ctx;
+    (void)claim;
+    return XCLAIM_SUCCESS;
+}
+
+static enum xclaim_error_t null_section(void *ctx)
+{
+    (void)ctx;
+    return XCLAIM_SUCCESS;
+}
+
+static enum xclaim_error_t null_open_submod(void *ctx, const struct q_useful_buf_c name)
+{
+    (void)ctx;
+    (void)name;
+    return XCLAIM_SUCCESS;
+}
+
+static enum xclaim_error_t
+null_output_nested(void *ctx, const struct q_useful_buf_c name, struct q_useful_buf_c token)
+{
+    (void)ctx;
+    (void)name;
+    (void)token;
+    return XCLAIM_SUCCESS;
+}
+
+
+static void null_encoder_init(xclaim_encoder *encoder)
+{
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->output_claim          = null_output_claim;
+    encoder->start_submods_section = null_section;
+    encoder->end_submods_section   = null_section;
+    encoder->open_submod           = null_open_submod;
+    encoder->close_submod          = null_section;
+    encoder->output_nested         = null_output_nested;
+}
+
+
+static void set_int_claim(struct test_level *level, int64_t label, int64_t value)
+{
+    struct xclaim *claim = &level->claims[level->count++];
+
+    memset(claim, 0, sizeof(*claim));
+    claim->qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim->qcbor_item.label.int64 = label;
+    claim->qcbor_item.uDataType   = QCBOR_TYPE_INT64;
+    claim->qcbor_item.val.int64   = value;
+}
+
+
+static void set_bstr_claim(struct test_level *level, int64_t label, size_t len)
+{
+    static const uint8_t bytes[64];
+    struct xclaim       *claim = &level->claims[level->count++];
+
+    memset(claim, 0, sizeof(*claim));
+    claim->qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim->qcbor_item.label.int64 = label;
+    claim->qcbor_item.uDataType   = QCBOR_TYPE_BYTE_STRING;
+    claim->qcbor_item.val.string  = (struct q_useful_buf_c){bytes, len};
+}
+
+
+/* Runs the token through a validator for profile. Returns the result
+ * of processing and the number of violations. */
+static enum xclaim_error_t validate(const struct test_token  *token,
+                                    const struct eat_profile *profile,
+                                    bool                      fail_fast,
+                                    bool                      with_cursor,
+                                    uint32_t                 *violations)
+{
+    struct eat_profile_validator validator;
+    struct test_decoder          test;
+    xclaim_decoder               inner;
+    xclaim_decoder               decoder;
+    xclaim_encoder               encoder;
+    enum xclaim_error_t          xclaim_error;
+
+    test_decoder_init(&inner, &test, token, with_cursor);
+    eat_profile_validator_init(&decoder, &validator, &inner, profile, fail_fast);
+    null_encoder_init(&encoder);
+
+    xclaim_error = xclaim_processor(&decoder, &encoder);
+    *violations = validator.violations;
+
+    return xclaim_error;
+}
+
+
+/*
+ * Public function. See eat_profile_tests.h
+ */
+int32_t eat_profile_hardware_test(void)
+{
+    static struct test_token good;
+    static struct test_token bad;
+    struct eat_profile       profile;
+    uint32_t                 violations;
+    int                      with_cursor;
+    int32_t                  return_value;
+
+    memset(&good, 0, sizeof(good));
+    set_bstr_claim(&good.top, CTOKEN_EAT_LABEL_UEID, 17);
+    set_bstr_claim(&good.top, CTOKEN_EAT_LABEL_NONCE, 8);
+    set_int_claim(&good.top, CTOKEN_EAT_LABEL_SECURITY_LEVEL, EAT_SL_HARDWARE);
+    set_int_claim(&good.top, CTOKEN_EAT_LABEL_DEBUG_STATE, CTOKEN_DEBUG_DISABLED_PERMANENT);
+    set_bstr_claim(&good.radio, CTOKEN_EAT_LABEL_UEID, 7);
+
+    /* The nonce is missing, the seclevel is not allowed and the ueid
+     * in radio is too short */
+    memset(&bad, 0, sizeof(bad));
+    set_bstr_claim(&bad.top, CTOKEN_EAT_LABEL_UEID, 17);
+    set_int_claim(&bad.top, CTOKEN_EAT_LABEL_SECURITY_LEVEL, EAT_SL_UNRESTRICTED);
+    set_bstr_claim(&bad.radio, CTOKEN_EAT_LABEL_UEID, 3);
+
+    if(eat_profile_load("hardware", &profile)) {
+        eat_profile_free(&profile);
+        return 1;
+    }
+
+    return_value = 0;
+    for(with_cursor = 0; with_cursor <= 1; with_cursor++) {
+        if(validate(&good, &profile, false, with_cursor, &violations) != XCLAIM_SUCCESS ||
+           violations != 0) {
+            return_value = 2;
+            break;
+        }
+
+        /* All the violations are found */
+        if(validate(&bad, &profile, false, with_cursor, &violations) != XCLAIM_ERR_PROFILE ||
+           violations != 3) {
+            return_value = 3;
+            break;
+        }
+
+        /* Or only the first */
+        if(validate(&bad, &profile, true, with_cursor, &violations) != XCLAIM_ERR_PROFILE ||
+           violations != 1) {
+            return_value = 4;
+            break;
+        }
+    }
+
+    eat_profile_free(&profile);
+
+    return return_value;
+}
+
+
+/*
+ * Public function. See eat_profile_tests.h
+ */
+int32_t eat_profile_rules_test(void)
+{
+    static const char *submod_rules[] = {
+        "submod:/radio",
+        "submod:/tee",
+        "submod:/gps",
+        "require:radio/nonce",
+        "type:nonce=int",
+        NULL
+    };
+    static const char *bad_rules[] = {
+        "require:/nonce=1",
+        "submod:gps",
+        "length:ueid=9-3",
+        "length:ueid",
+        "allow:ueid=1",
+        "type:ueid=string",
+        "bogus:ueid",
+        "require:/nosuchclaim",
+        "require:a//ueid",
+    };
+    static struct test_token token;
+    struct eat_profile       profile;
+    const char              *one_rule[2];
+    uint32_t                 violations;
+    size_t                   i;
+    int                      with_cursor;
+
+    /* A nested token meets a submod rule. The nonce in radio is
+     * missing and the one at the top level is the wrong type. */
+    memset(&token, 0, sizeof(token));
+    set_bstr_claim(&token.top, CTOKEN_EAT_LABEL_NONCE, 8);
+    set_bstr_claim(&token.radio, CTOKEN_EAT_LABEL_UEID, 8);
+
+    if(eat_profile_compile(submod_rules, &profile)) {
+        return 1;
+    }
+    for(with_cursor = 0; with_cursor <= 1; with_cursor++) {
+        if(validate(&token, &profile, false, with_cursor, &violations) != XCLAIM_ERR_PROFILE ||
+           violations != 3) {
+            return 2;
+        }
+    }
+
+    /* Each of these is rejected */
+    one_rule[1] = NULL;
+    for(i = 0; i < sizeof(bad_rules)/sizeof(bad_rules[0]); i++) {
+        one_rule[0] = bad_rules[i];
+        if(!eat_profile_compile(one_rule, &profile)) {
+            return 10 + (int32_t)i;
+        }
+    }
+
+    if(!eat_profile_load("no-such-profile", &profile)) {
+        eat_profile_free(&profile);
+        return 3;
+    }
+    eat_profile_free(&profile);
+
+    return 0;
+}
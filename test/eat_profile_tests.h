@@ -0,0 +1,29 @@
+/*
+ * eat_profile_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef eat_profile_tests_h
+#define eat_profile_tests_h
+
+#include <stdint.h>
+
+
+/* The built-in hardware profile passes a good token and finds every
+ * violation in a bad one, or only the first with fail_fast. */
+int32_t eat_profile_hardware_test(void);
+
+
+/* submod rules are met by submodules and nested tokens, scoped rules
+ * apply only in their submodule and bad rules don't compile. */
+int32_t eat_profile_rules_test(void);
+
+
+#endif /* eat_profile_tests_h */
@@ -0,0 +1,144 @@
+/*
+ * json_escape_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "json_escape_tests.h"
+#include "json_escape.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A fixed xorshift so every run checks the same values */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+
+static int needs_escape(uint8_t c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+
+/* The byte at a time scan that json_escape_scan() must match */
+static size_t scan_bytes(const uint8_t *string, size_t len)
+{
+    size_t i;
+
+    for(i = 0; i < len && !needs_escape(string[i]); i++);
+
+    return i;
+}
+
+
+/* Writes string with json_write_string() and checks the output */
+static int writes_as(const char *string, size_t len, const char *expected)
+{
+    char   *output;
+    size_t  output_len;
+    FILE   *file;
+    int     matched;
+
+    output = NULL;
+    file   = open_memstream(&output, &output_len);
+    if(file == NULL) {
+        return 0;
+    }
+    json_write_string(file, (struct q_useful_buf_c){string, len});
+    fclose(file);
+
+    matched = output_len == strlen(expected) && !memcmp(output, expected, output_len);
+    free(output);
+
+    return matched;
+}
+
+
+int32_t json_escape_test(void)
+{
+    /* The bytes either side of each escape class matter for the
+     * unsigned compares in the SSE2 and word paths. */
+    static const uint8_t specials[] = {
+        0x00, 0x01, 0x1f, '"', '\\', '\n', 0x7f, 0x80, 0xa2, 0xdc, 0xff,
+        0x20, 0x21, 0x23, 0x5b, 0x5d
+    };
+
+    uint8_t  buffer[80];
+    uint64_t state;
+    size_t   offset;
+    size_t   len;
+    size_t   position;
+    size_t   i;
+    size_t   j;
+
+    /* Every length from every alignment with no escape, then each of
+     * the special bytes at every position */
+    memset(buffer, 'a', sizeof(buffer));
+    for(offset = 0; offset < 16; offset++) {
+        for(len = 0; offset + len <= sizeof(buffer); len++) {
+            if(json_escape_scan(buffer + offset, len) != len) {
+                return 1;
+            }
+            for(position = 0; position < len; position++) {
+                for(i = 0; i < sizeof(specials); i++) {
+                    buffer[offset + position] = specials[i];
+                    if(json_escape_scan(buffer + offset, len) != scan_bytes(buffer + offset, len)) {
+                        return 2;
+                    }
+                }
+                buffer[offset + position] = 'a';
+            }
+        }
+    }
+
+    /* Random strings, mostly printable with some bytes to escape and
+     * some with the high bit set */
+    state = 0x2545f4914f6cdd1dULL;
+    for(i = 0; i < 100000; i++) {
+        len = next_random(&state) % sizeof(buffer);
+        for(j = 0; j < len; j++) {
+            buffer[j] = (uint8_t)(0x20 + next_random(&state) % 0x60);
+            if(next_random(&state) % 40 == 0) {
+                buffer[j] = specials[next_random(&state) % sizeof(specials)];
+            }
+        }
+        if(json_escape_scan(buffer, len) != scan_bytes(buffer, len)) {
+            return 3;
+        }
+    }
+
+    if(!writes_as("", 0, "\"\"")) {
+        return 4;
+    }
+    if(!writes_as("plain text that is longer than sixteen bytes", 44,
+                  "\"plain text that is longer than sixteen bytes\"")) {
+        return 5;
+    }
+    if(!writes_as("q\"b\\s/\b\f\n\r\t", 11, "\"q\\\"b\\\\s/\\b\\f\\n\\r\\t\"")) {
+        return 6;
+    }
+    if(!writes_as("\x01z\x1f\0", 4, "\"\\u0001z\\u001f\\u0000\"")) {
+        return 7;
+    }
+    /* UTF-8 goes through as it is */
+    if(!writes_as("caf\xc3\xa9", 5, "\"caf\xc3\xa9\"")) {
+        return 8;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * json_escape_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef json_escape_tests_h
+#define json_escape_tests_h
+
+#include <stdint.h>
+
+
+/* Checks json_escape_scan(), SSE2 or word at a time, against a
+ * byte at a time scan for every length and position of the byte
+ * needing an escape, and checks the escapes json_write_string()
+ * makes. */
+int32_t json_escape_test(void);
+
+
+#endif /* json_escape_tests_h */
@@ -0,0 +1,134 @@
+/*
+ * json_number_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "json_number_tests.h"
+#include "json_number.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <inttypes.h>
+
+
+/* A fixed xorshift so every run checks the same values */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+
+/* Formats a double and checks it reads back to the same bits and
+ * looks like a double, not an integer. */
+static int double_round_trips(double value)
+{
+    char   buffer[JSON_NUMBER_MAX_LEN];
+    size_t len;
+    double read_back;
+
+    len = json_format_double(value, buffer);
+    if(len == 0 || len >= JSON_NUMBER_MAX_LEN || strlen(buffer) != len) {
+        return 0;
+    }
+    if(strpbrk(buffer, ".eE") == NULL) {
+        return 0;
+    }
+
+    read_back = strtod(buffer, NULL);
+
+    return memcmp(&read_back, &value, sizeof(value)) == 0;
+}
+
+
+int32_t json_number_test(void)
+{
+    static const double doubles[] = {
+        0.0, -0.0, 1.0, -1.0, 0.1, 0.3, 1.0/3.0, 2.5, 100.0, 1e21, 1e22,
+        123456789012345678.0, 9007199254740993.0, 1e-7, 5e-324,
+        2.2250738585072014e-308, DBL_MAX, -DBL_MAX, 1.7976931348623157e308,
+        4.9406564584124654e-324, 0.000001, 299792458.0, 6.02214076e23
+    };
+    static const int64_t int64s[] = {
+        0, 1, -1, 9, 10, -10, 99, 100, 12345, INT32_MAX, INT32_MIN,
+        1000000000000LL, -999999999999999999LL, INT64_MAX, INT64_MIN
+    };
+    static const uint64_t uint64s[] = {
+        0, 1, 9, 10, 4294967295ULL, 4294967296ULL, 10000000000000000000ULL,
+        UINT64_MAX
+    };
+
+    char     buffer[JSON_NUMBER_MAX_LEN];
+    char     expected[JSON_NUMBER_MAX_LEN];
+    uint64_t state;
+    uint64_t bits;
+    double   value;
+    size_t   len;
+    size_t   i;
+
+    for(i = 0; i < sizeof(int64s) / sizeof(int64s[0]); i++) {
+        len = json_format_int64(int64s[i], buffer);
+        snprintf(expected, sizeof(expected), "%" PRId64, int64s[i]);
+        if(len != strlen(expected) || strcmp(buffer, expected)) {
+            return 1;
+        }
+    }
+
+    for(i = 0; i < sizeof(uint64s) / sizeof(uint64s[0]); i++) {
+        len = json_format_uint64(uint64s[i], buffer);
+        snprintf(expected, sizeof(expected), "%" PRIu64, uint64s[i]);
+        if(len != strlen(expected) || strcmp(buffer, expected)) {
+            return 2;
+        }
+    }
+
+    for(i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+        if(!double_round_trips(doubles[i])) {
+            return 3;
+        }
+    }
+
+    /* Random bit patterns cover all the exponents, subnormals
+     * included */
+    state = 0x9e3779b97f4a7c15ULL;
+    for(i = 0; i < 200000; i++) {
+        bits = next_random(&state);
+        memcpy(&value, &bits, sizeof(value));
+        if(isnan(value) || isinf(value)) {
+            continue;
+        }
+        if(!double_round_trips(value)) {
+            return 4;
+        }
+    }
+
+    /* Integers that are doubles, where the shortest form is tricky */
+    for(i = 0; i < 100000; i++) {
+        value = (double)(int64_t)(next_random(&state) >> (i % 64));
+        if(!double_round_trips(value)) {
+            return 5;
+        }
+    }
+
+    if(json_format_double(NAN, buffer) != 4 || strcmp(buffer, "null")) {
+        return 6;
+    }
+    if(json_format_double(-INFINITY, buffer) != 4 || strcmp(buffer, "null")) {
+        return 7;
+    }
+
+    return 0;
+}
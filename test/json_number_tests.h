@@ -0,0 +1,24 @@
+/*
+ * json_number_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef json_number_tests_h
+#define json_number_tests_h
+
+#include <stdint.h>
+
+
+/* Formats integers and doubles and checks they read back the same,
+ * including doubles with random bit patterns. */
+int32_t json_number_test(void);
+
+
+#endif /* json_number_tests_h */
@@ -0,0 +1,244 @@
+/*
+ * replay_store_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "replay_store_tests.h"
+#include "replay_store.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define WINDOW 100
+#define START  1600000000
+
+
+static uint64_t id_for(const struct replay_store *store, int64_t label, uint32_t n)
+{
+    uint8_t bytes[8];
+
+    memset(bytes, 0xc3, sizeof(bytes));
+    memcpy(bytes, &n, sizeof(n));
+
+    return replay_store_id(store, label, (struct q_useful_buf_c){bytes, sizeof(bytes)});
+}
+
+
+int32_t replay_store_duplicate_test(void)
+{
+    struct replay_store store;
+    int32_t             return_value;
+    uint32_t            i;
+
+    if(replay_store_open(&store, NULL, WINDOW, 1000)) {
+        return 1;
+    }
+
+    return_value = 0;
+
+    for(i = 0; i < 500; i++) {
+        if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, i), START, START) != REPLAY_NEW) {
+            return_value = 2;
+            goto Done;
+        }
+    }
+    for(i = 0; i < 500; i++) {
+        if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, i), START, START + 1) != REPLAY_DUPLICATE) {
+            return_value = 3;
+            goto Done;
+        }
+    }
+    if(store.checks != 1000 || store.duplicates != 500) {
+        return_value = 4;
+        goto Done;
+    }
+
+    /* A nonce with the same bytes as a cti is not a duplicate */
+    if(id_for(&store, CTOKEN_EAT_LABEL_NONCE, 0) == id_for(&store, CTOKEN_CWT_LABEL_CTI, 0)) {
+        return_value = 5;
+        goto Done;
+    }
+    if(replay_store_check(&store, id_for(&store, CTOKEN_EAT_LABEL_NONCE, 0), START, START + 1) != REPLAY_NEW) {
+        return_value = 6;
+        goto Done;
+    }
+
+    /* The capacity is rounded up to 1024 and only 3/4 is used */
+    for(i = 501; i < 1000; i++) {
+        if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, i), START, START + 1) == REPLAY_STORE_FULL) {
+            break;
+        }
+    }
+    if(i != 768) {
+        return_value = 7;
+        goto Done;
+    }
+
+    /* A tiny capacity is rounded up so there is still room */
+    replay_store_close(&store);
+    if(replay_store_open(&store, NULL, WINDOW, 1)) {
+        return 8;
+    }
+    for(i = 0; i < 10; i++) {
+        if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, i), START, START) != REPLAY_NEW) {
+            break;
+        }
+    }
+    if(i != REPLAY_STORE_MIN_CAPACITY / 4 * 3) {
+        return_value = 9;
+        goto Done;
+    }
+
+Done:
+    replay_store_close(&store);
+
+    return return_value;
+}
+
+
+int32_t replay_store_window_test(void)
+{
+    struct replay_store store;
+    char                file_name[] = "/tmp/xclaim_replay_XXXXXX";
+    int                 fd;
+    int32_t             return_value;
+    uint64_t            id;
+
+    fd = mkstemp(file_name);
+    if(fd < 0) {
+        return 1;
+    }
+    close(fd);
+
+    if(replay_store_open(&store, file_name, WINDOW, 64)) {
+        unlink(file_name);
+        return 2;
+    }
+
+    return_value = 0;
+
+    id = id_for(&store, CTOKEN_CWT_LABEL_CTI, 1);
+    if(replay_store_check(&store, id, START, START) != REPLAY_NEW) {
+        return_value = 3;
+        goto Done;
+    }
+
+    /* After one rotation it is in the previous table and still
+     * remembered */
+    if(replay_store_check(&store, id, START, START + WINDOW + 10) != REPLAY_DUPLICATE) {
+        return_value = 4;
+        goto Done;
+    }
+
+    /* Still there after closing and opening again */
+    replay_store_close(&store);
+    if(replay_store_open(&store, file_name, WINDOW, 64)) {
+        return_value = 5;
+        goto Done;
+    }
+    if(replay_store_check(&store, id, START, START + WINDOW + 20) != REPLAY_DUPLICATE) {
+        return_value = 6;
+        goto Done;
+    }
+
+    /* The next rotation drops it, but by then it is too old to be let
+     * in again */
+    if(replay_store_check(&store, id, START, START + 2 * WINDOW + 20) != REPLAY_TOO_OLD) {
+        return_value = 7;
+        goto Done;
+    }
+    if(replay_store_check(&store, id, START + 2 * WINDOW, START + 2 * WINDOW + 20) != REPLAY_NEW) {
+        return_value = 8;
+        goto Done;
+    }
+
+    /* Nothing for two windows clears both tables */
+    if(replay_store_check(&store, id, START + 5 * WINDOW, START + 5 * WINDOW) != REPLAY_NEW) {
+        return_value = 9;
+        goto Done;
+    }
+
+    /* Opening with another window starts over */
+    replay_store_close(&store);
+    if(replay_store_open(&store, file_name, WINDOW * 2, 64)) {
+        return_value = 10;
+        goto Done;
+    }
+    if(replay_store_check(&store, id, START + 5 * WINDOW, START + 5 * WINDOW) != REPLAY_NEW) {
+        return_value = 11;
+        goto Done;
+    }
+
+Done:
+    replay_store_close(&store);
+    unlink(file_name);
+
+    return return_value;
+}
+
+
+int32_t replay_store_iat_test(void)
+{
+    struct replay_store store;
+    int32_t             return_value;
+    uint64_t            id;
+    int64_t             now;
+    int64_t             skew;
+
+    /* The skew is half the window for short windows */
+    if(replay_store_open(&store, NULL, WINDOW, 64)) {
+        return 1;
+    }
+    skew = WINDOW / 2;
+
+    return_value = 2;
+    if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, 1), START + skew, START) != REPLAY_NEW ||
+       replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, 2), START + skew + 1, START) != REPLAY_IAT_IN_FUTURE) {
+        goto Done;
+    }
+    return_value = 3;
+    if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, 3), START - WINDOW + skew, START) != REPLAY_NEW ||
+       replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, 4), START - WINDOW + skew - 1, START) != REPLAY_TOO_OLD) {
+        goto Done;
+    }
+
+    /* A token with an iat as far ahead as allowed is never new again,
+     * however long it is replayed for */
+    id = id_for(&store, CTOKEN_CWT_LABEL_CTI, 1);
+    return_value = 4;
+    for(now = START + 1; now < START + 4 * WINDOW; now++) {
+        if(replay_store_check(&store, id, START + skew, now) == REPLAY_NEW) {
+            goto Done;
+        }
+    }
+    replay_store_close(&store);
+
+    /* The skew is at most REPLAY_STORE_MAX_SKEW for long windows */
+    if(replay_store_open(&store, NULL, 3600, 64)) {
+        return 5;
+    }
+    return_value = 6;
+    if(replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, 1), START + REPLAY_STORE_MAX_SKEW, START) != REPLAY_NEW ||
+       replay_store_check(&store, id_for(&store, CTOKEN_CWT_LABEL_CTI, 2), START + REPLAY_STORE_MAX_SKEW + 1, START) != REPLAY_IAT_IN_FUTURE) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    replay_store_close(&store);
+
+    return return_value;
+}
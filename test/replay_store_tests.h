@@ -0,0 +1,37 @@
+/*
+ * replay_store_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef replay_store_tests_h
+#define replay_store_tests_h
+
+#include <stdint.h>
+
+
+/* A token ID is new the first time and a duplicate after that, and
+ * the same bytes under another label are a different ID. A small
+ * capacity still takes some IDs. */
+int32_t replay_store_duplicate_test(void);
+
+
+/* IDs are remembered for at least the window and forgotten after
+ * twice the window. Tokens older than the window are rejected.
+ * Also that the store survives being closed and opened again. */
+int32_t replay_store_window_test(void);
+
+
+/* An iat further in the future than the skew is rejected, and a token
+ * with an iat within the skew can't get in again after its ID is
+ * forgotten. */
+int32_t replay_store_iat_test(void);
+
+
+#endif /* replay_store_tests_h */
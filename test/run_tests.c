@@ -0,0 +1,137 @@
+/*
+ * run_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+/* Runs the xclaim tests. "make test" builds and runs this.
+ *
+ *     run_tests [<name>...]
+ *
+ * With names, only the tests with those names are run. Each test
+ * returns 0 on success or a number that says which check in it
+ * failed. The exit status is the number of tests that failed.
+ */
+
+#include "cose_envelope_tests.h"
+#include "token_verify_tests.h"
+#include "verify_cache_tests.h"
+#include "replay_store_tests.h"
+#include "json_escape_tests.h"
+#include "json_number_tests.h"
+#include "xclaim_processor_tests.h"
+#include "claim_filter_tests.h"
+#include "token_stream_tests.h"
+#include "cert_chain_tests.h"
+#include "cose_eddsa_tests.h"
+#include "cose_mac0_tests.h"
+#include "cose_encrypt0_tests.h"
+#include "shm_ring_tests.h"
+#include "xclaim_batch_tests.h"
+#include "eat_profile_tests.h"
+#include "submod_seek_tests.h"
+#include "token_archive_tests.h"
+#include "columnar_encode_tests.h"
+#include "csv_encode_tests.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+struct test_entry {
+    const char *name;
+    int32_t   (*test)(void);
+};
+
+#define TEST_ENTRY(t) {#t, t}
+
+static const struct test_entry tests[] = {
+    TEST_ENTRY(cose_envelope_passthrough_test),
+    TEST_ENTRY(cose_envelope_unprotected_test),
+    TEST_ENTRY(token_verify_test),
+    TEST_ENTRY(token_verify_sequence_test),
+    TEST_ENTRY(verify_cache_test),
+    TEST_ENTRY(verify_cache_expiry_test),
+    TEST_ENTRY(replay_store_duplicate_test),
+    TEST_ENTRY(replay_store_window_test),
+    TEST_ENTRY(replay_store_iat_test),
+    TEST_ENTRY(json_escape_test),
+    TEST_ENTRY(json_number_test),
+    TEST_ENTRY(xclaim_processor_cursor_test),
+    TEST_ENTRY(xclaim_processor_limits_test),
+    TEST_ENTRY(claim_filter_scope_test),
+    TEST_ENTRY(claim_filter_hash_test),
+    TEST_ENTRY(claim_filter_nested_test),
+    TEST_ENTRY(token_stream_uccs_test),
+    TEST_ENTRY(token_stream_sign1_test),
+    TEST_ENTRY(cert_chain_cache_test),
+    TEST_ENTRY(cose_eddsa_test),
+    TEST_ENTRY(cose_mac0_test),
+    TEST_ENTRY(cose_encrypt0_test),
+    TEST_ENTRY(shm_ring_queue_test),
+    TEST_ENTRY(shm_ring_run_test),
+    TEST_ENTRY(xclaim_batch_test),
+    TEST_ENTRY(eat_profile_hardware_test),
+    TEST_ENTRY(eat_profile_rules_test),
+    TEST_ENTRY(submod_seek_test),
+    TEST_ENTRY(token_archive_query_test),
+    TEST_ENTRY(token_archive_damaged_index_test),
+    TEST_ENTRY(columnar_layout_test),
+    TEST_ENTRY(columnar_growth_test),
+    TEST_ENTRY(csv_quoting_test),
+};
+
+
+static bool selected(const char *name, int argc, char *argv[])
+{
+    int i;
+
+    if(argc < 2) {
+        return true;
+    }
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t  i;
+    int32_t result;
+    int     run;
+    int     failed;
+
+    run    = 0;
+    failed = 0;
+
+    for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if(!selected(tests[i].name, argc, argv)) {
+            continue;
+        }
+        run++;
+        result = (tests[i].test)();
+        if(result) {
+            printf("%s FAILED (returned %d)\n", tests[i].name, result);
+            failed++;
+        } else {
+            printf("%s passed\n", tests[i].name);
+        }
+    }
+
+    printf("%d of %d tests failed\n", failed, run);
+
+    return failed;
+}
@@ -0,0 +1,314 @@
+/*
+ * shm_ring_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "shm_ring_tests.h"
+#include "shm_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+
+/* A shared memory name no other test run will use */
+static void make_name(char *name, size_t name_size, const char *which)
+{
+    snprintf(name, name_size, "/xclaim-test-%s-%ld", which, (long)getpid());
+}
+
+
+/* Puts a request with id and the bytes of text. Returns 1 if the ring
+ * is full. */
+static int put_request(struct shm_ring *ring, uint64_t id, const char *text)
+{
+    struct shm_ring_slot *slot;
+    uint64_t              position;
+
+    slot = shm_ring_put_start(ring, SHM_RING_REQUEST, &position);
+    if(slot == NULL) {
+        return 1;
+    }
+    slot->id  = id;
+    slot->len = (uint32_t)strlen(text);
+    memcpy(shm_ring_slot_data(slot), text, slot->len);
+    shm_ring_put_finish(ring, SHM_RING_REQUEST, position);
+
+    return 0;
+}
+
+
+#define QUEUE_SLOTS 4
+
+
+/*
+ * Public function. See shm_ring_tests.h
+ */
+int32_t shm_ring_queue_test(void)
+{
+    struct shm_ring       ring;
+    struct shm_ring       attached;
+    struct shm_ring_slot *slot;
+    uint64_t              position;
+    uint64_t              next_id;
+    uint64_t              put_id;
+    char                  name[64];
+    char                  other_name[64];
+    int                   descriptor;
+    int                   lap;
+    int                   i;
+    int32_t               return_value;
+
+    make_name(name, sizeof(name), "queue");
+    make_name(other_name, sizeof(other_name), "other");
+    shm_unlink(name);
+    shm_unlink(other_name);
+
+    if(!shm_ring_create(&ring, name, 3, 64)) {
+        shm_ring_detach(&ring);
+        shm_unlink(name);
+        return 1;
+    }
+    if(shm_ring_create(&ring, name, QUEUE_SLOTS, 64)) {
+        return 2;
+    }
+    memset(&attached, 0, sizeof(attached));
+
+    /* The requests come out in order for several laps of the ring
+     * and a full ring takes no more */
+    return_value = 3;
+    put_id  = 0;
+    next_id = 0;
+    for(lap = 0; lap < 3; lap++) {
+        for(i = 0; i < QUEUE_SLOTS; i++) {
+            if(put_request(&ring, put_id++, "abc")) {
+                goto Done;
+            }
+        }
+        if(!put_request(&ring, put_id, "abc")) {
+            goto Done;
+        }
+        for(i = 0; i < QUEUE_SLOTS; i++) {
+            slot = shm_ring_get_start(&ring, SHM_RING_REQUEST, &position);
+            if(slot == NULL || slot->id != next_id++ || slot->len != 3 ||
+               memcmp(shm_ring_slot_data(slot), "abc", 3)) {
+                goto Done;
+            }
+            shm_ring_get_finish(&ring, SHM_RING_REQUEST, position);
+        }
+        if(shm_ring_get_start(&ring, SHM_RING_REQUEST, &position) != NULL) {
+            goto Done;
+        }
+    }
+
+    /* Another mapping sees what is put in this one */
+    return_value = 4;
+    if(shm_ring_attach(&attached, name)) {
+        goto Done;
+    }
+    if(put_request(&ring, 77, "xyz")) {
+        goto Done;
+    }
+    slot = shm_ring_get_start(&attached, SHM_RING_REQUEST, &position);
+    if(slot == NULL || slot->id != 77 || memcmp(shm_ring_slot_data(slot), "xyz", 3)) {
+        goto Done;
+    }
+    shm_ring_get_finish(&attached, SHM_RING_REQUEST, position);
+
+    /* The response ring is separate */
+    if(shm_ring_get_start(&attached, SHM_RING_RESPONSE, &position) != NULL) {
+        goto Done;
+    }
+
+    /* Shared memory that isn't a ring can't be attached */
+    return_value = 5;
+    descriptor = shm_open(other_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(descriptor < 0) {
+        goto Done;
+    }
+    i = ftruncate(descriptor, 4096);
+    close(descriptor);
+    if(i) {
+        goto Done;
+    }
+    shm_ring_detach(&attached);
+    if(!shm_ring_attach(&attached, other_name)) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    shm_ring_detach(&attached);
+    shm_ring_detach(&ring);
+    shm_unlink(name);
+    shm_unlink(other_name);
+
+    return return_value;
+}
+
+
+/* Outputs the request upper-cased. "bad" is an invalid token and
+ * "long" has too much output for a slot. */
+static int upper_case_process(void *context, struct q_useful_buf_c input_bytes, FILE *output)
+{
+    const char *input = input_bytes.ptr;
+    size_t      i;
+
+    (void)context;
+
+    if(input_bytes.len == 3 && !memcmp(input, "bad", 3)) {
+        return 2;
+    }
+    if(input_bytes.len == 4 && !memcmp(input, "long", 4)) {
+        for(i = 0; i < 1000; i++) {
+            fputc('L', output);
+        }
+        return 0;
+    }
+    for(i = 0; i < input_bytes.len; i++) {
+        fputc(toupper((unsigned char)input[i]), output);
+    }
+
+    return 0;
+}
+
+
+struct run_args {
+    const char *name;
+    int         result;
+};
+
+
+static void *run_thread(void *arg)
+{
+    struct run_args *args = arg;
+
+    args->result = shm_ring_run(args->name, 4, upper_case_process, NULL);
+
+    return NULL;
+}
+
+
+/* More requests than slots so the rings wrap while the workers run */
+#define RUN_SLOTS    8
+#define RUN_REQUESTS 200
+#define RUN_BAD      50
+#define RUN_LONG     120
+
+
+/*
+ * Public function. See shm_ring_tests.h
+ */
+int32_t shm_ring_run_test(void)
+{
+    static uint8_t        seen[RUN_REQUESTS];
+    struct shm_ring       ring;
+    struct shm_ring_slot *slot;
+    struct run_args       args;
+    pthread_t             thread;
+    uint64_t              position;
+    uint64_t              id;
+    uint32_t              put;
+    uint32_t              got;
+    char                  name[64];
+    char                  text[32];
+    char                  expected[32];
+    int32_t               return_value;
+
+    make_name(name, sizeof(name), "run");
+    shm_unlink(name);
+    if(shm_ring_create(&ring, name, RUN_SLOTS, 128)) {
+        return 1;
+    }
+
+    args.name   = name;
+    args.result = -1;
+    if(pthread_create(&thread, NULL, run_thread, &args)) {
+        shm_ring_detach(&ring);
+        shm_unlink(name);
+        return 2;
+    }
+
+    /* Keep the request ring full and take responses as they come */
+    memset(seen, 0, sizeof(seen));
+    return_value = 0;
+    put = 0;
+    got = 0;
+    while(got < RUN_REQUESTS && return_value == 0) {
+        while(put < RUN_REQUESTS) {
+            if(put == RUN_BAD) {
+                strcpy(text, "bad");
+            } else if(put == RUN_LONG) {
+                strcpy(text, "long");
+            } else {
+                snprintf(text, sizeof(text), "token%u", put);
+            }
+            if(put_request(&ring, put, text)) {
+                break;
+            }
+            put++;
+        }
+
+        slot = shm_ring_get_start(&ring, SHM_RING_RESPONSE, &position);
+        if(slot == NULL) {
+            shm_ring_wait(&ring, SHM_RING_RESPONSE);
+            continue;
+        }
+
+        id = slot->id;
+        if(id >= RUN_REQUESTS || seen[id]) {
+            return_value = 3;
+        } else if(id == RUN_BAD || id == RUN_LONG) {
+            if(slot->status != (id == RUN_BAD ? 2 : 1) || slot->len != 0) {
+                return_value = 4;
+            }
+        } else {
+            snprintf(expected, sizeof(expected), "TOKEN%u", (unsigned)id);
+            if(slot->status != 0 || slot->len != strlen(expected) ||
+               memcmp(shm_ring_slot_data(slot), expected, slot->len)) {
+                return_value = 5;
+            }
+        }
+        if(id < RUN_REQUESTS) {
+            seen[id] = 1;
+        }
+        shm_ring_get_finish(&ring, SHM_RING_RESPONSE, position);
+        got++;
+    }
+
+    /* After a failure the rest of the responses are taken so no
+     * worker is left waiting for a free response slot */
+    atomic_store(&ring.header->shutdown, 1);
+    while(got < put) {
+        slot = shm_ring_get_start(&ring, SHM_RING_RESPONSE, &position);
+        if(slot == NULL) {
+            shm_ring_wait(&ring, SHM_RING_RESPONSE);
+            continue;
+        }
+        shm_ring_get_finish(&ring, SHM_RING_RESPONSE, position);
+        got++;
+    }
+    pthread_join(thread, NULL);
+
+    /* The largest status is the result */
+    if(return_value == 0 && args.result != 2) {
+        return_value = 6;
+    }
+
+    shm_ring_detach(&ring);
+    shm_unlink(name);
+
+    return return_value;
+}
@@ -0,0 +1,32 @@
+/*
+ * shm_ring_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef shm_ring_tests_h
+#define shm_ring_tests_h
+
+#include <stdint.h>
+
+
+/* A ring gives back what is put in it, in order, over several laps,
+ * refuses puts when full and is seen the same through a second
+ * mapping. Bad slot counts and memory that isn't a ring are
+ * rejected. */
+int32_t shm_ring_queue_test(void);
+
+
+/* shm_ring_run() with several workers answers every request once
+ * with the right output and status, and returns the largest
+ * status. */
+int32_t shm_ring_run_test(void);
+
+
+#endif /* shm_ring_tests_h */
@@ -0,0 +1,255 @@
+/*
+ * submod_seek_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "submod_seek_tests.h"
+#include "ctoken_adapt.h"
+#include "cbor_seq.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <string.h>
+
+
+/* Makes CBOR for a test token */
+struct test_cbor {
+    uint8_t bytes[512];
+    size_t  len;
+};
+
+
+static void put_head(struct test_cbor *me, uint8_t major_type, uint64_t argument)
+{
+    me->len += cbor_encode_head(major_type, argument, me->bytes + me->len);
+}
+
+
+static void put_string(struct test_cbor *me, uint8_t major_type, const char *string)
+{
+    put_head(me, major_type, strlen(string));
+    memcpy(me->bytes + me->len, string, strlen(string));
+    me->len += strlen(string);
+}
+
+
+static void put_text(struct test_cbor *me, const char *text)
+{
+    put_string(me, CBOR_MAJOR_TYPE_TEXT_STRING, text);
+}
+
+
+/* A claim with a text string value */
+static void put_text_claim(struct test_cbor *me, int64_t label, const char *value)
+{
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, (uint64_t)label);
+    put_text(me, value);
+}
+
+
+static void put_submods_label(struct test_cbor *me)
+{
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_EAT_LABEL_SUBMODS);
+}
+
+
+/* A UCCS with submodules radio, tee, gps and json. tee has the
+ * submodules ta1 and ta2. gps is a nested CWT and json is a nested
+ * JSON token.
+ *
+ * 601({1: "top",
+ *      submods: {"radio": {1: "radio"},
+ *                "tee": {1: "tee",
+ *                        submods: {"ta1": {1: "ta1", 6: 5},
+ *                                  "ta2": {1: "ta2"}}},
+ *                "gps": h'A0',
+ *                "json": "{}"}})
+ */
+static void make_token(struct test_cbor *me)
+{
+    me->len = 0;
+    put_head(me, CBOR_MAJOR_TYPE_TAG, 601);
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 2);
+    put_text_claim(me, CTOKEN_CWT_LABEL_ISSUER, "top");
+    put_submods_label(me);
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 4);
+
+    put_text(me, "radio");
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 1);
+    put_text_claim(me, CTOKEN_CWT_LABEL_ISSUER, "radio");
+
+    put_text(me, "tee");
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 2);
+    put_text_claim(me, CTOKEN_CWT_LABEL_ISSUER, "tee");
+    put_submods_label(me);
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 2);
+    put_text(me, "ta1");
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 2);
+    put_text_claim(me, CTOKEN_CWT_LABEL_ISSUER, "ta1");
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_IAT);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, 5);
+    put_text(me, "ta2");
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 1);
+    put_text_claim(me, CTOKEN_CWT_LABEL_ISSUER, "ta2");
+
+    put_text(me, "gps");
+    put_string(me, CBOR_MAJOR_TYPE_BYTE_STRING, "\xa0");
+
+    put_text(me, "json");
+    put_text(me, "{}");
+}
+
+
+/* Splits a path like "tee/ta1" the way -submod does and seeks to it.
+ * The decoder is left for getting the claims of what was found. */
+static enum xclaim_error_t seek(const struct test_cbor     *token,
+                                const char                  *path_string,
+                                xclaim_decoder              *decoder,
+                                struct ctoken_decode_ctx    *decode_ctx,
+                                struct xclaim_submod_cursor *found)
+{
+    struct q_useful_buf_c path[XCLAIM_MAX_NESTING];
+    struct t_cose_key     no_key;
+    const char           *slash;
+    uint32_t              path_len;
+
+    for(path_len = 0; *path_string != '\0'; path_len++) {
+        slash = strchr(path_string, '/');
+        path[path_len].ptr = path_string;
+        path[path_len].len = slash ? (size_t)(slash - path_string) : strlen(path_string);
+        path_string += path[path_len].len + (slash ? 1 : 0);
+    }
+
+    memset(&no_key, 0, sizeof(no_key));
+    memset(found, 0, sizeof(*found));
+    if(xclaim_ctoken_decode_init(decoder, decode_ctx, (struct q_useful_buf_c){token->bytes, token->len}, no_key)) {
+        return XLCAIM_GENERAL_ERROR_BASE;
+    }
+
+    return xclaim_ctoken_seek_submod(decode_ctx, path, path_len, found);
+}
+
+
+/* Checks the next claim from the decoder is a text string */
+static int check_text_claim(xclaim_decoder *decoder, int64_t label, const char *value)
+{
+    struct xclaim claim;
+
+    memset(&claim, 0, sizeof(claim));
+    if(decoder->next_claim(decoder->ctx, &claim) != XCLAIM_SUCCESS) {
+        return 1;
+    }
+
+    return claim.qcbor_item.uLabelType != QCBOR_TYPE_INT64 ||
+           claim.qcbor_item.label.int64 != label ||
+           claim.qcbor_item.uDataType != QCBOR_TYPE_TEXT_STRING ||
+           q_useful_buf_compare(claim.qcbor_item.val.string, q_useful_buf_from_sz(value));
+}
+
+
+static int same_name(struct q_useful_buf_c name, const char *expected)
+{
+    return !q_useful_buf_compare(name, q_useful_buf_from_sz(expected));
+}
+
+
+/*
+ * Public function. See submod_seek_tests.h
+ */
+int32_t submod_seek_test(void)
+{
+    static const char *not_found[] = {
+        "nosuch",
+        "tee/ta3",
+        "radio/x",     /* radio has no submodules */
+        "gps/x",       /* nested tokens aren't gone into */
+        "tee/ta1/x",
+    };
+    static struct test_cbor     token;
+    struct ctoken_decode_ctx    decode_ctx;
+    xclaim_decoder              decoder;
+    struct xclaim_submod_cursor found;
+    struct xclaim               claim;
+    size_t                      i;
+
+    make_token(&token);
+
+    /* Two levels down. Only the claims of ta1 come back. */
+    if(seek(&token, "tee/ta1", &decoder, &decode_ctx, &found) != XCLAIM_SUCCESS ||
+       !same_name(found.name, "ta1")) {
+        return 1;
+    }
+    if(check_text_claim(&decoder, CTOKEN_CWT_LABEL_ISSUER, "ta1")) {
+        return 2;
+    }
+    if(decoder.next_claim(decoder.ctx, &claim) != XCLAIM_SUCCESS ||
+       claim.qcbor_item.label.int64 != CTOKEN_CWT_LABEL_IAT ||
+       claim.qcbor_item.val.int64 != 5) {
+        return 3;
+    }
+    if(decoder.next_claim(decoder.ctx, &claim) != XCLAIM_NO_MORE) {
+        return 4;
+    }
+
+    /* A submodule after one that is skipped */
+    if(seek(&token, "tee", &decoder, &decode_ctx, &found) != XCLAIM_SUCCESS ||
+       !same_name(found.name, "tee") ||
+       check_text_claim(&decoder, CTOKEN_CWT_LABEL_ISSUER, "tee")) {
+        return 5;
+    }
+    if(seek(&token, "tee/ta2/", &decoder, &decode_ctx, &found) != XCLAIM_SUCCESS ||
+       check_text_claim(&decoder, CTOKEN_CWT_LABEL_ISSUER, "ta2")) {
+        return 6;
+    }
+
+    /* Nested tokens are returned, not decoded */
+    if(seek(&token, "gps", &decoder, &decode_ctx, &found) != XCLAIM_SUBMOD_IS_TOKEN ||
+       !same_name(found.name, "gps") ||
+       found.nested_type != CTOKEN_TYPE_CWT ||
+       found.nested_token.len != 1 ||
+       ((const uint8_t *)found.nested_token.ptr)[0] != 0xa0) {
+        return 7;
+    }
+    if(seek(&token, "json", &decoder, &decode_ctx, &found) != XCLAIM_SUBMOD_IS_TOKEN ||
+       found.nested_type != CTOKEN_TYPE_JSON ||
+       !same_name(found.nested_token, "{}")) {
+        return 8;
+    }
+
+    for(i = 0; i < sizeof(not_found)/sizeof(not_found[0]); i++) {
+        if(seek(&token, not_found[i], &decoder, &decode_ctx, &found) != XCLAIM_NO_MORE) {
+            return 10 + (int32_t)i;
+        }
+    }
+
+    /* No submodules section at all */
+    token.len = 0;
+    put_head(&token, CBOR_MAJOR_TYPE_TAG, 601);
+    put_head(&token, CBOR_MAJOR_TYPE_MAP, 1);
+    put_text_claim(&token, CTOKEN_CWT_LABEL_ISSUER, "top");
+    if(seek(&token, "tee", &decoder, &decode_ctx, &found) != XCLAIM_NO_MORE) {
+        return 20;
+    }
+
+    /* A submodule name that isn't a text string */
+    token.len = 0;
+    put_head(&token, CBOR_MAJOR_TYPE_TAG, 601);
+    put_head(&token, CBOR_MAJOR_TYPE_MAP, 1);
+    put_submods_label(&token);
+    put_head(&token, CBOR_MAJOR_TYPE_MAP, 1);
+    put_head(&token, CBOR_MAJOR_TYPE_POSITIVE_INT, 4);
+    put_head(&token, CBOR_MAJOR_TYPE_MAP, 0);
+    if(seek(&token, "tee", &decoder, &decode_ctx, &found) !=
+       XCLAIM_CTOKEN_ERROR_BASE + CTOKEN_ERR_SUBMOD_NAME_NOT_A_TEXT_STRING) {
+        return 21;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * submod_seek_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef submod_seek_tests_h
+#define submod_seek_tests_h
+
+#include <stdint.h>
+
+
+/* Seeks to submodules of a UCCS by path, as -submod does, and checks
+ * that only the claims of the one at the end of the path come back.
+ * Also covers nested tokens at the end of a path, paths that aren't
+ * in the token and a submodule name that isn't a text string. */
+int32_t submod_seek_test(void);
+
+
+#endif /* submod_seek_tests_h */
@@ -0,0 +1,363 @@
+/*
+ * token_archive_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "token_archive_tests.h"
+#include "token_archive.h"
+#include "cbor_seq.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define TOKEN_COUNT   60
+#define INDEXED_COUNT 40
+#define DEVICE_COUNT  3
+#define TOKEN_MAX_LEN 64
+#define UCCS_TAG      601
+
+
+struct test_tokens {
+    uint8_t bytes[TOKEN_COUNT][TOKEN_MAX_LEN];
+    size_t  len[TOKEN_COUNT];
+};
+
+
+static int64_t iat_of(uint32_t n)
+{
+    /* Not in the order they are added */
+    return 1000 + (int64_t)((n * 7) % TOKEN_COUNT) * 10;
+}
+
+
+static size_t encode_label(int64_t label, uint8_t *out)
+{
+    if(label < 0) {
+        return cbor_encode_head(CBOR_MAJOR_TYPE_NEGATIVE_INT, (uint64_t)(-1 - label), out);
+    }
+    return cbor_encode_head(CBOR_MAJOR_TYPE_POSITIVE_INT, (uint64_t)label, out);
+}
+
+
+static size_t encode_id(uint32_t value, uint8_t *out)
+{
+    size_t len;
+
+    len = cbor_encode_head(CBOR_MAJOR_TYPE_BYTE_STRING, 8, out);
+    memset(out + len, 0x5c, 8);
+    memcpy(out + len, &value, sizeof(value));
+
+    return len + 8;
+}
+
+
+/* Token n is a UCCS with ueid n % DEVICE_COUNT, cti n and iat
+ * iat_of(n). */
+static void make_tokens(struct test_tokens *tokens)
+{
+    uint8_t *out;
+    size_t   len;
+    uint32_t n;
+
+    for(n = 0; n < TOKEN_COUNT; n++) {
+        out = tokens->bytes[n];
+        len  = cbor_encode_head(CBOR_MAJOR_TYPE_TAG, UCCS_TAG, out);
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_MAP, 3, out + len);
+        len += encode_label(CTOKEN_EAT_LABEL_UEID, out + len);
+        len += encode_id(n % DEVICE_COUNT, out + len);
+        len += encode_label(CTOKEN_CWT_LABEL_CTI, out + len);
+        len += encode_id(n, out + len);
+        len += encode_label(CTOKEN_CWT_LABEL_IAT, out + len);
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_POSITIVE_INT, (uint64_t)iat_of(n), out + len);
+        tokens->len[n] = len;
+    }
+}
+
+
+static int add_tokens(const char *name, const struct test_tokens *tokens, uint32_t first, uint32_t end)
+{
+    uint8_t  sequence[TOKEN_COUNT * TOKEN_MAX_LEN];
+    size_t   len;
+    uint32_t n;
+
+    len = 0;
+    for(n = first; n < end; n++) {
+        memcpy(sequence + len, tokens->bytes[n], tokens->len[n]);
+        len += tokens->len[n];
+    }
+
+    return token_archive_add(name, (struct q_useful_buf_c){sequence, len});
+}
+
+
+/* What the query callback found */
+struct found_tokens {
+    const struct test_tokens *tokens;
+    uint32_t                  count;
+    uint32_t                  numbers[TOKEN_COUNT];
+};
+
+
+static int found_callback(void *context, struct q_useful_buf token)
+{
+    struct found_tokens *found = (struct found_tokens *)context;
+    uint32_t             n;
+
+    for(n = 0; n < TOKEN_COUNT; n++) {
+        if(token.len == found->tokens->len[n] && !memcmp(token.ptr, found->tokens->bytes[n], token.len)) {
+            break;
+        }
+    }
+    if(found->count < TOKEN_COUNT) {
+        found->numbers[found->count++] = n;
+    }
+
+    return 0;
+}
+
+
+/* Runs a query and checks it found each of the tokens that should
+ * match once, the indexed ones first in iat order. ueid and cti are
+ * the token numbers or -1 for any. */
+static int32_t check_query(const struct token_archive *archive,
+                           const struct test_tokens   *tokens,
+                           int32_t                     ueid,
+                           int32_t                     cti,
+                           int64_t                     from,
+                           int64_t                     to)
+{
+    struct token_archive_query query;
+    struct found_tokens        found;
+    uint8_t                    ueid_bytes[16];
+    uint8_t                    cti_bytes[16];
+    uint64_t                   match_count;
+    uint32_t                   expected_count;
+    uint32_t                   seen[TOKEN_COUNT];
+    uint32_t                   n;
+    uint32_t                   i;
+    bool                       matches;
+
+    query.ueid = NULL_Q_USEFUL_BUF_C;
+    query.cti  = NULL_Q_USEFUL_BUF_C;
+    query.from = from;
+    query.to   = to;
+    if(ueid >= 0) {
+        query.ueid = (struct q_useful_buf_c){ueid_bytes + 1, encode_id((uint32_t)ueid, ueid_bytes) - 1};
+    }
+    if(cti >= 0) {
+        query.cti = (struct q_useful_buf_c){cti_bytes + 1, encode_id((uint32_t)cti, cti_bytes) - 1};
+    }
+
+    found.tokens = tokens;
+    found.count  = 0;
+    if(token_archive_query(archive, &query, found_callback, &found, &match_count) != 0 ||
+       match_count != found.count) {
+        return 1;
+    }
+
+    memset(seen, 0, sizeof(seen));
+    for(i = 0; i < found.count; i++) {
+        n = found.numbers[i];
+        if(n >= TOKEN_COUNT) {
+            return 2;
+        }
+        seen[n]++;
+        if(i > 0 && n < INDEXED_COUNT && found.numbers[i - 1] >= INDEXED_COUNT) {
+            return 3;
+        }
+        if(i > 0 && n < INDEXED_COUNT && iat_of(found.numbers[i - 1]) > iat_of(n)) {
+            return 4;
+        }
+    }
+
+    expected_count = 0;
+    for(n = 0; n < TOKEN_COUNT; n++) {
+        matches = (ueid < 0 || n % DEVICE_COUNT == (uint32_t)ueid) &&
+                  (cti < 0 || n == (uint32_t)cti) &&
+                  iat_of(n) >= from &&
+                  iat_of(n) <= to;
+        if(seen[n] != (matches ? 1 : 0)) {
+            return 5;
+        }
+        expected_count += matches;
+    }
+    if(found.count != expected_count) {
+        return 6;
+    }
+
+    return 0;
+}
+
+
+int32_t token_archive_query_test(void)
+{
+    static struct test_tokens tokens;
+    struct token_archive      archive;
+    char                      dir_name[] = "/tmp/xclaim_archive_XXXXXX";
+    char                      name[sizeof(dir_name) + 16];
+    char                      index_name[sizeof(name) + 4];
+    int32_t                   return_value;
+    int32_t                   result;
+
+    if(mkdtemp(dir_name) == NULL) {
+        return 1;
+    }
+    snprintf(name, sizeof(name), "%s/archive", dir_name);
+    snprintf(index_name, sizeof(index_name), "%s.idx", name);
+
+    memset(&archive, 0, sizeof(archive));
+    make_tokens(&tokens);
+
+    /* The first add makes the index. The second is small enough to be
+     * left after it. */
+    return_value = 2;
+    if(add_tokens(name, &tokens, 0, INDEXED_COUNT) ||
+       add_tokens(name, &tokens, INDEXED_COUNT, TOKEN_COUNT) ||
+       token_archive_open(&archive, name)) {
+        goto Done;
+    }
+    return_value = 3;
+    if(archive.tail_count != TOKEN_COUNT - INDEXED_COUNT) {
+        goto Done;
+    }
+
+    return_value = 100;
+    result = check_query(&archive, &tokens, -1, -1, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+    return_value = 200;
+    result = check_query(&archive, &tokens, 1, -1, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+    return_value = 300;
+    result = check_query(&archive, &tokens, -1, 12, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+    return_value = 400;
+    result = check_query(&archive, &tokens, -1, 45, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+    return_value = 500;
+    result = check_query(&archive, &tokens, -1, -1, 1100, 1300);
+    if(result) {
+        goto Done;
+    }
+    return_value = 600;
+    result = check_query(&archive, &tokens, 2, -1, 1150, 1400);
+    if(result) {
+        goto Done;
+    }
+    /* A ueid and cti that don't go together */
+    return_value = 700;
+    result = check_query(&archive, &tokens, 0, 13, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+    /* No such ueid */
+    return_value = 800;
+    result = check_query(&archive, &tokens, 7, -1, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+
+    return_value = 0;
+    result       = 0;
+
+Done:
+    token_archive_close(&archive);
+    unlink(index_name);
+    unlink(name);
+    rmdir(dir_name);
+
+    return return_value + result;
+}
+
+
+int32_t token_archive_damaged_index_test(void)
+{
+    static struct test_tokens tokens;
+    struct token_archive      archive;
+    char                      dir_name[] = "/tmp/xclaim_archive_XXXXXX";
+    char                      name[sizeof(dir_name) + 16];
+    char                      index_name[sizeof(name) + 4];
+    uint8_t                   damage[2 * INDEXED_COUNT * sizeof(uint32_t)];
+    FILE                     *index_file;
+    int32_t                   return_value;
+    int32_t                   result;
+
+    if(mkdtemp(dir_name) == NULL) {
+        return 1;
+    }
+    snprintf(name, sizeof(name), "%s/archive", dir_name);
+    snprintf(index_name, sizeof(index_name), "%s.idx", name);
+
+    memset(&archive, 0, sizeof(archive));
+    make_tokens(&tokens);
+
+    return_value = 2;
+    if(add_tokens(name, &tokens, 0, INDEXED_COUNT)) {
+        goto Done;
+    }
+
+    /* Every posting, after the 64 byte header and the 40 byte
+     * entries, is made to refer past the last entry */
+    memset(damage, 0xff, sizeof(damage));
+    index_file = fopen(index_name, "r+b");
+    return_value = 3;
+    if(index_file == NULL) {
+        goto Done;
+    }
+    if(fseek(index_file, 64 + INDEXED_COUNT * 40, SEEK_SET) ||
+       fwrite(damage, 1, sizeof(damage), index_file) != sizeof(damage)) {
+        fclose(index_file);
+        goto Done;
+    }
+    fclose(index_file);
+
+    /* The rest go after the index as before */
+    return_value = 4;
+    if(add_tokens(name, &tokens, INDEXED_COUNT, TOKEN_COUNT) ||
+       token_archive_open(&archive, name) ||
+       archive.tail_count != TOKEN_COUNT - INDEXED_COUNT) {
+        goto Done;
+    }
+
+    /* The queries on ueid and cti still find everything */
+    return_value = 100;
+    result = check_query(&archive, &tokens, 1, -1, INT64_MIN, INT64_MAX);
+    if(result) {
+        goto Done;
+    }
+    return_value = 200;
+    result = check_query(&archive, &tokens, -1, 12, 1000, 1400);
+    if(result) {
+        goto Done;
+    }
+
+    return_value = 0;
+    result       = 0;
+
+Done:
+    token_archive_close(&archive);
+    unlink(index_name);
+    unlink(name);
+    rmdir(dir_name);
+
+    return return_value + result;
+}
@@ -0,0 +1,29 @@
+/*
+ * token_archive_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef token_archive_tests_h
+#define token_archive_tests_h
+
+#include <stdint.h>
+
+
+/* Tokens added to an archive are found by ueid, cti and iat range,
+ * both those covered by the index and those after it. */
+int32_t token_archive_query_test(void);
+
+
+/* Postings in the index that refer past the last entry aren't used
+ * and the tokens are still found. */
+int32_t token_archive_damaged_index_test(void);
+
+
+#endif /* token_archive_tests_h */
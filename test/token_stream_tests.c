@@ -0,0 +1,381 @@
+/*
+ * token_stream_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "token_stream_tests.h"
+#include "token_stream.h"
+#include "cbor_seq.h"
+#include "openssl_keys.h"
+#include "ctoken/ctoken_cwt_labels.h"
+#include "ctoken/ctoken_eat_labels.h"
+
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/ecdsa.h>
+
+
+/* CBOR is put together in one of these */
+struct builder {
+    uint8_t bytes[1024];
+    size_t  len;
+};
+
+
+static void put_head(struct builder *me, uint8_t major_type, uint64_t argument)
+{
+    me->len += cbor_encode_head(major_type, argument, me->bytes + me->len);
+}
+
+
+static void put_bytes(struct builder *me, const void *bytes, size_t len)
+{
+    memcpy(me->bytes + me->len, bytes, len);
+    me->len += len;
+}
+
+
+static void put_string(struct builder *me, uint8_t major_type, const void *bytes, size_t len)
+{
+    put_head(me, major_type, len);
+    put_bytes(me, bytes, len);
+}
+
+
+static struct q_useful_buf_c built(const struct builder *me)
+{
+    return (struct q_useful_buf_c){me->bytes, me->len};
+}
+
+
+static const uint8_t nonce_bytes[] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+
+/* The claims-set {iss: "abc", nonce: h'0102030405060708', iat: 100,
+ * submods: {"sm": {iss: "x"}}} */
+static void make_claims(struct builder *me)
+{
+    me->len = 0;
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 4);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_ISSUER);
+    put_string(me, CBOR_MAJOR_TYPE_TEXT_STRING, "abc", 3);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_EAT_LABEL_NONCE);
+    put_string(me, CBOR_MAJOR_TYPE_BYTE_STRING, nonce_bytes, sizeof(nonce_bytes));
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_IAT);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, 100);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_EAT_LABEL_SUBMODS);
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 1);
+    put_string(me, CBOR_MAJOR_TYPE_TEXT_STRING, "sm", 2);
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 1);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_ISSUER);
+    put_string(me, CBOR_MAJOR_TYPE_TEXT_STRING, "x", 1);
+}
+
+
+/* Protected headers {1: -7}, alg ES256 */
+static const uint8_t es256_protected[] = {0xa1, 0x01, 0x26};
+
+
+/* Signs claims with ES256 and makes the COSE_Sign1 */
+static int make_sign1(EVP_PKEY *key, struct q_useful_buf_c claims, struct builder *token)
+{
+    struct builder       to_be_signed;
+    uint8_t              der[80];
+    const unsigned char *der_ptr;
+    size_t               der_len;
+    uint8_t              signature[64];
+    ECDSA_SIG           *sig;
+    EVP_MD_CTX          *md_ctx;
+    int                  ok;
+
+    to_be_signed.len = 0;
+    put_head(&to_be_signed, CBOR_MAJOR_TYPE_ARRAY, 4);
+    put_string(&to_be_signed, CBOR_MAJOR_TYPE_TEXT_STRING, "Signature1", 10);
+    put_string(&to_be_signed, CBOR_MAJOR_TYPE_BYTE_STRING, es256_protected, sizeof(es256_protected));
+    put_string(&to_be_signed, CBOR_MAJOR_TYPE_BYTE_STRING, "", 0);
+    put_string(&to_be_signed, CBOR_MAJOR_TYPE_BYTE_STRING, claims.ptr, claims.len);
+
+    der_len = sizeof(der);
+    md_ctx  = EVP_MD_CTX_new();
+    ok = md_ctx != NULL &&
+         EVP_DigestSignInit(md_ctx, NULL, EVP_sha256(), NULL, key) &&
+         EVP_DigestSign(md_ctx, der, &der_len, to_be_signed.bytes, to_be_signed.len);
+    EVP_MD_CTX_free(md_ctx);
+    if(!ok) {
+        return 1;
+    }
+
+    /* COSE wants r and s, not DER */
+    der_ptr = der;
+    sig = d2i_ECDSA_SIG(NULL, &der_ptr, (long)der_len);
+    if(sig == NULL) {
+        return 1;
+    }
+    ok = BN_bn2binpad(ECDSA_SIG_get0_r(sig), signature, 32) == 32 &&
+         BN_bn2binpad(ECDSA_SIG_get0_s(sig), signature + 32, 32) == 32;
+    ECDSA_SIG_free(sig);
+    if(!ok) {
+        return 1;
+    }
+
+    token->len = 0;
+    put_head(token, CBOR_MAJOR_TYPE_TAG, 18);
+    put_head(token, CBOR_MAJOR_TYPE_ARRAY, 4);
+    put_string(token, CBOR_MAJOR_TYPE_BYTE_STRING, es256_protected, sizeof(es256_protected));
+    put_head(token, CBOR_MAJOR_TYPE_MAP, 0);
+    put_string(token, CBOR_MAJOR_TYPE_BYTE_STRING, claims.ptr, claims.len);
+    put_string(token, CBOR_MAJOR_TYPE_BYTE_STRING, signature, sizeof(signature));
+
+    return 0;
+}
+
+
+/* Checks the claims from make_claims() in the order they come */
+static int check_claim(uint32_t index, const struct xclaim *claim)
+{
+    const QCBORItem *item = &(claim->qcbor_item);
+
+    switch(index) {
+        case 0:
+            return item->label.int64 != CTOKEN_CWT_LABEL_ISSUER ||
+                   item->uDataType != QCBOR_TYPE_TEXT_STRING ||
+                   item->val.string.len != 3 || memcmp(item->val.string.ptr, "abc", 3);
+        case 1:
+            return item->label.int64 != CTOKEN_EAT_LABEL_NONCE ||
+                   item->uDataType != QCBOR_TYPE_BYTE_STRING ||
+                   item->val.string.len != sizeof(nonce_bytes) ||
+                   memcmp(item->val.string.ptr, nonce_bytes, sizeof(nonce_bytes));
+        case 2:
+            return item->label.int64 != CTOKEN_CWT_LABEL_IAT ||
+                   item->uDataType != QCBOR_TYPE_INT64 ||
+                   item->val.int64 != 100;
+        default:
+            return 1;
+    }
+}
+
+
+/* Feeds token chunk_size bytes at a time, checking each claim as it
+ * comes out. first_claim_at is set to how many bytes had been fed
+ * when the first claim came out. Returns the final status: DONE,
+ * ERROR or NEED_MORE if the input ran out. claim_count is the number
+ * of good claims. */
+static enum token_stream_status_t stream_token(struct q_useful_buf_c  token,
+                                               size_t                 chunk_size,
+                                               uint32_t               option_flags,
+                                               struct t_cose_key      key,
+                                               uint32_t              *claim_count,
+                                               size_t                *first_claim_at,
+                                               int                   *submods_result)
+{
+    struct token_stream        stream;
+    struct ctoken_decode_ctx   submods_ctx;
+    xclaim_decoder             submods_decoder;
+    struct xclaim              claim;
+    enum token_stream_status_t status;
+    size_t                     fed;
+    size_t                     len;
+
+    token_stream_init(&stream, option_flags, key);
+    *claim_count    = 0;
+    *first_claim_at = 0;
+    *submods_result = -2;
+
+    fed    = 0;
+    status = TOKEN_STREAM_NEED_MORE;
+    while(1) {
+        status = token_stream_next(&stream, &claim);
+        if(status == TOKEN_STREAM_CLAIM) {
+            if(check_claim(*claim_count, &claim)) {
+                status = TOKEN_STREAM_ERROR;
+                break;
+            }
+            if(*claim_count == 0) {
+                *first_claim_at = fed;
+            }
+            (*claim_count)++;
+            continue;
+        }
+        if(status != TOKEN_STREAM_NEED_MORE || fed == token.len) {
+            break;
+        }
+        len = token.len - fed < chunk_size ? token.len - fed : chunk_size;
+        status = token_stream_feed(&stream, (struct q_useful_buf_c){(const uint8_t *)token.ptr + fed, len});
+        fed += len;
+        if(status == TOKEN_STREAM_ERROR) {
+            break;
+        }
+    }
+
+    if(status == TOKEN_STREAM_DONE) {
+        *submods_result = token_stream_submods(&stream, &submods_decoder, &submods_ctx);
+    }
+
+    token_stream_finish(&stream);
+
+    return status;
+}
+
+
+/*
+ * Public function. See token_stream_tests.h
+ */
+int32_t token_stream_uccs_test(void)
+{
+    static struct builder claims;
+    static struct builder token;
+    struct t_cose_key     no_key;
+    uint32_t              claim_count;
+    size_t                first_claim_at;
+    size_t                chunk_size;
+    int                   submods_result;
+
+    memset(&no_key, 0, sizeof(no_key));
+    make_claims(&claims);
+
+    token.len = 0;
+    put_head(&token, CBOR_MAJOR_TYPE_TAG, 601);
+    put_bytes(&token, claims.bytes, claims.len);
+
+    /* However the bytes are split up the claims are the same and
+     * each comes out as soon as it is in */
+    for(chunk_size = 1; chunk_size <= token.len; chunk_size++) {
+        if(stream_token(built(&token), chunk_size, 0, no_key,
+                        &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_DONE ||
+           claim_count != 3 ||
+           submods_result != 0) {
+            return 1;
+        }
+        if(chunk_size == 1 && first_claim_at != 3 + 1 + 2 + 3) {
+            /* The tag, the map head and the iss claim */
+            return 2;
+        }
+    }
+
+    /* A truncated token never finishes */
+    if(stream_token((struct q_useful_buf_c){token.bytes, token.len - 1}, 5, 0, no_key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_NEED_MORE) {
+        return 3;
+    }
+
+    /* Without the submods the rest is the same */
+    claims.bytes[0]--;
+    claims.len = 1 + (1 + 4) + (1 + 9) + (1 + 2);
+    if(stream_token(built(&claims), 4, 0, no_key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_DONE ||
+       claim_count != 3 ||
+       submods_result != 1) {
+        return 4;
+    }
+
+    /* A UCCS isn't accepted when it must be signed */
+    if(stream_token(built(&token), 4, TOKEN_STREAM_OPT_NO_VERIFY | TOKEN_STREAM_OPT_REQUIRE_PROTECTED,
+                    no_key, &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_ERROR ||
+       claim_count != 0) {
+        return 5;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Public function. See token_stream_tests.h
+ */
+int32_t token_stream_sign1_test(void)
+{
+    static struct builder claims;
+    static struct builder token;
+    struct t_cose_key     key;
+    struct t_cose_key     no_key;
+    EVP_PKEY             *pkey;
+    uint32_t              claim_count;
+    size_t                first_claim_at;
+    size_t                chunk_size;
+    int                   submods_result;
+    int32_t               return_value;
+
+    memset(&key, 0, sizeof(key));
+    memset(&no_key, 0, sizeof(no_key));
+    make_claims(&claims);
+
+    pkey = EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-256");
+    if(pkey == NULL) {
+        return 1;
+    }
+    return_value = 2;
+    if(make_sign1(pkey, built(&claims), &token)) {
+        EVP_PKEY_free(pkey);
+        goto Done;
+    }
+    if(set_evp_pkey(pkey, &key)) {
+        goto Done;
+    }
+
+    /* The signature is checked however the bytes are split up and
+     * the first claim comes out before the payload is all in */
+    return_value = 3;
+    for(chunk_size = 1; chunk_size <= token.len; chunk_size += 7) {
+        if(stream_token(built(&token), chunk_size, 0, key,
+                        &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_DONE ||
+           claim_count != 3 ||
+           submods_result != 0) {
+            goto Done;
+        }
+    }
+    if(stream_token(built(&token), 1, 0, key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_DONE ||
+       first_claim_at >= token.len - 64) {
+        goto Done;
+    }
+
+    /* A UCCS is an error when there is a key */
+    return_value = 4;
+    if(stream_token(built(&claims), 8, 0, key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_ERROR) {
+        goto Done;
+    }
+
+    /* A bad signature is found at the end, after the claims */
+    return_value = 5;
+    token.bytes[token.len - 1] ^= 0x01;
+    if(stream_token(built(&token), 16, 0, key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_ERROR ||
+       claim_count != 3) {
+        goto Done;
+    }
+
+    /* It isn't looked at without verification */
+    return_value = 6;
+    if(stream_token(built(&token), 16, TOKEN_STREAM_OPT_NO_VERIFY, no_key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_DONE ||
+       claim_count != 3) {
+        goto Done;
+    }
+
+    /* A change to the payload is a bad signature too. Its last byte,
+     * the "x" in the submodule, is just before the signature and its
+     * two-byte head. */
+    return_value = 7;
+    token.bytes[token.len - 1] ^= 0x01;
+    token.bytes[token.len - 64 - 2 - 1] ^= 0x01;
+    if(stream_token(built(&token), 16, 0, key,
+                    &claim_count, &first_claim_at, &submods_result) != TOKEN_STREAM_ERROR ||
+       claim_count != 3) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    free_ec_key(key);
+
+    return return_value;
+}
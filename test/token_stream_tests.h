@@ -0,0 +1,31 @@
+/*
+ * token_stream_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef token_stream_tests_h
+#define token_stream_tests_h
+
+#include <stdint.h>
+
+
+/* A UCCS fed in chunks of every size gives the same claims, each as
+ * soon as its bytes are in, and keeps the submods section. Truncated
+ * tokens don't finish and a UCCS is refused when it must be
+ * signed. */
+int32_t token_stream_uccs_test(void);
+
+
+/* An ES256 COSE_Sign1 fed in chunks is verified as it streams, and a
+ * bad signature or changed claim is an error at the end. */
+int32_t token_stream_sign1_test(void);
+
+
+#endif /* token_stream_tests_h */
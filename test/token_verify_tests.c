@@ -0,0 +1,277 @@
+/*
+ * token_verify_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "token_verify_tests.h"
+#include "token_verify.h"
+#include "cbor_seq.h"
+#include "cose_eddsa.h"
+#include "openssl_keys.h"
+#include "ctoken/ctoken_cwt_labels.h"
+
+#include <string.h>
+#include <time.h>
+#include <openssl/evp.h>
+
+
+/* An Ed25519-signed token. The signature is checked without t_cose
+ * and ctoken only decodes, so these tests don't depend on which
+ * algorithms t_cose has. */
+struct test_token {
+    uint8_t               claims[64];
+    size_t                claims_len;
+    uint8_t               bytes[64 + COSE_EDDSA_OVERHEAD];
+    struct q_useful_buf_c token;
+};
+
+
+/* Time claims to put in a token */
+struct test_times {
+    bool    has_exp;
+    int64_t exp;
+    bool    has_nbf;
+    int64_t nbf;
+    bool    exp_is_text;
+};
+
+
+static void put_head(struct test_token *me, uint8_t major_type, uint64_t argument)
+{
+    me->claims_len += cbor_encode_head(major_type, argument, me->claims + me->claims_len);
+}
+
+
+static int make_token(struct test_token *me, struct t_cose_key key, const struct test_times *times)
+{
+    me->claims_len = 0;
+    put_head(me, CBOR_MAJOR_TYPE_MAP, 1 + (times->has_exp || times->exp_is_text) + times->has_nbf);
+    put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_ISSUER);
+    put_head(me, CBOR_MAJOR_TYPE_TEXT_STRING, 3);
+    memcpy(me->claims + me->claims_len, "iss", 3);
+    me->claims_len += 3;
+    if(times->exp_is_text) {
+        put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_EXPIRATION);
+        put_head(me, CBOR_MAJOR_TYPE_TEXT_STRING, 1);
+        me->claims[me->claims_len++] = '0';
+    } else if(times->has_exp) {
+        put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_EXPIRATION);
+        put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, (uint64_t)times->exp);
+    }
+    if(times->has_nbf) {
+        put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, CTOKEN_CWT_LABEL_NOT_BEFORE);
+        put_head(me, CBOR_MAJOR_TYPE_POSITIVE_INT, (uint64_t)times->nbf);
+    }
+
+    return cose_eddsa_sign((struct q_useful_buf_c){me->claims, me->claims_len},
+                           key,
+                           NULL_Q_USEFUL_BUF_C,
+                           (struct q_useful_buf){me->bytes, sizeof(me->bytes)},
+                           &me->token);
+}
+
+
+static int make_key(struct t_cose_key *key)
+{
+    EVP_PKEY *pkey;
+
+    pkey = EVP_PKEY_Q_keygen(NULL, NULL, "ED25519");
+
+    return pkey == NULL || set_evp_pkey(pkey, key);
+}
+
+
+/* Verifies a token made with times. */
+static enum token_verify_result_t verify(struct t_cose_key        signing_key,
+                                         struct t_cose_key        verification_key,
+                                         const struct test_times *times,
+                                         bool                     check_time,
+                                         enum ctoken_err_t       *ctoken_error)
+{
+    static struct test_token   token;
+    struct token_verifier      verifier;
+    enum token_verify_result_t result;
+
+    if(make_token(&token, signing_key, times)) {
+        return TOKEN_VERIFY_NOT_DECRYPTED;
+    }
+
+    token_verifier_init(&verifier, CTOKEN_PROTECTION_COSE_SIGN1, verification_key, check_time);
+    result = token_verify(&verifier, token.token);
+    *ctoken_error = verifier.ctoken_error;
+    token_verifier_free(&verifier);
+
+    return result;
+}
+
+
+/*
+ * Public function. See token_verify_tests.h
+ */
+int32_t token_verify_test(void)
+{
+    struct t_cose_key key;
+    struct t_cose_key other_key;
+    struct test_times times;
+    enum ctoken_err_t ctoken_error;
+    int64_t           now;
+    int32_t           return_value;
+
+    memset(&key, 0, sizeof(key));
+    memset(&other_key, 0, sizeof(other_key));
+    now = (int64_t)time(NULL);
+
+    return_value = 1;
+    if(make_key(&key) || make_key(&other_key)) {
+        goto Done;
+    }
+
+    /* No time claims */
+    return_value = 2;
+    memset(&times, 0, sizeof(times));
+    if(verify(key, key, &times, true, &ctoken_error) != TOKEN_VERIFY_OK ||
+       ctoken_error != CTOKEN_ERR_SUCCESS) {
+        goto Done;
+    }
+
+    /* The wrong key */
+    return_value = 3;
+    if(verify(key, other_key, &times, true, &ctoken_error) != TOKEN_VERIFY_INVALID ||
+       ctoken_error != CTOKEN_ERR_COSE_SIGN1_VALIDATION) {
+        goto Done;
+    }
+
+    /* exp and nbf that are OK now */
+    return_value = 4;
+    times.has_exp = true;
+    times.exp     = now + 3600;
+    times.has_nbf = true;
+    times.nbf     = now - 3600;
+    if(verify(key, key, &times, true, &ctoken_error) != TOKEN_VERIFY_OK) {
+        goto Done;
+    }
+
+    /* Expired, but not checked unless asked for */
+    return_value = 5;
+    times.exp = now - 10;
+    if(verify(key, key, &times, true, &ctoken_error) != TOKEN_VERIFY_EXPIRED ||
+       verify(key, key, &times, false, &ctoken_error) != TOKEN_VERIFY_OK) {
+        goto Done;
+    }
+
+    return_value = 6;
+    times.exp = now + 3600;
+    times.nbf = now + 3600;
+    if(verify(key, key, &times, true, &ctoken_error) != TOKEN_VERIFY_NOT_YET_VALID) {
+        goto Done;
+    }
+
+    return_value = 7;
+    memset(&times, 0, sizeof(times));
+    times.exp_is_text = true;
+    if(verify(key, key, &times, true, &ctoken_error) != TOKEN_VERIFY_BAD_TIME_CLAIM ||
+       verify(key, key, &times, false, &ctoken_error) != TOKEN_VERIFY_OK) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    free_ec_key(key);
+    free_ec_key(other_key);
+
+    return return_value;
+}
+
+
+#define SEQUENCE_COUNT 5
+#define SEQUENCE_BAD   2
+
+
+/*
+ * Public function. See token_verify_tests.h
+ */
+int32_t token_verify_sequence_test(void)
+{
+    static struct test_token   tokens[SEQUENCE_COUNT];
+    static uint8_t             sequence_bytes[SEQUENCE_COUNT * sizeof(tokens[0].bytes)];
+    struct t_cose_key          key;
+    struct test_times          times;
+    struct token_verifier      verifier;
+    struct q_useful_buf_c      sequence;
+    struct q_useful_buf_c      token;
+    size_t                     sequence_len;
+    size_t                     i;
+    int32_t                    return_value;
+
+    memset(&key, 0, sizeof(key));
+    if(make_key(&key)) {
+        free_ec_key(key);
+        return 1;
+    }
+    token_verifier_init(&verifier, CTOKEN_PROTECTION_COSE_SIGN1, key, false);
+
+    /* The tokens one after another, as -verify_only takes them */
+    return_value = 1;
+    memset(&times, 0, sizeof(times));
+    sequence_len = 0;
+    for(i = 0; i < SEQUENCE_COUNT; i++) {
+        times.has_exp = true;
+        times.exp     = (int64_t)i;
+        if(make_token(&tokens[i], key, &times)) {
+            goto Done;
+        }
+        memcpy(sequence_bytes + sequence_len, tokens[i].token.ptr, tokens[i].token.len);
+        if(i == SEQUENCE_BAD) {
+            /* The last byte of the signature */
+            sequence_bytes[sequence_len + tokens[i].token.len - 1] ^= 0x80;
+        }
+        sequence_len += tokens[i].token.len;
+    }
+
+    /* Each is split off whole and only the bad one fails */
+    return_value = 2;
+    sequence = (struct q_useful_buf_c){sequence_bytes, sequence_len};
+    for(i = 0; i < SEQUENCE_COUNT; i++) {
+        if(cbor_seq_next(&sequence, &token) != 0 ||
+           token.len != tokens[i].token.len ||
+           (i != SEQUENCE_BAD && memcmp(token.ptr, tokens[i].token.ptr, token.len))) {
+            goto Done;
+        }
+        if(token_verify(&verifier, token) != (i == SEQUENCE_BAD ? TOKEN_VERIFY_INVALID : TOKEN_VERIFY_OK)) {
+            return_value = 3;
+            goto Done;
+        }
+    }
+    return_value = 4;
+    if(cbor_seq_next(&sequence, &token) != 1) {
+        goto Done;
+    }
+
+    /* A truncated last token is not well-formed */
+    return_value = 5;
+    sequence = (struct q_useful_buf_c){sequence_bytes, sequence_len - 1};
+    for(i = 0; i < SEQUENCE_COUNT - 1; i++) {
+        if(cbor_seq_next(&sequence, &token) != 0) {
+            goto Done;
+        }
+    }
+    if(cbor_seq_next(&sequence, &token) != -1) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    token_verifier_free(&verifier);
+    free_ec_key(key);
+
+    return return_value;
+}
@@ -0,0 +1,31 @@
+/*
+ * token_verify_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef token_verify_tests_h
+#define token_verify_tests_h
+
+#include <stdint.h>
+
+
+/* Verifies EdDSA-signed tokens as -verify_only does. Covers the
+ * wrong key, exp and nbf with and without the time check, and an exp
+ * that isn't an integer. */
+int32_t token_verify_test(void);
+
+
+/* Splits a CBOR sequence of tokens with cbor_seq_next() and verifies
+ * each, one of them with a bad signature. A truncated last token must
+ * not be well-formed. */
+int32_t token_verify_sequence_test(void);
+
+
+#endif /* token_verify_tests_h */
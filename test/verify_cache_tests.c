@@ -0,0 +1,216 @@
+/*
+ * verify_cache_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "verify_cache_tests.h"
+#include "verify_cache.h"
+#include "token_verify.h"
+
+#include <string.h>
+#include <time.h>
+
+
+/* These don't need to be real tokens. They are only hashed. */
+static void test_token(uint32_t n, uint8_t token[16])
+{
+    memset(token, 0xa5, 16);
+    memcpy(token, &n, sizeof(n));
+}
+
+
+static void make_result(int verdict, int64_t exp, int64_t nbf, struct verify_cache_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->verdict = verdict;
+    result->exp     = exp;
+    result->nbf     = nbf;
+    result->iat     = INT64_MIN;
+}
+
+
+int32_t verify_cache_test(void)
+{
+    static const uint8_t       key_a[VERIFY_CACHE_DIGEST_LEN] = {1};
+    static const uint8_t       key_b[VERIFY_CACHE_DIGEST_LEN] = {2};
+    struct verify_cache        cache;
+    struct verify_cache_result result;
+    struct verify_cache_result found;
+    uint8_t                    token[16];
+    uint8_t                    digests[5][VERIFY_CACHE_DIGEST_LEN];
+    uint8_t                    other_key_digest[VERIFY_CACHE_DIGEST_LEN];
+    int32_t                    return_value;
+    uint32_t                   i;
+
+    if(verify_cache_init(&cache, 4, key_a)) {
+        return 1;
+    }
+
+    return_value = 0;
+
+    for(i = 0; i < 5; i++) {
+        test_token(i, token);
+        if(verify_cache_digest(&cache, (struct q_useful_buf_c){token, sizeof(token)}, digests[i])) {
+            return_value = 2;
+            goto Done;
+        }
+    }
+
+    if(verify_cache_lookup(&cache, digests[0], &found)) {
+        return_value = 3;
+        goto Done;
+    }
+
+    make_result(TOKEN_VERIFY_OK, 1000, INT64_MIN, &result);
+    verify_cache_insert(&cache, digests[0], &result);
+    if(!verify_cache_lookup(&cache, digests[0], &found) ||
+       found.verdict != TOKEN_VERIFY_OK || found.exp != 1000 || found.nbf != INT64_MIN) {
+        return_value = 4;
+        goto Done;
+    }
+    if(cache.lookups != 2 || cache.hits != 1) {
+        return_value = 5;
+        goto Done;
+    }
+
+    /* Inserting again replaces the result rather than adding */
+    make_result(TOKEN_VERIFY_INVALID, INT64_MAX, INT64_MIN, &result);
+    verify_cache_insert(&cache, digests[0], &result);
+    if(!verify_cache_lookup(&cache, digests[0], &found) || found.verdict != TOKEN_VERIFY_INVALID) {
+        return_value = 6;
+        goto Done;
+    }
+
+    /* Fill it. Then 0 has been looked up and gets a second chance, so
+     * adding 4 evicts 1. */
+    make_result(TOKEN_VERIFY_OK, INT64_MAX, INT64_MIN, &result);
+    for(i = 1; i < 4; i++) {
+        verify_cache_insert(&cache, digests[i], &result);
+    }
+    verify_cache_insert(&cache, digests[4], &result);
+    if(!verify_cache_lookup(&cache, digests[0], &found) ||
+       verify_cache_lookup(&cache, digests[1], &found) ||
+       !verify_cache_lookup(&cache, digests[2], &found) ||
+       !verify_cache_lookup(&cache, digests[3], &found) ||
+       !verify_cache_lookup(&cache, digests[4], &found)) {
+        return_value = 7;
+        goto Done;
+    }
+
+    /* The same token for another key is a different entry */
+    verify_cache_free(&cache);
+    if(verify_cache_init(&cache, 4, key_b)) {
+        return 8;
+    }
+    test_token(0, token);
+    verify_cache_digest(&cache, (struct q_useful_buf_c){token, sizeof(token)}, other_key_digest);
+    if(!memcmp(other_key_digest, digests[0], VERIFY_CACHE_DIGEST_LEN)) {
+        return_value = 9;
+        goto Done;
+    }
+
+Done:
+    verify_cache_free(&cache);
+
+    return return_value;
+}
+
+
+/* Puts result in the cache for token and runs token_verify() on it.
+ * The token can't be verified, so anything but a cache hit gives
+ * TOKEN_VERIFY_INVALID. */
+static enum token_verify_result_t
+verify_cached(struct verify_cache              *cache,
+              bool                              check_time,
+              const struct verify_cache_result *result)
+{
+    struct token_verifier      verifier;
+    struct t_cose_key          no_key;
+    uint8_t                    token[16];
+    uint8_t                    digest[VERIFY_CACHE_DIGEST_LEN];
+    enum token_verify_result_t verify_result;
+
+    memset(&no_key, 0, sizeof(no_key));
+    no_key.crypto_lib = T_COSE_CRYPTO_LIB_OPENSSL;
+
+    test_token(7, token);
+    verify_cache_digest(cache, (struct q_useful_buf_c){token, sizeof(token)}, digest);
+    verify_cache_insert(cache, digest, result);
+
+    token_verifier_init(&verifier, CTOKEN_PROTECTION_COSE_SIGN1, no_key, check_time);
+    token_verifier_set_cache(&verifier, cache);
+    verify_result = token_verify(&verifier, (struct q_useful_buf_c){token, sizeof(token)});
+    token_verifier_free(&verifier);
+
+    return verify_result;
+}
+
+
+int32_t verify_cache_expiry_test(void)
+{
+    static const uint8_t       key_id[VERIFY_CACHE_DIGEST_LEN] = {0};
+    struct verify_cache        cache;
+    struct verify_cache_result result;
+    int64_t                    now;
+    int32_t                    return_value;
+
+    if(verify_cache_init(&cache, 16, key_id)) {
+        return 1;
+    }
+
+    return_value = 0;
+    now = (int64_t)time(NULL);
+
+    make_result(TOKEN_VERIFY_OK, now + 1000, INT64_MIN, &result);
+    if(verify_cached(&cache, true, &result) != TOKEN_VERIFY_OK) {
+        return_value = 2;
+        goto Done;
+    }
+    if(cache.hits != 1) {
+        return_value = 3;
+        goto Done;
+    }
+
+    /* Valid when it was cached, but expired since */
+    make_result(TOKEN_VERIFY_OK, now - 10, INT64_MIN, &result);
+    if(verify_cached(&cache, true, &result) != TOKEN_VERIFY_EXPIRED) {
+        return_value = 4;
+        goto Done;
+    }
+
+    make_result(TOKEN_VERIFY_OK, INT64_MAX, now + 1000, &result);
+    if(verify_cached(&cache, true, &result) != TOKEN_VERIFY_NOT_YET_VALID) {
+        return_value = 5;
+        goto Done;
+    }
+
+    /* Without the time check exp doesn't matter */
+    make_result(TOKEN_VERIFY_OK, now - 10, INT64_MIN, &result);
+    if(verify_cached(&cache, false, &result) != TOKEN_VERIFY_OK) {
+        return_value = 6;
+        goto Done;
+    }
+
+    make_result(TOKEN_VERIFY_INVALID, INT64_MAX, INT64_MIN, &result);
+    if(verify_cached(&cache, true, &result) != TOKEN_VERIFY_INVALID) {
+        return_value = 7;
+        goto Done;
+    }
+
+    if(cache.hits != 5) {
+        return_value = 8;
+        goto Done;
+    }
+
+Done:
+    verify_cache_free(&cache);
+
+    return return_value;
+}
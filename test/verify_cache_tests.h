@@ -0,0 +1,30 @@
+/*
+ * verify_cache_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef verify_cache_tests_h
+#define verify_cache_tests_h
+
+#include <stdint.h>
+
+
+/* Lookups miss until inserted, hit after, and entries are evicted
+ * when the cache is full. Results for another key never hit. */
+int32_t verify_cache_test(void);
+
+
+/* A cached result is checked against exp and nbf on every hit by
+ * token_verify(), so a cached token that has since expired is not
+ * reported as valid. */
+int32_t verify_cache_expiry_test(void);
+
+
+#endif /* verify_cache_tests_h */
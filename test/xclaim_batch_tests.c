@@ -0,0 +1,241 @@
+/*
+ * xclaim_batch_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "xclaim_batch_tests.h"
+#include "xclaim_batch.h"
+#include "cbor_seq.h"
+#include "cose_eddsa.h"
+#include "cose_envelope.h"
+#include "openssl_keys.h"
+
+#include <string.h>
+#include <openssl/evp.h>
+
+
+#define BATCH_COUNT 50
+
+/* These two don't verify. One has a changed signature and the other
+ * is a UCCS. */
+#define BATCH_BAD_SIGNATURE 7
+#define BATCH_UCCS          13
+
+#define PAYLOAD_MAX 32
+
+
+/* The tokens for a batch, each signed with the same Ed25519 key. The
+ * claims-set of each is different, {1: "issuer", 6: i}. */
+struct test_batch {
+    struct t_cose_key     key;
+    uint8_t               payloads[BATCH_COUNT][PAYLOAD_MAX];
+    size_t                payload_lens[BATCH_COUNT];
+    uint8_t               token_bytes[BATCH_COUNT][PAYLOAD_MAX + COSE_EDDSA_OVERHEAD];
+    struct q_useful_buf_c tokens[BATCH_COUNT];
+};
+
+
+static int make_batch(struct test_batch *me)
+{
+    EVP_PKEY *pkey;
+    uint8_t  *payload;
+    size_t    len;
+    size_t    i;
+
+    memset(me, 0, sizeof(*me));
+
+    pkey = EVP_PKEY_Q_keygen(NULL, NULL, "ED25519");
+    if(pkey == NULL || set_evp_pkey(pkey, &me->key)) {
+        return 1;
+    }
+
+    for(i = 0; i < BATCH_COUNT; i++) {
+        payload = me->payloads[i];
+        len  = cbor_encode_head(CBOR_MAJOR_TYPE_MAP, 2, payload);
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_POSITIVE_INT, 1, payload + len);
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_TEXT_STRING, 6, payload + len);
+        memcpy(payload + len, "issuer", 6);
+        len += 6;
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_POSITIVE_INT, 6, payload + len);
+        len += cbor_encode_head(CBOR_MAJOR_TYPE_POSITIVE_INT, i, payload + len);
+        me->payload_lens[i] = len;
+
+        if(i == BATCH_UCCS) {
+            memcpy(me->token_bytes[i], payload, len);
+            me->tokens[i] = (struct q_useful_buf_c){me->token_bytes[i], len};
+            continue;
+        }
+        if(cose_eddsa_sign((struct q_useful_buf_c){payload, len},
+                           me->key,
+                           NULL_Q_USEFUL_BUF_C,
+                           (struct q_useful_buf){me->token_bytes[i], sizeof(me->token_bytes[i])},
+                           &me->tokens[i])) {
+            return 1;
+        }
+    }
+
+    me->token_bytes[BATCH_BAD_SIGNATURE][me->tokens[BATCH_BAD_SIGNATURE].len - 1] ^= 0x01;
+
+    return 0;
+}
+
+
+/* Checks that output is a UCCS of the claims-set of token i */
+static int check_output(const struct test_batch *batch, size_t i, struct q_useful_buf_c output)
+{
+    struct t_cose_key     no_key;
+    struct q_useful_buf_c claims_set;
+
+    memset(&no_key, 0, sizeof(no_key));
+    if(!cose_envelope_is_uccs(output) || cose_envelope_unwrap(output, 0, no_key, &claims_set)) {
+        return 1;
+    }
+
+    return claims_set.len != batch->payload_lens[i] ||
+           memcmp(claims_set.ptr, batch->payloads[i], claims_set.len);
+}
+
+
+/* Checks the results of a batch where everything fit. Tokens that
+ * were converted must be in the arena in input order. */
+static int check_results(const struct test_batch         *batch,
+                         const struct xclaim_arena        *arena,
+                         const struct xclaim_batch_result *results)
+{
+    size_t next_offset;
+    size_t i;
+
+    next_offset = 0;
+    for(i = 0; i < BATCH_COUNT; i++) {
+        if(i == BATCH_BAD_SIGNATURE || i == BATCH_UCCS) {
+            if(results[i].status != XCLAIM_BATCH_INVALID || results[i].len != 0) {
+                return 1;
+            }
+            continue;
+        }
+        if(results[i].status != XCLAIM_BATCH_OK || results[i].offset != next_offset) {
+            return 1;
+        }
+        next_offset += results[i].len;
+        if(next_offset > arena->used ||
+           check_output(batch, i, (struct q_useful_buf_c){arena->ptr + results[i].offset, results[i].len})) {
+            return 1;
+        }
+    }
+
+    return next_offset != arena->used;
+}
+
+
+/*
+ * Public function. See xclaim_batch_tests.h
+ */
+int32_t xclaim_batch_test(void)
+{
+    static const unsigned       worker_counts[] = {0, 1, 3, 8, BATCH_COUNT + 10};
+    static struct test_batch    batch;
+    struct xclaim_batch_result  results[BATCH_COUNT];
+    struct xclaim_batch_options options;
+    struct xclaim_arena         arena;
+    uint8_t                     caller_buf[2048];
+    size_t                      fit_count;
+    size_t                      fit_size;
+    size_t                      i;
+    size_t                      w;
+    int32_t                     return_value;
+
+    memset(&arena, 0, sizeof(arena));
+
+    return_value = 1;
+    if(make_batch(&batch)) {
+        goto Done;
+    }
+
+    memset(&options, 0, sizeof(options));
+    options.output_format    = XCLAIM_BATCH_CBOR;
+    options.verification_key = batch.key;
+
+    /* The same output however many workers there are */
+    for(w = 0; w < sizeof(worker_counts)/sizeof(worker_counts[0]); w++) {
+        return_value = 10 + (int32_t)w;
+        options.workers = worker_counts[w];
+        memset(&arena, 0, sizeof(arena));
+        if(xclaim_convert_batch(batch.tokens, BATCH_COUNT, &options, &arena, results) != BATCH_COUNT - 2 ||
+           !arena.allocated ||
+           check_results(&batch, &arena, results)) {
+            goto Done;
+        }
+        xclaim_arena_free(&arena);
+    }
+
+    /* The caller's arena, reused for a second batch */
+    return_value = 2;
+    options.workers = 4;
+    memset(&arena, 0, sizeof(arena));
+    arena.ptr  = caller_buf;
+    arena.size = sizeof(caller_buf);
+    for(i = 0; i < 2; i++) {
+        arena.used = 0;
+        if(xclaim_convert_batch(batch.tokens, BATCH_COUNT, &options, &arena, results) != BATCH_COUNT - 2 ||
+           arena.allocated ||
+           check_results(&batch, &arena, results)) {
+            goto Done;
+        }
+    }
+
+    /* A caller's arena with room for only the first ten outputs. The
+     * rest don't fit. */
+    return_value = 3;
+    fit_count = 0;
+    fit_size  = 0;
+    for(i = 0; fit_count < 10; i++) {
+        if(results[i].status == XCLAIM_BATCH_OK) {
+            fit_size += results[i].len;
+            fit_count++;
+        }
+    }
+    arena.size = fit_size;
+    arena.used = 0;
+    if(xclaim_convert_batch(batch.tokens, BATCH_COUNT, &options, &arena, results) != fit_count ||
+       arena.used != fit_size) {
+        goto Done;
+    }
+    for(; i < BATCH_COUNT; i++) {
+        if(results[i].status != XCLAIM_BATCH_NO_ROOM && results[i].status != XCLAIM_BATCH_INVALID) {
+            goto Done;
+        }
+    }
+    memset(&arena, 0, sizeof(arena));
+
+    /* No tokens still gives an arena to free */
+    return_value = 4;
+    if(xclaim_convert_batch(batch.tokens, 0, &options, &arena, results) != 0 ||
+       !arena.allocated || arena.used != 0) {
+        goto Done;
+    }
+    xclaim_arena_free(&arena);
+
+    /* JSON output stops at the signature check the same way */
+    return_value = 5;
+    options.output_format = XCLAIM_BATCH_JSON;
+    if(xclaim_convert_batch(batch.tokens + BATCH_BAD_SIGNATURE, 1, &options, &arena, results) != 0 ||
+       results[0].status != XCLAIM_BATCH_INVALID ||
+       arena.used != 0) {
+        goto Done;
+    }
+
+    return_value = 0;
+
+Done:
+    xclaim_arena_free(&arena);
+    free_ec_key(batch.key);
+
+    return return_value;
+}
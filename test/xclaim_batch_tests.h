@@ -0,0 +1,26 @@
+/*
+ * xclaim_batch_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef xclaim_batch_tests_h
+#define xclaim_batch_tests_h
+
+#include <stdint.h>
+
+
+/* Converts a batch of EdDSA-signed tokens with different numbers of
+ * workers, in an arena from the batch and from the caller, and checks
+ * each output is in input order. Also covers tokens that don't
+ * verify, an arena that is too small and an empty batch. */
+int32_t xclaim_batch_test(void);
+
+
+#endif /* xclaim_batch_tests_h */
@@ -0,0 +1,519 @@
+/*
+ * xclaim_processor_tests.c
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#include "xclaim_processor_tests.h"
+#include "xclaim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+/* A made-up token is a tree of nodes. Node 0 is the top level. The
+ * children of a node are the submodules and nested tokens in its
+ * submodules section and are next to each other in the array. */
+
+#define MAX_NODES 600
+
+struct test_node {
+    char     name[8];
+    uint32_t claims;
+    bool     nested;
+    uint32_t first_child;
+    uint32_t child_count;
+};
+
+
+/* Deeper than XCLAIM_MAX_NESTING so the limit can be hit */
+#define TEST_MAX_DEPTH (XCLAIM_MAX_NESTING + 8)
+
+struct test_decoder {
+    const struct test_node *nodes;
+
+    /* path[depth] is the node being decoded */
+    uint32_t                depth;
+    uint32_t                path[TEST_MAX_DEPTH + 1];
+    uint32_t                next_claim;
+
+    /* The child at each level for the cursor */
+    uint32_t                position[TEST_MAX_DEPTH + 1];
+
+    /* How many times the submodule methods were called */
+    uint32_t                enter_calls;
+    uint32_t                cursor_calls;
+};
+
+
+/* The bytes of the nested tokens. Only the length matters. */
+static const uint8_t nested_bytes[64];
+
+#define NESTED_LEN 10
+
+
+static enum xclaim_error_t test_next_claim(void *ctx, struct xclaim *claim)
+{
+    struct test_decoder    *me   = (struct test_decoder *)ctx;
+    const struct test_node *node = &me->nodes[me->path[me->depth]];
+
+    if(me->next_claim >= node->claims) {
+        return XCLAIM_NO_MORE;
+    }
+    me->next_claim++;
+
+    memset(claim, 0, sizeof(*claim));
+    claim->qcbor_item.uLabelType  = QCBOR_TYPE_INT64;
+    claim->qcbor_item.label.int64 = me->next_claim;
+    claim->qcbor_item.uDataType   = QCBOR_TYPE_INT64;
+    claim->qcbor_item.val.int64   = me->next_claim;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+/* Goes into a child if it is a submodule */
+static enum xclaim_error_t
+child_at(struct test_decoder   *me,
+         uint32_t               index,
+         struct q_useful_buf_c *name,
+         bool                  *entered)
+{
+    const struct test_node *node = &me->nodes[me->path[me->depth]];
+    uint32_t                child;
+
+    *entered = false;
+    if(index >= node->child_count) {
+        return XCLAIM_NO_MORE;
+    }
+    child = node->first_child + index;
+    *name = q_useful_buf_from_sz(me->nodes[child].name);
+    if(me->nodes[child].nested) {
+        return XCLAIM_SUBMOD_IS_TOKEN;
+    }
+
+    me->depth++;
+    me->path[me->depth] = child;
+    me->next_claim      = 0;
+    *entered            = true;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t
+test_enter_submod(void *ctx, uint32_t index, struct q_useful_buf_c *name)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+    bool                 entered;
+
+    me->enter_calls++;
+
+    return child_at(me, index, name, &entered);
+}
+
+
+static enum xclaim_error_t test_exit_submod(void *ctx)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    me->depth--;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t
+test_get_nested(void                  *ctx,
+                uint32_t               index,
+                enum ctoken_type_t    *type,
+                struct q_useful_buf_c *name,
+                struct q_useful_buf_c *token)
+{
+    struct test_decoder    *me   = (struct test_decoder *)ctx;
+    const struct test_node *node = &me->nodes[me->path[me->depth]];
+
+    if(index >= node->child_count || !me->nodes[node->first_child + index].nested) {
+        return XCLAIM_NO_MORE;
+    }
+    *type  = CTOKEN_TYPE_CWT;
+    *name  = q_useful_buf_from_sz(me->nodes[node->first_child + index].name);
+    *token = (struct q_useful_buf_c){nested_bytes, NESTED_LEN};
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t cursor_at(struct test_decoder *me, struct xclaim_submod_cursor *cursor)
+{
+    enum xclaim_error_t xclaim_error;
+    uint32_t            depth;
+
+    me->cursor_calls++;
+
+    depth = me->depth;
+    xclaim_error = child_at(me, me->position[depth], &(cursor->name), &(cursor->entered));
+    if(xclaim_error == XCLAIM_SUBMOD_IS_TOKEN) {
+        cursor->nested_type  = CTOKEN_TYPE_CWT;
+        cursor->nested_token = (struct q_useful_buf_c){nested_bytes, NESTED_LEN};
+    }
+
+    return xclaim_error;
+}
+
+
+static enum xclaim_error_t test_first_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    me->position[me->depth] = 0;
+
+    return cursor_at(me, cursor);
+}
+
+
+static enum xclaim_error_t test_next_submod(void *ctx, struct xclaim_submod_cursor *cursor)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    if(cursor->entered) {
+        me->depth--;
+    }
+    me->position[me->depth]++;
+
+    return cursor_at(me, cursor);
+}
+
+
+static void test_rewind(void *ctx)
+{
+    struct test_decoder *me = (struct test_decoder *)ctx;
+
+    me->depth      = 0;
+    me->path[0]    = 0;
+    me->next_claim = 0;
+}
+
+
+static void test_decoder_init(xclaim_decoder         *decoder,
+                              struct test_decoder    *me,
+                              const struct test_node *nodes,
+                              bool                    with_cursor)
+{
+    memset(me, 0, sizeof(*me));
+    me->nodes = nodes;
+
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->ctx          = me;
+    decoder->next_claim   = test_next_claim;
+    decoder->enter_submod = test_enter_submod;
+    decoder->exit_submod  = test_exit_submod;
+    decoder->get_nested   = test_get_nested;
+    decoder->rewind       = test_rewind;
+    if(with_cursor) {
+        decoder->first_submod = test_first_submod;
+        decoder->next_submod  = test_next_submod;
+    }
+}
+
+
+/* An encoder that writes what it is given as text, for example
+ * "c1 [(sm1 c1 )nnt1 ]" for a claim labeled 1 and a submodules
+ * section with a submodule sm1 with one claim and a nested token
+ * nt1. */
+struct test_encoder {
+    char   text[8192];
+    size_t len;
+};
+
+
+/* For the methods with no name */
+#define NO_TEXT ((struct q_useful_buf_c){"", 0})
+
+
+static enum xclaim_error_t append(void *ctx, const char *text, struct q_useful_buf_c name)
+{
+    struct test_encoder *me = (struct test_encoder *)ctx;
+    int                  len;
+
+    len = snprintf(me->text + me->len, sizeof(me->text) - me->len,
+                   text, (int)name.len, (const char *)name.ptr);
+    if(len < 0 || (size_t)len >= sizeof(me->text) - me->len) {
+        return XCLAIM_ERR_CLAIM_TYPE;
+    }
+    me->len += (size_t)len;
+
+    return XCLAIM_SUCCESS;
+}
+
+
+static enum xclaim_error_t test_output_claim(void *ctx, const struct xclaim *claim)
+{
+    char label[24];
+
+    snprintf(label, sizeof(label), "%lld", (long long)claim->qcbor_item.label.int64);
+
+    return append(ctx, "c%.*s ", q_useful_buf_from_sz(label));
+}
+
+
+static enum xclaim_error_t test_start_section(void *ctx)
+{
+    return append(ctx, "[%.*s", NO_TEXT);
+}
+
+
+static enum xclaim_error_t test_end_section(void *ctx)
+{
+    return append(ctx, "]%.*s", NO_TEXT);
+}
+
+
+static enum xclaim_error_t test_open_submod(void *ctx, const struct q_useful_buf_c name)
+{
+    return append(ctx, "(%.*s ", name);
+}
+
+
+static enum xclaim_error_t test_close_submod(void *ctx)
+{
+    return append(ctx, ")%.*s", NO_TEXT);
+}
+
+
+static enum xclaim_error_t
+test_output_nested(void *ctx, const struct q_useful_buf_c name, struct q_useful_buf_c token)
+{
+    (void)token;
+
+    return append(ctx, "n%.*s ", name);
+}
+
+
+static void test_encoder_init(xclaim_encoder *encoder, struct test_encoder *me)
+{
+    me->len     = 0;
+    me->text[0] = '\0';
+
+    encoder->ctx                   = me;
+    encoder->output_claim          = test_output_claim;
+    encoder->start_submods_section = test_start_section;
+    encoder->end_submods_section   = test_end_section;
+    encoder->open_submod           = test_open_submod;
+    encoder->close_submod          = test_close_submod;
+    encoder->output_nested         = test_output_nested;
+}
+
+
+/*
+ * The token is
+ *
+ *   top: 2 claims
+ *     sm1: 1 claim
+ *       nt1: nested token
+ *       sm2: 3 claims
+ *     nt2: nested token
+ *     sm3: no claims
+ */
+static const struct test_node tree_nodes[] = {
+    {"",    2, false, 1, 3},
+    {"sm1", 1, false, 4, 2},
+    {"nt2", 0, true,  0, 0},
+    {"sm3", 0, false, 0, 0},
+    {"nt1", 0, true,  0, 0},
+    {"sm2", 3, false, 0, 0},
+};
+
+static const char tree_text[] = "c1 c2 [(sm1 c1 [nnt1 (sm2 c1 c2 c3 )])nnt2 (sm3 )]";
+
+
+/* The top level has WIDE_COUNT submodules with one claim each */
+#define WIDE_COUNT 300
+
+
+int32_t xclaim_processor_cursor_test(void)
+{
+    static struct test_node wide_nodes[WIDE_COUNT + 1];
+    struct test_decoder     test;
+    struct test_encoder     output;
+    xclaim_decoder          decoder;
+    xclaim_encoder          encoder;
+    uint32_t                i;
+
+    /* Without the cursor */
+    test_decoder_init(&decoder, &test, tree_nodes, false);
+    test_encoder_init(&encoder, &output);
+    if(xclaim_processor(&decoder, &encoder) != XCLAIM_SUCCESS ||
+       strcmp(output.text, tree_text)) {
+        return 1;
+    }
+    if(test.enter_calls == 0 || test.cursor_calls != 0) {
+        return 2;
+    }
+
+    /* With it the output is the same, and enter_submod isn't used */
+    test_decoder_init(&decoder, &test, tree_nodes, true);
+    test_encoder_init(&encoder, &output);
+    if(xclaim_processor(&decoder, &encoder) != XCLAIM_SUCCESS ||
+       strcmp(output.text, tree_text)) {
+        return 3;
+    }
+    if(test.enter_calls != 0) {
+        return 4;
+    }
+
+    /* One cursor call per submodule plus one to find the end of each
+     * submodules section, of which there are the top, sm1, sm2 and
+     * sm3 */
+    if(test.cursor_calls != 5 + 4) {
+        return 5;
+    }
+
+    /* Many submodules in one section are still one call each */
+    memset(wide_nodes, 0, sizeof(wide_nodes));
+    wide_nodes[0].first_child = 1;
+    wide_nodes[0].child_count = WIDE_COUNT;
+    for(i = 1; i <= WIDE_COUNT; i++) {
+        snprintf(wide_nodes[i].name, sizeof(wide_nodes[i].name), "s%u", i);
+        wide_nodes[i].claims = 1;
+    }
+    test_decoder_init(&decoder, &test, wide_nodes, true);
+    test_encoder_init(&encoder, &output);
+    if(xclaim_processor(&decoder, &encoder) != XCLAIM_SUCCESS) {
+        return 6;
+    }
+    if(test.cursor_calls != WIDE_COUNT + 1 + WIDE_COUNT || test.enter_calls != 0) {
+        return 7;
+    }
+
+    return 0;
+}
+
+
+/* Makes a chain of submodules each in the one before, length of them
+ * under the top level */
+static void make_chain(struct test_node *nodes, uint32_t length)
+{
+    uint32_t i;
+
+    memset(nodes, 0, sizeof(struct test_node) * (length + 1));
+    for(i = 0; i < length; i++) {
+        nodes[i].first_child = i + 1;
+        nodes[i].child_count = 1;
+        snprintf(nodes[i + 1].name, sizeof(nodes[i + 1].name), "d%u", i + 1);
+    }
+}
+
+
+static enum xclaim_error_t
+run_with_limits(const struct test_node *nodes, const struct xclaim_limits *limits, bool with_cursor)
+{
+    struct test_decoder test;
+    struct test_encoder output;
+    xclaim_decoder      decoder;
+    xclaim_encoder      encoder;
+
+    test_decoder_init(&decoder, &test, nodes, with_cursor);
+    test_encoder_init(&encoder, &output);
+
+    return xclaim_processor_with_limits(&decoder, &encoder, limits);
+}
+
+
+static enum xclaim_error_t
+failing_output_nested(void *ctx, const struct q_useful_buf_c name, struct q_useful_buf_c token)
+{
+    (void)ctx;
+    (void)name;
+    (void)token;
+
+    return XCLAIM_ERR_CLAIM_TYPE;
+}
+
+
+int32_t xclaim_processor_limits_test(void)
+{
+    static struct test_node chain_nodes[TEST_MAX_DEPTH + 1];
+    struct xclaim_limits    limits;
+    struct test_decoder     test;
+    struct test_encoder     output;
+    xclaim_decoder          decoder;
+    xclaim_encoder          encoder;
+    int                     with_cursor;
+
+    for(with_cursor = 0; with_cursor <= 1; with_cursor++) {
+        /* Nesting to max_depth is OK, one more is not */
+        xclaim_limits_default(&limits);
+        limits.max_depth = 3;
+        make_chain(chain_nodes, 3);
+        if(run_with_limits(chain_nodes, &limits, with_cursor) != XCLAIM_SUCCESS) {
+            return 1;
+        }
+        make_chain(chain_nodes, 4);
+        if(run_with_limits(chain_nodes, &limits, with_cursor) != XCLAIM_ERR_NESTING_TOO_DEEP) {
+            return 2;
+        }
+
+        /* max_depth can't be set over XCLAIM_MAX_NESTING */
+        limits.max_depth = TEST_MAX_DEPTH;
+        make_chain(chain_nodes, XCLAIM_MAX_NESTING);
+        if(run_with_limits(chain_nodes, &limits, with_cursor) != XCLAIM_SUCCESS) {
+            return 3;
+        }
+        make_chain(chain_nodes, XCLAIM_MAX_NESTING + 1);
+        if(run_with_limits(chain_nodes, &limits, with_cursor) != XCLAIM_ERR_NESTING_TOO_DEEP) {
+            return 4;
+        }
+
+        /* tree_nodes has 6 claims, 5 submodules and nested tokens, and
+         * two nested tokens of NESTED_LEN bytes */
+        xclaim_limits_default(&limits);
+        limits.max_claims = 6;
+        if(run_with_limits(tree_nodes, &limits, with_cursor) != XCLAIM_SUCCESS) {
+            return 5;
+        }
+        limits.max_claims = 5;
+        if(run_with_limits(tree_nodes, &limits, with_cursor) != XCLAIM_ERR_TOO_MANY_CLAIMS) {
+            return 6;
+        }
+
+        xclaim_limits_default(&limits);
+        limits.max_submods = 5;
+        if(run_with_limits(tree_nodes, &limits, with_cursor) != XCLAIM_SUCCESS) {
+            return 7;
+        }
+        limits.max_submods = 4;
+        if(run_with_limits(tree_nodes, &limits, with_cursor) != XCLAIM_ERR_TOO_MANY_SUBMODS) {
+            return 8;
+        }
+
+        xclaim_limits_default(&limits);
+        limits.max_nested_bytes = 2 * NESTED_LEN;
+        if(run_with_limits(tree_nodes, &limits, with_cursor) != XCLAIM_SUCCESS) {
+            return 9;
+        }
+        limits.max_nested_bytes = 2 * NESTED_LEN - 1;
+        if(run_with_limits(tree_nodes, &limits, with_cursor) != XCLAIM_ERR_NESTED_TOO_BIG) {
+            return 10;
+        }
+
+        /* An encoder error stops processing right there */
+        test_decoder_init(&decoder, &test, tree_nodes, with_cursor);
+        test_encoder_init(&encoder, &output);
+        encoder.output_nested = failing_output_nested;
+        if(xclaim_processor(&decoder, &encoder) != XCLAIM_ERR_CLAIM_TYPE) {
+            return 11;
+        }
+        if(strcmp(output.text, "c1 c2 [(sm1 c1 [")) {
+            return 12;
+        }
+    }
+
+    return 0;
+}
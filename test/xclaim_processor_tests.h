@@ -0,0 +1,30 @@
+/*
+ * xclaim_processor_tests.h
+ *
+ * Copyright (c) 2021, Laurence Lundblade.
+ *
+ * Created by Laurence Lundblade on 10/19/21.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * See BSD-3-Clause license in README.md
+ */
+
+#ifndef xclaim_processor_tests_h
+#define xclaim_processor_tests_h
+
+#include <stdint.h>
+
+
+/* A decoder with first_submod and next_submod gives the same output
+ * as one with only enter_submod and get_nested, and the index-based
+ * methods aren't used when it has the cursor. */
+int32_t xclaim_processor_cursor_test(void);
+
+
+/* Each of the limits in struct xclaim_limits can be reached but not
+ * gone over, and an error from the encoder ends processing. */
+int32_t xclaim_processor_limits_test(void);
+
+
+#endif /* xclaim_processor_tests_h */